@@ -0,0 +1,314 @@
+/**
+ * 操作历史分页基准测试：向内嵌SQLite存储的operation_log逐级灌入记录（默认到一千万行），
+ * 每到一级就测量几种分页查询的耗时，观察页耗时是否随表的增长保持不变。
+ *
+ * 用法：bench/history_bench [-n 最大行数] [-u 用户数] [-q 每种查询重复次数] [-d 数据库文件]
+ * 记录按轮转分给-u个用户，被测用户的记录数随表一起增长。每一级测量：
+ *   最新一页   不带游标（与客户端首次打开历史相同）
+ *   深处游标页 游标落在被测用户最早10%的记录处（一直点“加载更多”翻到很早的位置）
+ *   按操作过滤 operation过滤的最新一页
+ *   OFFSET对照 同样深度改用LIMIT/OFFSET翻页（原来的做法，耗时随深度线性增长，只作对比）
+ * 游标查询直接走sqlite_meta_store.history_page（#include "../sqlite_store.c"），与服务器执行的是同一条预编译语句。
+ * 不需要MySQL，离线即可运行；数据库文件每次运行重新生成。
+ */
+#include "../sqlite_store.c"
+
+#ifndef USE_SQLITE
+#error "history_bench需要以-DUSE_SQLITE编译（见Makefile的bench目标）"
+#endif
+
+#include <getopt.h>
+
+// ========================== 被测存储依赖的桩 ==========================
+ServerConfig server_config;
+
+void write_log(LogLevel level, const char *format, ...)
+{
+    (void)level;
+    (void)format;
+}
+
+// ========================== 灌数据 ==========================
+#define SEED_BATCH 50000          // 每个写事务插入的记录数
+#define SEED_BASE_TIME 1600000000 // 第一条记录的时间（之后每条晚一秒）
+
+static const char *bench_ops[] = {"上传", "下载", "删除", "重命名", "分享"};
+#define BENCH_OP_COUNT (int)(sizeof(bench_ops) / sizeof(bench_ops[0]))
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 追加记录，直到表中共有target行（按轮转分给各用户，时间和id一起递增）
+ * @param from 当前行数
+ * @param target 目标行数
+ * @param users 用户数
+ * @return 0=成功，-1=写入失败
+ */
+static int seed_rows(long long from, long long target, int users)
+{
+    static OpLogRecord batch[SEED_BATCH];
+    static char names[SEED_BATCH][32];
+
+    for (long long i = from; i < target;)
+    {
+        int count = 0;
+        for (; count < SEED_BATCH && i < target; count++, i++)
+        {
+            OpLogRecord *r = &batch[count];
+            memset(r, 0, sizeof(*r));
+            snprintf(r->username, sizeof(r->username), "bench_user%lld", i % users);
+            r->client_fd = 16 + (int)(i % 1000);
+            strcpy(r->ip, "127.0.0.1");
+            snprintf(r->operation, sizeof(r->operation), "%s", bench_ops[(i / users) % BENCH_OP_COUNT]);
+            strcpy(r->status, "成功");
+            snprintf(names[count], sizeof(names[count]), "file_%lld.dat", i);
+            r->filename = names[count];
+            r->time = (time_t)(SEED_BASE_TIME + i);
+        }
+        if (sqlite_meta_store.insert_logs(batch, count) == -1)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// ========================== 查询与计时 ==========================
+typedef struct
+{
+    long long total_us; // 累计耗时
+    long long max_us;   // 单次最大耗时
+    int rows;           // 最后一次返回的行数
+} Timing;
+
+/**
+ * @brief 取被测用户从最早一条往后数第offset条记录的(time, id)，作为深处翻页的游标（不计时）
+ * @param username 用户名
+ * @param offset 从最早一条起的偏移
+ * @param time_out 输出：记录时间
+ * @param time_size time_out缓冲区大小
+ * @param id_out 输出：记录id
+ * @return 0=成功，-1=失败
+ */
+static int deep_cursor(const char *username, long long offset, char *time_out, size_t time_size, long long *id_out)
+{
+    sqlite3_stmt *stmt = NULL;
+    int ret = -1;
+    if (sqlite3_prepare_v2(sq_local->db,
+                           "SELECT time, id FROM operation_log WHERE username=?1 "
+                           "ORDER BY time, id LIMIT 1 OFFSET ?2",
+                           -1, &stmt, NULL) != SQLITE_OK)
+    {
+        return -1;
+    }
+    sq_bind_text(stmt, 1, username);
+    sqlite3_bind_int64(stmt, 2, offset);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        sq_column_text(stmt, 0, time_out, time_size);
+        *id_out = sqlite3_column_int64(stmt, 1);
+        ret = 0;
+    }
+    sqlite3_finalize(stmt);
+    return ret;
+}
+
+/**
+ * @brief 用游标查询一页（服务器的history_page路径），重复repeat次计时
+ * @param username 用户名
+ * @param query 查询条件
+ * @param repeat 重复次数
+ * @return 计时结果
+ */
+static Timing time_cursor_page(const char *username, const HistoryQuery *query, int repeat)
+{
+    Timing t = {0, 0, 0};
+    for (int i = 0; i < repeat; i++)
+    {
+        cJSON *records = cJSON_CreateArray();
+        long long start = now_us();
+        t.rows = sqlite_meta_store.history_page(username, query, records);
+        long long elapsed = now_us() - start;
+        cJSON_Delete(records);
+        t.total_us += elapsed;
+        if (elapsed > t.max_us)
+            t.max_us = elapsed;
+    }
+    return t;
+}
+
+/**
+ * @brief 用LIMIT/OFFSET取同样深度的一页（原来的翻页方式，只作对照），重复repeat次计时
+ * @param username 用户名
+ * @param offset 从最新一条起跳过的行数
+ * @param limit 每页条数
+ * @param repeat 重复次数
+ * @return 计时结果
+ */
+static Timing time_offset_page(const char *username, long long offset, int limit, int repeat)
+{
+    Timing t = {0, 0, 0};
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(sq_local->db,
+                           "SELECT id, filename, operation, time, status FROM operation_log "
+                           "WHERE username=?1 ORDER BY time DESC, id DESC LIMIT ?2 OFFSET ?3",
+                           -1, &stmt, NULL) != SQLITE_OK)
+    {
+        t.rows = -1;
+        return t;
+    }
+    for (int i = 0; i < repeat; i++)
+    {
+        long long start = now_us();
+        sq_bind_text(stmt, 1, username);
+        sqlite3_bind_int(stmt, 2, limit);
+        sqlite3_bind_int64(stmt, 3, offset);
+        t.rows = 0;
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+            t.rows++;
+        sqlite3_reset(stmt);
+        long long elapsed = now_us() - start;
+        t.total_us += elapsed;
+        if (elapsed > t.max_us)
+            t.max_us = elapsed;
+    }
+    sqlite3_finalize(stmt);
+    return t;
+}
+
+/**
+ * @brief 打印一种查询的计时结果
+ * @param table_rows 表中总行数
+ * @param user_rows 被测用户的记录数
+ * @param name 查询名称
+ * @param t 计时结果
+ * @param repeat 重复次数
+ * @return 无返回值
+ */
+static void print_timing(long long table_rows, long long user_rows, const char *name, Timing t, int repeat)
+{
+    // 查询名放在行尾（中文按字节计宽，放在中间会错列）
+    printf("%12lld %10lld %6d %10.1f %10lld  %s\n",
+           table_rows, user_rows, t.rows, (double)t.total_us / repeat, t.max_us, name);
+}
+
+/**
+ * @brief 在当前表大小下跑一轮各种分页查询并打印
+ * @param table_rows 表中总行数
+ * @param users 用户数
+ * @param repeat 每种查询的重复次数
+ * @return 0=成功，-1=查询失败
+ */
+static int measure(long long table_rows, int users, int repeat)
+{
+    const char *username = "bench_user0";
+    long long user_rows = (table_rows + users - 1) / users;
+    long long depth = user_rows - user_rows / 10; // 从最新一条起跳过的行数
+
+    char cursor_time[32];
+    long long cursor_id;
+    if (deep_cursor(username, user_rows / 10, cursor_time, sizeof(cursor_time), &cursor_id) == -1)
+    {
+        fprintf(stderr, "取深处游标失败: %s\n", sqlite3_errmsg(sq_local->db));
+        return -1;
+    }
+
+    HistoryQuery newest = {"9999-12-31 23:59:59", LLONG_MAX, HISTORY_PAGE_DEFAULT, "", ""};
+    HistoryQuery deep = {cursor_time, cursor_id, HISTORY_PAGE_DEFAULT, "", ""};
+    HistoryQuery filtered = {"9999-12-31 23:59:59", LLONG_MAX, HISTORY_PAGE_DEFAULT, bench_ops[2], ""};
+
+    Timing t[4];
+    t[0] = time_cursor_page(username, &newest, repeat);
+    t[1] = time_cursor_page(username, &deep, repeat);
+    t[2] = time_cursor_page(username, &filtered, repeat);
+    t[3] = time_offset_page(username, depth, HISTORY_PAGE_DEFAULT, repeat);
+    static const char *names[] = {"最新一页", "深处游标页", "按操作过滤", "OFFSET对照"};
+    for (int i = 0; i < 4; i++)
+    {
+        if (t[i].rows == -1)
+        {
+            fprintf(stderr, "%s查询失败: %s\n", names[i], sqlite3_errmsg(sq_local->db));
+            return -1;
+        }
+        print_timing(table_rows, user_rows, names[i], t[i], repeat);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long long max_rows = 10000000;
+    int users = 10;
+    int repeat = 50;
+    const char *path = "/tmp/history_bench.db";
+    int opt;
+    while ((opt = getopt(argc, argv, "n:u:q:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            max_rows = atoll(optarg);
+            break;
+        case 'u':
+            users = atoi(optarg);
+            break;
+        case 'q':
+            repeat = atoi(optarg);
+            break;
+        case 'd':
+            path = optarg;
+            break;
+        default:
+            fprintf(stderr, "用法: %s [-n 最大行数] [-u 用户数] [-q 每种查询重复次数] [-d 数据库文件]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (max_rows <= 0 || users <= 0 || repeat <= 0)
+    {
+        fprintf(stderr, "参数必须为正数\n");
+        return 1;
+    }
+
+    // 每次从空库开始（连同WAL文件一起删除）
+    char wal_path[MAX_PATH_LEN];
+    unlink(path);
+    snprintf(wal_path, sizeof(wal_path), "%s-wal", path);
+    unlink(wal_path);
+    snprintf(wal_path, sizeof(wal_path), "%s-shm", path);
+    unlink(wal_path);
+
+    server_config.meta_path = path;
+    sqlite_meta_store.init();
+
+    printf("%d 个用户，每页 %d 条，每种查询重复 %d 次，数据库 %s\n", users, HISTORY_PAGE_DEFAULT, repeat, path);
+    printf("%12s %10s %6s %10s %10s  %s\n", "table_rows", "user_rows", "rows", "avg_us", "max_us", "查询");
+
+    // 每级行数乘10（最后一级为max_rows）
+    long long rows = 0;
+    for (long long level = 100000; rows < max_rows; level *= 10)
+    {
+        long long target = level < max_rows ? level : max_rows;
+        long long start = now_us();
+        if (seed_rows(rows, target, users) == -1)
+        {
+            fprintf(stderr, "写入记录失败: %s\n", sqlite3_errmsg(sq_local->db));
+            sqlite_meta_store.destroy();
+            return 1;
+        }
+        printf("-- 灌入 %lld 行，用时 %.1f 秒\n", target - rows, (now_us() - start) / 1e6);
+        rows = target;
+        if (measure(rows, users, repeat) == -1)
+        {
+            sqlite_meta_store.destroy();
+            return 1;
+        }
+    }
+
+    sqlite_meta_store.destroy();
+    return 0;
+}
@@ -0,0 +1,323 @@
+/**
+ * 线程池基准测试：同样的合成任务分别交给当前的按线程队列+偷任务调度器和原来的单队列线程池，
+ * 比较吞吐（任务/秒）和排队延迟（p50/p99/最大）。
+ *
+ * 用法：bench/thread_pool_bench [-p 投递线程数] [-n 每个投递线程的任务数] [-w 每个任务的工作量us] [-f 连接数] [-r 限速任务/秒]
+ * 投递线程模拟reactor：队列满时让出CPU后重试（对应reactor的延后派发）。
+ * 每种调度器跑两轮：不限速（测吞吐；此时队列始终是满的，排队延迟主要取决于队列总容量），
+ * 再按-r限速（低于饱和吞吐时的排队延迟才反映调度本身：锁竞争、唤醒、偷任务）。
+ * 当前调度器直接编译进本文件（#include "../thread_pool.c"），业务处理、连接表等依赖由下面的桩函数代替。
+ */
+#include "../thread_pool.c"
+
+#include <getopt.h>
+
+// ========================== 被测调度器依赖的桩 ==========================
+int server_running = 1;
+ThreadPool thread_pool;
+
+static Connection bench_conn;
+
+Connection *conn_lookup(ConnHandle handle)
+{
+    (void)handle;
+    return &bench_conn; // 连接始终有效，任务不会被丢弃
+}
+
+void conn_batch_begin(ConnHandle handle)
+{
+    (void)handle;
+}
+
+void conn_batch_end()
+{
+}
+
+void reactor_release_client(ConnHandle handle)
+{
+    (void)handle;
+}
+
+void uring_backend_run_task(Task *task)
+{
+    (void)task;
+}
+
+void write_log(LogLevel level, const char *format, ...)
+{
+    (void)level;
+    (void)format;
+}
+
+static void bench_release()
+{
+}
+
+static const MetaStore bench_meta_store = {.name = "bench", .release = bench_release};
+const MetaStore *meta_store = &bench_meta_store;
+
+// ========================== 合成任务 ==========================
+static int work_us = 5;                 // 每个任务忙等的时长（微秒）
+static long long *latencies = NULL;     // 每个任务的排队延迟（微秒）
+static long long latency_cap = 0;       // latencies容量（总任务数）
+static long long completed = 0;         // 已完成的任务数（原子）
+
+/**
+ * @brief 执行一个合成任务：记录排队延迟，再忙等work_us微秒
+ * @param wait_us 该任务的排队延迟
+ * @return 无返回值
+ */
+static void bench_run_task(long long wait_us)
+{
+    long long idx = __atomic_fetch_add(&completed, 1, __ATOMIC_SEQ_CST);
+    if (idx < latency_cap)
+        latencies[idx] = wait_us;
+    long long until = now_us() + work_us;
+    while (work_us > 0 && now_us() < until)
+    {
+    }
+}
+
+void handle_client_message(int client_fd, struct sockaddr_in client_addr)
+{
+    (void)client_fd;
+    (void)client_addr;
+    bench_run_task(thread_pool_task_wait_us());
+}
+
+int handle_upload(int client_fd)
+{
+    (void)client_fd;
+    bench_run_task(thread_pool_task_wait_us());
+    return 0;
+}
+
+int handle_download(int client_fd)
+{
+    (void)client_fd;
+    bench_run_task(thread_pool_task_wait_us());
+    return 0;
+}
+
+// ========================== 原来的单队列线程池（一把锁 + 一个信号量） ==========================
+static struct
+{
+    pthread_t threads[THREAD_POOL_SIZE];
+    Task queue[MAX_QUEUE_SIZE];
+    int front;
+    int rear;
+    int count;
+    pthread_mutex_t mutex;
+    sem_t semaphore;
+} legacy_pool;
+
+static void *legacy_thread_function(void *arg)
+{
+    (void)arg;
+    while (server_running)
+    {
+        sem_wait(&legacy_pool.semaphore);
+        if (!server_running)
+            break;
+
+        pthread_mutex_lock(&legacy_pool.mutex);
+        Task task = legacy_pool.queue[legacy_pool.front];
+        legacy_pool.front = (legacy_pool.front + 1) % MAX_QUEUE_SIZE;
+        legacy_pool.count--;
+        pthread_mutex_unlock(&legacy_pool.mutex);
+
+        bench_run_task(now_us() - task.enqueue_us);
+    }
+    return NULL;
+}
+
+static void legacy_pool_init()
+{
+    pthread_mutex_init(&legacy_pool.mutex, NULL);
+    sem_init(&legacy_pool.semaphore, 0, 0);
+    legacy_pool.front = legacy_pool.rear = legacy_pool.count = 0;
+    for (int i = 0; i < THREAD_POOL_SIZE; i++)
+        pthread_create(&legacy_pool.threads[i], NULL, legacy_thread_function, NULL);
+}
+
+static int legacy_pool_add_task(Task task)
+{
+    int ret = 0;
+    pthread_mutex_lock(&legacy_pool.mutex);
+    if (legacy_pool.count < MAX_QUEUE_SIZE)
+    {
+        task.enqueue_us = now_us();
+        legacy_pool.queue[legacy_pool.rear] = task;
+        legacy_pool.rear = (legacy_pool.rear + 1) % MAX_QUEUE_SIZE;
+        legacy_pool.count++;
+        sem_post(&legacy_pool.semaphore);
+    }
+    else
+    {
+        ret = -1;
+    }
+    pthread_mutex_unlock(&legacy_pool.mutex);
+    return ret;
+}
+
+static void legacy_pool_destroy()
+{
+    for (int i = 0; i < THREAD_POOL_SIZE; i++)
+        sem_post(&legacy_pool.semaphore);
+    for (int i = 0; i < THREAD_POOL_SIZE; i++)
+        pthread_join(legacy_pool.threads[i], NULL);
+    pthread_mutex_destroy(&legacy_pool.mutex);
+    sem_destroy(&legacy_pool.semaphore);
+}
+
+// ========================== 投递线程与测量 ==========================
+typedef struct
+{
+    const char *name;
+    void (*init)();
+    int (*add_task)(Task task);
+    void (*destroy)();
+} Scheduler;
+
+typedef struct
+{
+    const Scheduler *sched;
+    int id;
+    long long tasks;
+    int fds;
+    long long interval_us; // 每个投递线程两次投递的间隔（0=不限速）
+} Producer;
+
+static void *producer_main(void *arg)
+{
+    Producer *p = arg;
+    long long next = now_us();
+    for (long long i = 0; i < p->tasks; i++)
+    {
+        if (p->interval_us > 0)
+        {
+            next += p->interval_us;
+            long long now;
+            while ((now = now_us()) < next)
+            {
+                if (next - now > 200)
+                    usleep(next - now - 100);
+            }
+        }
+        Task task;
+        memset(&task, 0, sizeof(task));
+        // 各投递线程轮流使用自己那部分连接（模拟每个reactor管理一批连接）
+        task.client_fd = 16 + (int)((p->id * p->tasks + i) % p->fds);
+        task.conn = (ConnHandle)1 << 32 | (ConnHandle)task.client_fd;
+        task.type = TASK_CLIENT_MESSAGE;
+        while (p->sched->add_task(task) == -1)
+            sched_yield(); // 队列满：像reactor一样稍后重试
+    }
+    return NULL;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief 用指定调度器跑一轮，打印吞吐和排队延迟分位数
+ * @param sched 调度器
+ * @param producers 投递线程数
+ * @param per_producer 每个投递线程投递的任务数
+ * @param fds 模拟的连接数（决定任务投递到哪个工作线程的队列）
+ * @param rate 限速（任务/秒，0=不限速）
+ * @return 无返回值
+ */
+static void run_bench(const Scheduler *sched, int producers, long long per_producer, int fds, long long rate)
+{
+    long long total = per_producer * producers;
+    latency_cap = total;
+    completed = 0;
+    server_running = 1;
+    sched->init();
+
+    pthread_t threads[producers];
+    Producer args[producers];
+    long long start = now_us();
+    for (int i = 0; i < producers; i++)
+    {
+        args[i] = (Producer){sched, i, per_producer, fds, rate > 0 ? producers * 1000000LL / rate : 0};
+        pthread_create(&threads[i], NULL, producer_main, &args[i]);
+    }
+    for (int i = 0; i < producers; i++)
+        pthread_join(threads[i], NULL);
+    while (__atomic_load_n(&completed, __ATOMIC_SEQ_CST) < total)
+        usleep(100);
+    long long elapsed = now_us() - start;
+
+    server_running = 0;
+    sched->destroy();
+
+    qsort(latencies, total, sizeof(long long), cmp_ll);
+    printf("%-14s %-12s %10.0f 任务/秒   排队延迟 p50 %6lld us  p99 %6lld us  最大 %6lld us\n",
+           sched->name, rate > 0 ? "限速" : "不限速", total * 1e6 / (elapsed > 0 ? elapsed : 1),
+           latencies[total / 2], latencies[total - 1 - total / 100], latencies[total - 1]);
+}
+
+int main(int argc, char *argv[])
+{
+    int producers = 4;
+    long long per_producer = 200000;
+    int fds = 1000;
+    long long rate = 50000;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:w:f:r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            producers = atoi(optarg);
+            break;
+        case 'n':
+            per_producer = atoll(optarg);
+            break;
+        case 'w':
+            work_us = atoi(optarg);
+            break;
+        case 'f':
+            fds = atoi(optarg);
+            break;
+        case 'r':
+            rate = atoll(optarg);
+            break;
+        default:
+            fprintf(stderr, "用法: %s [-p 投递线程数] [-n 每个投递线程的任务数] [-w 每个任务的工作量us] [-f 连接数] [-r 限速任务/秒]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (producers <= 0 || per_producer <= 0 || fds <= 0 || work_us < 0 || rate <= 0)
+    {
+        fprintf(stderr, "参数必须为正数\n");
+        return 1;
+    }
+
+    latencies = malloc(sizeof(long long) * per_producer * producers);
+    if (!latencies)
+    {
+        perror("malloc");
+        return 1;
+    }
+
+    static const Scheduler schedulers[] = {
+        {"单队列(原)", legacy_pool_init, legacy_pool_add_task, legacy_pool_destroy},
+        {"偷任务(现)", thread_pool_init, thread_pool_add_task, thread_pool_destroy},
+    };
+    printf("%d个工作线程，%d个投递线程 x %lld 个任务，每个任务 %d us，%d 个连接，限速 %lld 任务/秒\n",
+           THREAD_POOL_SIZE, producers, per_producer, work_us, fds, rate);
+    for (size_t i = 0; i < sizeof(schedulers) / sizeof(schedulers[0]); i++)
+    {
+        run_bench(&schedulers[i], producers, per_producer, fds, 0);
+        run_bench(&schedulers[i], producers, per_producer, fds, rate);
+    }
+
+    free(latencies);
+    return 0;
+}
@@ -1,4 +1,8 @@
 #include "business.h"
+#include "conn_table.h"
+#include "multipart.h"
+#include <openssl/crypto.h>
+
 /**
  * @brief 初始化服务器（创建服务器根目录）
  * @param 无参数
@@ -39,10 +43,11 @@ void handle_login(int client_fd, cJSON *req, struct sockaddr_in client_addr)
         return;
     }
 
-    // 验证用户密码（查询数据库）
-    char sql[256];
-    snprintf(sql, sizeof(sql), "SELECT password FROM user WHERE username='%s'", username->valuestring);
-    if (mysql_query(&mysql, sql) != 0)
+    // 验证用户密码（预编译查询，用户名按参数绑定）
+    char stored_password[256];
+    int found = meta_store->user_password(username->valuestring,
+                                          stored_password, sizeof(stored_password));
+    if (found == -1)
     {
         cJSON_AddBoolToObject(res, "success", 0);
         cJSON_AddStringToObject(res, "message", "查询失败");
@@ -50,31 +55,24 @@ void handle_login(int client_fd, cJSON *req, struct sockaddr_in client_addr)
         cJSON_Delete(res);
         return;
     }
-
-    // 获取查询结果
-    MYSQL_RES *mysql_res = mysql_store_result(&mysql);
-    if (mysql_num_rows(mysql_res) == 0)
+    if (found == 0)
     { // 无此用户
         cJSON_AddBoolToObject(res, "success", 0);
         cJSON_AddStringToObject(res, "message", "用户不存在");
-        mysql_free_result(mysql_res);
         send_json_response(client_fd, res);
         cJSON_Delete(res);
         return;
     }
 
     // 验证密码
-    MYSQL_ROW row = mysql_fetch_row(mysql_res);
-    if (strcmp(row[0], password->valuestring) != 0)
+    if (strcmp(stored_password, password->valuestring) != 0)
     { // 密码不匹配
         cJSON_AddBoolToObject(res, "success", 0);
         cJSON_AddStringToObject(res, "message", "密码错误");
-        mysql_free_result(mysql_res);
         send_json_response(client_fd, res);
         cJSON_Delete(res);
         return;
     }
-    mysql_free_result(mysql_res);
 
     // 登录成功 - 检查并创建用户根目录（首次登录时创建）
     char root_dir[MAX_PATH_LEN];
@@ -91,13 +89,21 @@ void handle_login(int client_fd, cJSON *req, struct sockaddr_in client_addr)
         }
         get_user_root_dir(username->valuestring, root_dir); // 重新获取目录路径
     }
-    // 登录成功处理：返回响应、绑定用户名到客户端fd、记录操作日志
+    // 登录成功处理：返回响应（附会话令牌，断线重连时凭令牌恢复）、把连接登记到用户的在线会话中、记录操作日志
     cJSON_AddBoolToObject(res, "success", 1);
     cJSON_AddStringToObject(res, "message", "登录成功");
-    strncpy(client_username[client_fd], username->valuestring, sizeof(client_username[client_fd]) - 1);
+    char token[SESSION_TOKEN_MAX_LEN];
+    time_t expires;
+    if (session_token_issue(username->valuestring, token, &expires) == 0)
+    {
+        cJSON_AddStringToObject(res, "token", token);
+        cJSON_AddNumberToObject(res, "token_expires", (double)expires);
+    }
+    Connection *conn = conn_get(client_fd);
+    conn_bind_user(client_fd, username->valuestring);
     // 插入登录操作日志
     insert_operation_log(client_fd, username->valuestring,
-                         inet_ntoa(client_addrs[client_fd].sin_addr),
+                         inet_ntoa(conn->addr.sin_addr),
                          "login", NULL, "成功");
 
     send_json_response(client_fd, res);
@@ -106,6 +112,52 @@ void handle_login(int client_fd, cJSON *req, struct sockaddr_in client_addr)
     write_log(LOG_LEVEL_INFO, "用户登录成功: %s, 根目录: %s", username->valuestring, root_dir);
 }
 
+/**
+ * @brief 处理会话恢复请求（断线重连时凭登录返回的令牌恢复登录状态）
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含token）
+ * @param client_addr 客户端地址信息
+ * @return 无返回值
+ * @details 令牌的签名和有效期在内存中校验，不查询密码和用户目录；
+ *          成功时返回新令牌（有效期重新计算），客户端替换保存
+ */
+void handle_resume_session(int client_fd, cJSON *req, struct sockaddr_in client_addr)
+{
+    cJSON *token = cJSON_GetObjectItem(req, "token");
+
+    cJSON *res = cJSON_CreateObject();
+    cJSON_AddStringToObject(res, "type", "resume_result");
+
+    char username[50];
+    if (!cJSON_IsString(token) || !session_token_verify(token->valuestring, username))
+    {
+        cJSON_AddBoolToObject(res, "success", 0);
+        cJSON_AddStringToObject(res, "message", "会话已失效，请重新登录");
+        send_json_response(client_fd, res);
+        cJSON_Delete(res);
+        write_log(LOG_LEVEL_WARN, "客户端 %d 会话恢复失败：令牌无效或已过期", client_fd);
+        return;
+    }
+
+    cJSON_AddBoolToObject(res, "success", 1);
+    cJSON_AddStringToObject(res, "message", "会话已恢复");
+    cJSON_AddStringToObject(res, "username", username);
+    char new_token[SESSION_TOKEN_MAX_LEN];
+    time_t expires;
+    if (session_token_issue(username, new_token, &expires) == 0)
+    {
+        cJSON_AddStringToObject(res, "token", new_token);
+        cJSON_AddNumberToObject(res, "token_expires", (double)expires);
+    }
+    conn_bind_user(client_fd, username);
+    insert_operation_log(client_fd, username, inet_ntoa(client_addr.sin_addr),
+                         "resume", NULL, "成功");
+
+    send_json_response(client_fd, res);
+    cJSON_Delete(res);
+    write_log(LOG_LEVEL_INFO, "用户会话恢复: %s（fd: %d）", username, client_fd);
+}
+
 /**
  * @brief 处理客户端注册请求
  * @param client_fd 客户端文件描述符
@@ -132,8 +184,28 @@ void handle_register(int client_fd, cJSON *req)
         return;
     }
 
+    // 用户名即用户目录名：不能包含路径分隔符，不能以.开头（.cas为块存储目录）
+    if (username->valuestring[0] == '\0' || username->valuestring[0] == '.' ||
+        strchr(username->valuestring, '/'))
+    {
+        cJSON_AddBoolToObject(res, "success", 0);
+        cJSON_AddStringToObject(res, "message", "用户名不合法");
+        send_json_response(client_fd, res);
+        cJSON_Delete(res);
+        return;
+    }
+
     // 检查用户名是否已存在
-    if (mysql_find_user(username->valuestring) != -1)
+    int exists = meta_store->user_exists(username->valuestring);
+    if (exists == -1)
+    {
+        cJSON_AddBoolToObject(res, "success", 0);
+        cJSON_AddStringToObject(res, "message", "注册失败");
+        send_json_response(client_fd, res);
+        cJSON_Delete(res);
+        return;
+    }
+    if (exists == 1)
     {
         cJSON_AddBoolToObject(res, "success", 0);
         cJSON_AddStringToObject(res, "message", "用户名已存在");
@@ -143,11 +215,7 @@ void handle_register(int client_fd, cJSON *req)
     }
 
     // 插入新用户到数据库（root_dir默认空，首次登录创建）
-    char sql[512];
-    snprintf(sql, sizeof(sql),
-             "INSERT INTO user (username, password, root_dir) VALUES ('%s', '%s', '')",
-             username->valuestring, password->valuestring);
-    if (mysql_query(&mysql, sql) != 0)
+    if (meta_store->user_insert(username->valuestring, password->valuestring) != 0)
     {
         cJSON_AddBoolToObject(res, "success", 0);
         cJSON_AddStringToObject(res, "message", "注册失败");
@@ -165,24 +233,6 @@ void handle_register(int client_fd, cJSON *req)
     write_log(LOG_LEVEL_INFO, "用户注册成功: %s", username->valuestring);
 }
 
-/**
- * @brief 根据用户名获取在线客户端fd
- * @param username 目标用户名
- * @return 在线fd，找不到返回-1
- */
-int get_online_client_fd(const char *username)
-{
-    for (int fd = 0; fd < MAX_EVENTS; fd++)
-    {
-        // client_username[fd]是“fd→用户名”的映射（原方案已有），反向查找
-        if (client_username[fd] != NULL && strcmp(client_username[fd], username) == 0)
-        {
-            return fd; // 找到在线fd
-        }
-    }
-    return -1; // 接收者离线
-}
-
 /**
  * @brief 处理客户端文件列表请求
  * @param client_fd 客户端文件描述符
@@ -191,7 +241,7 @@ int get_online_client_fd(const char *username)
  */
 void handle_file_list(int client_fd, cJSON *req)
 {
-    const char *username = client_username[client_fd];
+    const char *username = conn_get(client_fd)->username;
     if (strlen(username) == 0)
     {
         cJSON *res = cJSON_CreateObject();
@@ -259,7 +309,11 @@ void handle_file_list(int client_fd, cJSON *req)
                 cJSON *file = cJSON_CreateObject();
                 cJSON_AddStringToObject(file, "name", entry->d_name);
                 cJSON_AddBoolToObject(file, "is_directory", S_ISDIR(st.st_mode));
-                cJSON_AddNumberToObject(file, "size", st.st_size);
+                // 文件在磁盘上是清单，大小取清单中记录的原文件大小
+                long long size = st.st_size;
+                if (S_ISREG(st.st_mode))
+                    cas_manifest_size(entry_path, &size);
+                cJSON_AddNumberToObject(file, "size", size);
                 cJSON_AddItemToArray(files, file);
             }
         }
@@ -272,15 +326,253 @@ void handle_file_list(int client_fd, cJSON *req)
 }
 
 /**
- * @brief 处理客户端文件上传控制请求（初始化上传）
+ * @brief 释放增量上传的块清单和标记
+ * @param info 上传状态
+ * @return 无返回值
+ */
+static void upload_release_delta(ClientUploadInfo *info)
+{
+    free(info->delta);
+    free(info->delta_have);
+    info->delta = NULL;
+    info->delta_have = NULL;
+}
+
+/**
+ * @brief 回复上传失败
  * @param client_fd 客户端文件描述符
- * @param req 客户端JSON请求（含文件名、文件大小、目标路径）
+ * @param message 失败原因
  * @return 无返回值
  */
-void handle_upload_ctl(int client_fd, cJSON *req)
+static void upload_reply_failure(int client_fd, const char *message)
+{
+    cJSON *res = cJSON_CreateObject();
+    cJSON_AddStringToObject(res, "type", "upload_result");
+    cJSON_AddBoolToObject(res, "success", 0);
+    cJSON_AddStringToObject(res, "message", message);
+    send_json_response(client_fd, res);
+    cJSON_Delete(res);
+}
+
+/**
+ * @brief 上传入库结束（在入库线程上调用）：记录操作日志，回复upload_result，释放暂存数据
+ * @param job 入库任务（UploadCommit的第一个成员）
+ * @param ret 入库结果（0=成功，-1=失败）
+ * @return 无返回值
+ * @details 发起上传的连接可能已断开或fd已被新连接复用，回复按句柄发送，失效则丢弃
+ */
+static void upload_commit_done(CasIngestJob *job, int ret)
+{
+    UploadCommit *uc = (UploadCommit *)job;
+    insert_operation_log(uc->client_fd, uc->username, uc->ip, "upload", job->manifest_path,
+                         ret == 0 ? "成功" : "失败");
+
+    cJSON *res = cJSON_CreateObject();
+    cJSON_AddStringToObject(res, "type", "upload_result");
+    cJSON_AddBoolToObject(res, "success", ret == 0);
+    cJSON_AddStringToObject(res, "message", ret == 0 ? "文件上传完成" : "文件保存失败");
+    send_json_to_conn(uc->conn, res);
+    cJSON_Delete(res);
+
+    if (uc->mp)
+    {
+        if (ret == 0)
+            write_log(LOG_LEVEL_INFO, "客户端 %d 分段上传完成：%s（%lld 字节，%d 段）",
+                      uc->client_fd, job->manifest_path, uc->mp->size, uc->mp->part_count);
+        multipart_free(uc->mp); // 暂存文件属于分段上传，随之关闭
+    }
+    else
+    {
+        if (job->fd >= 0) // 增量上传不需要接收数据时没有暂存文件
+            close(job->fd);
+        // 入库成功或暂存数据无效（哈希不符）都不再续传
+        upload_journal_discard(uc->journal);
+        if (ret == 0)
+        {
+            printf("客户端 %d 文件上传完成：%s\n", uc->client_fd, job->manifest_path);
+            write_log(LOG_LEVEL_INFO, "客户端 %d 文件上传完成：%s", uc->client_fd, job->manifest_path);
+        }
+    }
+    free(job->delta);
+    free(job->delta_have);
+    free(job->manifest_path);
+    free(uc);
+}
+
+/**
+ * @brief 创建上传提交（记下连接、用户和目标路径，入库结束后据此回复）
+ * @param client_fd 客户端文件描述符
+ * @param filepath 上传目标的完整路径
+ * @return 上传提交（其余字段为空），NULL=内存不足
+ */
+static UploadCommit *upload_commit_new(int client_fd, const char *filepath)
+{
+    Connection *conn = conn_get(client_fd);
+    UploadCommit *uc = calloc(1, sizeof(UploadCommit));
+    char *path = strdup(filepath);
+    if (!uc || !path)
+    {
+        free(uc);
+        free(path);
+        write_log(LOG_LEVEL_ERROR, "内存不足，无法提交上传入库: %s", filepath);
+        return NULL;
+    }
+    uc->job.fd = -1;
+    uc->job.manifest_path = path;
+    uc->job.done = upload_commit_done;
+    uc->conn = conn_handle(client_fd);
+    uc->client_fd = client_fd;
+    strncpy(uc->username, conn->username, sizeof(uc->username) - 1);
+    strncpy(uc->ip, inet_ntoa(conn->addr.sin_addr), sizeof(uc->ip) - 1);
+    return uc;
+}
+
+/**
+ * @brief 读取请求中可选的整文件哈希（file_hash，64位十六进制）
+ * @param req 客户端JSON请求
+ * @param file_hash 输出参数：整文件SHA-256
+ * @return 1=有合法的file_hash，0=没有或格式错误
+ */
+static int upload_parse_hash(cJSON *req, unsigned char *file_hash)
+{
+    cJSON *hash_json = cJSON_GetObjectItem(req, "file_hash");
+    return cJSON_IsString(hash_json) && strlen(hash_json->valuestring) == CAS_HASH_LEN * 2 &&
+           cas_hash_from_hex(hash_json->valuestring, file_hash) == 0;
+}
+
+/**
+ * @brief 秒传完成：记录操作日志并回复上传完成
+ * @param client_fd 客户端文件描述符
+ * @param filepath 上传目标的完整路径
+ * @param size 文件大小
+ * @return 无返回值
+ */
+static void upload_reply_instant(int client_fd, const char *filepath, long long size)
+{
+    Connection *conn = conn_get(client_fd);
+    insert_operation_log(client_fd, conn->username, inet_ntoa(conn->addr.sin_addr),
+                         "upload", filepath, "成功");
+    cJSON *res = cJSON_CreateObject();
+    cJSON_AddStringToObject(res, "type", "upload_result");
+    cJSON_AddBoolToObject(res, "success", 1);
+    cJSON_AddBoolToObject(res, "instant", 1);
+    cJSON_AddStringToObject(res, "message", "秒传完成");
+    send_json_response(client_fd, res);
+    cJSON_Delete(res);
+    write_log(LOG_LEVEL_INFO, "客户端 %d 秒传完成：%s（%lld 字节）", client_fd, filepath, size);
+}
+
+/**
+ * @brief 释放持有证明挑战
+ * @param ch 挑战（可为NULL）
+ * @return 无返回值
+ */
+void upload_challenge_free(UploadChallenge *ch)
+{
+    if (!ch)
+    {
+        return;
+    }
+    free(ch->filepath);
+    cJSON_Delete(ch->req);
+    free(ch);
+}
+
+/**
+ * @brief 向客户端发出跨用户秒传的持有证明挑战（upload_challenge），原始请求保存到连接上等待upload_proof
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求
+ * @param file_hash 客户端声明的整文件SHA-256
+ * @param size 客户端声明的文件大小
+ * @param filepath 上传目标的完整路径
+ * @param resume 原始请求的处理函数
+ * @return 1=已发出挑战，0=失败（继续正常上传）
+ * @details 无论服务器是否有相同内容的文件都发出挑战，只凭哈希探测不出其他用户是否有某个文件
+ */
+static int upload_send_challenge(int client_fd, cJSON *req, const unsigned char *file_hash, long long size,
+                                 const char *filepath, void (*resume)(int client_fd, cJSON *req))
+{
+    UploadChallenge *ch = calloc(1, sizeof(UploadChallenge));
+    if (!ch || cas_proof_challenge(size, ch->nonce, ch->ranges) == -1 ||
+        !(ch->filepath = strdup(filepath)) || !(ch->req = cJSON_Duplicate(req, 1)))
+    {
+        upload_challenge_free(ch);
+        return 0;
+    }
+    memcpy(ch->file_hash, file_hash, CAS_HASH_LEN);
+    ch->size = size;
+    ch->resume = resume;
+    ch->has_source = cas_proof_expect(file_hash, size, ch->nonce, ch->ranges, ch->expect, ch->src_path);
+
+    Connection *conn = conn_get(client_fd);
+    upload_challenge_free(conn->up.challenge);
+    conn->up.challenge = ch;
+
+    char nonce_hex[CAS_HASH_LEN * 2 + 1];
+    cas_hash_to_hex(ch->nonce, nonce_hex);
+    cJSON *res = cJSON_CreateObject();
+    cJSON_AddStringToObject(res, "type", "upload_challenge");
+    cJSON_AddStringToObject(res, "nonce", nonce_hex);
+    cJSON *ranges = cJSON_AddArrayToObject(res, "ranges");
+    for (int i = 0; i < CAS_PROOF_RANGES; i++)
+    {
+        cJSON *range = cJSON_CreateArray();
+        cJSON_AddItemToArray(range, cJSON_CreateNumber((double)ch->ranges[i].offset));
+        cJSON_AddItemToArray(range, cJSON_CreateNumber(ch->ranges[i].len));
+        cJSON_AddItemToArray(ranges, range);
+    }
+    send_json_response(client_fd, res);
+    cJSON_Delete(res);
+    return 1;
+}
+
+/**
+ * @brief 秒传：请求带整文件哈希（file_hash）时，用户自己已有相同内容的文件直接引用其块并回复上传完成；
+ *        请求还带instant_proof时，先要求客户端证明持有文件，再引用其他用户的相同内容
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含size，可选file_hash、instant_proof）
+ * @param root_dir 用户根目录（不需要证明时只在其中查找相同内容的文件）
+ * @param filepath 上传目标的完整路径
+ * @param resume 原始请求的处理函数（证明结束后未秒传时据此继续正常上传）
+ * @return 1=已秒传完成（已回复upload_result）或已发出挑战（已回复upload_challenge），0=未命中，继续正常上传
+ * @details 不超过CAS_PROOF_MIN_SIZE的文件不做跨用户秒传：内容容易被猜出，证明挡不住按猜测探测
+ */
+static int upload_try_instant(int client_fd, cJSON *req, const char *root_dir, const char *filepath,
+                              void (*resume)(int client_fd, cJSON *req))
+{
+    cJSON *size_json = cJSON_GetObjectItem(req, "size");
+    unsigned char file_hash[CAS_HASH_LEN];
+    if (!upload_parse_hash(req, file_hash) || !cJSON_IsNumber(size_json))
+    {
+        return 0;
+    }
+    long long size = (long long)size_json->valuedouble;
+    if (cas_instant_link(file_hash, size, root_dir, filepath))
+    {
+        upload_reply_instant(client_fd, filepath, size);
+        return 1;
+    }
+    if (cJSON_IsTrue(cJSON_GetObjectItem(req, "instant_proof")) && size >= CAS_PROOF_MIN_SIZE)
+    {
+        return upload_send_challenge(client_fd, req, file_hash, size, filepath, resume);
+    }
+    return 0;
+}
+
+/**
+ * @brief 开始或继续一次普通上传（upload和check_upload_resume共用）
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含文件名、文件大小、目标路径，可选整文件哈希file_hash）
+ * @param report_offset 1=总是回复upload_resume_info（续传请求），0=从头开始时回复ready_to_receive
+ * @return 无返回值
+ * @details 带file_hash的上传可续传：暂存数据和续传日志按（路径, 大小, 哈希）保存在块存储的partial目录，
+ *          连接中断或服务器重启后从已接收的偏移继续，入库时校验整文件哈希；
+ *          不带file_hash时写入匿名暂存文件，中断即丢弃
+ */
+static void upload_start(int client_fd, cJSON *req, int report_offset)
 {
     // 检查是否已登录
-    const char *username = client_username[client_fd];
+    const char *username = conn_get(client_fd)->username;
     if (strlen(username) == 0)
     {
         cJSON *res = cJSON_CreateObject();
@@ -315,6 +607,17 @@ void handle_upload_ctl(int client_fd, cJSON *req)
         user_path = path_json->valuestring;
     }
 
+    if (!cJSON_IsString(filename) || !cJSON_IsNumber(size_json) || size_json->valuedouble < 0)
+    {
+        upload_reply_failure(client_fd, "参数错误");
+        return;
+    }
+    if (!is_safe_target(root_dir, user_path, filename->valuestring))
+    {
+        upload_reply_failure(client_fd, "路径非法");
+        return;
+    }
+
     // 初始化响应JSON
     cJSON *res = cJSON_CreateObject();
     cJSON_AddStringToObject(res, "type", "upload_result");
@@ -323,14 +626,37 @@ void handle_upload_ctl(int client_fd, cJSON *req)
     char filepath[MAX_PATH_LEN];
     build_full_path(filepath, root_dir, user_path, filename->valuestring);
 
-    // 关键修正 1：正确打开文件（O_RDWR 支持读写，O_CREAT 不存在则创建，O_TRUNC 存在则清空）
-    int file_fd = open(filepath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    // 服务器已有相同内容的文件时不传输数据
+    if (upload_try_instant(client_fd, req, root_dir, filepath,
+                           report_offset ? handle_check_upload_resume : handle_upload_ctl))
+    {
+        cJSON_Delete(res);
+        return;
+    }
+
+    // 数据先写入块存储的暂存文件，接收完成后切块入库，用户路径上只保存清单
+    long long actual_file_size = size_json->valuedouble; // 客户端实际文件大小
+    unsigned char file_hash[CAS_HASH_LEN];
+    int has_hash = upload_parse_hash(req, file_hash);
+    UploadJournal *journal = NULL;
+    int file_fd;
+    if (has_hash)
+    {
+        char key[CAS_HASH_LEN * 2 + 1];
+        upload_journal_key(filepath, actual_file_size, 'F', file_hash, key);
+        journal = upload_journal_open(key, filepath, actual_file_size, 0, NULL, &file_fd);
+    }
+    else
+    {
+        file_fd = cas_stage_open();
+    }
     if (file_fd == -1)
     {
+        int busy = errno == EBUSY;
         perror("文件打开失败（上传）");
         write_log(LOG_LEVEL_ERROR, "客户端 %d 文件打开失败（上传）: %s", client_fd, strerror(errno));
         cJSON_AddBoolToObject(res, "success", 0);
-        cJSON_AddStringToObject(res, "message", "创建文件失败");
+        cJSON_AddStringToObject(res, "message", busy ? "该文件正在其他连接上传" : "创建文件失败");
         send_json_response(client_fd, res);
         cJSON_Delete(res);
         return;
@@ -343,155 +669,868 @@ void handle_upload_ctl(int client_fd, cJSON *req)
         perror("fstat 失败");
         write_log(LOG_LEVEL_ERROR, "客户端 %d fstat 失败：%s", client_fd, strerror(errno));
         close(file_fd); // 关闭无效文件描述符
+        if (journal)
+            upload_journal_close(journal, journal->committed);
         cJSON_AddBoolToObject(res, "success", 0);
         cJSON_AddStringToObject(res, "message", "获取文件大小失败");
         send_json_response(client_fd, res);
         cJSON_Delete(res);
         return;
     }
-    long long actual_file_size = size_json->valuedouble; // 客户端实际文件大小
 
-    // 初始化客户端上传状态（绑定到 client_fd）
-    if (client_fd < MAX_EVENTS)
+    // 初始化客户端上传状态（绑定到连接对象）
+    ClientUploadInfo *info = &conn_get(client_fd)->up;
+    if (conn_set_path(&info->filepath, filepath) == -1)
     {
-        client_up_info[client_fd].state = UP_STATE_RECEIVING;
-        strncpy(client_up_info[client_fd].filepath, filepath, sizeof(client_up_info[client_fd].filepath) - 1);
-        client_up_info[client_fd].filesize = actual_file_size; // 使用实际大小
-        client_up_info[client_fd].received = 0;
-        client_up_info[client_fd].fd = file_fd; // 保存文件描述符
+        close(file_fd);
+        if (journal)
+            upload_journal_close(journal, journal->committed);
+        cJSON_AddBoolToObject(res, "success", 0);
+        cJSON_AddStringToObject(res, "message", "服务器内存不足");
+        send_json_response(client_fd, res);
+        cJSON_Delete(res);
+        return;
     }
-
-    // 通知客户端：服务器已准备好接收数据
-    cJSON *ready = cJSON_CreateObject();
-    cJSON_AddStringToObject(ready, "type", "ready_to_receive");
-    send_json_response(client_fd, ready);
-    cJSON_Delete(ready);
+    upload_release_delta(info); // 普通上传：整个文件都在接收的数据中
+    info->state = UP_STATE_RECEIVING;
+    info->filesize = actual_file_size; // 使用实际大小
+    info->received = journal ? journal->committed : 0; // 续传：从上次已接收的偏移继续
+    info->fd = file_fd; // 保存文件描述符
+    info->use_splice = server_config.upload_splice;
+    info->journal = journal;
+    info->verify_hash = has_hash;
+    info->base = 0;
+    info->multipart = NULL;
+    if (has_hash)
+        memcpy(info->file_hash, file_hash, CAS_HASH_LEN);
     cJSON_Delete(res);
-}
 
-/**
- * @brief 处理客户端上传数据（接收并写入文件）
- * @param client_fd 客户端文件描述符
- * @return 0=处理成功，-1=处理失败
- */
-int handle_upload(int client_fd)
-{
-    // 检查上传状态（仅处理“接收中”状态的请求）
-    if (client_up_info[client_fd].state != UP_STATE_RECEIVING)
+    if (report_offset || info->received > 0)
     {
-        return -1;
+        // 续传：客户端从offset处继续发送
+        cJSON *resume = cJSON_CreateObject();
+        cJSON_AddStringToObject(resume, "type", "upload_resume_info");
+        cJSON_AddNumberToObject(resume, "offset", (double)info->received);
+        cJSON_AddNumberToObject(resume, "size", (double)info->filesize);
+        send_json_response(client_fd, resume);
+        cJSON_Delete(resume);
     }
-
-    // 从上传状态中提取关键信息
-    int file_fd = client_up_info[client_fd].fd;
-    long long file_size = client_up_info[client_fd].filesize;
-
-    // 循环读取，直到缓冲区为空或数据接收完成
-    while (client_up_info[client_fd].received < file_size)
+    else
     {
-        char file_buf[BUFFER_SIZE];
-        ssize_t len = recv(client_fd, file_buf, BUFFER_SIZE, 0);
-        if (len < 0)
-        {
-            // 区分 "缓冲区空"（EAGAIN）和 "真实错误"
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
-            {
-                break; // 缓冲区空，退出循环
-            }
-            // 其他错误（如客户端断开）
-            perror("上传数据接收失败");
-            write_log(LOG_LEVEL_ERROR, "客户端 %d 上传数据接收失败: %s", client_fd, strerror(errno));
-            close(file_fd);
-            client_up_info[client_fd].state = UP_STATE_IDLE;
-            // 发送失败响应
-            cJSON *progress_res = cJSON_CreateObject();
-            cJSON_AddStringToObject(progress_res, "type", "upload_progress");
-            cJSON_AddBoolToObject(progress_res, "success", 0);
-            send_json_response(client_fd, progress_res);
-            cJSON_Delete(progress_res);
-            return -1;
-        }
-        else if (len == 0)
-        {
-            // 客户端主动断开
-            perror("客户端断开连接");
-            write_log(LOG_LEVEL_WARN, "客户端 %d 上传时断开连接", client_fd);
-            close(file_fd);
-            client_up_info[client_fd].state = UP_STATE_IDLE;
-            return -1;
-        }
-
-        // 写入文件
-        ssize_t written = write(file_fd, file_buf, len);
-        if (written != len)
-        {
-            perror("写入文件失败");
-            write_log(LOG_LEVEL_ERROR, "客户端 %d 写入文件失败: %s", client_fd, strerror(errno));
-            close(file_fd);
-            client_up_info[client_fd].state = UP_STATE_IDLE;
-            return -1;
-        }
-
-        // 更新接收进度，并检查是否已完成
-        client_up_info[client_fd].received += written;
-        printf("DEBUG: 小文件接收 %zd 字节，累计 %lld/%lld\n", len, client_up_info[client_fd].received, file_size);
-
-        if (client_up_info[client_fd].received >= file_size)
-        {
-            break; // 数据已接收完，提前退出循环
-        }
+        // 通知客户端：服务器已准备好接收数据
+        cJSON *ready = cJSON_CreateObject();
+        cJSON_AddStringToObject(ready, "type", "ready_to_receive");
+        send_json_response(client_fd, ready);
+        cJSON_Delete(ready);
     }
-    // ====================== 结束文件处理 ======================
-
-    // ====================== 进度计算与响应 ======================
-    bool isComplete = (client_up_info[client_fd].received >= client_up_info[client_fd].filesize);
-    double progress = isComplete ? 100.0 : (double)client_up_info[client_fd].received / client_up_info[client_fd].filesize * 100;
-
-    // 发送上传进度响应
-    cJSON *progress_res = cJSON_CreateObject();
-    cJSON_AddStringToObject(progress_res, "type", "upload_progress");
-    cJSON_AddBoolToObject(progress_res, "success", 1);
-    cJSON_AddNumberToObject(progress_res, "progress", progress);
-    cJSON_AddNumberToObject(progress_res, "received", client_up_info[client_fd].received);
-    cJSON_AddNumberToObject(progress_res, "total", client_up_info[client_fd].filesize);
-    send_json_response(client_fd, progress_res);
-    cJSON_Delete(progress_res);
 
-    // 上传完成判断（基于整数比较，避免浮点误差）
-    if (isComplete)
+    // 没有数据要接收（空文件，或上次中断时数据已全部收到）：直接入库
+    if (info->received >= info->filesize)
     {
-        // 记录上传成功日志
-        insert_operation_log(client_fd, client_username[client_fd],
-                             inet_ntoa(client_addrs[client_fd].sin_addr),
-                             "upload", client_up_info[client_fd].filepath, "成功");
-
-        close(file_fd); // 关闭文件描述符
-        // 发送上传完成响应
-        cJSON *finish_res = cJSON_CreateObject();
-        cJSON_AddStringToObject(finish_res, "type", "upload_result");
-        cJSON_AddBoolToObject(finish_res, "success", 1);
-        cJSON_AddStringToObject(finish_res, "message", "文件上传完成");
-        send_json_response(client_fd, finish_res);
-        cJSON_Delete(finish_res);
-
-        client_up_info[client_fd].state = UP_STATE_IDLE; // 重置上传状态
-        printf("客户端 %d 文件上传完成：%s\n", client_fd, client_up_info[client_fd].filepath);
-        write_log(LOG_LEVEL_INFO, "客户端 %d 文件上传完成：%s", client_fd, client_up_info[client_fd].filepath);
+        upload_finish(client_fd);
     }
+}
 
-    return 0;
+/**
+ * @brief 处理客户端文件上传控制请求（初始化上传）
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含文件名、文件大小、目标路径，可选整文件哈希file_hash用于秒传和断点续传）
+ * @return 无返回值
+ * @details 同一文件有未完成的上传时自动续传，回复upload_resume_info（offset为已接收的字节数）代替ready_to_receive
+ */
+void handle_upload_ctl(int client_fd, cJSON *req)
+{
+    upload_start(client_fd, req, 0);
 }
 
 /**
- * @brief 处理客户端文件下载控制请求（初始化下载）
+ * @brief 处理断点续传请求：查询同一文件未完成上传的进度并从该处继续接收
  * @param client_fd 客户端文件描述符
- * @param req 客户端JSON请求（含文件名、目标路径）
+ * @param req 客户端JSON请求（字段同upload，file_hash必填，否则只能从头上传）
  * @return 无返回值
+ * @details 回复upload_resume_info（offset为已接收的字节数，没有未完成的上传时为0），之后客户端从offset处发送数据
  */
-void handle_download_ctl(int client_fd, cJSON *req)
+void handle_check_upload_resume(int client_fd, cJSON *req)
 {
-    // 检查是否已登录
-    const char *username = client_username[client_fd];
+    upload_start(client_fd, req, 1);
+}
+
+/**
+ * @brief 处理客户端增量上传请求：客户端给出新版本的内容定义切块清单，服务器回复该路径当前版本中没有的块，
+ *        之后只接收这些块的数据
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含文件名、文件大小、目标路径、chunks=[[块哈希, 块长度], ...]，可选file_hash用于秒传）
+ * @return 无返回值
+ * @details 先回复upload_plan（missing为需要发送的块下标，bytes为需要发送的总字节数，
+ *          offset为上次中断前已收到的字节数，客户端跳过这部分），再回复ready_to_receive；
+ *          不需要发送任何数据时直接写入新版本并回复upload_result。
+ *          缺少的块按块清单保存续传日志，同一块清单再次上传时沿用上次的计划和进度。
+ *          接收完成后每块都按声明的哈希校验，与声明不符的上传整体失败
+ */
+void handle_upload_delta(int client_fd, cJSON *req)
+{
+    const char *username = conn_get(client_fd)->username;
+    if (strlen(username) == 0)
+    {
+        upload_reply_failure(client_fd, "未登录");
+        return;
+    }
+
+    char root_dir[MAX_PATH_LEN];
+    if (!get_user_root_dir(username, root_dir))
+    {
+        upload_reply_failure(client_fd, "获取用户目录失败");
+        return;
+    }
+
+    cJSON *filename = cJSON_GetObjectItem(req, "filename");
+    cJSON *size_json = cJSON_GetObjectItem(req, "size");
+    cJSON *chunks_json = cJSON_GetObjectItem(req, "chunks");
+    cJSON *path_json = cJSON_GetObjectItem(req, "path");
+    const char *user_path = "/";
+    if (cJSON_IsString(path_json))
+    {
+        user_path = path_json->valuestring;
+    }
+    if (!cJSON_IsString(filename) || !cJSON_IsNumber(size_json) || !cJSON_IsArray(chunks_json) ||
+        size_json->valuedouble < 0)
+    {
+        upload_reply_failure(client_fd, "参数错误");
+        return;
+    }
+
+    if (!is_safe_target(root_dir, user_path, filename->valuestring))
+    {
+        upload_reply_failure(client_fd, "路径非法");
+        return;
+    }
+    char filepath[MAX_PATH_LEN];
+    build_full_path(filepath, root_dir, user_path, filename->valuestring);
+    if (upload_try_instant(client_fd, req, root_dir, filepath, handle_upload_delta))
+    {
+        return;
+    }
+
+    // 解析客户端的块清单：每块长度不超过CAS_CHUNK_MAX，总长度必须等于文件大小
+    int count = cJSON_GetArraySize(chunks_json);
+    CasManifest *m = malloc(sizeof(CasManifest) + (size_t)count * sizeof(CasChunkRef));
+    unsigned char *have = malloc(count > 0 ? count : 1);
+    if (!m || !have)
+    {
+        free(m);
+        free(have);
+        upload_reply_failure(client_fd, "服务器内存不足");
+        return;
+    }
+    m->size = (long long)size_json->valuedouble;
+    m->count = count;
+    long long offset = 0;
+    int parsed = 0;
+    cJSON *item;
+    cJSON_ArrayForEach(item, chunks_json)
+    {
+        cJSON *hash = cJSON_GetArrayItem(item, 0);
+        cJSON *len = cJSON_GetArrayItem(item, 1);
+        CasChunkRef *c = &m->chunks[parsed];
+        if (!cJSON_IsString(hash) || strlen(hash->valuestring) != CAS_HASH_LEN * 2 ||
+            cas_hash_from_hex(hash->valuestring, c->hash) == -1 ||
+            !cJSON_IsNumber(len) || len->valuedouble < 1 || len->valuedouble > CAS_CHUNK_MAX)
+            break;
+        c->len = (uint32_t)len->valuedouble;
+        c->offset = offset;
+        offset += c->len;
+        parsed++;
+    }
+    if (parsed < count || offset != m->size)
+    {
+        free(m);
+        free(have);
+        upload_reply_failure(client_fd, "块清单错误");
+        return;
+    }
+
+    // 与该路径当前版本比较，只接收没有的块；有续传日志时沿用上次的计划（暂存数据按上次的计划排列）
+    long long missing = cas_delta_plan(filepath, m, have);
+    int file_fd = -1;
+    UploadJournal *journal = NULL;
+    if (missing > 0)
+    {
+        unsigned char list_hash[CAS_HASH_LEN];
+        char key[CAS_HASH_LEN * 2 + 1];
+        if (cas_manifest_digest(m, list_hash) == 0)
+        {
+            upload_journal_key(filepath, m->size, 'D', list_hash, key);
+            journal = upload_journal_open(key, filepath, missing, count, have, &file_fd);
+        }
+        if (!journal)
+        {
+            int busy = errno == EBUSY;
+            free(m);
+            free(have);
+            upload_reply_failure(client_fd, busy ? "该文件正在其他连接上传" : "创建文件失败");
+            return;
+        }
+        missing = journal->size;
+    }
+
+    ClientUploadInfo *info = &conn_get(client_fd)->up;
+    if (conn_set_path(&info->filepath, filepath) == -1)
+    {
+        if (file_fd != -1)
+            close(file_fd);
+        if (journal)
+            upload_journal_close(journal, journal->committed);
+        free(m);
+        free(have);
+        upload_reply_failure(client_fd, "服务器内存不足");
+        return;
+    }
+    upload_release_delta(info);
+    info->delta = m;
+    info->delta_have = have;
+    info->state = UP_STATE_RECEIVING;
+    info->filesize = missing; // 只接收缺少的块（按块顺序首尾相接）
+    info->received = journal ? journal->committed : 0;
+    info->fd = file_fd;
+    info->use_splice = server_config.upload_splice;
+    info->journal = journal;
+    info->verify_hash = 0; // 每块入库时都按块哈希校验
+    info->base = 0;
+    info->multipart = NULL;
+
+    cJSON *plan = cJSON_CreateObject();
+    cJSON_AddStringToObject(plan, "type", "upload_plan");
+    cJSON *missing_json = cJSON_AddArrayToObject(plan, "missing");
+    for (int i = 0; i < count; i++)
+    {
+        if (!have[i])
+            cJSON_AddItemToArray(missing_json, cJSON_CreateNumber(i));
+    }
+    cJSON_AddNumberToObject(plan, "bytes", (double)missing);
+    cJSON_AddNumberToObject(plan, "offset", (double)info->received);
+    send_json_response(client_fd, plan);
+    cJSON_Delete(plan);
+    write_log(LOG_LEVEL_INFO, "客户端 %d 增量上传 %s：%d 块，需接收 %lld/%lld 字节（已接收 %lld）",
+              client_fd, filepath, count, missing, m->size, info->received);
+
+    if (info->received >= missing)
+    {
+        // 所有块都已存在，或上次中断时缺少的块已全部收到：直接写入新版本
+        upload_finish(client_fd);
+        return;
+    }
+
+    cJSON *ready = cJSON_CreateObject();
+    cJSON_AddStringToObject(ready, "type", "ready_to_receive");
+    send_json_response(client_fd, ready);
+    cJSON_Delete(ready);
+}
+
+/**
+ * @brief 回复分段上传中一段的结果
+ * @param client_fd 客户端文件描述符
+ * @param part 段号
+ * @param message 失败原因（NULL=该段已收到）
+ * @return 无返回值
+ */
+static void upload_reply_part(int client_fd, int part, const char *message)
+{
+    cJSON *res = cJSON_CreateObject();
+    cJSON_AddStringToObject(res, "type", "upload_part_result");
+    cJSON_AddNumberToObject(res, "part", part);
+    cJSON_AddBoolToObject(res, "success", message == NULL);
+    if (message)
+        cJSON_AddStringToObject(res, "message", message);
+    send_json_response(client_fd, res);
+    cJSON_Delete(res);
+}
+
+/**
+ * @brief 处理发起分段上传请求：大文件切成MULTIPART_PART_SIZE的段，由客户端在多个连接上并发上传
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含文件名、文件大小、目标路径、file_hash必填）
+ * @return 无返回值
+ * @details 回复upload_multipart_ready（upload_id、part_size、part_count）；服务器已有相同文件时直接秒传。
+ *          各段写入按文件大小预分配的暂存文件，全部收到后由upload_multipart_complete校验整文件哈希并入库
+ */
+void handle_upload_multipart_init(int client_fd, cJSON *req)
+{
+    const char *username = conn_get(client_fd)->username;
+    if (strlen(username) == 0)
+    {
+        upload_reply_failure(client_fd, "未登录");
+        return;
+    }
+    char root_dir[MAX_PATH_LEN];
+    if (!get_user_root_dir(username, root_dir))
+    {
+        upload_reply_failure(client_fd, "获取用户目录失败");
+        return;
+    }
+
+    cJSON *filename = cJSON_GetObjectItem(req, "filename");
+    cJSON *size_json = cJSON_GetObjectItem(req, "size");
+    cJSON *path_json = cJSON_GetObjectItem(req, "path");
+    const char *user_path = cJSON_IsString(path_json) ? path_json->valuestring : "/";
+    unsigned char file_hash[CAS_HASH_LEN];
+    // 各段由不同连接写入，拼接结果是否正确以整文件哈希为准，所以必须提供
+    if (!cJSON_IsString(filename) || !cJSON_IsNumber(size_json) || size_json->valuedouble <= 0 ||
+        !upload_parse_hash(req, file_hash))
+    {
+        upload_reply_failure(client_fd, "参数错误");
+        return;
+    }
+
+    if (!is_safe_target(root_dir, user_path, filename->valuestring))
+    {
+        upload_reply_failure(client_fd, "路径非法");
+        return;
+    }
+    char filepath[MAX_PATH_LEN];
+    build_full_path(filepath, root_dir, user_path, filename->valuestring);
+    if (upload_try_instant(client_fd, req, root_dir, filepath, handle_upload_multipart_init))
+    {
+        return;
+    }
+
+    long long size = (long long)size_json->valuedouble;
+    MultipartUpload *mp = multipart_create(username, filepath, size, file_hash);
+    if (!mp)
+    {
+        int err = errno;
+        write_log(LOG_LEVEL_ERROR, "客户端 %d 发起分段上传失败: %s, %s", client_fd, filepath, strerror(err));
+        upload_reply_failure(client_fd, err == EBUSY     ? "进行中的分段上传过多，请稍后再试"
+                                        : err == ENOSPC ? "服务器空间不足"
+                                                        : "创建文件失败");
+        return;
+    }
+
+    cJSON *res = cJSON_CreateObject();
+    cJSON_AddStringToObject(res, "type", "upload_multipart_ready");
+    cJSON_AddStringToObject(res, "upload_id", mp->id);
+    cJSON_AddNumberToObject(res, "part_size", MULTIPART_PART_SIZE);
+    cJSON_AddNumberToObject(res, "part_count", mp->part_count);
+    send_json_response(client_fd, res);
+    cJSON_Delete(res);
+}
+
+/**
+ * @brief 处理上传一段的请求：之后在本连接上接收该段的数据，按段偏移写入暂存文件
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含upload_id、part段号）
+ * @return 无返回值
+ * @details 回复ready_to_receive（part、offset、length），客户端随后发送length字节，
+ *          收完回复upload_part_result；同一用户已登录（或恢复会话）的任意连接都可以上传段
+ */
+void handle_upload_part(int client_fd, cJSON *req)
+{
+    Connection *conn = conn_get(client_fd);
+    cJSON *id_json = cJSON_GetObjectItem(req, "upload_id");
+    cJSON *part_json = cJSON_GetObjectItem(req, "part");
+    int part = cJSON_IsNumber(part_json) ? part_json->valueint : -1;
+    if (strlen(conn->username) == 0)
+    {
+        upload_reply_part(client_fd, part, "未登录");
+        return;
+    }
+    if (!cJSON_IsString(id_json) || !cJSON_IsNumber(part_json))
+    {
+        upload_reply_part(client_fd, part, "参数错误");
+        return;
+    }
+
+    MultipartUpload *mp;
+    long long offset, len;
+    int file_fd;
+    if (multipart_part_begin(id_json->valuestring, conn->username, part, &mp, &offset, &len, &file_fd) == -1)
+    {
+        upload_reply_part(client_fd, part, errno == ENOENT  ? "分段上传不存在或已过期"
+                                           : errno == EINVAL ? "段号无效"
+                                           : errno == EBUSY  ? "该段正在其他连接上传"
+                                                             : "打开暂存文件失败");
+        return;
+    }
+    ClientUploadInfo *info = &conn->up;
+    if (conn_set_path(&info->filepath, mp->filepath) == -1)
+    {
+        close(file_fd);
+        multipart_part_end(mp, part, 0);
+        upload_reply_part(client_fd, part, "服务器内存不足");
+        return;
+    }
+    upload_release_delta(info);
+    info->state = UP_STATE_RECEIVING;
+    info->filesize = len; // 本连接只接收这一段
+    info->received = 0;
+    info->base = offset;
+    info->fd = file_fd;
+    info->use_splice = server_config.upload_splice;
+    info->journal = NULL;
+    info->verify_hash = 0; // 完成时按整个文件校验
+    info->multipart = mp;
+    info->part = part;
+
+    cJSON *ready = cJSON_CreateObject();
+    cJSON_AddStringToObject(ready, "type", "ready_to_receive");
+    cJSON_AddNumberToObject(ready, "part", part);
+    cJSON_AddNumberToObject(ready, "offset", (double)offset);
+    cJSON_AddNumberToObject(ready, "length", (double)len);
+    send_json_response(client_fd, ready);
+    cJSON_Delete(ready);
+}
+
+/**
+ * @brief 处理跨用户秒传的持有证明（应答upload_challenge）
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含proof：SHA-256(nonce || 各范围的数据)，十六进制）
+ * @return 无返回值
+ * @details 挑战只能应答一次；证明与服务器按源文件算出的一致时引用其块并回复上传完成，
+ *          否则按原始请求继续正常上传（服务器没有相同内容和证明不符对客户端表现一致）
+ */
+void handle_upload_proof(int client_fd, cJSON *req)
+{
+    Connection *conn = conn_get(client_fd);
+    UploadChallenge *ch = conn->up.challenge;
+    conn->up.challenge = NULL;
+    if (!ch)
+    {
+        upload_reply_failure(client_fd, "没有等待应答的秒传挑战");
+        return;
+    }
+    if (strlen(conn->username) == 0)
+    {
+        upload_challenge_free(ch);
+        upload_reply_failure(client_fd, "未登录");
+        return;
+    }
+
+    cJSON *proof_json = cJSON_GetObjectItem(req, "proof");
+    unsigned char proof[CAS_HASH_LEN];
+    int proved = ch->has_source && cJSON_IsString(proof_json) &&
+                 strlen(proof_json->valuestring) == CAS_HASH_LEN * 2 &&
+                 cas_hash_from_hex(proof_json->valuestring, proof) == 0 &&
+                 CRYPTO_memcmp(proof, ch->expect, CAS_HASH_LEN) == 0;
+    if (proved && cas_instant_link_from(ch->src_path, ch->file_hash, ch->size, ch->filepath))
+    {
+        upload_reply_instant(client_fd, ch->filepath, ch->size);
+        write_log(LOG_LEVEL_INFO, "客户端 %d 通过持有证明，引用 %s 的内容", client_fd, ch->src_path);
+        upload_challenge_free(ch);
+        return;
+    }
+    if (ch->has_source && !proved)
+    {
+        write_log(LOG_LEVEL_WARN, "客户端 %d 秒传持有证明不符（用户 %s），改为正常上传：%s",
+                  client_fd, conn->username, ch->filepath);
+    }
+
+    // 未秒传：按原始请求继续正常上传，不再发出挑战
+    cJSON_ReplaceItemInObject(ch->req, "instant_proof", cJSON_CreateFalse());
+    ch->resume(client_fd, ch->req);
+    upload_challenge_free(ch);
+}
+
+/**
+ * @brief 处理完成分段上传请求：所有段都已收到时交给入库线程校验整文件哈希，切块入库并写入清单
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含upload_id）
+ * @return 无返回值
+ * @details 入库结束后由入库线程回复upload_result；还有段没收到时立即回复失败并给出missing（未收到的段数），
+ *          分段上传保留，客户端补传后可再次完成；哈希不符时整个分段上传作废
+ */
+void handle_upload_multipart_complete(int client_fd, cJSON *req)
+{
+    Connection *conn = conn_get(client_fd);
+    cJSON *id_json = cJSON_GetObjectItem(req, "upload_id");
+    if (strlen(conn->username) == 0)
+    {
+        upload_reply_failure(client_fd, "未登录");
+        return;
+    }
+    if (!cJSON_IsString(id_json))
+    {
+        upload_reply_failure(client_fd, "参数错误");
+        return;
+    }
+
+    int missing;
+    MultipartUpload *mp = multipart_take(id_json->valuestring, conn->username, &missing);
+    if (!mp)
+    {
+        if (errno != EAGAIN)
+        {
+            upload_reply_failure(client_fd, "分段上传不存在或已过期");
+            return;
+        }
+        char message[64];
+        snprintf(message, sizeof(message), "还有 %d 段未上传", missing);
+        cJSON *res = cJSON_CreateObject();
+        cJSON_AddStringToObject(res, "type", "upload_result");
+        cJSON_AddBoolToObject(res, "success", 0);
+        cJSON_AddStringToObject(res, "message", message);
+        cJSON_AddNumberToObject(res, "missing", missing);
+        send_json_response(client_fd, res);
+        cJSON_Delete(res);
+        return;
+    }
+
+    // 校验整文件哈希、切块入库交给入库线程，结束后由其回复upload_result
+    UploadCommit *uc = upload_commit_new(client_fd, mp->filepath);
+    if (!uc)
+    {
+        multipart_free(mp);
+        upload_reply_failure(client_fd, "服务器内存不足");
+        return;
+    }
+    uc->mp = mp;
+    uc->job.fd = mp->fd;
+    uc->job.size = mp->size;
+    uc->job.expect_hash = mp->file_hash;
+    cas_ingest_submit(&uc->job);
+}
+
+/**
+ * @brief 向客户端发送当前上传进度
+ * @param client_fd 客户端文件描述符
+ * @return 无返回值
+ */
+void upload_report_progress(int client_fd)
+{
+    ClientUploadInfo *info = &conn_get(client_fd)->up;
+    bool isComplete = (info->received >= info->filesize);
+    double progress = isComplete ? 100.0 : (double)info->received / info->filesize * 100;
+
+    // 发送上传进度响应
+    cJSON *progress_res = cJSON_CreateObject();
+    cJSON_AddStringToObject(progress_res, "type", "upload_progress");
+    cJSON_AddBoolToObject(progress_res, "success", 1);
+    cJSON_AddNumberToObject(progress_res, "progress", progress);
+    cJSON_AddNumberToObject(progress_res, "received", info->received);
+    cJSON_AddNumberToObject(progress_res, "total", info->filesize);
+    send_json_response(client_fd, progress_res);
+    cJSON_Delete(progress_res);
+}
+
+// 每个工作线程独占一个splice中转管道（socket → pipe → 文件），首次上传时创建
+static __thread int upload_pipe[2] = {-1, -1};
+
+/**
+ * @brief 获取当前工作线程的splice中转管道（不存在则创建）
+ * @param 无参数
+ * @return 0=管道可用，-1=创建失败
+ */
+static int get_upload_pipe()
+{
+    if (upload_pipe[0] != -1)
+    {
+        return 0;
+    }
+    if (pipe2(upload_pipe, O_CLOEXEC) == -1)
+    {
+        write_log(LOG_LEVEL_ERROR, "创建上传splice管道失败: %s", strerror(errno));
+        upload_pipe[0] = upload_pipe[1] = -1;
+        return -1;
+    }
+    // 尽量放大管道容量，减少每MB的splice次数（失败则保持默认64KB）
+    fcntl(upload_pipe[1], F_SETPIPE_SZ, UPLOAD_PIPE_SIZE);
+    return 0;
+}
+
+/**
+ * @brief 关闭当前工作线程的splice中转管道（管道内残留数据无法确定时调用）
+ * @param 无参数
+ * @return 无返回值
+ */
+static void reset_upload_pipe()
+{
+    if (upload_pipe[0] != -1)
+    {
+        close(upload_pipe[0]);
+        close(upload_pipe[1]);
+    }
+    upload_pipe[0] = upload_pipe[1] = -1;
+}
+
+/**
+ * @brief 把管道中已搬入的数据全部写入上传文件（从指定偏移开始）
+ * @param info 客户端上传状态
+ * @param len 管道中待写入的字节数
+ * @return 0=全部写入，-1=写入失败
+ * @details 文件系统不支持splice（EINVAL）时，改为read+pwrite取出残留数据，
+ *          并把该连接切换回拷贝模式
+ */
+static int drain_upload_pipe(ClientUploadInfo *info, size_t len)
+{
+    loff_t off = info->base + info->received;
+    while (len > 0)
+    {
+        ssize_t out = splice(upload_pipe[0], NULL, info->fd, &off, len, SPLICE_F_MOVE);
+        if (out > 0)
+        {
+            len -= out;
+            continue;
+        }
+        if (out < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (out < 0 && errno == EINVAL)
+        {
+            info->use_splice = 0;
+            char buf[BUFFER_SIZE];
+            while (len > 0)
+            {
+                ssize_t n = read(upload_pipe[0], buf, len < sizeof(buf) ? len : sizeof(buf));
+                if (n <= 0 || pwrite(info->fd, buf, n, off) != n)
+                {
+                    return -1;
+                }
+                off += n;
+                len -= n;
+            }
+            return 0;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 以splice方式接收上传数据（socket → 管道 → 文件，不经过用户态缓冲区）
+ * @param client_fd 客户端文件描述符
+ * @param info 客户端上传状态
+ * @return 1=本轮有数据写入，0=socket已无数据，-1=接收/写入失败，-2=客户端断开
+ * @details 单次最多搬运TRANSFER_SLICE_BYTES字节后让出线程，剩余数据由重新挂载的EPOLLIN再次派发
+ */
+static int upload_receive_splice(int client_fd, ClientUploadInfo *info)
+{
+    if (get_upload_pipe() == -1)
+    {
+        info->use_splice = 0; // 管道不可用，退回拷贝模式
+        return 1;
+    }
+
+    int progressed = 0;
+    long long moved = 0;
+    while (info->use_splice && info->received < info->filesize && moved < TRANSFER_SLICE_BYTES)
+    {
+        // 每次最多搬一个管道容量，且不越过文件末尾（避免吞掉后续控制消息）
+        long long left = info->filesize - info->received;
+        size_t want = left > UPLOAD_PIPE_SIZE ? UPLOAD_PIPE_SIZE : (size_t)left;
+        ssize_t in = splice(client_fd, NULL, upload_pipe[1], NULL, want,
+                            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (in < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return progressed;
+            write_log(LOG_LEVEL_ERROR, "客户端 %d 上传splice接收失败: %s", client_fd, strerror(errno));
+            return -1;
+        }
+        if (in == 0)
+        {
+            return -2;
+        }
+
+        if (drain_upload_pipe(info, in) == -1)
+        {
+            write_log(LOG_LEVEL_ERROR, "客户端 %d 上传splice写入文件失败: %s", client_fd, strerror(errno));
+            reset_upload_pipe(); // 管道内可能残留数据，丢弃重建
+            return -1;
+        }
+        info->received += in;
+        moved += in;
+        progressed = 1;
+    }
+    return 1;
+}
+
+/**
+ * @brief 以recv+pwrite拷贝方式接收上传数据（splice不可用时的兜底路径）
+ * @param client_fd 客户端文件描述符
+ * @param info 客户端上传状态
+ * @return 1=本轮有数据写入，0=socket已无数据，-1=接收/写入失败，-2=客户端断开
+ * @details 与splice路径相同，单次最多搬运TRANSFER_SLICE_BYTES字节
+ */
+static int upload_receive_copy(int client_fd, ClientUploadInfo *info)
+{
+    int progressed = 0;
+    long long moved = 0;
+    while (info->received < info->filesize && moved < TRANSFER_SLICE_BYTES)
+    {
+        char file_buf[BUFFER_SIZE];
+        long long left = info->filesize - info->received;
+        size_t want = left > BUFFER_SIZE ? BUFFER_SIZE : (size_t)left;
+        ssize_t len = recv(client_fd, file_buf, want, 0);
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // 区分 "缓冲区空"（EAGAIN）和 "真实错误"
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return progressed;
+            write_log(LOG_LEVEL_ERROR, "客户端 %d 上传数据接收失败: %s", client_fd, strerror(errno));
+            return -1;
+        }
+        if (len == 0)
+        {
+            return -2;
+        }
+
+        if (pwrite(info->fd, file_buf, len, info->base + info->received) != len)
+        {
+            write_log(LOG_LEVEL_ERROR, "客户端 %d 写入文件失败: %s", client_fd, strerror(errno));
+            return -1;
+        }
+        info->received += len;
+        moved += len;
+        progressed = 1;
+    }
+    return 1;
+}
+
+/**
+ * @brief 处理客户端上传数据（接收并写入文件）
+ * @param client_fd 客户端文件描述符
+ * @return 0=处理成功，-1=处理失败
+ */
+int handle_upload(int client_fd)
+{
+    ClientUploadInfo *info = &conn_get(client_fd)->up;
+    // 检查上传状态（仅处理“接收中”状态的请求）
+    if (info->state != UP_STATE_RECEIVING)
+    {
+        return -1;
+    }
+
+    // 优先走splice零拷贝路径；splice不可用时（管道创建失败、文件系统不支持）退回拷贝路径
+    int ret = 1;
+    if (info->use_splice)
+    {
+        ret = upload_receive_splice(client_fd, info);
+    }
+    if (ret == 1 && !info->use_splice)
+    {
+        ret = upload_receive_copy(client_fd, info);
+    }
+
+    if (ret == -2)
+    {
+        // 客户端主动断开
+        write_log(LOG_LEVEL_WARN, "客户端 %d 上传时断开连接", client_fd);
+        upload_abort(info);
+        return -1;
+    }
+    if (ret == -1)
+    {
+        upload_abort(info);
+        // 发送失败响应
+        cJSON *progress_res = cJSON_CreateObject();
+        cJSON_AddStringToObject(progress_res, "type", "upload_progress");
+        cJSON_AddBoolToObject(progress_res, "success", 0);
+        send_json_response(client_fd, progress_res);
+        cJSON_Delete(progress_res);
+        return -1;
+    }
+
+    // ====================== 进度计算与响应 ======================
+    upload_journal_checkpoint(info->journal, info->received);
+    bool isComplete = (info->received >= info->filesize);
+    upload_report_progress(client_fd);
+
+    // 上传完成判断（基于整数比较，避免浮点误差）
+    if (isComplete)
+    {
+        upload_finish(client_fd);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 上传数据全部写入后的收尾（暂存数据交给入库线程，入库结束后由其记录日志、发送完成响应；
+ *        分段上传的一段只回复该段的结果）
+ * @param client_fd 客户端文件描述符
+ * @return 无返回值
+ */
+void upload_finish(int client_fd)
+{
+    Connection *conn = conn_get(client_fd);
+    ClientUploadInfo *info = &conn->up;
+
+    if (info->multipart)
+    {
+        // 分段上传的一段：数据已写到段偏移处，整个文件在完成请求时入库
+        close(info->fd);
+        info->fd = -1;
+        multipart_part_end(info->multipart, info->part, 1);
+        info->multipart = NULL;
+        info->state = UP_STATE_IDLE;
+        upload_reply_part(client_fd, info->part, NULL);
+        return;
+    }
+
+    // 暂存文件切块入库、用户路径上写入清单（已存在的块只增加引用）交给入库线程：
+    // 大文件要整个读一遍并逐块哈希，不在工作线程上做；暂存文件、增量清单和续传日志随任务移交
+    UploadCommit *uc = upload_commit_new(client_fd, info->filepath);
+    if (!uc)
+    {
+        upload_release_delta(info);
+        upload_abort(info); // 保留续传进度，客户端稍后可以续传
+        upload_reply_failure(client_fd, "服务器内存不足");
+        return;
+    }
+    uc->job.fd = info->fd;
+    uc->job.size = info->filesize;
+    if (info->verify_hash)
+    {
+        memcpy(uc->file_hash, info->file_hash, CAS_HASH_LEN);
+        uc->job.expect_hash = uc->file_hash;
+    }
+    uc->job.delta = info->delta;
+    uc->job.delta_have = info->delta_have;
+    uc->journal = info->journal;
+    info->fd = -1;
+    info->delta = NULL;
+    info->delta_have = NULL;
+    info->journal = NULL;
+    info->state = UP_STATE_IDLE; // 连接回到控制帧接收，入库结束后由入库线程回复upload_result
+    cas_ingest_submit(&uc->job);
+}
+
+/**
+ * @brief 中止接收中的上传（连接断开或写入失败）：关闭暂存文件，可续传的上传把已接收的字节数记入续传日志，
+ *        分段上传的段标记为未收到
+ * @param info 上传状态
+ * @return 无返回值
+ */
+void upload_abort(ClientUploadInfo *info)
+{
+    if (info->fd >= 0)
+        close(info->fd);
+    info->fd = -1;
+    upload_journal_close(info->journal, info->received);
+    info->journal = NULL;
+    if (info->multipart)
+    {
+        multipart_part_end(info->multipart, info->part, 0); // 该段需要重新上传
+        info->multipart = NULL;
+    }
+    info->state = UP_STATE_IDLE;
+}
+
+/**
+ * @brief 处理客户端文件下载控制请求（初始化下载）
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含文件名、目标路径，可选offset、length指定字节范围，if_hash指定续传的版本）
+ * @return 无返回值
+ * @details 只发送请求的字节范围（预览、读取日志末尾、续传未完成的下载）；
+ *          if_hash与文件当前版本不符时改为发送整个文件，download_meta中的offset、length为实际发送的范围
+ */
+void handle_download_ctl(int client_fd, cJSON *req)
+{
+    // 检查是否已登录
+    const char *username = conn_get(client_fd)->username;
     if (strlen(username) == 0)
     {
         cJSON *res = cJSON_CreateObject();
@@ -540,7 +1579,6 @@ void handle_download_ctl(int client_fd, cJSON *req)
     // 构建下载文件的完整路径
     char filepath[MAX_PATH_LEN];
     build_full_path(filepath, root_dir, user_path, filename->valuestring);
-    strncpy(client_dl_info[client_fd].filepath, filepath, sizeof(client_dl_info[client_fd].filepath) - 1);
     // 路径安全检查（防止路径穿越）
     if (!is_safe_path(root_dir, filepath))
     {
@@ -553,9 +1591,9 @@ void handle_download_ctl(int client_fd, cJSON *req)
         return;
     }
 
-    // 检查文件是否存在
-    struct stat st;
-    if (stat(filepath, &st) == -1)
+    // 读取文件清单（文件不存在或不是清单都视为不存在）
+    CasManifest *manifest = cas_manifest_load(filepath);
+    if (!manifest)
     {
         cJSON *res = cJSON_CreateObject();
         cJSON_AddStringToObject(res, "type", "download_result");
@@ -565,222 +1603,226 @@ void handle_download_ctl(int client_fd, cJSON *req)
         cJSON_Delete(res);
         return;
     }
-    long long fileSize = st.st_size; // 获取文件大小
+    long long fileSize = manifest->size; // 获取文件大小
+
+    // 请求范围：offset起（默认0）、length字节（默认到文件末尾，超出部分截掉）
+    cJSON *offset_json = cJSON_GetObjectItem(req, "offset");
+    cJSON *length_json = cJSON_GetObjectItem(req, "length");
+    long long range_start = cJSON_IsNumber(offset_json) ? (long long)offset_json->valuedouble : 0;
+    long long range_len = cJSON_IsNumber(length_json) ? (long long)length_json->valuedouble : -1;
+    // 续传时客户端带上已下载部分所属版本的整文件哈希（if_hash）：文件已被覆盖或无法确认版本时，
+    // 忽略请求范围发送整个文件，避免把新旧两个版本的数据拼在一起
+    cJSON *if_hash_json = cJSON_GetObjectItem(req, "if_hash");
+    if (cJSON_IsString(if_hash_json))
+    {
+        unsigned char if_hash[CAS_HASH_LEN];
+        if (!manifest->has_file_hash || strlen(if_hash_json->valuestring) != CAS_HASH_LEN * 2 ||
+            cas_hash_from_hex(if_hash_json->valuestring, if_hash) == -1 ||
+            memcmp(if_hash, manifest->file_hash, CAS_HASH_LEN) != 0)
+        {
+            range_start = 0;
+            range_len = -1;
+        }
+    }
+    if (range_start < 0 || range_start > fileSize)
+    {
+        free(manifest);
+        cJSON *res = cJSON_CreateObject();
+        cJSON_AddStringToObject(res, "type", "download_result");
+        cJSON_AddBoolToObject(res, "success", 0);
+        cJSON_AddStringToObject(res, "message", "请求的范围无效");
+        send_json_response(client_fd, res);
+        cJSON_Delete(res);
+        return;
+    }
+    if (range_len < 0 || range_len > fileSize - range_start)
+    {
+        range_len = fileSize - range_start;
+    }
 
-    // 发送文件元数据（文件名、大小、是否为目录）
+    ClientDownloadInfo *dl = &conn_get(client_fd)->dl;
+    if (conn_set_path(&dl->filepath, filepath) == -1)
+    {
+        free(manifest);
+        cJSON *res = cJSON_CreateObject();
+        cJSON_AddStringToObject(res, "type", "download_result");
+        cJSON_AddBoolToObject(res, "success", 0);
+        cJSON_AddStringToObject(res, "message", "服务器内存不足");
+        send_json_response(client_fd, res);
+        cJSON_Delete(res);
+        return;
+    }
+
+    // 发送文件元数据（文件名、文件总大小、实际发送的范围、版本哈希、是否为目录）
     cJSON *meta = cJSON_CreateObject();
     cJSON_AddStringToObject(meta, "type", "download_meta");
     cJSON_AddStringToObject(meta, "filename", filename->valuestring);
     cJSON_AddNumberToObject(meta, "size", fileSize);
+    cJSON_AddNumberToObject(meta, "offset", range_start);
+    cJSON_AddNumberToObject(meta, "length", range_len);
+    if (manifest->has_file_hash)
+    {
+        char hash_hex[CAS_HASH_LEN * 2 + 1];
+        cas_hash_to_hex(manifest->file_hash, hash_hex);
+        cJSON_AddStringToObject(meta, "file_hash", hash_hex);
+    }
     cJSON_AddBoolToObject(meta, "is_directory", 0); // 标记为文件
     send_json_response(client_fd, meta);
     cJSON_Delete(meta);
 
     // 在 handle_download_ctl 末尾加上
-    client_dl_info[client_fd].filesize = fileSize;
-    client_dl_info[client_fd].offset = 0;
-    client_dl_info[client_fd].total_sent = 0;
-    client_dl_info[client_fd].fd = -1; // 表示未打开
+    free(dl->manifest);
+    dl->manifest = manifest;
+    dl->chunk_idx = 0;
+    dl->filesize = fileSize;
+    dl->offset = range_start;
+    dl->end = range_start + range_len;
+    dl->fd = -1; // 表示未打开
 }
 
 /**
- * @brief 处理客户端下载数据（读取文件并发送）
+ * @brief 处理客户端下载数据（sendfile零拷贝发送，按文件偏移断点续发）
  * @param client_fd 客户端文件描述符
- * @return 0=处理成功，-1=处理失败
+ * @return 0=处理成功（已发完或等待下次EPOLLOUT），-1=处理失败
+ * @details 单次最多发送TRANSFER_SLICE_BYTES字节后让出线程，重新挂载的EPOLLOUT会立即再次派发，
+ *          多个大文件下载轮流占用工作线程
  */
 int handle_download(int client_fd)
 {
-    // 检查下载状态
-    printf("handle_download: client_fd=%d, state=%d\n", client_fd, client_dl_info[client_fd].state);
-    // 从下载状态中提取关键信息
-    const char *filepath = client_dl_info[client_fd].filepath;
-    long long fileSize = client_dl_info[client_fd].filesize;
-
-    // 以只读方式打开下载文件
-    int fd;
-    if (client_dl_info[client_fd].fd < 0)
-    {
-        fd = open(filepath, O_RDONLY);
-        printf("open file: %s, fd=%d\n", filepath, fd);
-        lseek(fd, client_dl_info[client_fd].offset, SEEK_SET);
-        client_dl_info[client_fd].fd = fd;
-    }
-    else
-    {
-        fd = client_dl_info[client_fd].fd;
-        lseek(fd, client_dl_info[client_fd].offset, SEEK_SET);
-    }
+    Connection *conn = conn_get(client_fd);
+    ClientDownloadInfo *dl = &conn->dl;
+    const char *filepath = dl->filepath;
+    long long end = dl->end;
 
-    if (fd == -1)
-    {
-        perror("下载文件打开失败");
-        write_log(LOG_LEVEL_ERROR, "客户端 %d 下载文件打开失败: %s", client_fd, strerror(errno));
-        // 记录下载失败日志
-        insert_operation_log(client_fd, client_username[client_fd], inet_ntoa(client_addrs[client_fd].sin_addr), "download", filepath, "失败");
-        // 发送下载失败响应
-        cJSON *res = cJSON_CreateObject();
-        cJSON_AddStringToObject(res, "type", "download_result");
-        cJSON_AddBoolToObject(res, "success", 0);
-        cJSON_AddStringToObject(res, "message", "文件打开失败");
-        send_json_response(client_fd, res);
-        cJSON_Delete(res);
-        client_dl_info[client_fd].state = DL_STATE_IDLE; // 重置下载状态
-        return -1;
+    // 文件数据开始发送前先发完排队的响应（如download_meta），文件数据不能插到响应帧中间
+    if (dl->fd < 0)
+    {
+        int flush_ret = conn_flush(client_fd);
+        if (flush_ret != 0)
+        {
+            return flush_ret == 1 ? 0 : -1;
+        }
     }
+
     // 通知客户端：服务器已准备好发送数据
-    if (client_dl_info[client_fd].state != DL_STATE_SENDING)
-    { // 新增判断
+    if (dl->state != DL_STATE_SENDING)
+    {
         cJSON *ready = cJSON_CreateObject();
         cJSON_AddStringToObject(ready, "type", "ready_to_send");
         send_json_response(client_fd, ready);
         cJSON_Delete(ready);
-        client_dl_info[client_fd].state = DL_STATE_SENDING; // 只在首次准备时更新状态
+        dl->state = DL_STATE_SENDING; // 只在首次准备时更新状态
     }
-    printf("客户端 %d 准备发送文件：%s (%lld bytes)\n", client_fd, filepath, fileSize);
-
-    // 小文件使用传统 read/write 方式
-    char file_buf[BUFFER_SIZE];
-    ssize_t read_len;
-    long long total_sent = client_dl_info[client_fd].total_sent; // 继续上次发送进度
 
-    printf("fd=%d, offset=%lld, fileSize=%lld, 未发数据长度=%zu\n",
-           fd, client_dl_info[client_fd].offset, fileSize,
-           client_dl_info[client_fd].remaining_len); // 新增：打印未发长度
-
-    // 【新增逻辑：先发上次没发完的remaining数据】
-    if (client_dl_info[client_fd].remaining_len > 0)
+    // 内核直接从页缓存发往socket：不经过用户态缓冲区，进度只记录文件偏移
+    long long moved = 0;
+    while (dl->offset < end)
     {
-        size_t total_written = 0;
-        // 循环发送remaining_buf中的未发数据
-        while (total_written < client_dl_info[client_fd].remaining_len)
+        if (moved >= TRANSFER_SLICE_BYTES)
         {
-            ssize_t sent = send(client_fd,
-                                client_dl_info[client_fd].remaining_buf + total_written,
-                                client_dl_info[client_fd].remaining_len - total_written,
-                                0);
-            if (sent < 0)
-            {
-                if (errno == EINTR)
-                    continue;
-                else if (errno == EAGAIN || errno == EWOULDBLOCK)
-                {
-                    // 仍没发完，更新remaining数据（把已发的部分删掉）
-                    memmove(client_dl_info[client_fd].remaining_buf,
-                            client_dl_info[client_fd].remaining_buf + total_written,
-                            client_dl_info[client_fd].remaining_len - total_written);
-                    client_dl_info[client_fd].remaining_len -= total_written;
-                    // 更新累计发送量，保存进度
-                    client_dl_info[client_fd].total_sent += total_written;
-                    return 0; // 等下次epoll事件再发
-                }
-                else
-                {
-                    // 其他错误，清理
-                    perror("未发数据发送失败");
-                    close(fd);
-                    client_dl_info[client_fd].state = DL_STATE_IDLE;
-                    client_dl_info[client_fd].remaining_len = 0; // 重置未发长度
-                    return -1;
-                }
-            }
-            total_written += sent;
+            // 本次时间片用完：偏移已保存，让出线程，socket仍可写时EPOLLOUT会再次派发
+            return 0;
+        }
+        // 定位当前偏移所在的数据块（跨块时切换dl->fd），单次发送不越过块边界
+        off_t off;
+        size_t chunk_left;
+        if (cas_download_seek(dl, &off, &chunk_left) == -1)
+        {
+            perror("下载文件打开失败");
+            write_log(LOG_LEVEL_ERROR, "客户端 %d 下载文件打开失败: %s", client_fd, strerror(errno));
+            // 记录下载失败日志
+            insert_operation_log(client_fd, conn->username, inet_ntoa(conn->addr.sin_addr), "download", filepath, "失败");
+            // 发送下载失败响应
+            cJSON *res = cJSON_CreateObject();
+            cJSON_AddStringToObject(res, "type", "download_result");
+            cJSON_AddBoolToObject(res, "success", 0);
+            cJSON_AddStringToObject(res, "message", "文件打开失败");
+            send_json_response(client_fd, res);
+            cJSON_Delete(res);
+            dl->state = DL_STATE_IDLE; // 重置下载状态（任务结束后恢复为只关注读事件）
+            return -1;
         }
-        // 所有remaining数据发完，重置缓冲区
-        client_dl_info[client_fd].remaining_len = 0;
-        total_sent += total_written; // 更新累计发送量
-        printf("上次未发数据已发完，累计发送：%lld\n", total_sent);
-    }
-
-    while ((total_sent < fileSize) && (read_len = read(fd, file_buf, BUFFER_SIZE)) > 0)
-    { // 程序没进循环！
-        printf("read_len=%zd\n", read_len);
-        ssize_t total_written = 0;
-        // 确保所有读取的数据都发送完毕
-        while (total_written < read_len)
+        off_t start = off;
+        long long left = end - dl->offset;
+        size_t chunk = left > SENDFILE_CHUNK_SIZE ? SENDFILE_CHUNK_SIZE : (size_t)left;
+        if (chunk > chunk_left)
+            chunk = chunk_left;
+        ssize_t sent = sendfile(client_fd, dl->fd, &off, chunk);
+        if (sent < 0)
         {
-            ssize_t sent = send(client_fd, file_buf + total_written, read_len - total_written, 0);
-            if (sent < 0)
+            if (errno == EINTR)
             {
-                if (errno == EINTR)
-                {
-                    continue; // 被信号中断，重试
-                }
-                else if (errno == EAGAIN || errno == EWOULDBLOCK)
-                {
-                    // printf("EAGAIN: 缓冲区满，等待下次发送\n");
-                    //  缓冲区满，保存进度，等待下次epoll事件
-                    //  不要close(fd)，不要发完成响应
-                    //  新逻辑：1. 暂存未发数据 2. 更新正确的offset 3. 保存进度
-                    size_t unsent_len = read_len - total_written; // 本次未发完的字节数
-                    // 把未发的部分copy到remaining_buf
-                    memcpy(client_dl_info[client_fd].remaining_buf,
-                           file_buf + total_written,
-                           unsent_len);
-                    client_dl_info[client_fd].remaining_len = unsent_len; // 记录未发长度
-
-                    // 关键：offset += read_len（文件已读了read_len字节，下次从这之后读）
-                    client_dl_info[client_fd].offset += read_len;
-                    // 关键：累计发送量 += 已发的字节数
-                    client_dl_info[client_fd].total_sent += total_written;
-
-                    printf("EAGAIN：暂存未发数据%zu字节，下次从文件offset=%lld继续\n",
-                           unsent_len, client_dl_info[client_fd].offset);
-                    return 0;
-                }
-                else
-                {
-                    // 其他错误，处理异常
-                    perror("文件发送失败");
-                    write_log(LOG_LEVEL_ERROR, "客户端 %d 文件发送失败: %s", client_fd, strerror(errno));
-                    close(fd);
-                    client_dl_info[client_fd].state = DL_STATE_IDLE;
-                    return -1;
-                }
+                continue; // 被信号中断，重试
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                // socket发送缓冲区满：偏移已保存，等待下次EPOLLOUT从此处继续
+                return 0;
             }
-            total_written += sent;
+            // 其他错误（如客户端断开）
+            perror("文件发送失败");
+            write_log(LOG_LEVEL_ERROR, "客户端 %d 文件发送失败: %s", client_fd, strerror(errno));
+            close(dl->fd);
+            dl->fd = -1;
+            dl->state = DL_STATE_IDLE;
+            return -1;
         }
-        total_sent += total_written;
-        client_dl_info[client_fd].offset += read_len;      // 更新文件偏移
-        client_dl_info[client_fd].total_sent = total_sent; // 保存累计发送量
-        printf("read_len=%zd, total_written=%zd, total_sent=%lld\n", read_len, total_written, total_sent);
-        // // 发送下载进度
-        // double progress = (double)total_sent / fileSize * 100;
-        // cJSON* progress_res = cJSON_CreateObject();
-        // cJSON_AddStringToObject(progress_res, "type", "download_progress");
-        // cJSON_AddNumberToObject(progress_res, "progress", progress);
-        // send_json_response(client_fd, progress_res);
-        // cJSON_Delete(progress_res);
-        printf("DEBUG: 发送 %zd 字节，累计 %lld/%lld\n", total_written, total_sent, fileSize);
-    }
-    // 只有真正全部发完才执行下面
-    if (total_sent >= fileSize)
-    {
-        close(fd);
-        // 发送下载完成响应
-        cJSON *res = cJSON_CreateObject();
-        cJSON_AddStringToObject(res, "type", "download_result");
-        cJSON_AddBoolToObject(res, "success", 1);
-        cJSON_AddStringToObject(res, "message", "下载完成");
-        send_json_response(client_fd, res);
-        cJSON_Delete(res);
-        client_dl_info[client_fd].state = DL_STATE_IDLE;
-        // 记录下载成功日志
-        insert_operation_log(client_fd, client_username[client_fd],
-                             inet_ntoa(client_addrs[client_fd].sin_addr),
-                             "download", filepath, "成功");
-
-        printf("客户端 %d 文件下载完成：%s\n", client_fd, filepath);
-        write_log(LOG_LEVEL_INFO, "客户端 %d 文件下载完成：%s", client_fd, filepath);
-
-        // 文件全部发送完毕后
-        struct epoll_event ev;
-        ev.events = EPOLLIN | EPOLLET;
-        ev.data.fd = client_fd;
-        epoll_ctl(epfd, EPOLL_CTL_MOD, client_fd, &ev);
-
-        // close(fd);
-        return 0;
+        if (sent == 0)
+        {
+            // 文件在下载过程中被截断，无法再读到数据
+            write_log(LOG_LEVEL_ERROR, "客户端 %d 下载文件被截断: %s（偏移 %lld/%lld）",
+                      client_fd, filepath, dl->offset, dl->filesize);
+            close(dl->fd);
+            dl->fd = -1;
+            dl->state = DL_STATE_IDLE;
+            insert_operation_log(client_fd, conn->username,
+                                 inet_ntoa(conn->addr.sin_addr),
+                                 "download", filepath, "失败");
+            return -1;
+        }
+        moved += off - start;
+        dl->offset += off - start;
     }
+
+    download_finish(client_fd);
+    return 0;
+}
+
+/**
+ * @brief 下载数据全部发出后的收尾（关闭文件、发送完成响应、记录日志）
+ * @param client_fd 客户端文件描述符
+ * @return 无返回值
+ */
+void download_finish(int client_fd)
+{
+    Connection *conn = conn_get(client_fd);
+    ClientDownloadInfo *dl = &conn->dl;
+    const char *filepath = dl->filepath;
+
+    if (dl->fd >= 0) // 空文件没有数据块，不会打开块文件
+        close(dl->fd);
+    dl->fd = -1;
+    free(dl->manifest);
+    dl->manifest = NULL;
+    // 发送下载完成响应
+    cJSON *res = cJSON_CreateObject();
+    cJSON_AddStringToObject(res, "type", "download_result");
+    cJSON_AddBoolToObject(res, "success", 1);
+    cJSON_AddStringToObject(res, "message", "下载完成");
+    send_json_response(client_fd, res);
+    cJSON_Delete(res);
+    dl->state = DL_STATE_IDLE;
+    // 记录下载成功日志
+    insert_operation_log(client_fd, conn->username,
+                         inet_ntoa(conn->addr.sin_addr),
+                         "download", filepath, "成功");
+
+    printf("客户端 %d 文件下载完成：%s\n", client_fd, filepath);
+    write_log(LOG_LEVEL_INFO, "客户端 %d 文件下载完成：%s", client_fd, filepath);
+    // 本次下载已结束：清掉路径，迟到或重复的ready_to_receive不会再触发一次发送
+    free(dl->filepath);
+    dl->filepath = NULL;
+    // 状态已回到空闲，任务结束重新挂载事件时恢复为只关注读事件
 }
 
 /**
@@ -793,7 +1835,7 @@ int handle_download(int client_fd)
 void handle_delete(int client_fd, cJSON *req, struct sockaddr_in client_addr)
 {
     // 检查是否已登录
-    const char *username = client_username[client_fd];
+    const char *username = conn_get(client_fd)->username;
     if (strlen(username) == 0)
     {
         cJSON *res = cJSON_CreateObject();
@@ -869,49 +1911,16 @@ void handle_delete(int client_fd, cJSON *req, struct sockaddr_in client_addr)
     }
 
     int success = 0;
-    // 判断是目录还是文件，分别处理删除逻辑
+    // 判断是目录还是文件，分别处理删除逻辑（删除清单时释放块引用，无人引用的块随之删除）
     if (S_ISDIR(st.st_mode))
     {
         // 递归删除目录（先删子文件/子目录，再删当前目录）
-        DIR *dir = opendir(filepath);
-        if (dir)
-        {
-            struct dirent *entry;
-            while ((entry = readdir(dir)) != NULL)
-            {
-                // 跳过当前目录（.）和上级目录（..）
-                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-                    continue;
-
-                // 构建子文件/子目录的完整路径
-                char entry_path[MAX_PATH_LEN];
-                snprintf(entry_path, MAX_PATH_LEN, "%s/%s", filepath, entry->d_name);
-                struct stat entry_st;
-                if (stat(entry_path, &entry_st) == 0)
-                {
-                    if (S_ISDIR(entry_st.st_mode))
-                    {
-                        // 递归删除子目录（使用系统命令 rm -rf，简化逻辑）
-                        char rm_cmd[1024];
-                        snprintf(rm_cmd, sizeof(rm_cmd), "rm -rf %s", entry_path);
-                        system(rm_cmd);
-                    }
-                    else
-                    {
-                        // 删除子文件
-                        unlink(entry_path);
-                    }
-                }
-            }
-            closedir(dir);
-            // 删除空目录
-            success = rmdir(filepath) == 0;
-        }
+        success = cas_remove_tree(filepath) == 0;
     }
     else
     {
         // 删除文件
-        success = unlink(filepath) == 0;
+        success = cas_remove(filepath) == 0;
     }
 
     // 发送删除结果响应
@@ -946,24 +1955,19 @@ void handle_delete(int client_fd, cJSON *req, struct sockaddr_in client_addr)
  */
 void handle_share_response(int client_fd, cJSON *req)
 {
-    const char *username = client_username[client_fd];
+    const char *username = conn_get(client_fd)->username;
     int share_id = cJSON_GetNumberValue(cJSON_GetObjectItem(req, "share_id"));
     const char *action = cJSON_GetStringValue(cJSON_GetObjectItem(req, "action"));
 
     // 查询分享信息
-    char sql[1024];
-    snprintf(sql, sizeof(sql),
-             "SELECT owner, filepath, filename FROM file_share "
-             "WHERE id = %d AND recipient = '%s' AND status = 'pending'",
-             share_id, username);
-
-    if (mysql_query(&mysql, sql) != 0)
+    ShareInfo info;
+    int found = meta_store->share_get_pending(share_id, username, &info);
+    if (found == -1)
     {
-        write_log(LOG_LEVEL_ERROR, "处理分享响应查询失败: %s", mysql_error(&mysql));
+        write_log(LOG_LEVEL_ERROR, "处理分享响应查询失败: share_id=%d", share_id);
         return;
     }
-    MYSQL_RES *res = mysql_store_result(&mysql);
-    if (!res || mysql_num_rows(res) == 0)
+    if (found == 0)
     {
         cJSON *response = cJSON_CreateObject();
         cJSON_AddStringToObject(response, "type", "share_result");
@@ -974,21 +1978,14 @@ void handle_share_response(int client_fd, cJSON *req)
         return;
     }
 
-    MYSQL_ROW row = mysql_fetch_row(res);
-    const char *owner = row[0];
-    const char *filepath = row[1];
-    const char *filename = row[2];
-    mysql_free_result(res);
+    const char *owner = info.owner;
+    const char *filepath = info.filepath;
+    const char *filename = info.filename;
 
     // 更新分享状态
-    snprintf(sql, sizeof(sql),
-             "UPDATE file_share SET status = '%s', accept_time = NOW() "
-             "WHERE id = %d",
-             (strcmp(action, "accept") == 0) ? "accepted" : "rejected", share_id);
-
-    if (mysql_query(&mysql, sql) != 0)
+    if (meta_store->share_set_status(share_id, (strcmp(action, "accept") == 0) ? "accepted" : "rejected") != 0)
     {
-        write_log(LOG_LEVEL_ERROR, "更新分享状态失败: %s", mysql_error(&mysql));
+        write_log(LOG_LEVEL_ERROR, "更新分享状态失败: share_id=%d", share_id);
         cJSON *response = cJSON_CreateObject();
         cJSON_AddStringToObject(response, "type", "share_result");
         cJSON_AddBoolToObject(response, "success", 0);
@@ -998,7 +1995,7 @@ void handle_share_response(int client_fd, cJSON *req)
         return;
     }
 
-    // 如果是接受分享，需要复制文件到接收者目录
+    // 如果是接受分享，在接收者目录写入引用同一批块的清单（不复制数据）
     if (strcmp(action, "accept") == 0)
     {
         char owner_root[MAX_PATH_LEN];
@@ -1020,10 +2017,10 @@ void handle_share_response(int client_fd, cJSON *req)
         snprintf(shared_dir, sizeof(shared_dir), "%s/shared", recipient_root);
         mkdir_recursive(shared_dir, 0700);
 
-        // 复制文件
-        if (copy_file(full_src_path, full_dest_path) != 0)
+        // 引用源文件的块
+        if (cas_link(full_src_path, full_dest_path) != 0)
         {
-            write_log(LOG_LEVEL_ERROR, "复制分享文件失败: %s -> %s", full_src_path, full_dest_path);
+            write_log(LOG_LEVEL_ERROR, "接收分享文件失败: %s -> %s", full_src_path, full_dest_path);
             cJSON *response = cJSON_CreateObject();
             cJSON_AddStringToObject(response, "type", "share_result");
             cJSON_AddBoolToObject(response, "success", 0);
@@ -1035,7 +2032,7 @@ void handle_share_response(int client_fd, cJSON *req)
     }
 
     // 记录操作日志
-    insert_operation_log(client_fd, username, inet_ntoa(client_addrs[client_fd].sin_addr),
+    insert_operation_log(client_fd, username, inet_ntoa(conn_get(client_fd)->addr.sin_addr),
                          (strcmp(action, "accept") == 0) ? "accept_share" : "reject_share",
                          filename, "成功");
 
@@ -1059,61 +2056,16 @@ int get_file_owner(const char *filepath, char *owner)
     if (!filepath || !owner)
         return 0;
 
-    char sql[512];
     // 假设存在 file 表，包含 filepath 和 owner 字段
-    snprintf(sql, sizeof(sql), "SELECT owner FROM file WHERE filepath='%s'", filepath);
-
-    if (mysql_query(&mysql, sql) != 0)
+    int found = meta_store->file_owner(filepath, owner, 20);
+    if (found == -1)
     {
-        write_log(LOG_LEVEL_ERROR, "查询文件所有者失败: %s", mysql_error(&mysql));
+        write_log(LOG_LEVEL_ERROR, "查询文件所有者失败: %s", filepath);
         return 0;
     }
-
-    MYSQL_RES *res = mysql_store_result(&mysql);
-    if (!res || mysql_num_rows(res) == 0)
-    {
-        mysql_free_result(res);
-        return 0; // 未找到文件所有者
-    }
-
-    MYSQL_ROW row = mysql_fetch_row(res);
-    strncpy(owner, row[0], 20 - 1);
-    mysql_free_result(res);
-    return 1;
+    return found; // 0=未找到文件所有者
 }
 
-// 添加文件复制函数
-int copy_file(const char *src, const char *dest)
-{
-    int src_fd = open(src, O_RDONLY);
-    if (src_fd == -1)
-    {
-        return -1;
-    }
-
-    int dest_fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (dest_fd == -1)
-    {
-        close(src_fd);
-        return -1;
-    }
-
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_read;
-    while ((bytes_read = read(src_fd, buffer, BUFFER_SIZE)) > 0)
-    {
-        if (write(dest_fd, buffer, bytes_read) != bytes_read)
-        {
-            close(src_fd);
-            close(dest_fd);
-            return -1;
-        }
-    }
-
-    close(src_fd);
-    close(dest_fd);
-    return bytes_read == 0 ? 0 : -1;
-}
 /**
  * @brief 处理客户端文件分享请求
  * @param client_fd 客户端文件描述符
@@ -1122,28 +2074,16 @@ int copy_file(const char *src, const char *dest)
  */
 void handle_share(int client_fd, cJSON *req)
 {
-    const char *owner = client_username[client_fd];
+    const char *owner = conn_get(client_fd)->username;
     const char *recipient = cJSON_GetStringValue(cJSON_GetObjectItem(req, "recipient"));
     const char *filepath = cJSON_GetStringValue(cJSON_GetObjectItem(req, "path")); // 注意：客户端传的是"path"，对应表的filepath
     const char *filename = cJSON_GetStringValue(cJSON_GetObjectItem(req, "filename"));
 
-    // 1. 转义变量（避免SQL注入）
-    char owner_esc[512], recipient_esc[512], filepath_esc[512], filename_esc[512], perm_esc[512];
-    mysql_real_escape_string(&mysql, owner_esc, owner, strlen(owner));
-    mysql_real_escape_string(&mysql, recipient_esc, recipient, strlen(recipient));
-    mysql_real_escape_string(&mysql, filepath_esc, filepath, strlen(filepath));
-    mysql_real_escape_string(&mysql, filename_esc, filename, strlen(filename));
-
-    // 2. 插入file_share表（补全filename字段）
-    char sql[1024];
-    snprintf(sql, sizeof(sql),
-             "INSERT INTO file_share (owner, recipient, filepath, filename, share_time, status) "
-             "VALUES ('%s', '%s', '%s', '%s', NOW(), 'pending')",
-             owner_esc, recipient_esc, filepath_esc, filename_esc);
-
-    if (mysql_query(&mysql, sql) != 0)
+    // 1-3. 插入file_share表（参数按绑定传入，避免SQL注入），取得新分享的ID（用于接收者响应时关联）
+    int share_id = meta_store->share_insert(owner, recipient, filepath, filename);
+    if (share_id == -1)
     {
-        write_log(LOG_LEVEL_ERROR, "文件分享失败: %s", mysql_error(&mysql));
+        write_log(LOG_LEVEL_ERROR, "文件分享失败: %s -> %s", owner, recipient);
         // 给分享者返回失败响应
         cJSON *res = cJSON_CreateObject();
         cJSON_AddStringToObject(res, "type", "share_result");
@@ -1154,23 +2094,17 @@ void handle_share(int client_fd, cJSON *req)
         return;
     }
 
-    // 3. 关键：获取刚插入的分享ID（用于接收者响应时关联）
-    int share_id = mysql_insert_id(&mysql); // 获取自增ID
-
-    // 4. 检查接收者是否在线，若在线则推送share_request消息
-    int recipient_fd = get_online_client_fd(recipient);
-    if (recipient_fd != -1)
+    // 4. 向接收者所有在线会话推送share_request消息（格式和接收者上线时check_pending_shares一致）
+    cJSON *push_msg = cJSON_CreateObject();
+    cJSON_AddStringToObject(push_msg, "type", "share_request"); // 实时推送用share_request
+    cJSON_AddNumberToObject(push_msg, "id", share_id);          // 分享ID
+    cJSON_AddStringToObject(push_msg, "owner", owner);          // 分享者
+    cJSON_AddStringToObject(push_msg, "filename", filename);    // 文件名
+    int pushed = send_json_to_user(recipient, push_msg);
+    cJSON_Delete(push_msg);
+    if (pushed > 0)
     {
-        // 构造推送的JSON消息（和接收者上线时check_pending_shares的格式一致）
-        cJSON *push_msg = cJSON_CreateObject();
-        cJSON_AddStringToObject(push_msg, "type", "share_request"); // 实时推送用share_request
-        cJSON_AddNumberToObject(push_msg, "id", share_id);          // 分享ID
-        cJSON_AddStringToObject(push_msg, "owner", owner);          // 分享者
-        cJSON_AddStringToObject(push_msg, "filename", filename);    // 文件名
-        // 发送推送消息给接收者
-        send_json_response(recipient_fd, push_msg);
-        cJSON_Delete(push_msg);
-        write_log(LOG_LEVEL_INFO, "已推送分享请求给在线用户 %s（fd: %d）", recipient, recipient_fd);
+        write_log(LOG_LEVEL_INFO, "已推送分享请求给在线用户 %s（%d 个会话）", recipient, pushed);
     }
     else
     {
@@ -1195,7 +2129,7 @@ void handle_share(int client_fd, cJSON *req)
 void handle_history_query(int client_fd, cJSON *req)
 {
     // 检查是否已登录
-    const char *username = client_username[client_fd];
+    const char *username = conn_get(client_fd)->username;
     if (strlen(username) == 0)
     {
         cJSON *res = cJSON_CreateObject();
@@ -1207,19 +2141,54 @@ void handle_history_query(int client_fd, cJSON *req)
         return;
     }
 
-    // 构建查询SQL：获取该用户最近100条操作记录
-    char sql[1024];
-    snprintf(sql, sizeof(sql),
-             "SELECT filename, operation, time, status FROM operation_log "
-             "WHERE username='%s' ORDER BY time DESC LIMIT 100", // 按时间倒序，取前100条
-             username);
+    // 解析分页参数：游标(before_time, before_id)缺省表示从最新一条开始
+    cJSON *before_time = cJSON_GetObjectItem(req, "before_time");
+    cJSON *before_id = cJSON_GetObjectItem(req, "before_id");
+    cJSON *limit_item = cJSON_GetObjectItem(req, "limit");
+    cJSON *operation = cJSON_GetObjectItem(req, "operation");
+    cJSON *prefix = cJSON_GetObjectItem(req, "filename_prefix");
+
+    const char *cursor_time = "9999-12-31 23:59:59";
+    long long cursor_id = LLONG_MAX;
+    if (cJSON_IsString(before_time) && cJSON_IsNumber(before_id))
+    {
+        cursor_time = before_time->valuestring;
+        cursor_id = (long long)before_id->valuedouble;
+    }
+    int limit = cJSON_IsNumber(limit_item) ? limit_item->valueint : HISTORY_PAGE_DEFAULT;
+    if (limit <= 0 || limit > HISTORY_PAGE_MAX)
+    {
+        limit = limit <= 0 ? HISTORY_PAGE_DEFAULT : HISTORY_PAGE_MAX;
+    }
+    const char *op_filter = cJSON_IsString(operation) ? operation->valuestring : "";
+
+    // 文件名前缀转成LIKE模式：转义通配符后追加%
+    char pattern[MAX_PATH_LEN * 2 + 2] = "";
+    if (cJSON_IsString(prefix) && prefix->valuestring[0])
+    {
+        size_t n = 0;
+        for (const char *c = prefix->valuestring; *c && n < sizeof(pattern) - 3; c++)
+        {
+            if (*c == '%' || *c == '_' || *c == '\\')
+                pattern[n++] = '\\';
+            pattern[n++] = *c;
+        }
+        pattern[n++] = '%';
+        pattern[n] = '\0';
+    }
+
+    // 按(time, id)倒序从游标之后取一页，走(username, time, id)索引，不排序全表
+    HistoryQuery query = {cursor_time, cursor_id, limit, op_filter, pattern};
+    cJSON *records = cJSON_CreateArray(); // 存储多条记录
 
     // 记录SQL执行开始时间（调试用）
     struct timeval sql_start;
     gettimeofday(&sql_start, NULL);
-    // 执行SQL查询
-    if (mysql_query(&mysql, sql) != 0)
+    // 执行查询
+    int count = meta_store->history_page(username, &query, records);
+    if (count == -1)
     {
+        cJSON_Delete(records);
         cJSON *res = cJSON_CreateObject();
         cJSON_AddStringToObject(res, "type", "history_result");
         cJSON_AddBoolToObject(res, "success", 0);
@@ -1229,9 +2198,6 @@ void handle_history_query(int client_fd, cJSON *req)
         return;
     }
 
-    // 获取查询结果
-    MYSQL_RES *res = mysql_store_result(&mysql);
-    MYSQL_ROW row;
     // 记录SQL执行结束时间，计算耗时（调试用）
     struct timeval sql_end;
     gettimeofday(&sql_end, NULL);
@@ -1243,134 +2209,384 @@ void handle_history_query(int client_fd, cJSON *req)
     cJSON *history_res = cJSON_CreateObject();
     cJSON_AddStringToObject(history_res, "type", "history_result");
     cJSON_AddBoolToObject(history_res, "success", 1);
-    cJSON *records = cJSON_CreateArray(); // 存储多条记录
 
-    // 遍历查询结果，添加到响应中
-    while ((row = mysql_fetch_row(res)) != NULL)
+    // 添加记录数组到响应；取满一页说明可能还有更早的记录，返回续读游标
+    cJSON_AddItemToObject(history_res, "records", records);
+    cJSON_AddBoolToObject(history_res, "has_more", count == limit);
+    if (count == limit)
     {
-        cJSON *record = cJSON_CreateObject();
-        cJSON_AddStringToObject(record, "filename", row[0] ? row[0] : "");   // 文件名（空则填空字符串）
-        cJSON_AddStringToObject(record, "operation", row[1] ? row[1] : "");  // 操作类型
-        cJSON_AddStringToObject(record, "time", row[2] ? row[2] : "");       // 操作时间
-        cJSON_AddStringToObject(record, "status", row[3] ? row[3] : "未知"); // 操作状态（默认“未知”）
-        cJSON_AddItemToArray(records, record);
+        // 最后一行即下一页的游标
+        cJSON *last = cJSON_GetArrayItem(records, count - 1);
+        cJSON *cursor = cJSON_CreateObject();
+        cJSON_AddStringToObject(cursor, "before_time", cJSON_GetStringValue(cJSON_GetObjectItem(last, "time")));
+        cJSON_AddNumberToObject(cursor, "before_id", cJSON_GetNumberValue(cJSON_GetObjectItem(last, "id")));
+        cJSON_AddItemToObject(history_res, "next_cursor", cursor);
     }
-    mysql_free_result(res); // 释放结果集内存
-
-    // 添加记录数组到响应，发送给客户端
-    cJSON_AddItemToObject(history_res, "records", records);
     send_json_response(client_fd, history_res);
     cJSON_Delete(history_res);
 }
 
 /**
- * @brief 处理客户端普通消息（解析JSON并分发到对应业务函数）
+ * @brief 客户端断开时清理会话（记录退出日志、解绑用户名、释放传输中的文件）
  * @param client_fd 客户端文件描述符
- * @param client_addr 客客户端地址信息
- * @return 无返回值
+ * @param client_addr 客户端地址信息
+ * @return 无返回值（不关闭client_fd，由调用方决定关闭时机）
  */
-void handle_client_message(int client_fd, struct sockaddr_in client_addr)
+void cleanup_client_session(int client_fd, struct sockaddr_in client_addr)
+{
+    Connection *conn = conn_get(client_fd);
+    if (!conn)
+    {
+        return;
+    }
+
+    // 客户端已登录，记录退出日志
+    if (strlen(conn->username) > 0)
+    {
+        insert_operation_log(client_fd, conn->username,
+                             inet_ntoa(client_addr.sin_addr),
+                             "logout", NULL, "成功");
+        conn_unbind_user(client_fd);
+    }
+
+    // 释放未完成的上传/下载占用的文件描述符
+    if (conn->up.state == UP_STATE_RECEIVING)
+    {
+        upload_abort(&conn->up); // 可续传的上传保留已接收的数据
+    }
+    upload_release_delta(&conn->up);
+    upload_challenge_free(conn->up.challenge);
+    conn->up.challenge = NULL;
+    if (conn->dl.state == DL_STATE_SENDING && conn->dl.fd >= 0)
+    {
+        close(conn->dl.fd);
+        conn->dl.fd = -1;
+    }
+    free(conn->dl.manifest);
+    conn->dl.manifest = NULL;
+    conn->dl.state = DL_STATE_IDLE;
+}
+
+/**
+ * @brief 确保输入缓冲区还能再收至少1个字节，并为当前帧的结束符预留1字节
+ * @param conn 连接对象
+ * @return 0=成功，-1=内存不足
+ */
+static int frame_buf_reserve(Connection *conn)
+{
+    size_t need = conn->in_len + 2;
+    if (conn->in_len >= 4)
+    {
+        // 帧头已到：一次扩到能放下整帧，避免大帧反复翻倍拷贝（帧长已在解码时校验过上限）
+        uint32_t net_len;
+        memcpy(&net_len, conn->in_buf, 4);
+        size_t frame_need = 4 + (size_t)ntohl(net_len) + 1;
+        if (frame_need > need)
+            need = frame_need;
+    }
+    if (need <= conn->in_cap)
+    {
+        return 0;
+    }
+
+    size_t new_cap = conn->in_cap ? conn->in_cap : FRAME_BUF_INIT;
+    while (new_cap < need)
+        new_cap *= 2;
+    if (new_cap > MAX_FRAME_SIZE + 5)
+        new_cap = MAX_FRAME_SIZE + 5;
+
+    char *new_buf = realloc(conn->in_buf, new_cap);
+    if (!new_buf)
+    {
+        write_log(LOG_LEVEL_ERROR, "内存不足，无法扩展输入缓冲区");
+        return -1;
+    }
+    conn->in_buf = new_buf;
+    conn->in_cap = new_cap;
+    return 0;
+}
+
+/**
+ * @brief 从输入缓冲区解码并分发所有完整的帧，不完整的半帧留在缓冲区等下次EPOLLIN
+ * @param client_fd 客户端文件描述符
+ * @param conn 连接对象
+ * @param client_addr 客户端地址信息
+ * @return 0=缓冲区已无完整帧，1=请求进入上传接收状态（后续字节是文件数据），-1=帧非法需关闭连接
+ */
+static int frame_decode(int client_fd, Connection *conn, struct sockaddr_in client_addr)
 {
-    // 第一步：读取JSON消息长度前缀（4字节，网络字节序）
-    int net_len;
-    ssize_t recv_len = recv(client_fd, &net_len, 4, 0);
-    if (recv_len <= 0)
+    size_t pos = 0;
+    int ret = 0;
+
+    while (conn->in_len - pos >= 4)
     {
-        // 处理客户端断开（正常/异常）
-        if (recv_len == 0)
+        uint32_t net_len;
+        memcpy(&net_len, conn->in_buf + pos, 4);
+        uint32_t data_len = ntohl(net_len);
+        if (data_len > MAX_FRAME_SIZE)
         {
-            write_log(LOG_LEVEL_INFO, "客户端 %d 正常断开", client_fd);
+            write_log(LOG_LEVEL_WARN, "客户端 %d 控制帧过大（%u字节），断开连接", client_fd, data_len);
+            ret = -1;
+            break;
         }
-        else
+        if (conn->in_len - pos - 4 < data_len)
         {
-            write_log(LOG_LEVEL_WARN, "客户端 %d 异常掉线: %s", client_fd, strerror(errno));
+            break; // 半帧，等待后续数据
         }
 
-        // 客户端已登录，记录退出日志
-        if (strlen(client_username[client_fd]) > 0)
+        // 原地加结束符（接收时始终预留1字节，不会越界），分发后恢复下一帧的首字节
+        char *json_buf = conn->in_buf + pos + 4;
+        char saved = json_buf[data_len];
+        json_buf[data_len] = '\0';
+        int dispatch_ret = dispatch_request(client_fd, json_buf, client_addr);
+        json_buf[data_len] = saved;
+        pos += 4 + data_len;
+
+        if (dispatch_ret == -1)
         {
-            insert_operation_log(client_fd, client_username[client_fd],
-                                 inet_ntoa(client_addr.sin_addr),
-                                 "logout", NULL, "成功");
-            memset(client_username[client_fd], 0, sizeof(client_username[client_fd]));
+            ret = -1;
+            break;
+        }
+        if (conn->up.state == UP_STATE_RECEIVING)
+        {
+            ret = 1;
+            break;
         }
-        close(client_fd);
-        return;
     }
 
-    // 转换长度为本地字节序
-    int data_len = ntohl(net_len);
-    // 分配缓冲区存储JSON数据（+1用于存储字符串结束符）
-    char *json_buf = malloc(data_len + 1);
-    if (!json_buf)
+    if (pos > 0)
     {
-        write_log(LOG_LEVEL_ERROR, "内存不足，无法分配JSON缓冲区");
-        close(client_fd);
-        return;
+        conn->in_len -= pos;
+        memmove(conn->in_buf, conn->in_buf + pos, conn->in_len);
     }
+    return ret;
+}
+
+/**
+ * @brief 上传请求之后已收进输入缓冲区的字节属于文件数据，先写入文件
+ * @param client_fd 客户端文件描述符
+ * @param conn 连接对象
+ * @return 1=上传仍未完成，0=上传已完成，-1=写文件失败（已通知客户端）
+ */
+static int upload_take_buffered(int client_fd, Connection *conn)
+{
+    ClientUploadInfo *info = &conn->up;
+    long long left = info->filesize - info->received;
+    size_t n = (long long)conn->in_len > left ? (size_t)left : conn->in_len;
 
-    // 第二步：读取完整JSON数据（处理粘包/分包）
-    ssize_t total_read = 0;
-    while (total_read < data_len)
+    size_t done = 0;
+    while (done < n)
     {
-        recv_len = recv(client_fd, json_buf + total_read, data_len - total_read, 0);
-        if (recv_len < 0)
+        ssize_t written = pwrite(info->fd, conn->in_buf + done, n - done, info->base + info->received + done);
+        if (written <= 0)
+        {
+            write_log(LOG_LEVEL_ERROR, "客户端 %d 写入文件失败: %s", client_fd, strerror(errno));
+            upload_abort(info);
+            cJSON *progress_res = cJSON_CreateObject();
+            cJSON_AddStringToObject(progress_res, "type", "upload_progress");
+            cJSON_AddBoolToObject(progress_res, "success", 0);
+            send_json_response(client_fd, progress_res);
+            cJSON_Delete(progress_res);
+            return -1;
+        }
+        done += written;
+    }
+    info->received += n;
+    conn->in_len -= n;
+    memmove(conn->in_buf, conn->in_buf + n, conn->in_len);
+
+    if (info->received < info->filesize)
+    {
+        return 1;
+    }
+    upload_report_progress(client_fd);
+    upload_finish(client_fd);
+    return 0;
+}
+
+/**
+ * @brief 处理客户端普通消息（读取socket中已到达的数据，解码并分发其中所有完整的JSON帧）
+ * @param client_fd 客户端文件描述符
+ * @param client_addr 客户端地址信息
+ * @return 无返回值
+ * @details 读到EAGAIN即返回事件循环，半帧保留在连接的输入缓冲区，下次EPOLLIN时接着解码；
+ *          慢速客户端等待期间不占用工作线程
+ */
+void handle_client_message(int client_fd, struct sockaddr_in client_addr)
+{
+    Connection *conn = conn_get(client_fd);
+
+    while (1)
+    {
+        // 第一步：先处理缓冲区中已完整的帧
+        int ret = frame_decode(client_fd, conn, client_addr);
+        if (ret == -1)
+        {
+            cleanup_client_session(client_fd, client_addr);
+            conn_close(client_fd);
+            return;
+        }
+        if (ret == 1)
         {
-            // 非致命错误（中断或暂时无法读取），重试
-            if (errno != EINTR && errno != EAGAIN)
+            // 进入上传状态：缓冲区剩余字节先写入文件，未传完则继续从socket接收文件数据
+            if (conn->in_len > 0)
+                ret = upload_take_buffered(client_fd, conn);
+            if (ret == 1)
             {
-                write_log(LOG_LEVEL_ERROR, "客户端 %d 读取JSON失败: %s", client_fd, strerror(errno));
-                free(json_buf);
-                close(client_fd);
-                return;
+                handle_upload(client_fd);
+                break;
             }
+            continue; // 上传已结束（完成或失败），缓冲区里可能还有后续请求
+        }
+
+        // 第二步：从socket读取更多数据（非阻塞，读空即返回）
+        if (frame_buf_reserve(conn) == -1)
+        {
+            cleanup_client_session(client_fd, client_addr);
+            conn_close(client_fd);
+            return;
+        }
+        ssize_t recv_len = recv(client_fd, conn->in_buf + conn->in_len, conn->in_cap - conn->in_len - 1, 0);
+        if (recv_len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break; // 数据已读空，等待下次EPOLLIN
         }
-        else if (recv_len == 0)
+        if (recv_len <= 0)
         {
-            // 客户端断开，数据不完整
-            write_log(LOG_LEVEL_WARN, "客户端 %d 断开，数据不完整", client_fd);
-            free(json_buf);
-            memset(client_username[client_fd], 0, sizeof(client_username[client_fd]));
-            close(client_fd);
+            // 处理客户端断开（正常/异常）
+            if (recv_len == 0)
+            {
+                write_log(LOG_LEVEL_INFO, "客户端 %d 正常断开", client_fd);
+            }
+            else
+            {
+                write_log(LOG_LEVEL_WARN, "客户端 %d 异常掉线: %s", client_fd, strerror(errno));
+            }
+            cleanup_client_session(client_fd, client_addr);
+            conn_close(client_fd);
             return;
         }
-        else
+        conn->in_len += recv_len;
+    }
+
+    // 没有半帧时释放缓冲区，空闲连接不占输入缓冲
+    if (conn->in_len == 0 && conn->in_buf)
+    {
+        free(conn->in_buf);
+        conn->in_buf = NULL;
+        conn->in_cap = 0;
+    }
+}
+
+/**
+ * @brief 过载保护：当前任务排队超过OVERLOAD_QUEUE_MS时，对新发起的请求直接回复busy
+ * @param client_fd 客户端文件描述符
+ * @param type 请求类型
+ * @param req 请求JSON对象（去掉密码后原样带回，客户端据此重试）
+ * @return 1=已回复busy（请求不再处理），0=正常处理
+ * @details 只拦截会新开一次业务的请求；ready_to_receive、share_response等进行中会话的
+ *          后续消息照常处理，避免打断已开始的传输
+ */
+static int reject_if_overloaded(int client_fd, const char *type, cJSON *req)
+{
+    static const char *admission_types[] = {
+        "login", "register", "list", "upload", "upload_delta", "check_upload_resume",
+        "upload_multipart_init", "download", "delete", "history_query", "share"};
+
+    long long wait_ms = thread_pool_task_wait_us() / 1000;
+    if (wait_ms < OVERLOAD_QUEUE_MS)
+    {
+        return 0;
+    }
+
+    int admissible = 0;
+    for (size_t i = 0; i < sizeof(admission_types) / sizeof(admission_types[0]); i++)
+    {
+        if (strcmp(type, admission_types[i]) == 0)
         {
-            total_read += recv_len;
+            admissible = 1;
+            break;
         }
     }
-    json_buf[data_len] = '\0'; // 添加字符串结束符
+    if (!admissible)
+    {
+        return 0;
+    }
+
+    // 建议等待时长取本次排队时长的2倍，给队列留出消化的时间
+    long long retry_after = wait_ms * 2;
+    if (retry_after > BUSY_RETRY_MAX_MS)
+    {
+        retry_after = BUSY_RETRY_MAX_MS;
+    }
+
+    cJSON *request = cJSON_Duplicate(req, 1);
+    cJSON_DeleteItemFromObject(request, "password");
+
+    cJSON *res = cJSON_CreateObject();
+    cJSON_AddStringToObject(res, "type", "busy");
+    cJSON_AddStringToObject(res, "request_type", type);
+    cJSON_AddNumberToObject(res, "retry_after", (double)retry_after);
+    cJSON_AddStringToObject(res, "message", "服务器繁忙，请稍后重试");
+    cJSON_AddItemToObject(res, "request", request);
+    send_json_response(client_fd, res);
+    cJSON_Delete(res);
+
+    write_log(LOG_LEVEL_WARN, "客户端 %d 请求 %s 排队 %lld ms，回复busy（%lld ms后重试）",
+              client_fd, type, wait_ms, retry_after);
+    return 1;
+}
 
-    // 第三步：解析JSON数据
+/**
+ * @brief 解析一帧完整的JSON请求并分发到对应业务函数（epoll与io_uring后端共用）
+ * @param client_fd 客户端文件描述符
+ * @param json_buf 以'\0'结尾的JSON请求文本
+ * @param client_addr 客户端地址信息
+ * @return 0=已处理，-1=请求非法（调用方应关闭连接）
+ */
+int dispatch_request(int client_fd, const char *json_buf, struct sockaddr_in client_addr)
+{
+    // 解析JSON数据
     cJSON *root = cJSON_Parse(json_buf);
-    free(json_buf); // 释放缓冲区（已解析，无需保留）
     if (!root)
     {
         // JSON解析失败
         write_log(LOG_LEVEL_ERROR, "客户端 %d JSON解析失败: %s", client_fd, cJSON_GetErrorPtr());
-        close(client_fd);
-        return;
+        return -1;
     }
 
-    // 第四步：提取请求类型（type字段），分发到对应业务函数
+    // 提取请求类型（type字段），分发到对应业务函数
     cJSON *type = cJSON_GetObjectItem(root, "type");
     if (!cJSON_IsString(type))
     {
         write_log(LOG_LEVEL_WARN, "客户端 %d 请求缺少type字段", client_fd);
         cJSON_Delete(root);
-        close(client_fd);
-        return;
+        return -1;
     }
 
     // 打印请求类型（调试用）
     printf("收到客户端 %d 请求: %s\n", client_fd, type->valuestring);
     write_log(LOG_LEVEL_INFO, "收到客户端 %d 请求: %s", client_fd, type->valuestring);
 
+    // 服务器过载：新请求直接回复busy，不再占用工作线程和数据库
+    if (reject_if_overloaded(client_fd, type->valuestring, root))
+    {
+        cJSON_Delete(root);
+        return 0;
+    }
+
     // 根据请求类型分发处理
     if (strcmp(type->valuestring, "login") == 0)
     {
         handle_login(client_fd, root, client_addr);
     }
+    else if (strcmp(type->valuestring, "resume_session") == 0)
+    {
+        handle_resume_session(client_fd, root, client_addr);
+    }
     else if (strcmp(type->valuestring, "register") == 0)
     {
         handle_register(client_fd, root);
@@ -1383,19 +2599,44 @@ void handle_client_message(int client_fd, struct sockaddr_in client_addr)
     {
         handle_upload_ctl(client_fd, root);
     }
+    else if (strcmp(type->valuestring, "upload_delta") == 0)
+    {
+        handle_upload_delta(client_fd, root);
+    }
+    else if (strcmp(type->valuestring, "upload_multipart_init") == 0)
+    {
+        handle_upload_multipart_init(client_fd, root);
+    }
+    else if (strcmp(type->valuestring, "upload_part") == 0)
+    {
+        handle_upload_part(client_fd, root);
+    }
+    else if (strcmp(type->valuestring, "upload_multipart_complete") == 0)
+    {
+        handle_upload_multipart_complete(client_fd, root);
+    }
+    else if (strcmp(type->valuestring, "upload_proof") == 0)
+    {
+        handle_upload_proof(client_fd, root);
+    }
+    else if (strcmp(type->valuestring, "check_upload_resume") == 0)
+    {
+        handle_check_upload_resume(client_fd, root);
+    }
     else if (strcmp(type->valuestring, "download") == 0)
     {
         handle_download_ctl(client_fd, root);
     }
     else if (strcmp(type->valuestring, "ready_to_receive") == 0)
     {
-        // 客户端确认准备好，进入发送状态
-        client_dl_info[client_fd].state = DL_STATE_SENDING;
-        struct epoll_event ev;
-        ev.events = EPOLLOUT | EPOLLET;
-        ev.data.fd = client_fd;
-        epoll_ctl(epfd, EPOLL_CTL_MOD, client_fd, &ev);
-        printf("客户端 %d 准备好接收数据，切换为EPOLLOUT\n", client_fd);
+        // 客户端确认准备好，进入发送状态（没有待发送的下载则忽略：之前的download请求失败、
+        // 或上次下载已结束后迟到的重复确认，不能再发一遍数据和download_result）
+        ClientDownloadInfo *dl = &conn_get(client_fd)->dl;
+        if (dl->filepath && dl->manifest)
+        {
+            dl->state = DL_STATE_SENDING; // 任务结束重新挂载事件时切换为关注EPOLLOUT
+            printf("客户端 %d 准备好接收数据，切换为EPOLLOUT\n", client_fd);
+        }
     }
     else if (strcmp(type->valuestring, "delete") == 0)
     {
@@ -1425,4 +2666,5 @@ void handle_client_message(int client_fd, struct sockaddr_in client_addr)
     }
 
     cJSON_Delete(root); // 释放cJSON对象内存
-}
\ No newline at end of file
+    return 0;
+}
@@ -20,6 +20,17 @@ void init_server();
  */
 void handle_login(int client_fd, cJSON *req, struct sockaddr_in client_addr);
 
+/**
+ * @brief 处理会话恢复请求（断线重连时凭登录返回的令牌恢复登录状态）
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含token）
+ * @param client_addr 客户端地址信息
+ * @return 无返回值
+ * @details 令牌的签名和有效期在内存中校验，不查询密码和用户目录；
+ *          成功时返回新令牌（有效期重新计算），客户端替换保存
+ */
+void handle_resume_session(int client_fd, cJSON *req, struct sockaddr_in client_addr);
+
 /**
  * @brief 处理客户端注册请求
  * @param client_fd 客户端文件描述符
@@ -39,11 +50,75 @@ void handle_file_list(int client_fd, cJSON *req);
 /**
  * @brief 处理客户端文件上传控制请求（初始化上传）
  * @param client_fd 客户端文件描述符
- * @param req 客户端JSON请求（含文件名、文件大小、目标路径）
+ * @param req 客户端JSON请求（含文件名、文件大小、目标路径，可选整文件哈希file_hash用于秒传和断点续传）
  * @return 无返回值
+ * @details 同一文件有未完成的上传时自动续传，回复upload_resume_info（offset为已接收的字节数）代替ready_to_receive
  */
 void handle_upload_ctl(int client_fd, cJSON *req);
 
+/**
+ * @brief 处理断点续传请求：查询同一文件未完成上传的进度并从该处继续接收
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（字段同upload，file_hash必填，否则只能从头上传）
+ * @return 无返回值
+ * @details 回复upload_resume_info（offset为已接收的字节数，没有未完成的上传时为0），之后客户端从offset处发送数据
+ */
+void handle_check_upload_resume(int client_fd, cJSON *req);
+
+/**
+ * @brief 处理客户端增量上传请求：客户端给出新版本的内容定义切块清单，服务器回复该路径当前版本中没有的块，
+ *        之后只接收这些块的数据
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含文件名、文件大小、目标路径、chunks=[[块哈希, 块长度], ...]，可选file_hash用于秒传）
+ * @return 无返回值
+ * @details 先回复upload_plan（missing为需要发送的块下标，bytes为需要发送的总字节数，
+ *          offset为上次中断前已收到的字节数，客户端跳过这部分），再回复ready_to_receive；
+ *          不需要发送任何数据时直接写入新版本并回复upload_result。
+ *          缺少的块按块清单保存续传日志，同一块清单再次上传时沿用上次的计划和进度。
+ *          接收完成后每块都按声明的哈希校验，与声明不符的上传整体失败
+ */
+void handle_upload_delta(int client_fd, cJSON *req);
+
+/**
+ * @brief 处理发起分段上传请求：大文件切成MULTIPART_PART_SIZE的段，由客户端在多个连接上并发上传
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含文件名、文件大小、目标路径、file_hash必填）
+ * @return 无返回值
+ * @details 回复upload_multipart_ready（upload_id、part_size、part_count）；服务器已有相同文件时直接秒传。
+ *          各段写入按文件大小预分配的暂存文件，全部收到后由upload_multipart_complete校验整文件哈希并入库
+ */
+void handle_upload_multipart_init(int client_fd, cJSON *req);
+
+/**
+ * @brief 处理上传一段的请求：之后在本连接上接收该段的数据，按段偏移写入暂存文件
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含upload_id、part段号）
+ * @return 无返回值
+ * @details 回复ready_to_receive（part、offset、length），客户端随后发送length字节，
+ *          收完回复upload_part_result；同一用户已登录（或恢复会话）的任意连接都可以上传段
+ */
+void handle_upload_part(int client_fd, cJSON *req);
+
+/**
+ * @brief 处理跨用户秒传的持有证明（应答upload_challenge）
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含proof：SHA-256(nonce || 各范围的数据)，十六进制）
+ * @return 无返回值
+ * @details 挑战只能应答一次；证明与服务器按源文件算出的一致时引用其块并回复上传完成，
+ *          否则按原始请求继续正常上传（服务器没有相同内容和证明不符对客户端表现一致）
+ */
+void handle_upload_proof(int client_fd, cJSON *req);
+
+/**
+ * @brief 处理完成分段上传请求：所有段都已收到时交给入库线程校验整文件哈希，切块入库并写入清单
+ * @param client_fd 客户端文件描述符
+ * @param req 客户端JSON请求（含upload_id）
+ * @return 无返回值
+ * @details 入库结束后由入库线程回复upload_result；还有段没收到时立即回复失败并给出missing（未收到的段数），
+ *          分段上传保留，客户端补传后可再次完成；哈希不符时整个分段上传作废
+ */
+void handle_upload_multipart_complete(int client_fd, cJSON *req);
+
 /**
  * @brief 处理客户端目录上传请求（创建目标目录）
  * @param client_fd 客户端文件描述符
@@ -62,8 +137,10 @@ int handle_upload(int client_fd);
 /**
  * @brief 处理客户端文件下载控制请求（初始化下载）
  * @param client_fd 客户端文件描述符
- * @param req 客户端JSON请求（含文件名、目标路径）
+ * @param req 客户端JSON请求（含文件名、目标路径，可选offset、length指定字节范围，if_hash指定续传的版本）
  * @return 无返回值
+ * @details 只发送请求的字节范围（预览、读取日志末尾、续传未完成的下载）；
+ *          if_hash与文件当前版本不符时改为发送整个文件，download_meta中的offset、length为实际发送的范围
  */
 void handle_download_ctl(int client_fd, cJSON *req);
 
@@ -100,23 +177,78 @@ void handle_delete(int client_fd, cJSON *req, struct sockaddr_in client_addr);
 void handle_share(int client_fd, cJSON *req);
 
 /**
- * @brief 处理客户端操作历史查询请求
+ * @brief 处理客户端操作历史查询请求（按游标分页）
  * @param client_fd 客户端文件描述符
- * @param req 客户端JSON请求（无额外参数）
- * @return 无返回值
+ * @param req 客户端JSON请求（可选：before_time/before_id 上一页返回的游标，limit 每页条数，
+ *            operation 按操作类型过滤，filename_prefix 按文件名前缀过滤）
+ * @return 无返回值（响应带has_more，还有更早记录时带next_cursor）
  */
 void handle_history_query(int client_fd, cJSON *req);
 
 /**
- * @brief 处理客户端普通消息（解析JSON并分发到对应业务函数）
+ * @brief 处理客户端普通消息（读取socket中已到达的数据，解码并分发其中所有完整的JSON帧）
  * @param client_fd 客户端文件描述符
  * @param client_addr 客户端地址信息
  * @return 无返回值
+ * @details 读到EAGAIN即返回事件循环，半帧保留在连接的输入缓冲区，下次EPOLLIN时接着解码
  */
 void handle_client_message(int client_fd, struct sockaddr_in client_addr);
 
+/**
+ * @brief 解析一帧完整的JSON请求并分发到对应业务函数（epoll与io_uring后端共用）
+ * @param client_fd 客户端文件描述符
+ * @param json_buf 以'\0'结尾的JSON请求文本
+ * @param client_addr 客户端地址信息
+ * @return 0=已处理，-1=请求非法（调用方应关闭连接）
+ */
+int dispatch_request(int client_fd, const char *json_buf, struct sockaddr_in client_addr);
+
+/**
+ * @brief 客户端断开时清理会话（记录退出日志、解绑用户名、释放传输中的文件）
+ * @param client_fd 客户端文件描述符
+ * @param client_addr 客户端地址信息
+ * @return 无返回值（不关闭client_fd，由调用方决定关闭时机）
+ */
+void cleanup_client_session(int client_fd, struct sockaddr_in client_addr);
+
+/**
+ * @brief 向客户端发送当前上传进度
+ * @param client_fd 客户端文件描述符
+ * @return 无返回值
+ */
+void upload_report_progress(int client_fd);
+
+/**
+ * @brief 上传数据全部写入后的收尾（暂存数据交给入库线程，入库结束后由其记录日志、发送完成响应；
+ *        分段上传的一段只回复该段的结果）
+ * @param client_fd 客户端文件描述符
+ * @return 无返回值
+ */
+void upload_finish(int client_fd);
+
+/**
+ * @brief 中止接收中的上传（连接断开或写入失败）：关闭暂存文件，可续传的上传把已接收的字节数记入续传日志，
+ *        分段上传的段标记为未收到
+ * @param info 上传状态
+ * @return 无返回值
+ */
+void upload_abort(ClientUploadInfo *info);
+
+/**
+ * @brief 释放持有证明挑战
+ * @param ch 挑战（可为NULL）
+ * @return 无返回值
+ */
+void upload_challenge_free(UploadChallenge *ch);
+
+/**
+ * @brief 下载数据全部发出后的收尾（关闭文件、发送完成响应、记录日志）
+ * @param client_fd 客户端文件描述符
+ * @return 无返回值
+ */
+void download_finish(int client_fd);
+
 void handle_share_response(int client_fd, cJSON *req);
 void check_pending_shares(int client_fd);
-int copy_file(const char *src, const char *dest);
 
 #endif // BUSINESS_H
\ No newline at end of file
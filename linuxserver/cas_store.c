@@ -0,0 +1,1611 @@
+#include "cas_store.h"
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#define CAS_CHUNK_DIR CAS_ROOT "/chunks" // 块文件目录（按哈希前两位分256个子目录）
+#define CAS_TMP_DIR CAS_ROOT "/tmp"      // 上传暂存、写入中的块和清单
+#define CAS_MANIFEST_MAGIC "CDM1 "       // 清单首行：CDM1 文件大小 块数 [整文件哈希]
+
+// 内容定义切块（FastCDC）：Gear滚动哈希的高位全为0处切块；平均长度之前用更严的掩码，之后放宽，
+// 块长集中在平均值附近。客户端（增量上传）使用相同的参数和Gear表，切点一致才能复用服务器已有的块
+#define CAS_CDC_MASK_S (((1ULL << 22) - 1) << 42) // 平均长度之前的切块掩码（22位）
+#define CAS_CDC_MASK_L (((1ULL << 18) - 1) << 46) // 平均长度之后的切块掩码（18位）
+static uint64_t cas_gear[256];                    // Gear表（splitmix64固定序列生成，与客户端一致）
+
+// 块引用计数表：只在内存中，启动时由全部清单重建
+static CasIndexShard cas_index[CAS_INDEX_SHARDS] = {
+    [0 ... CAS_INDEX_SHARDS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}};
+
+// 替换/删除清单时，读旧清单和rename/unlink在同一临界区完成，保证每个旧清单的块引用只释放一次
+static pthread_mutex_t cas_manifest_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// 整文件哈希索引（秒传）：和引用计数一样只在内存中，由清单首行记录的整文件哈希在启动时重建；
+// 每个清单一项（同一内容在不同用户目录下各有一项，秒传只在请求者自己的目录中查找）；
+// 只在上传完成时变化，一把锁足够（加锁顺序：cas_manifest_mutex → cas_file_mutex）
+static CasFileEntry *cas_files[CAS_FILE_BUCKETS];
+static pthread_mutex_t cas_file_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// 统计（原子累加）
+static unsigned long long cas_chunks_written = 0; // 新写入的块数
+static unsigned long long cas_chunks_deduped = 0; // 已存在、只增加引用的块数
+static unsigned long long cas_bytes_deduped = 0;  // 去重省下的写入字节数
+static unsigned long long cas_instant_hits = 0;   // 秒传命中次数
+static unsigned long long cas_instant_bytes = 0;  // 秒传省去传输的字节数
+static unsigned long long cas_ingest_jobs = 0;    // 交给入库线程的上传数
+
+// 后台入库队列：上传收齐后的切块、哈希和写清单由入库线程按提交顺序执行
+static CasIngestJob *cas_ingest_head = NULL;
+static CasIngestJob *cas_ingest_tail = NULL;
+static int cas_ingest_pending = 0;  // 队列中等待执行的任务数
+static int cas_ingest_stopping = 0; // 1=停止（写完队列中的任务后退出）
+static int cas_ingest_started = 0;  // 已启动的入库线程数
+static pthread_t cas_ingest_threads[CAS_INGEST_THREADS];
+static pthread_mutex_t cas_ingest_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cas_ingest_cond = PTHREAD_COND_INITIALIZER;
+
+// ========================== 块引用计数表 ==========================
+/**
+ * @brief 哈希值转十六进制字符串
+ * @param hash 块哈希
+ * @param hex 输出参数：十六进制串（CAS_HASH_LEN * 2 + 1字节）
+ * @return 无返回值
+ */
+void cas_hash_to_hex(const unsigned char *hash, char *hex)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < CAS_HASH_LEN; i++)
+    {
+        hex[i * 2] = digits[hash[i] >> 4];
+        hex[i * 2 + 1] = digits[hash[i] & 0x0f];
+    }
+    hex[CAS_HASH_LEN * 2] = '\0';
+}
+
+/**
+ * @brief 十六进制字符串转块哈希
+ * @param hex 十六进制串（至少CAS_HASH_LEN * 2个字符）
+ * @param hash 输出参数：块哈希
+ * @return 0=成功，-1=含非十六进制字符
+ */
+int cas_hash_from_hex(const char *hex, unsigned char *hash)
+{
+    for (int i = 0; i < CAS_HASH_LEN * 2; i++)
+    {
+        char c = hex[i];
+        int v = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+        if (v < 0)
+        {
+            return -1;
+        }
+        if (i % 2 == 0)
+            hash[i / 2] = (unsigned char)(v << 4);
+        else
+            hash[i / 2] |= (unsigned char)v;
+    }
+    return 0;
+}
+
+/**
+ * @brief 构建块文件路径（CAS_CHUNK_DIR/哈希前两位/完整哈希）
+ * @param hash 块哈希
+ * @param path 输出参数：块文件路径（MAX_PATH_LEN）
+ * @return 无返回值
+ */
+static void cas_chunk_path(const unsigned char *hash, char *path)
+{
+    char hex[CAS_HASH_LEN * 2 + 1];
+    cas_hash_to_hex(hash, hex);
+    snprintf(path, MAX_PATH_LEN, "%s/%.2s/%s", CAS_CHUNK_DIR, hex, hex);
+}
+
+/**
+ * @brief 根据块哈希定位引用计数表的分片和哈希桶（SHA-256本身均匀，直接取前4字节）
+ * @param hash 块哈希
+ * @param bucket 输出参数：哈希桶头指针的地址
+ * @return 分片指针
+ */
+static CasIndexShard *cas_index_shard(const unsigned char *hash, CasIndexEntry ***bucket)
+{
+    uint32_t h;
+    memcpy(&h, hash, sizeof(h));
+    CasIndexShard *shard = &cas_index[h & (CAS_INDEX_SHARDS - 1)];
+    *bucket = &shard->buckets[(h / CAS_INDEX_SHARDS) & (CAS_INDEX_BUCKETS - 1)];
+    return shard;
+}
+
+/**
+ * @brief 在哈希桶中查找块（调用方持有分片锁）
+ * @param bucket 哈希桶
+ * @param hash 块哈希
+ * @return 表项，NULL=块不存在
+ */
+static CasIndexEntry *cas_index_find(CasIndexEntry **bucket, const unsigned char *hash)
+{
+    for (CasIndexEntry *e = *bucket; e; e = e->next)
+    {
+        if (memcmp(e->hash, hash, CAS_HASH_LEN) == 0)
+        {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 在哈希桶中插入新块（调用方持有分片锁，引用数为0）
+ * @param bucket 哈希桶
+ * @param hash 块哈希
+ * @param len 块长度
+ * @return 表项，NULL=内存不足
+ */
+static CasIndexEntry *cas_index_insert(CasIndexEntry **bucket, const unsigned char *hash, uint32_t len)
+{
+    CasIndexEntry *e = calloc(1, sizeof(CasIndexEntry));
+    if (!e)
+    {
+        return NULL;
+    }
+    memcpy(e->hash, hash, CAS_HASH_LEN);
+    e->len = len;
+    e->next = *bucket;
+    *bucket = e;
+    return e;
+}
+
+/**
+ * @brief 块已存在时增加一次引用
+ * @param hash 块哈希
+ * @return 1=已引用，0=块不存在
+ */
+static int cas_chunk_acquire(const unsigned char *hash)
+{
+    CasIndexEntry **bucket;
+    CasIndexShard *shard = cas_index_shard(hash, &bucket);
+    pthread_mutex_lock(&shard->lock);
+    CasIndexEntry *e = cas_index_find(bucket, hash);
+    if (e)
+    {
+        e->refs++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return e != NULL;
+}
+
+/**
+ * @brief 释放一次块引用，引用归零时删除块文件
+ * @param hash 块哈希
+ * @return 无返回值
+ */
+static void cas_chunk_release(const unsigned char *hash)
+{
+    CasIndexEntry **bucket;
+    CasIndexShard *shard = cas_index_shard(hash, &bucket);
+    pthread_mutex_lock(&shard->lock);
+    CasIndexEntry **pp = bucket;
+    while (*pp && memcmp((*pp)->hash, hash, CAS_HASH_LEN) != 0)
+    {
+        pp = &(*pp)->next;
+    }
+    CasIndexEntry *e = *pp;
+    if (e && --e->refs <= 0)
+    {
+        // 在分片锁内删除：同一块的并发入库要么先看到表项（引用+1），要么在删除后重新写入
+        char path[MAX_PATH_LEN];
+        cas_chunk_path(hash, path);
+        unlink(path);
+        *pp = e->next;
+        free(e);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * @brief 释放清单前count个块的引用
+ * @param m 清单
+ * @param count 块数
+ * @return 无返回值
+ */
+static void cas_release_chunks(const CasManifest *m, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        cas_chunk_release(m->chunks[i].hash);
+    }
+}
+
+/**
+ * @brief 把数据全部写入文件（处理短写和EINTR）
+ * @param fd 文件描述符
+ * @param data 数据
+ * @param len 数据长度
+ * @return 0=成功，-1=写入失败
+ */
+static int cas_write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief 从指定偏移读满len字节（处理短读和EINTR）
+ * @param fd 文件描述符
+ * @param buf 输出缓冲区
+ * @param len 读取长度
+ * @param offset 文件偏移
+ * @return 0=成功，-1=读取失败或文件不足len字节
+ */
+static int cas_read_full(int fd, char *buf, size_t len, off_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+        {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief 在临时目录创建一个临时文件
+ * @param path 输出参数：临时文件路径（MAX_PATH_LEN）
+ * @param prefix 文件名前缀
+ * @return 文件描述符，-1=创建失败
+ */
+static int cas_tmp_open(char *path, const char *prefix)
+{
+    snprintf(path, MAX_PATH_LEN, "%s/%s-XXXXXX", CAS_TMP_DIR, prefix);
+    int fd = mkostemp(path, O_CLOEXEC);
+    if (fd == -1)
+    {
+        write_log(LOG_LEVEL_ERROR, "块存储创建临时文件失败: %s", strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * @brief 存入一个块并增加引用：已存在的块只增加引用，不存在时写入块文件
+ * @param hash 块哈希
+ * @param data 块数据
+ * @param len 块长度
+ * @return 0=成功，-1=写入失败
+ * @details 块文件先写到临时文件，在分片锁内再次确认后rename到位，锁内不做大块写入
+ */
+static int cas_chunk_store(const unsigned char *hash, const char *data, uint32_t len)
+{
+    if (cas_chunk_acquire(hash))
+    {
+        __atomic_fetch_add(&cas_chunks_deduped, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&cas_bytes_deduped, len, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    char tmp[MAX_PATH_LEN];
+    int fd = cas_tmp_open(tmp, "chunk");
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (cas_write_all(fd, data, len) == -1)
+    {
+        write_log(LOG_LEVEL_ERROR, "写入块文件失败: %s", strerror(errno));
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+
+    char path[MAX_PATH_LEN];
+    cas_chunk_path(hash, path);
+    CasIndexEntry **bucket;
+    CasIndexShard *shard = cas_index_shard(hash, &bucket);
+    pthread_mutex_lock(&shard->lock);
+    CasIndexEntry *e = cas_index_find(bucket, hash);
+    if (e)
+    {
+        // 写入期间其他线程已存入同一块
+        e->refs++;
+        pthread_mutex_unlock(&shard->lock);
+        unlink(tmp);
+        return 0;
+    }
+    if (rename(tmp, path) == -1)
+    {
+        pthread_mutex_unlock(&shard->lock);
+        write_log(LOG_LEVEL_ERROR, "块文件落盘失败: %s, %s", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    e = cas_index_insert(bucket, hash, len);
+    if (!e)
+    {
+        unlink(path);
+        pthread_mutex_unlock(&shard->lock);
+        return -1;
+    }
+    e->refs = 1;
+    pthread_mutex_unlock(&shard->lock);
+    __atomic_fetch_add(&cas_chunks_written, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// ========================== 内容定义切块 ==========================
+/**
+ * @brief 生成Gear表（splitmix64，种子固定为0）
+ * @param 无参数
+ * @return 无返回值
+ */
+static void cas_gear_init()
+{
+    uint64_t x = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        x += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        cas_gear[i] = z ^ (z >> 31);
+    }
+}
+
+/**
+ * @brief 在数据开头找下一个切点（FastCDC）
+ * @param data 从块起点开始的数据（文件剩余部分不少于CAS_CHUNK_MAX时应至少给CAS_CHUNK_MAX字节）
+ * @param len 数据长度
+ * @return 块长度（不超过len和CAS_CHUNK_MAX）
+ * @details 前CAS_CHUNK_MIN字节不计算哈希直接跳过；只有内容决定切点，
+ *          文件中间插入或删除数据只影响附近的块，其余块的切点和哈希不变
+ */
+static size_t cas_cdc_cut(const unsigned char *data, size_t len)
+{
+    if (len <= CAS_CHUNK_MIN)
+    {
+        return len;
+    }
+    size_t limit = len > CAS_CHUNK_MAX ? CAS_CHUNK_MAX : len;
+    size_t normal = limit > CAS_CHUNK_AVG ? CAS_CHUNK_AVG : limit;
+
+    uint64_t h = 0;
+    size_t i = CAS_CHUNK_MIN;
+    for (; i < normal; i++)
+    {
+        h = (h << 1) + cas_gear[data[i]];
+        if (!(h & CAS_CDC_MASK_S))
+            return i + 1;
+    }
+    for (; i < limit; i++)
+    {
+        h = (h << 1) + cas_gear[data[i]];
+        if (!(h & CAS_CDC_MASK_L))
+            return i + 1;
+    }
+    return limit;
+}
+
+// ========================== 清单 ==========================
+/**
+ * @brief 读取并解析文件清单
+ * @param path 清单路径
+ * @return 清单（调用方free），NULL=不存在或不是清单
+ */
+CasManifest *cas_manifest_load(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    struct stat st;
+    char magic[sizeof(CAS_MANIFEST_MAGIC) - 1];
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size < (off_t)sizeof(magic) ||
+        cas_read_full(fd, magic, sizeof(magic), 0) == -1 ||
+        memcmp(magic, CAS_MANIFEST_MAGIC, sizeof(magic)) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    char *text = malloc(st.st_size + 1);
+    if (!text || cas_read_full(fd, text, st.st_size, 0) == -1)
+    {
+        free(text);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    text[st.st_size] = '\0';
+
+    // 首行：CDM1 文件大小 块数 [整文件哈希]
+    char *end;
+    char *p = text + sizeof(magic);
+    long long size = strtoll(p, &end, 10);
+    if (end == p || *end != ' ' || size < 0)
+    {
+        free(text);
+        return NULL;
+    }
+    p = end + 1;
+    long count = strtol(p, &end, 10);
+    // 每行至少“哈希 长度\n”，块数不可能超过文件长度允许的行数
+    if (end == p || count < 0 || count > st.st_size / (CAS_HASH_LEN * 2 + 3))
+    {
+        free(text);
+        return NULL;
+    }
+    unsigned char file_hash[CAS_HASH_LEN];
+    int has_file_hash = 0;
+    if (*end == ' ' && strlen(end + 1) > CAS_HASH_LEN * 2 && cas_hash_from_hex(end + 1, file_hash) == 0)
+    {
+        has_file_hash = 1;
+        end += 1 + CAS_HASH_LEN * 2;
+    }
+    if (*end != '\n')
+    {
+        free(text);
+        return NULL;
+    }
+
+    CasManifest *m = malloc(sizeof(CasManifest) + count * sizeof(CasChunkRef));
+    if (!m)
+    {
+        free(text);
+        return NULL;
+    }
+    m->size = size;
+    m->count = (int)count;
+    m->has_file_hash = has_file_hash;
+    memcpy(m->file_hash, file_hash, CAS_HASH_LEN);
+
+    // 之后每行一个块：哈希 长度
+    long long offset = 0;
+    long parsed = 0;
+    p = end + 1;
+    for (; parsed < count; parsed++)
+    {
+        CasChunkRef *c = &m->chunks[parsed];
+        if (strlen(p) < CAS_HASH_LEN * 2 + 3 || cas_hash_from_hex(p, c->hash) == -1 || p[CAS_HASH_LEN * 2] != ' ')
+            break;
+        p += CAS_HASH_LEN * 2 + 1;
+        unsigned long len = strtoul(p, &end, 10);
+        if (end == p || *end != '\n' || len == 0 || len > UINT32_MAX)
+            break;
+        c->len = (uint32_t)len;
+        c->offset = offset;
+        offset += len;
+        p = end + 1;
+    }
+    free(text);
+
+    // 块长度之和必须等于文件大小
+    if (parsed < count || offset != size)
+    {
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+/**
+ * @brief 只读取清单头部，获取文件大小（文件列表使用）
+ * @param path 清单路径
+ * @param size 输出参数：文件大小
+ * @return 1=是清单，0=不是清单或读取失败
+ */
+int cas_manifest_size(const char *path, long long *size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return 0;
+    }
+    char head[64];
+    ssize_t n = pread(fd, head, sizeof(head) - 1, 0);
+    close(fd);
+    if (n < (ssize_t)sizeof(CAS_MANIFEST_MAGIC) - 1 ||
+        memcmp(head, CAS_MANIFEST_MAGIC, sizeof(CAS_MANIFEST_MAGIC) - 1) != 0)
+    {
+        return 0;
+    }
+    head[n] = '\0';
+
+    char *end;
+    long long value = strtoll(head + sizeof(CAS_MANIFEST_MAGIC) - 1, &end, 10);
+    if (*end != ' ' || value < 0)
+    {
+        return 0;
+    }
+    *size = value;
+    return 1;
+}
+
+/**
+ * @brief 整文件哈希定位索引的哈希桶
+ * @param hash 整文件哈希
+ * @return 哈希桶头指针的地址
+ */
+static CasFileEntry **cas_file_bucket(const unsigned char *hash)
+{
+    uint32_t h;
+    memcpy(&h, hash, sizeof(h));
+    return &cas_files[h & (CAS_FILE_BUCKETS - 1)];
+}
+
+/**
+ * @brief 记录某路径的清单内容为该整文件哈希（该路径已有相同的项时不重复记录）
+ * @param hash 整文件哈希
+ * @param size 文件大小
+ * @param path 清单路径
+ * @return 无返回值（内存不足时不记录，只影响秒传命中）
+ */
+static void cas_file_index_put(const unsigned char *hash, long long size, const char *path)
+{
+    CasFileEntry **bucket = cas_file_bucket(hash);
+    pthread_mutex_lock(&cas_file_mutex);
+    CasFileEntry *e = *bucket;
+    while (e && (memcmp(e->hash, hash, CAS_HASH_LEN) != 0 || e->size != size || strcmp(e->path, path) != 0))
+    {
+        e = e->next;
+    }
+    if (!e && (e = calloc(1, sizeof(CasFileEntry))) != NULL)
+    {
+        if ((e->path = strdup(path)) != NULL)
+        {
+            memcpy(e->hash, hash, CAS_HASH_LEN);
+            e->size = size;
+            e->next = *bucket;
+            *bucket = e;
+        }
+        else
+        {
+            free(e);
+        }
+    }
+    pthread_mutex_unlock(&cas_file_mutex);
+}
+
+/**
+ * @brief 某路径的清单被删除或替换：若索引中该哈希正指向这个路径则删除该项
+ * @param hash 整文件哈希
+ * @param path 清单路径
+ * @return 无返回值
+ */
+static void cas_file_index_drop(const unsigned char *hash, const char *path)
+{
+    CasFileEntry **pp = cas_file_bucket(hash);
+    pthread_mutex_lock(&cas_file_mutex);
+    while (*pp)
+    {
+        CasFileEntry *e = *pp;
+        if (memcmp(e->hash, hash, CAS_HASH_LEN) == 0 && strcmp(e->path, path) == 0)
+        {
+            *pp = e->next;
+            free(e->path);
+            free(e);
+            break;
+        }
+        pp = &e->next;
+    }
+    pthread_mutex_unlock(&cas_file_mutex);
+}
+
+/**
+ * @brief 把清单写到用户路径（先写临时文件再rename，原子替换；被替换的旧清单释放其块引用）
+ * @param m 清单（其中的块引用已由调用方持有）
+ * @param path 用户路径
+ * @return 0=成功，-1=写入失败（调用方负责撤销m的块引用）
+ */
+static int cas_manifest_commit(const CasManifest *m, const char *path)
+{
+    size_t cap = 128 + (size_t)m->count * (CAS_HASH_LEN * 2 + 13);
+    char *text = malloc(cap);
+    if (!text)
+    {
+        return -1;
+    }
+    char file_hex[CAS_HASH_LEN * 2 + 1];
+    if (m->has_file_hash)
+        cas_hash_to_hex(m->file_hash, file_hex);
+    size_t len = snprintf(text, cap, "%s%lld %d%s%s\n", CAS_MANIFEST_MAGIC, m->size, m->count,
+                          m->has_file_hash ? " " : "", m->has_file_hash ? file_hex : "");
+    for (int i = 0; i < m->count; i++)
+    {
+        char hex[CAS_HASH_LEN * 2 + 1];
+        cas_hash_to_hex(m->chunks[i].hash, hex);
+        len += snprintf(text + len, cap - len, "%s %u\n", hex, m->chunks[i].len);
+    }
+
+    char tmp[MAX_PATH_LEN];
+    int fd = cas_tmp_open(tmp, "manifest");
+    if (fd == -1)
+    {
+        free(text);
+        return -1;
+    }
+    int ret = cas_write_all(fd, text, len);
+    close(fd);
+    free(text);
+    if (ret == -1)
+    {
+        write_log(LOG_LEVEL_ERROR, "写入清单失败: %s, %s", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+
+    pthread_mutex_lock(&cas_manifest_mutex);
+    CasManifest *old = cas_manifest_load(path);
+    if (rename(tmp, path) == -1)
+    {
+        pthread_mutex_unlock(&cas_manifest_mutex);
+        write_log(LOG_LEVEL_ERROR, "替换清单失败: %s, %s", path, strerror(errno));
+        unlink(tmp);
+        free(old);
+        return -1;
+    }
+    if (old && old->has_file_hash)
+        cas_file_index_drop(old->file_hash, path);
+    if (m->has_file_hash)
+        cas_file_index_put(m->file_hash, m->size, path);
+    pthread_mutex_unlock(&cas_manifest_mutex);
+
+    if (old)
+    {
+        cas_release_chunks(old, old->count);
+        free(old);
+    }
+    return 0;
+}
+
+// ========================== 对外接口 ==========================
+/**
+ * @brief 创建上传暂存文件（位于块存储的临时目录，创建后立即unlink，关闭即释放）
+ * @param 无参数
+ * @return 暂存文件的文件描述符，-1=创建失败
+ */
+int cas_stage_open()
+{
+    char path[MAX_PATH_LEN];
+    int fd = cas_tmp_open(path, "upload");
+    if (fd != -1)
+    {
+        unlink(path);
+    }
+    return fd;
+}
+
+/**
+ * @brief 把文件内容切块入库，并在用户路径写入清单（原子替换，旧清单的块引用随之释放）
+ * @param fd 文件内容所在的文件描述符（按偏移读取，不改变文件位置）
+ * @param size 文件大小
+ * @param manifest_path 用户可见的文件路径（写成清单）
+ * @param expect_hash 客户端声明的整文件SHA-256（NULL=不校验）
+ * @return 0=成功，-1=失败（内容与声明的哈希不符或写入失败，已入库的块引用全部撤销）
+ * @details 按内容定义切块；已存在的块只增加引用计数，不再写盘
+ */
+int cas_ingest(int fd, long long size, const char *manifest_path, const unsigned char *expect_hash)
+{
+    // 除最后一块外每块至少CAS_CHUNK_MIN字节
+    long long cap = size / CAS_CHUNK_MIN + 1;
+    CasManifest *m = malloc(sizeof(CasManifest) + cap * sizeof(CasChunkRef));
+    unsigned char *buf = malloc(CAS_CHUNK_MAX);
+    if (!m || !buf)
+    {
+        free(m);
+        free(buf);
+        write_log(LOG_LEVEL_ERROR, "文件入库失败（内存不足）: %s", manifest_path);
+        return -1;
+    }
+    m->size = size;
+    m->count = 0;
+    m->has_file_hash = 0;
+    EVP_MD_CTX *file_ctx = EVP_MD_CTX_new();
+    int ok = file_ctx && EVP_DigestInit_ex(file_ctx, EVP_sha256(), NULL) == 1;
+
+    // buf始终从当前块起点开始，切块前补满CAS_CHUNK_MAX字节（文件末尾除外）
+    size_t buffered = 0;
+    long long offset = 0;
+    while (ok && offset < size)
+    {
+        long long read_pos = offset + buffered;
+        size_t want = CAS_CHUNK_MAX - buffered;
+        if (want > size - read_pos)
+            want = (size_t)(size - read_pos);
+        if (want > 0 && cas_read_full(fd, (char *)buf + buffered, want, read_pos) == -1)
+        {
+            ok = 0;
+            break;
+        }
+        buffered += want;
+
+        CasChunkRef *c = &m->chunks[m->count];
+        c->offset = offset;
+        c->len = (uint32_t)cas_cdc_cut(buf, buffered);
+        if (EVP_Digest(buf, c->len, c->hash, NULL, EVP_sha256(), NULL) != 1 ||
+            EVP_DigestUpdate(file_ctx, buf, c->len) != 1 ||
+            cas_chunk_store(c->hash, (const char *)buf, c->len) == -1)
+        {
+            ok = 0;
+            break;
+        }
+        m->count++;
+        memmove(buf, buf + c->len, buffered - c->len);
+        buffered -= c->len;
+        offset += c->len;
+    }
+    free(buf);
+    if (ok)
+    {
+        // 整文件哈希由服务器按实际内容计算，秒传索引不采信客户端声明的哈希
+        ok = EVP_DigestFinal_ex(file_ctx, m->file_hash, NULL) == 1;
+        m->has_file_hash = ok;
+        // 暂存数据可能跨越多次连接续传而来，与声明的哈希不符则整体作废
+        if (ok && expect_hash && memcmp(m->file_hash, expect_hash, CAS_HASH_LEN) != 0)
+        {
+            write_log(LOG_LEVEL_WARN, "上传内容与声明的整文件哈希不符: %s", manifest_path);
+            ok = 0;
+        }
+    }
+    EVP_MD_CTX_free(file_ctx);
+
+    int ret = -1;
+    if (ok && cas_manifest_commit(m, manifest_path) == 0)
+    {
+        ret = 0;
+    }
+    else
+    {
+        write_log(LOG_LEVEL_ERROR, "文件入库失败: %s（已入库 %d 块）", manifest_path, m->count);
+        cas_release_chunks(m, m->count);
+    }
+    free(m);
+    return ret;
+}
+
+/**
+ * @brief 块哈希比较（qsort/bsearch使用）
+ * @param a 块
+ * @param b 块
+ * @return 按哈希字节序比较的结果
+ */
+static int cas_chunk_cmp(const void *a, const void *b)
+{
+    return memcmp(((const CasChunkRef *)a)->hash, ((const CasChunkRef *)b)->hash, CAS_HASH_LEN);
+}
+
+/**
+ * @brief 增量上传计划：标出新版本中哪些块已在该路径的当前版本里
+ * @param path 用户路径（当前版本的清单）
+ * @param m 客户端给出的新版本清单
+ * @param have 输出参数：每块一个字节，1=当前版本已有，0=需要客户端发送
+ * @return 需要客户端发送的字节数
+ * @details 只和同一路径的旧版本比较，不查询全局块表（不向客户端透露其他用户是否有某块内容）
+ */
+long long cas_delta_plan(const char *path, const CasManifest *m, unsigned char *have)
+{
+    CasManifest *old = cas_manifest_load(path);
+    if (old)
+    {
+        qsort(old->chunks, old->count, sizeof(CasChunkRef), cas_chunk_cmp);
+    }
+
+    long long missing = 0;
+    for (int i = 0; i < m->count; i++)
+    {
+        have[i] = old && bsearch(&m->chunks[i], old->chunks, old->count, sizeof(CasChunkRef), cas_chunk_cmp);
+        if (!have[i])
+            missing += m->chunks[i].len;
+    }
+    free(old);
+    return missing;
+}
+
+/**
+ * @brief 计算块清单的摘要（文件大小和每块的哈希、长度）
+ * @param m 清单
+ * @param digest 输出参数：SHA-256摘要
+ * @return 0=成功，-1=计算失败
+ */
+int cas_manifest_digest(const CasManifest *m, unsigned char *digest)
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    int ok = ctx && EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) == 1 &&
+             EVP_DigestUpdate(ctx, &m->size, sizeof(m->size)) == 1;
+    for (int i = 0; ok && i < m->count; i++)
+    {
+        ok = EVP_DigestUpdate(ctx, m->chunks[i].hash, CAS_HASH_LEN) == 1 &&
+             EVP_DigestUpdate(ctx, &m->chunks[i].len, sizeof(m->chunks[i].len)) == 1;
+    }
+    ok = ok && EVP_DigestFinal_ex(ctx, digest, NULL) == 1;
+    EVP_MD_CTX_free(ctx);
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief 增量上传入库：已有的块增加引用，其余块依次从暂存数据中读出并校验哈希后入库，最后写入新清单
+ * @param fd 暂存文件（按顺序只包含have为0的块）
+ * @param m 客户端给出的新版本清单（入库时记下服务器计算的整文件哈希）
+ * @param have cas_delta_plan给出的标记
+ * @param manifest_path 用户路径（写成清单）
+ * @return 0=成功，-1=失败（数据与声明的哈希不符、旧版本已被删除或写入失败，已入库的块引用全部撤销）
+ */
+int cas_ingest_delta(int fd, CasManifest *m, const unsigned char *have, const char *manifest_path)
+{
+    unsigned char *buf = malloc(CAS_CHUNK_MAX);
+    EVP_MD_CTX *file_ctx = EVP_MD_CTX_new();
+    if (!buf || !file_ctx || EVP_DigestInit_ex(file_ctx, EVP_sha256(), NULL) != 1)
+    {
+        free(buf);
+        EVP_MD_CTX_free(file_ctx);
+        write_log(LOG_LEVEL_ERROR, "增量上传入库失败（内存不足）: %s", manifest_path);
+        return -1;
+    }
+
+    long long pos = 0; // 下一个需要接收的块在暂存文件中的偏移
+    int done = 0;
+    for (; done < m->count; done++)
+    {
+        const CasChunkRef *c = &m->chunks[done];
+        if (have[done])
+        {
+            // 计划之后旧版本被删除或覆盖，块可能已不存在
+            if (!cas_chunk_acquire(c->hash))
+                break;
+            // 整文件哈希要覆盖全部内容：已有的块从块文件读出（已持有引用，块文件不会被删除）
+            char path[MAX_PATH_LEN];
+            cas_chunk_path(c->hash, path);
+            int chunk_fd = open(path, O_RDONLY | O_CLOEXEC);
+            int read_ret = chunk_fd == -1 ? -1 : cas_read_full(chunk_fd, (char *)buf, c->len, 0);
+            if (chunk_fd != -1)
+                close(chunk_fd);
+            if (read_ret == -1 || EVP_DigestUpdate(file_ctx, buf, c->len) != 1)
+            {
+                cas_chunk_release(c->hash);
+                break;
+            }
+            __atomic_fetch_add(&cas_chunks_deduped, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&cas_bytes_deduped, c->len, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        unsigned char hash[CAS_HASH_LEN];
+        if (cas_read_full(fd, (char *)buf, c->len, pos) == -1 ||
+            EVP_Digest(buf, c->len, hash, NULL, EVP_sha256(), NULL) != 1)
+            break;
+        if (memcmp(hash, c->hash, CAS_HASH_LEN) != 0)
+        {
+            write_log(LOG_LEVEL_WARN, "增量上传块校验失败: %s（第 %d 块）", manifest_path, done);
+            break;
+        }
+        if (EVP_DigestUpdate(file_ctx, buf, c->len) != 1 ||
+            cas_chunk_store(c->hash, (const char *)buf, c->len) == -1)
+            break;
+        pos += c->len;
+    }
+    free(buf);
+    int ok = done == m->count && EVP_DigestFinal_ex(file_ctx, m->file_hash, NULL) == 1;
+    m->has_file_hash = ok;
+    EVP_MD_CTX_free(file_ctx);
+
+    if (!ok || cas_manifest_commit(m, manifest_path) == -1)
+    {
+        write_log(LOG_LEVEL_ERROR, "增量上传入库失败: %s（块 %d/%d）", manifest_path, done, m->count);
+        cas_release_chunks(m, done);
+        return -1;
+    }
+    return 0;
+}
+
+// ========================== 后台入库 ==========================
+/**
+ * @brief 执行一个入库任务并调用其回调
+ * @param job 入库任务
+ * @return 无返回值
+ */
+static void cas_ingest_run(CasIngestJob *job)
+{
+    int ret = job->delta ? cas_ingest_delta(job->fd, job->delta, job->delta_have, job->manifest_path)
+                         : cas_ingest(job->fd, job->size, job->manifest_path, job->expect_hash);
+    job->done(job, ret);
+}
+
+/**
+ * @brief 入库线程主函数（按提交顺序取任务执行，停止时写完队列中剩余的任务再退出）
+ * @param arg 无实际意义（满足pthread_create要求）
+ * @return 无返回值（NULL）
+ */
+static void *cas_ingest_thread(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&cas_ingest_mutex);
+        while (!cas_ingest_head && !cas_ingest_stopping)
+        {
+            pthread_cond_wait(&cas_ingest_cond, &cas_ingest_mutex);
+        }
+        CasIngestJob *job = cas_ingest_head;
+        if (job)
+        {
+            cas_ingest_head = job->next;
+            if (!cas_ingest_head)
+                cas_ingest_tail = NULL;
+            cas_ingest_pending--;
+        }
+        pthread_mutex_unlock(&cas_ingest_mutex);
+        if (!job)
+            break; // 已停止且队列为空
+
+        cas_ingest_run(job);
+        // 回调中可能同步写操作日志：归还本线程借出的数据库连接
+        meta_store->release();
+    }
+    return NULL;
+}
+
+/**
+ * @brief 启动后台入库线程（全部创建失败时入库在提交者线程上同步执行）
+ * @param 无参数
+ * @return 无返回值（需在meta_store_init之后、线程池之前调用）
+ */
+void cas_ingest_start()
+{
+    for (int i = 0; i < CAS_INGEST_THREADS; i++)
+    {
+        if (pthread_create(&cas_ingest_threads[cas_ingest_started], NULL, cas_ingest_thread, NULL) != 0)
+        {
+            write_log(LOG_LEVEL_WARN, "入库线程创建失败: %s", strerror(errno));
+            continue;
+        }
+        cas_ingest_started++;
+    }
+    if (cas_ingest_started == 0)
+    {
+        write_log(LOG_LEVEL_WARN, "没有可用的入库线程，上传收齐后在工作线程上同步入库");
+        return;
+    }
+    write_log(LOG_LEVEL_INFO, "后台入库线程已启动（%d 个）", cas_ingest_started);
+}
+
+/**
+ * @brief 提交入库任务：放入队列由入库线程执行，结束后在入库线程上调用job->done
+ * @param job 入库任务（done之前提交者不能再访问）
+ * @return 无返回值
+ * @details 大文件入库要把暂存数据完整读一遍、逐块哈希并写盘，放在工作线程上会长时间占住线程，
+ *          绕过TRANSFER_SLICE_BYTES的分片让出；入库线程未启动或已停止时退化为当场同步执行
+ */
+void cas_ingest_submit(CasIngestJob *job)
+{
+    job->next = NULL;
+    pthread_mutex_lock(&cas_ingest_mutex);
+    if (cas_ingest_started == 0 || cas_ingest_stopping)
+    {
+        pthread_mutex_unlock(&cas_ingest_mutex);
+        cas_ingest_run(job);
+        return;
+    }
+    if (cas_ingest_tail)
+        cas_ingest_tail->next = job;
+    else
+        cas_ingest_head = job;
+    cas_ingest_tail = job;
+    int pending = ++cas_ingest_pending;
+    pthread_cond_signal(&cas_ingest_cond);
+    pthread_mutex_unlock(&cas_ingest_mutex);
+
+    __atomic_fetch_add(&cas_ingest_jobs, 1, __ATOMIC_RELAXED);
+    if (pending > CAS_INGEST_THREADS)
+    {
+        write_log(LOG_LEVEL_INFO, "入库线程繁忙，%d 个上传等待入库", pending - CAS_INGEST_THREADS);
+    }
+}
+
+/**
+ * @brief 停止后台入库线程（写完队列中剩余的任务后退出）
+ * @param 无参数
+ * @return 无返回值（调用前需已停止线程池，不再有新任务提交；需在停止操作日志写线程之前调用）
+ */
+void cas_ingest_stop()
+{
+    pthread_mutex_lock(&cas_ingest_mutex);
+    cas_ingest_stopping = 1;
+    pthread_cond_broadcast(&cas_ingest_cond);
+    pthread_mutex_unlock(&cas_ingest_mutex);
+
+    for (int i = 0; i < cas_ingest_started; i++)
+    {
+        pthread_join(cas_ingest_threads[i], NULL);
+    }
+    cas_ingest_started = 0;
+}
+
+/**
+ * @brief 让目标路径引用清单中的全部块
+ * @param m 清单（来自另一个路径）
+ * @param dst_path 目标路径
+ * @return 0=成功，-1=块已不存在（源文件同时被删除）或写入失败
+ */
+static int cas_link_manifest(const CasManifest *m, const char *dst_path)
+{
+    int acquired = 0;
+    while (acquired < m->count && cas_chunk_acquire(m->chunks[acquired].hash))
+    {
+        acquired++;
+    }
+    if (acquired < m->count || cas_manifest_commit(m, dst_path) == -1)
+    {
+        cas_release_chunks(m, acquired);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 让目标路径引用源文件的全部块（分享接收：只写一份清单，不复制数据）
+ * @param src_path 源文件清单路径
+ * @param dst_path 目标路径
+ * @return 0=成功，-1=源文件不存在或写入失败
+ */
+int cas_link(const char *src_path, const char *dst_path)
+{
+    CasManifest *m = cas_manifest_load(src_path);
+    if (!m)
+    {
+        return -1;
+    }
+    int ret = cas_link_manifest(m, dst_path);
+    free(m);
+    return ret;
+}
+
+/**
+ * @brief 在整文件哈希索引中查找内容相同的清单
+ * @param file_hash 整文件SHA-256
+ * @param size 文件大小
+ * @param scope 只在该目录（以/结尾）下查找，空串=所有用户的文件
+ * @param src_path 输出参数：找到的清单路径（MAX_PATH_LEN）
+ * @return 1=找到，0=没有
+ */
+static int cas_file_lookup(const unsigned char *file_hash, long long size, const char *scope, char *src_path)
+{
+    int found = 0;
+    size_t scope_len = strlen(scope);
+    CasFileEntry **bucket = cas_file_bucket(file_hash);
+    pthread_mutex_lock(&cas_file_mutex);
+    for (CasFileEntry *e = *bucket; e; e = e->next)
+    {
+        if (memcmp(e->hash, file_hash, CAS_HASH_LEN) == 0 && e->size == size &&
+            strncmp(e->path, scope, scope_len) == 0)
+        {
+            snprintf(src_path, MAX_PATH_LEN, "%s", e->path);
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cas_file_mutex);
+    return found;
+}
+
+/**
+ * @brief 秒传：请求者目录中有相同内容的文件时，目标路径直接引用其全部块
+ * @param file_hash 客户端声明的整文件SHA-256
+ * @param size 客户端声明的文件大小
+ * @param scope 只在该目录（请求者的根目录，以/结尾）下的清单中查找
+ * @param dst_path 目标路径
+ * @return 1=命中（已写入清单），0=未命中（需要正常上传或先证明持有文件）
+ * @details 不需要证明的快速路径：只凭哈希不能引用其他用户的文件，也无法探测服务器上是否有某个文件；
+ *          其他用户的相同内容要先通过持有证明（cas_proof_expect）再用cas_instant_link_from引用
+ */
+int cas_instant_link(const unsigned char *file_hash, long long size, const char *scope, const char *dst_path)
+{
+    char src_path[MAX_PATH_LEN];
+    if (!cas_file_lookup(file_hash, size, scope, src_path))
+    {
+        return 0;
+    }
+    return cas_instant_link_from(src_path, file_hash, size, dst_path);
+}
+
+/**
+ * @brief 秒传：目标路径引用指定源清单的全部块
+ * @param src_path 源清单路径（内容相同的文件）
+ * @param file_hash 整文件SHA-256
+ * @param size 文件大小
+ * @param dst_path 目标路径
+ * @return 1=命中（已写入清单），0=未命中（源文件已被覆盖或删除，需要正常上传）
+ * @details 索引只记录服务器入库时计算的哈希；引用前重新读取源清单，确认其整文件哈希和大小仍然一致
+ */
+int cas_instant_link_from(const char *src_path, const unsigned char *file_hash, long long size, const char *dst_path)
+{
+    CasManifest *m = cas_manifest_load(src_path);
+    int hit = m && m->has_file_hash && m->size == size &&
+              memcmp(m->file_hash, file_hash, CAS_HASH_LEN) == 0 &&
+              cas_link_manifest(m, dst_path) == 0;
+    if (hit)
+    {
+        __atomic_fetch_add(&cas_instant_hits, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&cas_instant_bytes, size, __ATOMIC_RELAXED);
+    }
+    free(m);
+    return hit;
+}
+
+/**
+ * @brief 按清单读取文件内容中的一段（可跨越块边界）
+ * @param m 清单
+ * @param offset 起始偏移
+ * @param buf 输出缓冲区
+ * @param len 读取长度（offset + len不超过文件大小）
+ * @return 0=成功，-1=块文件已不存在或读取失败
+ */
+static int cas_manifest_read(const CasManifest *m, long long offset, char *buf, size_t len)
+{
+    // 二分查找偏移所在的块
+    int lo = 0, hi = m->count - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (m->chunks[mid].offset <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    for (int i = lo; len > 0 && i < m->count; i++)
+    {
+        const CasChunkRef *c = &m->chunks[i];
+        long long chunk_off = offset - c->offset;
+        size_t n = c->len - (size_t)chunk_off;
+        if (n > len)
+            n = len;
+        char path[MAX_PATH_LEN];
+        cas_chunk_path(c->hash, path);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        int ret = fd == -1 ? -1 : cas_read_full(fd, buf, n, chunk_off);
+        if (fd != -1)
+            close(fd);
+        if (ret == -1)
+            return -1;
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return len == 0 ? 0 : -1;
+}
+
+/**
+ * @brief 生成跨用户秒传的持有证明挑战：随机nonce和CAS_PROOF_RANGES个随机字节范围
+ * @param size 文件大小（不小于CAS_PROOF_MIN_SIZE）
+ * @param nonce 输出参数：随机数（CAS_HASH_LEN字节）
+ * @param ranges 输出参数：字节范围（CAS_PROOF_RANGES个）
+ * @return 0=成功，-1=随机数生成失败
+ */
+int cas_proof_challenge(long long size, unsigned char *nonce, CasProofRange *ranges)
+{
+    uint64_t pick[CAS_PROOF_RANGES];
+    if (RAND_bytes(nonce, CAS_HASH_LEN) != 1 || RAND_bytes((unsigned char *)pick, sizeof(pick)) != 1)
+    {
+        write_log(LOG_LEVEL_ERROR, "生成秒传挑战失败（随机数不可用）");
+        return -1;
+    }
+    for (int i = 0; i < CAS_PROOF_RANGES; i++)
+    {
+        ranges[i].len = size < CAS_PROOF_RANGE_LEN ? (uint32_t)size : CAS_PROOF_RANGE_LEN;
+        ranges[i].offset = (long long)(pick[i] % (uint64_t)(size - ranges[i].len + 1));
+    }
+    return 0;
+}
+
+/**
+ * @brief 计算跨用户秒传的期望证明：在所有用户的文件中找相同内容的清单，按挑战读出数据计算
+ * @param file_hash 客户端声明的整文件SHA-256
+ * @param size 客户端声明的文件大小
+ * @param nonce 挑战的随机数（CAS_HASH_LEN字节）
+ * @param ranges 挑战的字节范围（CAS_PROOF_RANGES个）
+ * @param proof 输出参数：SHA-256(nonce || 各范围的数据)
+ * @param src_path 输出参数：相同内容的源清单路径（MAX_PATH_LEN）
+ * @return 1=有相同内容的文件且已算出，0=没有（或源文件已变化、块读取失败）
+ * @details 客户端用本地文件按相同方式计算；只知道整文件哈希的一方算不出证明，无法借秒传取得别人的文件
+ */
+int cas_proof_expect(const unsigned char *file_hash, long long size, const unsigned char *nonce,
+                     const CasProofRange *ranges, unsigned char *proof, char *src_path)
+{
+    if (!cas_file_lookup(file_hash, size, "", src_path))
+    {
+        return 0;
+    }
+    CasManifest *m = cas_manifest_load(src_path);
+    if (!m || !m->has_file_hash || m->size != size || memcmp(m->file_hash, file_hash, CAS_HASH_LEN) != 0)
+    {
+        free(m);
+        return 0;
+    }
+
+    char buf[CAS_PROOF_RANGE_LEN];
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    int ok = ctx && EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) == 1 &&
+             EVP_DigestUpdate(ctx, nonce, CAS_HASH_LEN) == 1;
+    for (int i = 0; ok && i < CAS_PROOF_RANGES; i++)
+    {
+        ok = cas_manifest_read(m, ranges[i].offset, buf, ranges[i].len) == 0 &&
+             EVP_DigestUpdate(ctx, buf, ranges[i].len) == 1;
+    }
+    ok = ok && EVP_DigestFinal_ex(ctx, proof, NULL) == 1;
+    EVP_MD_CTX_free(ctx);
+    free(m);
+    return ok;
+}
+
+/**
+ * @brief 删除文件清单并释放其块引用（引用归零的块文件随之删除）
+ * @param path 清单路径
+ * @return 0=成功，-1=删除失败
+ */
+int cas_remove(const char *path)
+{
+    pthread_mutex_lock(&cas_manifest_mutex);
+    CasManifest *m = cas_manifest_load(path);
+    int ret = unlink(path);
+    if (ret == 0 && m && m->has_file_hash)
+        cas_file_index_drop(m->file_hash, path);
+    pthread_mutex_unlock(&cas_manifest_mutex);
+
+    if (m)
+    {
+        if (ret == 0)
+            cas_release_chunks(m, m->count);
+        free(m);
+    }
+    return ret == 0 ? 0 : -1;
+}
+
+/**
+ * @brief 递归删除目录（其中每个清单的块引用都会释放）
+ * @param dir_path 目录路径
+ * @return 0=全部删除，-1=有文件或目录删除失败
+ */
+int cas_remove_tree(const char *dir_path)
+{
+    DIR *dir = opendir(dir_path);
+    if (!dir)
+    {
+        return -1;
+    }
+
+    int ret = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        char entry_path[MAX_PATH_LEN];
+        snprintf(entry_path, MAX_PATH_LEN, "%s/%s", dir_path, entry->d_name);
+        struct stat st;
+        if (lstat(entry_path, &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            if (cas_remove_tree(entry_path) == -1)
+                ret = -1;
+        }
+        else if (cas_remove(entry_path) == -1)
+        {
+            ret = -1;
+        }
+    }
+    closedir(dir);
+
+    if (rmdir(dir_path) == -1)
+    {
+        ret = -1;
+    }
+    return ret;
+}
+
+/**
+ * @brief 定位下载偏移所在的数据块：必要时把dl->fd切换到该块的文件
+ * @param dl 下载状态（dl->manifest已加载，dl->offset小于文件大小）
+ * @param chunk_off 输出参数：块内偏移
+ * @param chunk_left 输出参数：块内从该偏移起剩余的字节数
+ * @return 0=成功，-1=块文件打开失败
+ */
+int cas_download_seek(ClientDownloadInfo *dl, off_t *chunk_off, size_t *chunk_left)
+{
+    const CasManifest *m = dl->manifest;
+    const CasChunkRef *c = dl->fd >= 0 ? &m->chunks[dl->chunk_idx] : NULL;
+    if (!c || dl->offset < c->offset || dl->offset >= c->offset + c->len)
+    {
+        // 二分查找偏移所在的块（顺序下载时只在跨块时进入这里）
+        int lo = 0, hi = m->count - 1;
+        while (lo < hi)
+        {
+            int mid = (lo + hi + 1) / 2;
+            if (m->chunks[mid].offset <= dl->offset)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+
+        if (dl->fd >= 0)
+        {
+            close(dl->fd);
+        }
+        char path[MAX_PATH_LEN];
+        cas_chunk_path(m->chunks[lo].hash, path);
+        dl->fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (dl->fd == -1)
+        {
+            return -1;
+        }
+        dl->chunk_idx = lo;
+        c = &m->chunks[lo];
+    }
+
+    *chunk_off = dl->offset - c->offset;
+    *chunk_left = c->len - (size_t)*chunk_off;
+    return 0;
+}
+
+// ========================== 启动扫描 ==========================
+/**
+ * @brief 启动时为清单中的块记一次引用（不写块文件）
+ * @param c 块
+ * @return 0=成功，-1=内存不足
+ */
+static int cas_index_add(const CasChunkRef *c)
+{
+    CasIndexEntry **bucket;
+    CasIndexShard *shard = cas_index_shard(c->hash, &bucket);
+    pthread_mutex_lock(&shard->lock);
+    CasIndexEntry *e = cas_index_find(bucket, c->hash);
+    if (!e)
+    {
+        e = cas_index_insert(bucket, c->hash, c->len);
+        if (!e)
+        {
+            pthread_mutex_unlock(&shard->lock);
+            return -1;
+        }
+        char path[MAX_PATH_LEN];
+        cas_chunk_path(c->hash, path);
+        if (access(path, F_OK) == -1)
+        {
+            write_log(LOG_LEVEL_ERROR, "清单引用的块文件缺失: %s", path);
+        }
+    }
+    e->refs++;
+    pthread_mutex_unlock(&shard->lock);
+    return 0;
+}
+
+/**
+ * @brief 扫描目录树：清单计入引用，旧版直接保存的文件转换为清单
+ * @param dir_path 目录路径
+ * @param manifests 输出参数：累加清单数
+ * @param converted 输出参数：累加转换的旧文件数
+ * @return 无返回值
+ */
+static void cas_scan_tree(const char *dir_path, int *manifests, int *converted)
+{
+    DIR *dir = opendir(dir_path);
+    if (!dir)
+    {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        char entry_path[MAX_PATH_LEN];
+        snprintf(entry_path, MAX_PATH_LEN, "%s/%s", dir_path, entry->d_name);
+        struct stat st;
+        if (lstat(entry_path, &st) == -1)
+            continue;
+        if (S_ISDIR(st.st_mode))
+        {
+            cas_scan_tree(entry_path, manifests, converted);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode))
+            continue;
+
+        CasManifest *m = cas_manifest_load(entry_path);
+        if (m)
+        {
+            for (int i = 0; i < m->count; i++)
+            {
+                cas_index_add(&m->chunks[i]);
+            }
+            if (m->has_file_hash)
+                cas_file_index_put(m->file_hash, m->size, entry_path);
+            free(m);
+            (*manifests)++;
+            continue;
+        }
+
+        // 旧版文件：内容切块入库，原路径换成清单
+        int fd = open(entry_path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1 || cas_ingest(fd, st.st_size, entry_path, NULL) == -1)
+        {
+            write_log(LOG_LEVEL_ERROR, "转换旧文件失败: %s", entry_path);
+        }
+        else
+        {
+            (*converted)++;
+        }
+        if (fd != -1)
+            close(fd);
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief 删除目录中的所有文件（清理上次运行残留的临时文件）
+ * @param dir_path 目录路径
+ * @return 无返回值
+ */
+static void cas_clear_dir(const char *dir_path)
+{
+    DIR *dir = opendir(dir_path);
+    if (!dir)
+    {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        char path[MAX_PATH_LEN];
+        snprintf(path, MAX_PATH_LEN, "%s/%s", dir_path, entry->d_name);
+        unlink(path);
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief 删除没有被任何清单引用的块文件（上次运行在写清单前退出时留下）
+ * @param 无参数
+ * @return 删除的块数
+ */
+static int cas_collect_garbage()
+{
+    int removed = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        char sub[MAX_PATH_LEN];
+        snprintf(sub, MAX_PATH_LEN, "%s/%02x", CAS_CHUNK_DIR, i);
+        DIR *dir = opendir(sub);
+        if (!dir)
+            continue;
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            unsigned char hash[CAS_HASH_LEN];
+            if (strlen(entry->d_name) != CAS_HASH_LEN * 2 || cas_hash_from_hex(entry->d_name, hash) == -1)
+                continue;
+
+            CasIndexEntry **bucket;
+            cas_index_shard(hash, &bucket);
+            if (!cas_index_find(bucket, hash))
+            {
+                char path[MAX_PATH_LEN];
+                snprintf(path, MAX_PATH_LEN, "%s/%s", sub, entry->d_name);
+                unlink(path);
+                removed++;
+            }
+        }
+        closedir(dir);
+    }
+    return removed;
+}
+
+/**
+ * @brief 初始化块存储：创建目录，扫描所有用户目录中的清单重建块引用计数，
+ *        把旧版直接保存的文件转换为清单，删除没有被引用的块和残留的临时文件
+ * @param 无参数
+ * @return 0=成功，-1=失败（目录无法创建）
+ * @details 清单是引用关系的唯一依据，引用计数和整文件哈希索引只保存在内存中，每次启动由清单重建
+ */
+int cas_init()
+{
+    cas_gear_init();
+    if (mkdir_recursive(CAS_TMP_DIR, 0700) == -1 || mkdir_recursive(CAS_CHUNK_DIR, 0700) == -1)
+    {
+        return -1;
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        char sub[MAX_PATH_LEN];
+        snprintf(sub, MAX_PATH_LEN, "%s/%02x", CAS_CHUNK_DIR, i);
+        if (mkdir(sub, 0700) == -1 && errno != EEXIST)
+        {
+            write_log(LOG_LEVEL_ERROR, "创建块目录失败: %s, %s", sub, strerror(errno));
+            return -1;
+        }
+    }
+    cas_clear_dir(CAS_TMP_DIR);
+
+    // 服务器根目录下的每个子目录是一个用户目录（跳过块存储自身）
+    int manifests = 0, converted = 0;
+    DIR *root = opendir(SERVER_ROOT);
+    if (root)
+    {
+        struct dirent *entry;
+        while ((entry = readdir(root)) != NULL)
+        {
+            if (entry->d_name[0] == '.')
+                continue;
+            char path[MAX_PATH_LEN];
+            snprintf(path, MAX_PATH_LEN, "%s/%s", SERVER_ROOT, entry->d_name);
+            struct stat st;
+            if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode))
+            {
+                cas_scan_tree(path, &manifests, &converted);
+            }
+        }
+        closedir(root);
+    }
+    int removed = cas_collect_garbage();
+
+    write_log(LOG_LEVEL_INFO, "块存储初始化完成：%d 个清单，转换旧文件 %d 个，清理无引用块 %d 个",
+              manifests, converted, removed);
+    return 0;
+}
+
+/**
+ * @brief 把块存储的块数、占用空间和去重命中情况写入日志
+ * @param 无参数
+ * @return 无返回值
+ */
+void cas_log_stats()
+{
+    long long chunks = 0, bytes = 0, refs = 0;
+    for (int i = 0; i < CAS_INDEX_SHARDS; i++)
+    {
+        CasIndexShard *shard = &cas_index[i];
+        pthread_mutex_lock(&shard->lock);
+        for (int b = 0; b < CAS_INDEX_BUCKETS; b++)
+        {
+            for (CasIndexEntry *e = shard->buckets[b]; e; e = e->next)
+            {
+                chunks++;
+                bytes += e->len;
+                refs += e->refs;
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    write_log(LOG_LEVEL_INFO, "块存储统计：%lld 个块（%lld 字节，被引用 %lld 次），本次运行新写入 %llu 块，去重 %llu 块（省去写入 %llu 字节），秒传 %llu 次（省去传输 %llu 字节），后台入库 %llu 个上传",
+              chunks, bytes, refs,
+              __atomic_load_n(&cas_chunks_written, __ATOMIC_RELAXED),
+              __atomic_load_n(&cas_chunks_deduped, __ATOMIC_RELAXED),
+              __atomic_load_n(&cas_bytes_deduped, __ATOMIC_RELAXED),
+              __atomic_load_n(&cas_instant_hits, __ATOMIC_RELAXED),
+              __atomic_load_n(&cas_instant_bytes, __ATOMIC_RELAXED),
+              __atomic_load_n(&cas_ingest_jobs, __ATOMIC_RELAXED));
+}
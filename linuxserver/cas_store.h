@@ -0,0 +1,199 @@
+#ifndef CAS_STORE_H
+#define CAS_STORE_H
+
+#include "cloud_disk.h"
+
+/**
+ * @brief 初始化块存储：创建目录，扫描所有用户目录中的清单重建块引用计数，
+ *        把旧版直接保存的文件转换为清单，删除没有被引用的块和残留的临时文件
+ * @param 无参数
+ * @return 0=成功，-1=失败（目录无法创建）
+ * @details 清单是引用关系的唯一依据，引用计数和整文件哈希索引只保存在内存中，每次启动由清单重建
+ */
+int cas_init();
+
+/**
+ * @brief 创建上传暂存文件（位于块存储的临时目录，创建后立即unlink，关闭即释放）
+ * @param 无参数
+ * @return 暂存文件的文件描述符，-1=创建失败
+ */
+int cas_stage_open();
+
+/**
+ * @brief 把文件内容切块入库，并在用户路径写入清单（原子替换，旧清单的块引用随之释放）
+ * @param fd 文件内容所在的文件描述符（按偏移读取，不改变文件位置）
+ * @param size 文件大小
+ * @param manifest_path 用户可见的文件路径（写成清单）
+ * @param expect_hash 客户端声明的整文件SHA-256（NULL=不校验）
+ * @return 0=成功，-1=失败（内容与声明的哈希不符或写入失败，已入库的块引用全部撤销）
+ * @details 按内容定义切块；已存在的块只增加引用计数，不再写盘
+ */
+int cas_ingest(int fd, long long size, const char *manifest_path, const unsigned char *expect_hash);
+
+/**
+ * @brief 块哈希转十六进制字符串
+ * @param hash 块哈希
+ * @param hex 输出参数：十六进制串（CAS_HASH_LEN * 2 + 1字节）
+ * @return 无返回值
+ */
+void cas_hash_to_hex(const unsigned char *hash, char *hex);
+
+/**
+ * @brief 十六进制字符串转块哈希
+ * @param hex 十六进制串（至少CAS_HASH_LEN * 2个字符）
+ * @param hash 输出参数：块哈希
+ * @return 0=成功，-1=含非十六进制字符
+ */
+int cas_hash_from_hex(const char *hex, unsigned char *hash);
+
+/**
+ * @brief 增量上传计划：标出新版本中哪些块已在该路径的当前版本里
+ * @param path 用户路径（当前版本的清单）
+ * @param m 客户端给出的新版本清单
+ * @param have 输出参数：每块一个字节，1=当前版本已有，0=需要客户端发送
+ * @return 需要客户端发送的字节数
+ * @details 只和同一路径的旧版本比较，不查询全局块表（不向客户端透露其他用户是否有某块内容）
+ */
+long long cas_delta_plan(const char *path, const CasManifest *m, unsigned char *have);
+
+/**
+ * @brief 计算块清单的摘要（文件大小和每块的哈希、长度）
+ * @param m 清单
+ * @param digest 输出参数：SHA-256摘要
+ * @return 0=成功，-1=计算失败
+ */
+int cas_manifest_digest(const CasManifest *m, unsigned char *digest);
+
+/**
+ * @brief 增量上传入库：已有的块增加引用，其余块依次从暂存数据中读出并校验哈希后入库，最后写入新清单
+ * @param fd 暂存文件（按顺序只包含have为0的块）
+ * @param m 客户端给出的新版本清单（入库时记下服务器计算的整文件哈希）
+ * @param have cas_delta_plan给出的标记
+ * @param manifest_path 用户路径（写成清单）
+ * @return 0=成功，-1=失败（数据与声明的哈希不符、旧版本已被删除或写入失败，已入库的块引用全部撤销）
+ */
+int cas_ingest_delta(int fd, CasManifest *m, const unsigned char *have, const char *manifest_path);
+
+/**
+ * @brief 启动后台入库线程（全部创建失败时入库在提交者线程上同步执行）
+ * @param 无参数
+ * @return 无返回值（需在meta_store_init之后、线程池之前调用）
+ */
+void cas_ingest_start();
+
+/**
+ * @brief 提交入库任务：放入队列由入库线程执行，结束后在入库线程上调用job->done
+ * @param job 入库任务（done之前提交者不能再访问）
+ * @return 无返回值
+ * @details 大文件入库要把暂存数据完整读一遍、逐块哈希并写盘，放在工作线程上会长时间占住线程，
+ *          绕过TRANSFER_SLICE_BYTES的分片让出；入库线程未启动或已停止时退化为当场同步执行
+ */
+void cas_ingest_submit(CasIngestJob *job);
+
+/**
+ * @brief 停止后台入库线程（写完队列中剩余的任务后退出）
+ * @param 无参数
+ * @return 无返回值（调用前需已停止线程池，不再有新任务提交；需在停止操作日志写线程之前调用）
+ */
+void cas_ingest_stop();
+
+/**
+ * @brief 读取并解析文件清单
+ * @param path 清单路径
+ * @return 清单（调用方free），NULL=不存在或不是清单
+ */
+CasManifest *cas_manifest_load(const char *path);
+
+/**
+ * @brief 只读取清单头部，获取文件大小（文件列表使用）
+ * @param path 清单路径
+ * @param size 输出参数：文件大小
+ * @return 1=是清单，0=不是清单或读取失败
+ */
+int cas_manifest_size(const char *path, long long *size);
+
+/**
+ * @brief 让目标路径引用源文件的全部块（分享接收：只写一份清单，不复制数据）
+ * @param src_path 源文件清单路径
+ * @param dst_path 目标路径
+ * @return 0=成功，-1=源文件不存在或写入失败
+ */
+int cas_link(const char *src_path, const char *dst_path);
+
+/**
+ * @brief 秒传：请求者目录中有相同内容的文件时，目标路径直接引用其全部块
+ * @param file_hash 客户端声明的整文件SHA-256
+ * @param size 客户端声明的文件大小
+ * @param scope 只在该目录（请求者的根目录，以/结尾）下的清单中查找
+ * @param dst_path 目标路径
+ * @return 1=命中（已写入清单），0=未命中（需要正常上传或先证明持有文件）
+ * @details 不需要证明的快速路径：只凭哈希不能引用其他用户的文件，也无法探测服务器上是否有某个文件；
+ *          其他用户的相同内容要先通过持有证明（cas_proof_expect）再用cas_instant_link_from引用
+ */
+int cas_instant_link(const unsigned char *file_hash, long long size, const char *scope, const char *dst_path);
+
+/**
+ * @brief 秒传：目标路径引用指定源清单的全部块
+ * @param src_path 源清单路径（内容相同的文件）
+ * @param file_hash 整文件SHA-256
+ * @param size 文件大小
+ * @param dst_path 目标路径
+ * @return 1=命中（已写入清单），0=未命中（源文件已被覆盖或删除，需要正常上传）
+ * @details 索引只记录服务器入库时计算的哈希；引用前重新读取源清单，确认其整文件哈希和大小仍然一致
+ */
+int cas_instant_link_from(const char *src_path, const unsigned char *file_hash, long long size, const char *dst_path);
+
+/**
+ * @brief 生成跨用户秒传的持有证明挑战：随机nonce和CAS_PROOF_RANGES个随机字节范围
+ * @param size 文件大小（不小于CAS_PROOF_MIN_SIZE）
+ * @param nonce 输出参数：随机数（CAS_HASH_LEN字节）
+ * @param ranges 输出参数：字节范围（CAS_PROOF_RANGES个）
+ * @return 0=成功，-1=随机数生成失败
+ */
+int cas_proof_challenge(long long size, unsigned char *nonce, CasProofRange *ranges);
+
+/**
+ * @brief 计算跨用户秒传的期望证明：在所有用户的文件中找相同内容的清单，按挑战读出数据计算
+ * @param file_hash 客户端声明的整文件SHA-256
+ * @param size 客户端声明的文件大小
+ * @param nonce 挑战的随机数（CAS_HASH_LEN字节）
+ * @param ranges 挑战的字节范围（CAS_PROOF_RANGES个）
+ * @param proof 输出参数：SHA-256(nonce || 各范围的数据)
+ * @param src_path 输出参数：相同内容的源清单路径（MAX_PATH_LEN）
+ * @return 1=有相同内容的文件且已算出，0=没有（或源文件已变化、块读取失败）
+ * @details 客户端用本地文件按相同方式计算；只知道整文件哈希的一方算不出证明，无法借秒传取得别人的文件
+ */
+int cas_proof_expect(const unsigned char *file_hash, long long size, const unsigned char *nonce,
+                     const CasProofRange *ranges, unsigned char *proof, char *src_path);
+
+/**
+ * @brief 删除文件清单并释放其块引用（引用归零的块文件随之删除）
+ * @param path 清单路径
+ * @return 0=成功，-1=删除失败
+ */
+int cas_remove(const char *path);
+
+/**
+ * @brief 递归删除目录（其中每个清单的块引用都会释放）
+ * @param dir_path 目录路径
+ * @return 0=全部删除，-1=有文件或目录删除失败
+ */
+int cas_remove_tree(const char *dir_path);
+
+/**
+ * @brief 定位下载偏移所在的数据块：必要时把dl->fd切换到该块的文件
+ * @param dl 下载状态（dl->manifest已加载，dl->offset小于文件大小）
+ * @param chunk_off 输出参数：块内偏移
+ * @param chunk_left 输出参数：块内从该偏移起剩余的字节数
+ * @return 0=成功，-1=块文件打开失败
+ */
+int cas_download_seek(ClientDownloadInfo *dl, off_t *chunk_off, size_t *chunk_left);
+
+/**
+ * @brief 把块存储的块数、占用空间和去重命中情况写入日志
+ * @param 无参数
+ * @return 无返回值
+ */
+void cas_log_stats();
+
+#endif // CAS_STORE_H
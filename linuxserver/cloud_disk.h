@@ -26,16 +26,73 @@
 #include <libgen.h>   // 用于 dirname/basename 函数
 #include <stdarg.h>   // 用于日志函数可变参数
 #include <sys/time.h> // 用于时间统计
+#include <sys/sendfile.h> // 用于下载零拷贝发送
+#include <sys/uio.h>      // 用于响应队列合并发送（writev/sendmsg）
+#include <stddef.h>       // 用于offsetof
+#include <limits.h>       // 用于LLONG_MAX等整数上限
 
 // ========================== 常量定义 ==========================
 #define PORT 8000                          // 服务器端口号
-#define MAX_EVENTS 1024                    // 最大epoll事件数（最大用户连接数）
+#define MAX_EVENTS 1024                    // 单次epoll_wait最多返回的事件数
+#define CONN_CHUNK_SHIFT 10                // 连接表每块容纳 1<<10 个连接
+#define CONN_CHUNK_SIZE (1 << CONN_CHUNK_SHIFT)
+#define CONN_MAX_CHUNKS 1024               // 连接表最多块数（块按需分配）
+#define MAX_CONNECTIONS (CONN_CHUNK_SIZE * CONN_MAX_CHUNKS) // 可管理的最大fd（约100万）
 #define BUFFER_SIZE 4096                   // 单次数据传输缓冲区大小
-#define MAX_USERS 100                      // 最大缓存用户数
+#define SENDFILE_CHUNK_SIZE (1 << 20)      // 单次sendfile最多发送的字节数
+#define UPLOAD_PIPE_SIZE (1 << 20)         // 上传splice中转管道的容量（单次最多搬运的字节数）
+#define MAX_FRAME_SIZE (1 << 20)           // 单个JSON控制帧的最大长度
+#define FRAME_BUF_INIT 1024                // 控制帧输入缓冲区初始容量（按需翻倍，空闲时释放）
+#define OUT_QUEUE_MAX (4 << 20)            // 单个连接待发送响应的字节上限（超过视为慢客户端，断开）
+#define OUT_IOV_MAX 64                     // 单次sendmsg合并发送的最大帧数
+#define USER_CACHE_SHARDS 64               // 用户缓存分片数（必须是2的幂，各分片独立加锁）
+#define USER_CACHE_CAPACITY (256 * 1024)   // 用户缓存最多容纳的用户数（满了按近似LRU淘汰）
+#define USER_CACHE_BUCKETS (USER_CACHE_CAPACITY / USER_CACHE_SHARDS) // 每个分片的哈希桶数（2的幂）
+#define SESSION_SHARDS 64                  // 在线会话索引分片数（必须是2的幂，各分片独立加锁）
+#define SESSION_BUCKETS 256                // 在线会话索引每个分片的哈希桶数（2的幂）
 #define SERVER_ROOT "/home/tmn/servertest" // 服务器根目录（所有用户目录的父目录）
+#define CAS_ROOT SERVER_ROOT "/.cas"       // 块存储目录（chunks/按哈希存放的数据块，tmp/写入中的临时文件，partial/未完成的上传）
+#define CAS_CHUNK_MIN (1 << 18)            // 内容定义切块的最小块长度（最后一块可能更小）
+#define CAS_CHUNK_AVG (1 << 20)            // 内容定义切块的目标平均块长度
+#define CAS_CHUNK_MAX (1 << 22)            // 内容定义切块的最大块长度
+#define CAS_HASH_LEN 32                    // 块哈希长度（SHA-256）
+#define CAS_INDEX_SHARDS 64                // 块引用计数表分片数（必须是2的幂，各分片独立加锁）
+#define CAS_INDEX_BUCKETS 4096             // 块引用计数表每个分片的哈希桶数（2的幂）
+#define CAS_FILE_BUCKETS 4096              // 整文件哈希索引的哈希桶数（2的幂）
+#define CAS_PROOF_RANGES 4                 // 跨用户秒传持有证明：服务器随机选取的字节范围数
+#define CAS_PROOF_RANGE_LEN 4096           // 跨用户秒传持有证明：每个字节范围的长度
+#define CAS_PROOF_MIN_SIZE CAS_CHUNK_MIN   // 跨用户秒传的最小文件大小（更小的文件内容容易被猜出，直接上传）
+#define CAS_INGEST_THREADS 2               // 后台入库线程数（上传收齐后切块、哈希、写清单，不占用工作线程）
+#define UPLOAD_PARTIAL_DIR CAS_ROOT "/partial" // 未完成上传的暂存数据和续传日志（按续传键命名）
+#define UPLOAD_JOURNAL_STEP (64 << 20)     // 上传每接收这么多字节更新一次续传日志（服务器异常退出后最多重传这么多）
+#define UPLOAD_PARTIAL_TTL (7 * 24 * 3600) // 未完成上传的保留时长（秒），续传日志超过该时长未更新即回收
+#define UPLOAD_PARTIAL_GC_INTERVAL 3600    // 运行中回收过期未完成上传的最短间隔（秒）
+#define MULTIPART_PART_SIZE (16 << 20)     // 分段上传的段大小（最后一段可能更小），客户端每个连接每次上传一段
+#define MULTIPART_ID_LEN 16                // 分段上传ID的随机字节数（十六进制串为两倍长度）
+#define MULTIPART_MAX_PER_USER 4           // 每个用户同时进行的分段上传数上限（暂存文件按整个文件大小预分配）
+#define MULTIPART_TTL (24 * 3600)          // 分段上传超过该时长没有新的段即回收（秒）
 #define THREAD_POOL_SIZE 8                 // 线程池大小
-#define MAX_QUEUE_SIZE 100                 // 请求队列最大长度
+#define MAX_QUEUE_SIZE 128                 // 每个工作线程每条任务通道的最大长度
+#define INTERACTIVE_WORKERS 2              // 只处理交互任务的预留工作线程数（编号0起）
+#define TRANSFER_SLICE_BYTES (4 << 20)     // 单个上传/下载任务最多搬运的字节数，超过即让出线程
+#define DEFER_RETRY_MS 10                  // 线程池满时延后派发的任务的重试间隔（毫秒）
+#define OVERLOAD_QUEUE_MS 200              // 请求排队超过该时长视为过载，直接回复busy
+#define BUSY_RETRY_MAX_MS 5000             // busy响应建议客户端重试等待的上限（毫秒）
+#define LATENCY_BUCKETS 32                 // 排队延迟直方图桶数（第i桶为[2^(i-1), 2^i)微秒）
 #define MAX_PATH_LEN 4096                  // 最大文件路径长度
+#define MAX_REACTORS 64                    // reactor线程数上限
+#define DB_POOL_SIZE (THREAD_POOL_SIZE + 1) // MySQL连接池大小（每个工作线程和操作日志写线程同时最多借出一个连接）
+#define DB_HEALTH_INTERVAL 30              // MySQL连接池后台健康检查间隔（秒）
+#define HISTORY_PAGE_DEFAULT 100           // 操作历史每页默认条数
+#define HISTORY_PAGE_MAX 500               // 操作历史每页最大条数
+#define OPLOG_RING_SIZE 4096               // 操作日志环形队列容量（必须是2的幂）
+#define OPLOG_BATCH_MAX 256                // 操作日志单条多行INSERT的最大行数（攒够即唤醒写线程）
+#define OPLOG_FLUSH_MS_DEFAULT 100         // 操作日志默认刷盘间隔（毫秒，-L 0 为同步写入）
+#define SESSION_TOKEN_TTL (7 * 24 * 3600)  // 会话令牌有效期（秒），断线重连时凭令牌恢复登录
+#define SESSION_TOKEN_KEY_LEN 32           // 会话令牌HMAC-SHA256签名密钥长度（字节）
+#define SESSION_TOKEN_MAC_HEX_LEN 64       // 会话令牌签名的十六进制长度
+#define SESSION_TOKEN_MAX_LEN 160          // 会话令牌最大长度（用户名.过期时间戳.签名）
+#define LISTEN_BACKLOG 512                 // 每个监听socket的全连接队列长度
 
 // ========================== 枚举类型定义 ==========================
 /**
@@ -47,6 +104,16 @@ typedef enum
     UP_STATE_RECEIVING // 接收上传数据状态
 } UploadState;
 
+/**
+ * @brief 分段上传中一段的状态
+ */
+typedef enum
+{
+    MULTIPART_PART_MISSING,   // 未收到（或上次接收中断）
+    MULTIPART_PART_RECEIVING, // 某个连接正在接收
+    MULTIPART_PART_DONE       // 已完整写入暂存文件
+} MultipartPartState;
+
 /**
  * @brief 下载状态枚举
  */
@@ -74,20 +141,180 @@ typedef enum
 {
     TASK_CLIENT_MESSAGE, // 客户端普通消息任务
     TASK_UPLOAD_DATA,    // 上传数据处理任务
-    TASK_DOWNLOAD_DATA   // 下载数据处理任务
+    TASK_DOWNLOAD_DATA,  // 下载数据处理任务
+    TASK_FLUSH_OUTPUT,   // 发送缓冲区可写，继续发送排队的响应
+    TASK_URING_MESSAGE,  // io_uring后端：处理已收齐的一帧JSON请求
+    TASK_URING_FINISH,   // io_uring后端：上传/下载数据传输完毕后的收尾
+    TASK_URING_CLOSE     // io_uring后端：连接断开后的会话清理
 } TaskType;
 
+/**
+ * @brief 任务通道枚举（线程池按通道调度，交互请求不排在大文件传输后面）
+ */
+typedef enum
+{
+    LANE_INTERACTIVE, // 交互通道：控制消息、响应续发（登录、列表、历史等）
+    LANE_BULK,        // 批量通道：上传/下载数据传输（按字节预算分片执行）
+    TASK_LANES        // 通道数量
+} TaskLane;
+
+/**
+ * @brief 网络/文件IO后端枚举
+ */
+typedef enum
+{
+    IO_BACKEND_EPOLL, // 边缘触发epoll + 线程池（默认）
+    IO_BACKEND_URING  // io_uring完成事件驱动（-u，需USE_IO_URING=1编译）
+} IoBackend;
+
+/**
+ * @brief 元数据存储后端枚举（用户、分享、操作日志）
+ */
+typedef enum
+{
+    META_BACKEND_MYSQL, // MySQL连接池（默认）
+    META_BACKEND_SQLITE // 内嵌SQLite数据库文件（-S 文件，需USE_SQLITE=1编译）
+} MetaBackend;
+
+/**
+ * @brief 预编译语句编号（MySQL与SQLite各有一份对应的SQL，每个数据库连接缓存一份，首次使用时prepare）
+ */
+typedef enum
+{
+    STMT_USER_PASSWORD, // 按用户名查询密码（登录）
+    STMT_USER_ID,       // 按用户名查询用户ID（注册查重）
+    STMT_USER_ROOT_DIR, // 按用户名查询用户根目录
+    STMT_HISTORY,       // 按游标分页查询用户的操作记录（time, id倒序）
+    STMT_INSERT_LOG,    // 插入一条操作记录
+    STMT_INSERT_USER,   // 注册新用户
+    STMT_SET_ROOT_DIR,  // 更新用户根目录
+    STMT_SHARE_INSERT,  // 发起文件分享
+    STMT_SHARE_PENDING, // 查询发给指定接收者的待处理分享
+    STMT_SHARE_STATUS,  // 更新分享状态（接受/拒绝）
+    STMT_FILE_OWNER,    // 按文件路径查询所有者
+    DB_STMT_COUNT       // 预编译语句数量
+} DbStmtId;
+
 // ========================== 结构体定义 ==========================
+/**
+ * @brief 文件清单中的一个数据块（块文件按SHA-256存放在CAS_ROOT/chunks下）
+ */
+typedef struct
+{
+    unsigned char hash[CAS_HASH_LEN]; // 块内容的SHA-256
+    uint32_t len;                     // 块长度
+    long long offset;                 // 块在文件中的起始偏移
+} CasChunkRef;
+
+/**
+ * @brief 文件清单（用户目录中的每个文件只保存块列表，相同内容的块全局只存一份）
+ */
+typedef struct CasManifest
+{
+    long long size;        // 文件总大小
+    int count;             // 块数
+    int has_file_hash;     // 1=file_hash有效（入库时由服务器计算；旧版清单没有）
+    unsigned char file_hash[CAS_HASH_LEN]; // 整个文件内容的SHA-256（秒传索引的键）
+    CasChunkRef chunks[];  // 按偏移排列的块
+} CasManifest;
+
+/**
+ * @brief 续传日志（一个未完成上传：暂存数据 <键>.data + 日志 <键>.journal，跨连接、跨重启保留）
+ */
+typedef struct UploadJournal
+{
+    struct UploadJournal *next;     // 活动上传链表中的下一项（同一上传同时只允许一个连接写入）
+    char key[CAS_HASH_LEN * 2 + 1]; // 续传键（目标路径、文件大小和内容标识的SHA-256）
+    long long size;                 // 暂存数据总长度（增量上传为缺少的块的总长度）
+    long long committed;            // 日志中记录的已接收字节数（续传起点）
+    int count;                      // 增量上传的块数（普通上传为0）
+    unsigned char *have;            // 增量上传计划（count字节，续传时沿用，暂存数据按此排列）
+    char *filepath;                 // 上传目标的完整路径
+} UploadJournal;
+
+/**
+ * @brief 分段上传（大文件切成固定大小的段，多个连接并发上传各段，全部收到后一次入库）
+ * @details 只保存在内存中，暂存文件创建后立即unlink，服务器重启后分段上传需要重新开始
+ */
+typedef struct MultipartUpload
+{
+    struct MultipartUpload *next;        // 分段上传链表中的下一项
+    char id[MULTIPART_ID_LEN * 2 + 1];   // 上传ID（随机十六进制串，其他连接凭它上传段）
+    char username[50];                   // 发起上传的用户（只有该用户的连接能上传段和完成上传）
+    char *filepath;                      // 上传目标的完整路径
+    long long size;                      // 文件大小
+    int part_count;                      // 段数
+    unsigned char *parts;                // 每段的状态（MultipartPartState，每段一个字节）
+    int receiving;                       // 正在接收的段数（大于0时不能完成，也不会被回收）
+    int fd;                              // 暂存文件（已按文件大小预分配，各连接dup后按段偏移写入）
+    unsigned char file_hash[CAS_HASH_LEN]; // 客户端声明的整文件SHA-256（入库时校验）
+    time_t last_active;                  // 最近一次有段开始或结束的时间（超过MULTIPART_TTL即回收）
+} MultipartUpload;
+
+/**
+ * @brief 持有证明挑战中的一个字节范围
+ */
+typedef struct
+{
+    long long offset; // 范围在文件中的起始偏移
+    uint32_t len;     // 范围长度
+} CasProofRange;
+
+/**
+ * @brief 跨用户秒传的持有证明挑战：客户端须对随机字节范围连同nonce计算SHA-256，证明确实持有文件内容
+ * @details 只凭整文件哈希不能引用其他用户的文件；挑战等待应答期间保存原始请求，
+ *          证明不通过或服务器没有相同内容时按原始请求继续正常上传（两种情况对客户端表现一致）
+ */
+typedef struct UploadChallenge
+{
+    unsigned char nonce[CAS_HASH_LEN];         // 随机数（每次挑战不同，证明不能重放）
+    CasProofRange ranges[CAS_PROOF_RANGES];    // 随机选取的字节范围
+    int has_source;                            // 1=服务器有相同内容的文件，expect有效
+    unsigned char expect[CAS_HASH_LEN];        // 按源文件内容算出的期望证明
+    char src_path[MAX_PATH_LEN];               // 相同内容的源清单路径
+    unsigned char file_hash[CAS_HASH_LEN];     // 客户端声明的整文件SHA-256
+    long long size;                            // 客户端声明的文件大小
+    char *filepath;                            // 上传目标的完整路径
+    cJSON *req;                                // 原始上传请求（副本）
+    void (*resume)(int client_fd, cJSON *req); // 原始请求的处理函数（未秒传时据此继续正常上传）
+} UploadChallenge;
+
+/**
+ * @brief 后台入库任务（上传数据收齐后交给入库线程切块入库、写入清单，结束后在入库线程上调用done）
+ * @details 任务本身和fd、manifest_path、delta等资源都归提交者所有，由done负责释放
+ */
+typedef struct CasIngestJob
+{
+    struct CasIngestJob *next;   // 入库队列中的下一个任务
+    int fd;                      // 暂存文件（增量上传不需要接收数据时为-1）
+    long long size;              // 文件大小（整文件入库）
+    char *manifest_path;         // 用户路径（写成清单）
+    unsigned char *expect_hash;  // 客户端声明的整文件SHA-256（NULL=不校验，整文件入库）
+    struct CasManifest *delta;   // 增量上传的新版本清单（NULL=整文件入库）
+    unsigned char *delta_have;   // 增量上传：cas_delta_plan给出的标记
+    void (*done)(struct CasIngestJob *job, int ret); // 入库结束回调（ret：0=成功，-1=失败）
+} CasIngestJob;
+
 /**
  * @brief 客户端上传信息结构体（记录单个客户端的上传状态）
  */
 typedef struct
 {
-    UploadState state;           // 上传状态
-    char filepath[MAX_PATH_LEN]; // 上传文件的完整路径
-    long long filesize;          // 上传文件总大小
-    long long received;          // 已接收文件大小
-    int fd;                      // 上传文件的文件描述符
+    UploadState state;   // 上传状态
+    char *filepath;      // 上传文件的完整路径（开始上传时分配，连接关闭时释放）
+    long long filesize;  // 上传文件总大小
+    long long received;  // 已接收文件大小
+    int fd;              // 上传文件的文件描述符
+    int use_splice;      // 1=splice零拷贝接收，0=recv+pwrite拷贝接收
+    struct CasManifest *delta;  // 增量上传：客户端给出的新版本块清单（NULL=普通上传）
+    unsigned char *delta_have;  // 增量上传：每块是否已在旧版本中（1=不用传，0=在接收的数据中）
+    struct UploadJournal *journal; // 可续传的上传：续传日志（NULL=匿名暂存文件，中断即丢弃）
+    int verify_hash;            // 1=入库时校验整文件哈希（普通上传带file_hash时）
+    unsigned char file_hash[CAS_HASH_LEN]; // 客户端声明的整文件SHA-256
+    long long base;             // 写入暂存文件的起始偏移（分段上传为段偏移，其余为0），第received字节写在base+received
+    struct MultipartUpload *multipart; // 分段上传：正在接收的段所属的上传（NULL=不是分段上传的段）
+    int part;                   // 分段上传：正在接收的段号
+    struct UploadChallenge *challenge; // 跨用户秒传：等待客户端应答的持有证明挑战（NULL=没有）
 } ClientUploadInfo;
 
 /**
@@ -95,100 +322,443 @@ typedef struct
  */
 typedef struct
 {
-    DownloadState state;             // 下载状态
-    char filepath[MAX_PATH_LEN];     // 下载文件的完整路径
-    long long filesize;              // 下载文件总大小
-    int tar_fd;                      // 文件夹下载时的tar包文件描述符
-    long long sent;                  // 已发送文件大小
-    long long offset;                // 当前文件读取偏移位置
-    long long total_sent;            // 累计发送大小（包括多次发送）
-    int fd;                          // 当前下载文件的文件描述符
-    char remaining_buf[BUFFER_SIZE]; // 固定缓冲区，存没发完的字节
-    size_t remaining_len;            // 缓冲区中未发的字节数（初始0）
+    DownloadState state; // 下载状态
+    char *filepath;      // 下载文件的完整路径（开始下载时分配，连接关闭时释放）
+    long long filesize;  // 下载文件总大小
+    int tar_fd;          // 文件夹下载时的tar包文件描述符
+    long long offset;    // 下一次sendfile的文件偏移（从请求范围的起点开始）
+    long long end;       // 请求范围的结束偏移（不含），offset到达end即下载完成
+    int fd;              // 当前正在发送的数据块的文件描述符
+    struct CasManifest *manifest; // 下载文件的块清单（开始下载时加载，连接关闭时释放）
+    int chunk_idx;       // fd对应的块在清单中的下标
 } ClientDownloadInfo;
 
 /**
- * @brief 用户缓存结构体（内存中缓存用户信息，减少数据库查询）
+ * @brief 待发送的响应帧（4字节长度前缀 + JSON，一次分配）
+ */
+typedef struct OutFrame
+{
+    struct OutFrame *next; // 队列中的下一帧
+    size_t len;            // 帧总长度（含长度前缀）
+    size_t sent;           // 已发送字节数（短写时记录进度）
+    char data[];           // 帧数据
+} OutFrame;
+
+/**
+ * @brief 连接句柄（高32位为代数，低32位为fd）
+ * @details fd关闭后会被内核复用，代数在每次关闭时+1，
+ *          线程池中排队的旧任务/旧epoll事件凭句柄即可识别出连接已不是原来那个
+ */
+typedef uint64_t ConnHandle;
+
+/**
+ * @brief 客户端连接对象（连接表按fd分块分配，空闲连接只占这一个结构体）
+ */
+typedef struct
+{
+    pthread_mutex_t lock;      // 连接锁（保护响应队列和调度状态，其他连接的工作线程也可能推送消息）
+    uint32_t generation;       // 代数（与fd组成句柄，lock之后的字段在新连接登记时清零）
+    int busy;                  // 1=已派发给工作线程（EPOLLONESHOT已摘除，处理完再重新挂上）
+    int in_use;                // 1=已被连接占用
+    int epfd;                  // 所属reactor的epoll实例（io_uring后端为-1）
+    struct sockaddr_in addr;   // 客户端地址信息
+    char username[50];         // 登录后绑定的用户名（未登录为空串）
+    ClientUploadInfo up;       // 上传状态
+    ClientDownloadInfo dl;     // 下载状态
+    char *in_buf;              // 控制帧输入缓冲区（收到半帧时保留，读空后释放）
+    size_t in_len;             // 输入缓冲区已有字节数
+    size_t in_cap;             // 输入缓冲区容量
+    OutFrame *out_head;        // 待发送响应队列头
+    OutFrame *out_tail;        // 待发送响应队列尾
+    size_t out_bytes;          // 队列中未发送的字节数（背压上限OUT_QUEUE_MAX）
+    int out_armed;             // 1=当前挂载的事件因队列未发完包含EPOLLOUT
+    void *backend_ctx;         // io_uring后端的连接状态（epoll后端不用）
+} Connection;
+
+/**
+ * @brief 上传提交（收齐的上传交给入库线程时随任务保存，入库结束后据此回复、记录日志并释放暂存数据）
+ */
+typedef struct
+{
+    CasIngestJob job;                      // 入库任务（第一个成员，回调中由任务指针取回整个结构）
+    ConnHandle conn;                       // 发起上传的连接（入库结束时可能已断开，回复随之丢弃）
+    int client_fd;                         // 客户端文件描述符（操作日志）
+    char username[50];                     // 上传用户
+    char ip[INET_ADDRSTRLEN];              // 客户端IP地址
+    unsigned char file_hash[CAS_HASH_LEN]; // 客户端声明的整文件SHA-256（普通上传校验用的副本）
+    struct UploadJournal *journal;         // 可续传的上传：续传日志（入库结束后作废）
+    struct MultipartUpload *mp;            // 分段上传（NULL=普通/增量上传；暂存文件属于它）
+} UploadCommit;
+
+/**
+ * @brief 用户缓存项（内存中缓存用户根目录，减少数据库查询）
+ */
+typedef struct UserCacheEntry
+{
+    struct UserCacheEntry *hash_next; // 同一哈希桶中的下一项
+    struct UserCacheEntry *lru_prev;  // 淘汰链表中较新的一项
+    struct UserCacheEntry *lru_next;  // 淘汰链表中较旧的一项
+    uint32_t hash;                    // 用户名哈希值
+    int referenced;                   // 1=上次淘汰扫描后被命中过（读锁下原子置位，淘汰时给第二次机会）
+    char username[50];                // 用户名
+    char *root_dir;                   // 用户根目录路径（按实际长度分配）
+} UserCacheEntry;
+
+/**
+ * @brief 用户缓存分片（读多写少：命中只加读锁，插入/淘汰加写锁）
+ */
+typedef struct
+{
+    pthread_rwlock_t lock;            // 分片读写锁
+    UserCacheEntry **buckets;         // 哈希桶（USER_CACHE_BUCKETS个）
+    UserCacheEntry *lru_head;         // 淘汰链表头（最新插入）
+    UserCacheEntry *lru_tail;         // 淘汰链表尾（最旧，优先淘汰）
+    int count;                        // 分片内缓存项数
+    unsigned long long hits;          // 命中次数（原子累加）
+    unsigned long long misses;        // 未命中次数（原子累加）
+    unsigned long long evictions;     // 淘汰次数（写锁内累加）
+} __attribute__((aligned(64))) UserCacheShard;
+
+/**
+ * @brief 用户缓存（按用户名哈希分片的哈希表，容量USER_CACHE_CAPACITY，CLOCK近似LRU淘汰）
  */
 typedef struct
 {
-    char username[50];           // 用户名
-    char root_dir[MAX_PATH_LEN]; // 用户根目录路径
+    UserCacheShard shards[USER_CACHE_SHARDS]; // 各分片
 } UserCache;
 
+/**
+ * @brief 在线用户（会话索引中的一项：同一用户名下所有已登录连接，支持多端同时在线）
+ */
+typedef struct SessionUser
+{
+    struct SessionUser *hash_next;    // 同一哈希桶中的下一项
+    uint32_t hash;                    // 用户名哈希值
+    char username[50];                // 用户名
+    int *fds;                         // 已登录连接的fd（无序，删除时用末尾元素填补）
+    int count;                        // 在线连接数
+    int cap;                          // fds容量
+} SessionUser;
+
+/**
+ * @brief 在线会话索引分片（登录/断开和向用户推送消息都只锁一个分片）
+ */
+typedef struct
+{
+    pthread_mutex_t lock;                  // 分片互斥锁
+    SessionUser *buckets[SESSION_BUCKETS]; // 哈希桶
+} __attribute__((aligned(64))) SessionShard;
+
+/**
+ * @brief 块引用计数表项（块文件存在且至少被一个清单引用）
+ */
+typedef struct CasIndexEntry
+{
+    struct CasIndexEntry *next;       // 同一哈希桶中的下一项
+    unsigned char hash[CAS_HASH_LEN]; // 块内容的SHA-256
+    uint32_t len;                     // 块长度
+    int refs;                         // 引用该块的清单条目数（归零时删除块文件）
+} CasIndexEntry;
+
+/**
+ * @brief 块引用计数表分片（按块哈希分片，增减引用和创建/删除块文件在分片锁内完成）
+ */
+typedef struct
+{
+    pthread_mutex_t lock;                      // 分片互斥锁
+    CasIndexEntry *buckets[CAS_INDEX_BUCKETS]; // 哈希桶
+} __attribute__((aligned(64))) CasIndexShard;
+
+/**
+ * @brief 整文件哈希索引项（秒传：整文件哈希 → 内容为该哈希的某个清单路径，命中时校验该清单后引用其块）
+ */
+typedef struct CasFileEntry
+{
+    struct CasFileEntry *next;        // 同一哈希桶中的下一项
+    unsigned char hash[CAS_HASH_LEN]; // 整个文件内容的SHA-256
+    long long size;                   // 文件大小
+    char *path;                       // 清单路径
+} CasFileEntry;
+
 /**
  * @brief 线程池任务结构体（单个任务的信息）
  */
 typedef struct
 {
     int client_fd;                  // 客户端文件描述符
+    ConnHandle conn;                // 连接句柄（执行前校验，连接已关闭则丢弃任务）
     TaskType type;                  // 任务类型
     struct sockaddr_in client_addr; // 客户端地址信息
+    char *payload;                  // TASK_URING_MESSAGE的JSON请求文本（由工作线程释放）
+    long long enqueue_us;           // 首次入队时刻（微秒，用于统计排队延迟；新任务填0）
 } Task;
 
 /**
- * @brief 线程池结构体（管理线程池的线程、任务队列、同步锁）
+ * @brief 任务队列（循环队列）
+ */
+typedef struct
+{
+    Task queue[MAX_QUEUE_SIZE]; // 任务数组
+    int front;                  // 队列头索引（出队、被偷）
+    int rear;                   // 队列尾索引（入队）
+    int count;                  // 队列中任务数量
+} TaskQueue;
+
+/**
+ * @brief 排队延迟统计（log2直方图，用于估算p99）
+ */
+typedef struct
+{
+    unsigned long long count;                 // 统计的任务数
+    unsigned long long sum_us;                // 排队延迟累计（微秒）
+    unsigned long long max_us;                // 排队延迟最大值（微秒）
+    unsigned long long hist[LATENCY_BUCKETS]; // 排队延迟直方图
+} LatencyStats;
+
+/**
+ * @brief 工作线程（每个通道一条任务队列 + 统计，按缓存行对齐避免线程间伪共享）
+ */
+typedef struct
+{
+    pthread_mutex_t mutex;              // 本线程队列互斥锁（只有队列主人、投递者和偷任务的线程竞争）
+    TaskQueue lanes[TASK_LANES];        // 各通道的任务队列
+    unsigned long long executed;        // 本线程执行的任务数
+    unsigned long long stolen;          // 其中从其他线程队列偷来的任务数
+    LatencyStats latency[TASK_LANES];   // 各通道的排队延迟统计
+} __attribute__((aligned(64))) Worker;
+
+/**
+ * @brief 线程池结构体（每个工作线程一组任务队列，空闲线程从其他队列偷任务）
+ * @details 编号小于INTERACTIVE_WORKERS的线程只处理交互通道，其余线程先交互后批量；
+ *          两组线程各自一个唤醒信号量，批量任务不会唤醒预留线程
  */
 typedef struct
 {
     pthread_t threads[THREAD_POOL_SIZE]; // 线程池中的线程ID数组
-    Task queue[MAX_QUEUE_SIZE];          // 任务队列
-    int front;                           // 队列头索引（出队）
-    int rear;                            // 队列尾索引（入队）
-    int count;                           // 队列中任务数量
-    pthread_mutex_t mutex;               // 任务队列互斥锁
-    sem_t semaphore;                     // 任务队列信号量（控制线程唤醒）
+    Worker workers[THREAD_POOL_SIZE];    // 各工作线程的任务队列和统计
+    int idle_reserved;                   // 正在休眠的预留线程数（原子访问）
+    int idle_general;                    // 正在休眠的通用线程数（原子访问）
+    sem_t sem_reserved;                  // 预留线程唤醒信号量（只在有线程休眠时投递）
+    sem_t sem_general;                   // 通用线程唤醒信号量（只在有线程休眠时投递）
 } ThreadPool;
 
+/**
+ * @brief MySQL连接池（固定大小，工作线程按任务借出，后台线程定期检查空闲连接）
+ */
+typedef struct
+{
+    MYSQL conns[DB_POOL_SIZE];          // 连接句柄
+    int broken[DB_POOL_SIZE];           // 1=连接已断开，待重连
+    MYSQL_STMT *stmts[DB_POOL_SIZE][DB_STMT_COUNT]; // 各连接的预编译语句缓存（NULL=尚未prepare）
+    int free_list[DB_POOL_SIZE];        // 空闲连接下标（栈）
+    int free_count;                     // 空闲连接数
+    pthread_mutex_t mutex;              // 保护空闲列表和统计
+    pthread_cond_t cond;                // 有连接归还时通知等待者
+    pthread_cond_t health_cond;         // 唤醒健康检查线程（退出时）
+    pthread_t health_thread;            // 健康检查线程
+    int health_started;                 // 健康检查线程是否已启动
+    unsigned long long acquires;        // 借出次数
+    unsigned long long waits;           // 其中需要等待的次数
+    unsigned long long wait_sum_us;     // 等待时长累计（微秒）
+    unsigned long long wait_max_us;     // 等待时长最大值（微秒）
+} DbPool;
+
+/**
+ * @brief 一条操作记录（批量写入时暂存在环形队列中）
+ */
+typedef struct
+{
+    char username[50];          // 操作用户名
+    int client_fd;              // 客户端文件描述符
+    char ip[INET_ADDRSTRLEN];   // 客户端IP地址
+    char operation[32];         // 操作类型
+    char status[32];            // 操作状态
+    char *filename;             // 操作的文件名（堆上分配，写入后释放；NULL=无）
+    time_t time;                // 操作发生时间（入队时记录，不受批量延迟影响）
+} OpLogRecord;
+
+/**
+ * @brief 操作历史分页查询条件
+ */
+typedef struct
+{
+    const char *before_time;      // 游标：只返回早于(before_time, before_id)的记录
+    long long before_id;          // 游标中的记录id
+    int limit;                    // 本页最多返回的条数
+    const char *operation;        // 按操作类型过滤（空串=不过滤）
+    const char *filename_pattern; // 文件名LIKE模式（已转义通配符并追加%，空串=不过滤）
+} HistoryQuery;
+
+/**
+ * @brief 待处理的分享信息
+ */
+typedef struct
+{
+    char owner[50];              // 分享者
+    char filepath[MAX_PATH_LEN]; // 文件所在路径（相对分享者根目录）
+    char filename[MAX_PATH_LEN]; // 文件名
+} ShareInfo;
+
+/**
+ * @brief 元数据存储接口（业务代码只通过meta_store访问用户、分享和操作日志，启动时选定后端）
+ * @details 查询类函数统一返回 1=查到，0=无结果，-1=失败；写入类函数返回 0=成功，-1=失败
+ */
+typedef struct
+{
+    const char *name;                                                       // 后端名称
+    void (*init)();                                                         // 打开存储并建表/迁移（失败时退出程序）
+    void (*destroy)();                                                      // 关闭存储（调用前需已停止线程池和操作日志写线程）
+    void (*release)();                                                      // 每个任务结束后归还本线程占用的连接
+    int (*user_password)(const char *username, char *out, size_t out_size); // 查询用户密码
+    int (*user_exists)(const char *username);                               // 查询用户是否存在
+    int (*user_insert)(const char *username, const char *password);         // 注册新用户
+    int (*user_root_dir)(const char *username, char *out, size_t out_size); // 查询用户根目录
+    int (*user_set_root_dir)(const char *username, const char *root_dir);   // 更新用户根目录
+    int (*share_insert)(const char *owner, const char *recipient,
+                        const char *filepath, const char *filename);        // 发起分享（返回分享id，-1=失败）
+    int (*share_get_pending)(int share_id, const char *recipient, ShareInfo *info); // 查询待处理分享
+    int (*share_set_status)(int share_id, const char *status);              // 更新分享状态
+    int (*file_owner)(const char *filepath, char *owner, size_t owner_size); // 查询文件所有者
+    int (*history_page)(const char *username, const HistoryQuery *query,
+                        cJSON *records);                                    // 查询一页操作历史（返回行数，-1=失败）
+    int (*insert_logs)(OpLogRecord *records, int count);                    // 写入一批操作记录
+} MetaStore;
+
+/**
+ * @brief reactor结构体（一个reactor = 一个线程 + 独立监听socket + 独立epoll实例）
+ * @details 多reactor模式下各监听socket开启SO_REUSEPORT，由内核在reactor间分摊新连接；
+ *          连接被哪个reactor accept，整个生命周期就只注册在该reactor的epoll上
+ */
+typedef struct
+{
+    int id;           // reactor编号（0号运行在主线程）
+    int listen_fd;    // 本reactor的监听socket
+    int epfd;         // 本reactor的epoll实例
+    pthread_t thread; // reactor线程ID（0号reactor不单独建线程）
+    Task *deferred;     // 线程池满时延后派发的任务（FIFO，只由本reactor线程访问）
+    int deferred_head;  // 延后队列中第一个待派发任务的下标
+    int deferred_count; // 延后队列数组已用长度（有效任务为[deferred_head, deferred_count)）
+    int deferred_cap;   // 延后队列数组容量
+} Reactor;
+
+/**
+ * @brief 服务器启动配置（由命令行参数解析得到）
+ */
+typedef struct
+{
+    int daemon_mode;   // 1=守护进程运行，0=前台运行（-f）
+    int reactor_count; // reactor线程数（-r N，0表示按CPU核数）
+    int upload_splice; // 1=上传走splice零拷贝（默认），0=recv+write拷贝模式（-c）
+    IoBackend io_backend; // IO后端（-u 选择io_uring，不可用时回退epoll）
+    int log_flush_ms;  // 操作日志刷盘间隔（-L ms，宕机最多丢失这段时间的记录；0=同步写入）
+    MetaBackend meta_backend; // 元数据存储后端（-S 文件 选择内嵌SQLite）
+    const char *meta_path;    // SQLite数据库文件路径
+    const char *token_key_path; // 会话令牌签名密钥文件（-K，不指定时每次启动随机生成）
+} ServerConfig;
+
 // ========================== 全局变量extern声明 ==========================
 extern int server_running;                            // 服务器运行状态标志（1=运行，0=退出）
-extern int server_fd;                                 // 服务器监听socket文件描述符
-extern int epfd;                                      // epoll实例文件描述符
-extern UserCache user_cache[MAX_USERS];               // 用户信息缓存数组
-extern int user_cache_count;                          // 缓存的用户数量
+extern int shutdown_fd;                               // 退出通知eventfd（终止信号处理函数写入，唤醒各事件循环）
+extern ServerConfig server_config;                    // 服务器启动配置
+extern Reactor reactors[MAX_REACTORS];                // reactor数组
+extern int reactor_count;                             // 实际启动的reactor数量
+extern UserCache user_cache;                          // 用户信息缓存
 extern char server_ip[INET_ADDRSTRLEN];               // 服务器IP地址
-extern ClientUploadInfo client_up_info[MAX_EVENTS];   // 客户端上传信息数组（按fd索引）
-extern ClientDownloadInfo client_dl_info[MAX_EVENTS]; // 客户端下载信息数组（按fd索引）
-extern MYSQL mysql;                                   // MySQL连接句柄
-extern char client_username[MAX_EVENTS][50];          // 客户端fd->用户名映射（登录后绑定）
-extern struct sockaddr_in client_addrs[MAX_EVENTS];   // 客户端fd->IP地址映射
+extern DbPool db_pool;                                // MySQL连接池
 extern ThreadPool thread_pool;                        // 线程池实例
+extern const MetaStore *meta_store;                   // 当前使用的元数据存储后端
+extern const MetaStore mysql_meta_store;              // MySQL元数据存储
+extern const MetaStore sqlite_meta_store;             // 内嵌SQLite元数据存储
 
 // ========================== 函数声明（跨文件调用） ==========================
 // 1. 工具函数（utils.c）
 void write_log(LogLevel level, const char *format, ...);
 int is_safe_path(const char *base_dir, const char *user_path);
+int is_safe_target(const char *base_dir, const char *user_path, const char *filename);
 int mkdir_recursive(const char *path, mode_t mode);
 void build_full_path(char *full_path, const char *base_dir, const char *user_path, const char *filename);
 void send_json_response(int client_fd, cJSON *root);
+int send_json_to_user(const char *username, cJSON *root);
+int send_json_to_conn(ConnHandle handle, cJSON *root);
+uint32_t str_hash(const char *str);
 int pack_directory(const char *dir_path, const char *tar_path);
 
 // 2. MySQL工具函数（mysql_utils.c）
-void init_mysql();
-int check_mysql_connection();
-int mysql_find_user(const char *username);
+void db_pool_init();
+MYSQL *db_conn();
+void db_release();
+MYSQL_STMT *db_stmt(DbStmtId id);
+void db_bind_string(MYSQL_BIND *bind, const char *str, unsigned long *length);
+int db_stmt_failed(MYSQL_STMT *stmt, DbStmtId id);
+int db_query_string(DbStmtId id, const char *param, char *out, size_t out_size);
+void db_pool_log_stats();
+void db_pool_destroy();
+
+// 2.1 元数据存储与操作日志（meta_store.c）
+void meta_store_init();
+void meta_store_destroy();
 void insert_operation_log(int client_fd, const char *username, const char *ip,
                           const char *operation, const char *filename, const char *status);
+void oplog_writer_start();
+void oplog_writer_stop();
 
 // 3. 用户管理函数（user.c）
 int get_user_root_dir(const char *username, char *root_dir);
 int create_user_root_dir(const char *username);
+void user_cache_init();
+int user_cache_get(const char *username, char *root_dir);
+void user_cache_put(const char *username, const char *root_dir);
+void user_cache_log_stats();
 
 // 4. 线程池函数（thread_pool.c）
 void thread_pool_init();
-void thread_pool_add_task(Task task);
+int thread_pool_add_task(Task task);
 void *thread_function(void *arg);
+long long thread_pool_task_wait_us();
+void thread_pool_log_stats();
+void thread_pool_destroy();
 
 // 5. 守护进程+信号处理函数（daemon_signal.c）
 void daemonize(const char *log_file);
 void signal_handler(int signo);
+int signal_init();
+void signal_unblock_shutdown();
+
+// 6. reactor事件循环函数（reactor.c）
+int create_listen_socket(int reuse_port, int nonblock);
+int reactor_init(Reactor *reactor, int id, int reuse_port);
+void *reactor_loop(void *arg);
+int reactor_arm_client_locked(int client_fd, Connection *conn);
+void reactor_release_client(ConnHandle handle);
+void reactor_close_all();
+
+// 7. io_uring后端函数（uring_backend.c）
+int uring_backend_run();
+void uring_backend_run_task(Task *task);
 
-// 6. 业务逻辑函数（business.c）
+// 8. 连接表函数（conn_table.c）
+Connection *conn_open(int fd, struct sockaddr_in addr, int epfd, ConnHandle *handle);
+Connection *conn_get(int fd);
+Connection *conn_lookup(ConnHandle handle);
+ConnHandle conn_handle(int fd);
+void conn_close(int fd);
+void conn_bind_user(int fd, const char *username);
+void conn_unbind_user(int fd);
+int conn_send_to_user(const char *username, const char *body, uint32_t len);
+int conn_set_path(char **dst, const char *path);
+int conn_queue_frame(int fd, const char *body, uint32_t len);
+int conn_queue_frame_to(int fd, ConnHandle handle, const char *body, uint32_t len);
+int conn_flush(int fd);
+void conn_batch_begin(ConnHandle handle);
+void conn_batch_end();
+
+// 9. 业务逻辑函数（business.c）
 void init_server();
 void handle_login(int client_fd, cJSON *req, struct sockaddr_in client_addr);
 void handle_register(int client_fd, cJSON *req);
 void handle_file_list(int client_fd, cJSON *req);
 void handle_upload_ctl(int client_fd, cJSON *req);
+void handle_upload_delta(int client_fd, cJSON *req);
 void handle_upload_dir(int client_fd, cJSON *req);
 int handle_upload(int client_fd);
 void handle_download_ctl(int client_fd, cJSON *req);
@@ -198,5 +768,67 @@ void handle_delete(int client_fd, cJSON *req, struct sockaddr_in client_addr);
 void handle_share(int client_fd, cJSON *req);
 void handle_history_query(int client_fd, cJSON *req);
 void handle_client_message(int client_fd, struct sockaddr_in client_addr);
+int dispatch_request(int client_fd, const char *json_buf, struct sockaddr_in client_addr);
+void cleanup_client_session(int client_fd, struct sockaddr_in client_addr);
+void upload_report_progress(int client_fd);
+void upload_finish(int client_fd);
+void upload_abort(ClientUploadInfo *info);
+void upload_challenge_free(UploadChallenge *ch);
+void handle_check_upload_resume(int client_fd, cJSON *req);
+void handle_upload_multipart_init(int client_fd, cJSON *req);
+void handle_upload_part(int client_fd, cJSON *req);
+void handle_upload_multipart_complete(int client_fd, cJSON *req);
+void handle_upload_proof(int client_fd, cJSON *req);
+void download_finish(int client_fd);
+void handle_resume_session(int client_fd, cJSON *req, struct sockaddr_in client_addr);
+
+// 10. 会话令牌函数（session_token.c）
+int session_token_init();
+int session_token_issue(const char *username, char *token, time_t *expires);
+int session_token_verify(const char *token, char *username);
+
+// 11. 块存储函数（cas_store.c）
+int cas_init();
+int cas_stage_open();
+int cas_ingest(int fd, long long size, const char *manifest_path, const unsigned char *expect_hash);
+void cas_hash_to_hex(const unsigned char *hash, char *hex);
+int cas_hash_from_hex(const char *hex, unsigned char *hash);
+long long cas_delta_plan(const char *path, const CasManifest *m, unsigned char *have);
+int cas_manifest_digest(const CasManifest *m, unsigned char *digest);
+int cas_ingest_delta(int fd, CasManifest *m, const unsigned char *have, const char *manifest_path);
+void cas_ingest_start();
+void cas_ingest_submit(CasIngestJob *job);
+void cas_ingest_stop();
+CasManifest *cas_manifest_load(const char *path);
+int cas_manifest_size(const char *path, long long *size);
+int cas_link(const char *src_path, const char *dst_path);
+int cas_instant_link(const unsigned char *file_hash, long long size, const char *scope, const char *dst_path);
+int cas_instant_link_from(const char *src_path, const unsigned char *file_hash, long long size, const char *dst_path);
+int cas_proof_challenge(long long size, unsigned char *nonce, CasProofRange *ranges);
+int cas_proof_expect(const unsigned char *file_hash, long long size, const unsigned char *nonce,
+                     const CasProofRange *ranges, unsigned char *proof, char *src_path);
+int cas_remove(const char *path);
+int cas_remove_tree(const char *dir_path);
+int cas_download_seek(ClientDownloadInfo *dl, off_t *chunk_off, size_t *chunk_left);
+void cas_log_stats();
+
+// 12. 断点续传函数（upload_journal.c）
+int upload_journal_init();
+void upload_journal_key(const char *filepath, long long size, char kind,
+                        const unsigned char *content_id, char *key);
+UploadJournal *upload_journal_open(const char *key, const char *filepath, long long size,
+                                   int count, unsigned char *have, int *fd);
+void upload_journal_checkpoint(UploadJournal *j, long long received);
+void upload_journal_close(UploadJournal *j, long long received);
+void upload_journal_discard(UploadJournal *j);
+
+// 13. 分段上传函数（multipart.c）
+MultipartUpload *multipart_create(const char *username, const char *filepath, long long size,
+                                  const unsigned char *file_hash);
+int multipart_part_begin(const char *id, const char *username, int part,
+                         MultipartUpload **mp, long long *offset, long long *len, int *fd);
+void multipart_part_end(MultipartUpload *mp, int part, int done);
+MultipartUpload *multipart_take(const char *id, const char *username, int *missing);
+void multipart_free(MultipartUpload *mp);
 
 #endif // CLOUD_DISK_H
\ No newline at end of file
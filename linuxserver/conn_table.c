@@ -0,0 +1,605 @@
+#include "conn_table.h"
+
+// 连接表：按fd分块（每块CONN_CHUNK_SIZE个Connection），块在第一次用到时分配、之后不再释放，
+// 因此查找无需加锁；只有分配新块时需要互斥（多个reactor可能同时accept）
+static Connection *conn_chunks[CONN_MAX_CHUNKS];
+static pthread_mutex_t conn_chunk_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// 当前工作线程正在处理的连接（句柄，0=无）：发给它的响应先排队，任务结束时一次合并发送
+static __thread ConnHandle batch_conn = 0;
+
+// 在线会话索引：用户名 → 该用户所有已登录连接（登录时登记，退出/断开时移除），
+// 推送消息时直接取出目标用户的连接，不扫描连接表；锁顺序为 分片锁 → 连接锁
+static SessionShard session_shards[SESSION_SHARDS] = {
+    [0 ... SESSION_SHARDS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}};
+
+/**
+ * @brief 取fd对应的连接槽位
+ * @param fd 客户端文件描述符
+ * @param create 1=所在块不存在时分配，0=不分配
+ * @return 槽位指针，NULL=fd越界/块未分配/内存不足
+ */
+static Connection *conn_slot(int fd, int create)
+{
+    if (fd < 0 || fd >= MAX_CONNECTIONS)
+    {
+        return NULL;
+    }
+
+    int chunk_idx = fd >> CONN_CHUNK_SHIFT;
+    Connection *chunk = __atomic_load_n(&conn_chunks[chunk_idx], __ATOMIC_ACQUIRE);
+    if (!chunk && create)
+    {
+        pthread_mutex_lock(&conn_chunk_mutex);
+        chunk = conn_chunks[chunk_idx];
+        if (!chunk)
+        {
+            chunk = calloc(CONN_CHUNK_SIZE, sizeof(Connection));
+            if (chunk)
+            {
+                for (int i = 0; i < CONN_CHUNK_SIZE; i++)
+                    pthread_mutex_init(&chunk[i].lock, NULL);
+                __atomic_store_n(&conn_chunks[chunk_idx], chunk, __ATOMIC_RELEASE);
+            }
+            else
+            {
+                write_log(LOG_LEVEL_ERROR, "连接表分配失败（fd=%d）", fd);
+            }
+        }
+        pthread_mutex_unlock(&conn_chunk_mutex);
+    }
+    return chunk ? &chunk[fd & (CONN_CHUNK_SIZE - 1)] : NULL;
+}
+
+static ConnHandle make_handle(int fd, uint32_t generation)
+{
+    return ((ConnHandle)generation << 32) | (uint32_t)fd;
+}
+
+/**
+ * @brief 登记新连接（fd所在块不存在时按需分配），代数+1并清空旧状态
+ * @param fd 客户端文件描述符
+ * @param addr 客户端地址信息
+ * @param epfd 所属reactor的epoll实例（io_uring后端传-1）
+ * @param handle 输出：新连接的句柄（可为NULL）
+ * @return 连接对象，NULL=fd超出上限或内存不足
+ */
+Connection *conn_open(int fd, struct sockaddr_in addr, int epfd, ConnHandle *handle)
+{
+    Connection *conn = conn_slot(fd, 1);
+    if (!conn)
+    {
+        return NULL;
+    }
+
+    // 代数从1开始，句柄永远不为0（0留给监听socket等非连接事件）
+    uint32_t generation = conn->generation + 1;
+    if (generation == 0)
+        generation = 1;
+    // 锁跨连接复用，只清零其后的字段；持锁重置，按旧句柄加锁校验的线程看不到中间状态
+    pthread_mutex_lock(&conn->lock);
+    memset((char *)conn + offsetof(Connection, generation), 0,
+           sizeof(Connection) - offsetof(Connection, generation));
+    conn->generation = generation;
+    conn->epfd = epfd;
+    conn->addr = addr;
+    conn->up.fd = -1;
+    conn->dl.fd = -1;
+    conn->dl.tar_fd = -1;
+    __atomic_store_n(&conn->in_use, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&conn->lock);
+
+    if (handle)
+    {
+        *handle = make_handle(fd, generation);
+    }
+    return conn;
+}
+
+/**
+ * @brief 按fd取连接对象（业务函数在已校验的任务内使用）
+ * @param fd 客户端文件描述符
+ * @return 连接对象，NULL=fd未登记
+ */
+Connection *conn_get(int fd)
+{
+    Connection *conn = conn_slot(fd, 0);
+    if (!conn || !__atomic_load_n(&conn->in_use, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    return conn;
+}
+
+/**
+ * @brief 按句柄取连接对象，校验代数（fd已关闭或已被新连接复用时返回NULL）
+ * @param handle 连接句柄
+ * @return 连接对象，NULL=句柄已失效
+ */
+Connection *conn_lookup(ConnHandle handle)
+{
+    Connection *conn = conn_get(CONN_HANDLE_FD(handle));
+    if (!conn || conn->generation != CONN_HANDLE_GEN(handle))
+    {
+        return NULL;
+    }
+    return conn;
+}
+
+/**
+ * @brief 获取fd上当前连接的句柄
+ * @param fd 客户端文件描述符
+ * @return 连接句柄，0=fd未登记
+ */
+ConnHandle conn_handle(int fd)
+{
+    Connection *conn = conn_get(fd);
+    return conn ? make_handle(fd, conn->generation) : 0;
+}
+
+/**
+ * @brief 关闭连接：释放路径和缓冲区、代数+1使旧句柄失效，最后关闭socket
+ * @param fd 客户端文件描述符
+ * @return 无返回值
+ * @details 先让槽位失效再close(fd)：内核复用该fd之前，旧句柄已经查不到连接
+ */
+void conn_close(int fd)
+{
+    Connection *conn = conn_get(fd);
+    if (conn)
+    {
+        // 先移出在线会话索引，之后不会再有推送选中这个fd
+        conn_unbind_user(fd);
+        // 持锁让旧句柄失效：持锁校验句柄的线程（释放处理中状态、合并发送）不会作用到已关闭的连接
+        pthread_mutex_lock(&conn->lock);
+        __atomic_store_n(&conn->in_use, 0, __ATOMIC_RELEASE);
+        conn->generation++;
+        pthread_mutex_unlock(&conn->lock);
+        free(conn->up.filepath);
+        free(conn->dl.filepath);
+        conn->up.filepath = NULL;
+        conn->dl.filepath = NULL;
+        free(conn->dl.manifest);
+        conn->dl.manifest = NULL;
+        free(conn->up.delta);
+        free(conn->up.delta_have);
+        conn->up.delta = NULL;
+        conn->up.delta_have = NULL;
+        // 断开时cleanup_client_session已保存续传进度、交还分段上传的段，这里只兜底释放
+        upload_journal_close(conn->up.journal, conn->up.received);
+        conn->up.journal = NULL;
+        if (conn->up.multipart)
+            multipart_part_end(conn->up.multipart, conn->up.part, 0);
+        conn->up.multipart = NULL;
+        upload_challenge_free(conn->up.challenge);
+        conn->up.challenge = NULL;
+        free(conn->in_buf);
+        conn->in_buf = NULL;
+        conn->in_len = 0;
+        conn->in_cap = 0;
+        conn->backend_ctx = NULL;
+
+        // 丢弃未发出的响应（其他线程可能正在向该连接推送，需加锁）
+        pthread_mutex_lock(&conn->lock);
+        OutFrame *frame = conn->out_head;
+        while (frame)
+        {
+            OutFrame *next = frame->next;
+            free(frame);
+            frame = next;
+        }
+        conn->out_head = NULL;
+        conn->out_tail = NULL;
+        conn->out_bytes = 0;
+        conn->out_armed = 0;
+        pthread_mutex_unlock(&conn->lock);
+    }
+    close(fd);
+}
+
+/**
+ * @brief 根据用户名哈希定位会话索引的分片
+ * @param hash 用户名哈希
+ * @return 分片指针
+ */
+static SessionShard *session_shard(uint32_t hash)
+{
+    return &session_shards[hash & (SESSION_SHARDS - 1)];
+}
+
+/**
+ * @brief 根据用户名哈希定位分片内的哈希桶
+ * @param shard 分片
+ * @param hash 用户名哈希
+ * @return 哈希桶头指针的地址
+ */
+static SessionUser **session_bucket(SessionShard *shard, uint32_t hash)
+{
+    return &shard->buckets[(hash / SESSION_SHARDS) & (SESSION_BUCKETS - 1)];
+}
+
+/**
+ * @brief 在分片内查找在线用户（调用方持有分片锁）
+ * @param shard 分片
+ * @param hash 用户名哈希
+ * @param username 用户名
+ * @return 在线用户，NULL=没有在线会话
+ */
+static SessionUser *session_find(SessionShard *shard, uint32_t hash, const char *username)
+{
+    for (SessionUser *u = *session_bucket(shard, hash); u; u = u->hash_next)
+    {
+        if (u->hash == hash && strcmp(u->username, username) == 0)
+        {
+            return u;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 把连接登记为某用户的在线会话（同一用户可有多个会话；连接已绑定其他用户时先解绑）
+ * @param fd 客户端文件描述符
+ * @param username 用户名
+ * @return 无返回值（内存不足时只绑定用户名，该会话收不到推送）
+ */
+void conn_bind_user(int fd, const char *username)
+{
+    Connection *conn = conn_get(fd);
+    if (!conn)
+    {
+        return;
+    }
+    if (conn->username[0] != '\0')
+    {
+        if (strcmp(conn->username, username) == 0)
+        {
+            return; // 重复登录同一用户：已登记
+        }
+        conn_unbind_user(fd);
+    }
+    strncpy(conn->username, username, sizeof(conn->username) - 1);
+
+    uint32_t hash = str_hash(conn->username);
+    SessionShard *shard = session_shard(hash);
+    pthread_mutex_lock(&shard->lock);
+    SessionUser *u = session_find(shard, hash, conn->username);
+    if (!u)
+    {
+        u = calloc(1, sizeof(SessionUser));
+        if (!u)
+        {
+            pthread_mutex_unlock(&shard->lock);
+            write_log(LOG_LEVEL_ERROR, "在线会话登记失败（内存不足）: %s", conn->username);
+            return;
+        }
+        u->hash = hash;
+        strcpy(u->username, conn->username);
+        SessionUser **bucket = session_bucket(shard, hash);
+        u->hash_next = *bucket;
+        *bucket = u;
+    }
+    if (u->count == u->cap)
+    {
+        int cap = u->cap ? u->cap * 2 : 4;
+        int *fds = realloc(u->fds, cap * sizeof(int));
+        if (!fds)
+        {
+            pthread_mutex_unlock(&shard->lock);
+            write_log(LOG_LEVEL_ERROR, "在线会话登记失败（内存不足）: %s", conn->username);
+            return;
+        }
+        u->fds = fds;
+        u->cap = cap;
+    }
+    u->fds[u->count++] = fd;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * @brief 把连接从其用户的在线会话中移除并清空绑定的用户名（未登录的连接直接返回）
+ * @param fd 客户端文件描述符
+ * @return 无返回值（用户最后一个会话移除时释放该用户的索引项）
+ */
+void conn_unbind_user(int fd)
+{
+    Connection *conn = conn_get(fd);
+    if (!conn || conn->username[0] == '\0')
+    {
+        return;
+    }
+
+    uint32_t hash = str_hash(conn->username);
+    SessionShard *shard = session_shard(hash);
+    pthread_mutex_lock(&shard->lock);
+    SessionUser **pp = session_bucket(shard, hash);
+    while (*pp && ((*pp)->hash != hash || strcmp((*pp)->username, conn->username) != 0))
+    {
+        pp = &(*pp)->hash_next;
+    }
+    SessionUser *u = *pp;
+    if (u)
+    {
+        for (int i = 0; i < u->count; i++)
+        {
+            if (u->fds[i] == fd)
+            {
+                u->fds[i] = u->fds[--u->count];
+                break;
+            }
+        }
+        if (u->count == 0)
+        {
+            *pp = u->hash_next;
+            free(u->fds);
+            free(u);
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    conn->username[0] = '\0';
+}
+
+/**
+ * @brief 向某用户所有在线会话各加入一帧消息（自动加4字节长度前缀）
+ * @param username 目标用户名
+ * @param body 帧内容（JSON文本）
+ * @param len 帧内容长度
+ * @return 成功入队的会话数，0=用户不在线
+ * @details 持分片锁逐个入队：会话在连接关闭前先从索引移除，索引中的fd一定属于仍在线的连接
+ */
+int conn_send_to_user(const char *username, const char *body, uint32_t len)
+{
+    uint32_t hash = str_hash(username);
+    SessionShard *shard = session_shard(hash);
+    int sent = 0;
+
+    pthread_mutex_lock(&shard->lock);
+    SessionUser *u = session_find(shard, hash, username);
+    for (int i = 0; u && i < u->count; i++)
+    {
+        if (conn_queue_frame(u->fds[i], body, len) == 0)
+        {
+            sent++;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return sent;
+}
+
+/**
+ * @brief 保存上传/下载文件路径（按实际长度分配，替换旧路径）
+ * @param dst 连接中的路径字段（如&conn->up.filepath）
+ * @param path 完整路径
+ * @return 0=成功，-1=内存不足
+ */
+int conn_set_path(char **dst, const char *path)
+{
+    char *copy = strdup(path);
+    if (!copy)
+    {
+        write_log(LOG_LEVEL_ERROR, "内存不足，无法保存文件路径");
+        return -1;
+    }
+    free(*dst);
+    *dst = copy;
+    return 0;
+}
+
+/**
+ * @brief 在持有lock时尽量发送队列中的帧（一次sendmsg合并多帧）
+ * @param fd 客户端文件描述符
+ * @param conn 连接对象
+ * @return 0=队列已发空，1=发送缓冲区满仍有剩余，-1=连接出错（队列已清空）
+ */
+static int flush_locked(int fd, Connection *conn)
+{
+    while (conn->out_head)
+    {
+        struct iovec iov[OUT_IOV_MAX];
+        int iovcnt = 0;
+        for (OutFrame *frame = conn->out_head; frame && iovcnt < OUT_IOV_MAX; frame = frame->next)
+        {
+            iov[iovcnt].iov_base = frame->data + frame->sent;
+            iov[iovcnt].iov_len = frame->len - frame->sent;
+            iovcnt++;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 1;
+
+            write_log(LOG_LEVEL_WARN, "客户端 %d 响应发送失败: %s", fd, strerror(errno));
+            while (conn->out_head)
+            {
+                OutFrame *next = conn->out_head->next;
+                free(conn->out_head);
+                conn->out_head = next;
+            }
+            conn->out_tail = NULL;
+            conn->out_bytes = 0;
+            return -1;
+        }
+
+        // 按已发送字节数弹出完整发出的帧，最后一帧可能只发出一部分
+        conn->out_bytes -= sent;
+        while (sent > 0)
+        {
+            OutFrame *frame = conn->out_head;
+            size_t left = frame->len - frame->sent;
+            if ((size_t)sent < left)
+            {
+                frame->sent += sent;
+                break;
+            }
+            sent -= left;
+            conn->out_head = frame->next;
+            free(frame);
+        }
+        if (!conn->out_head)
+            conn->out_tail = NULL;
+    }
+    return 0;
+}
+
+/**
+ * @brief 在持有lock且连接有效时发送响应队列，并按剩余情况开关EPOLLOUT
+ * @param fd 客户端文件描述符
+ * @param conn 连接对象
+ * @return 0=队列已发空，1=仍有剩余，-1=连接出错
+ */
+static int conn_flush_locked(int fd, Connection *conn)
+{
+    int ret;
+    if (conn->dl.fd >= 0)
+        ret = conn->out_head ? 1 : 0; // 下载数据流进行中：响应不能插进文件数据，等下载结束再发
+    else
+        ret = flush_locked(fd, conn);
+    // 是否需要EPOLLOUT有变化时重新挂载；正在被工作线程处理的连接由其处理结束时统一挂载
+    if ((ret == 1) != conn->out_armed && !conn->busy)
+    {
+        reactor_arm_client_locked(fd, conn);
+    }
+    return ret;
+}
+
+/**
+ * @brief 发送连接响应队列中的帧，并按剩余情况开关EPOLLOUT
+ * @param fd 客户端文件描述符
+ * @return 0=队列已发空，1=仍有剩余（已关注EPOLLOUT，可写时继续），-1=连接出错
+ * @details 下载文件已打开（数据流进行中）时只保留队列不发送
+ */
+int conn_flush(int fd)
+{
+    Connection *conn = conn_get(fd);
+    if (!conn)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&conn->lock);
+    int ret = conn->in_use ? conn_flush_locked(fd, conn) : -1;
+    pthread_mutex_unlock(&conn->lock);
+    return ret;
+}
+
+/**
+ * @brief 把一帧响应（自动加4字节长度前缀）加入连接的发送队列
+ * @param fd 客户端文件描述符
+ * @param body 帧内容（JSON文本）
+ * @param len 帧内容长度
+ * @return 0=已入队，-1=连接不存在/内存不足/超过背压上限
+ * @details 发给当前任务所属连接的帧等任务结束（conn_batch_end）时合并发送；
+ *          发给其他连接的帧（如分享通知）立即发送
+ */
+int conn_queue_frame(int fd, const char *body, uint32_t len)
+{
+    return conn_queue_frame_to(fd, 0, body, len);
+}
+
+/**
+ * @brief 把一帧响应加入指定连接的发送队列（句柄失效则丢弃）
+ * @param fd 客户端文件描述符
+ * @param handle 目标连接的句柄（0=fd上当前的连接）
+ * @param body 帧内容（JSON文本）
+ * @param len 帧内容长度
+ * @return 0=已入队，-1=连接已关闭/fd已被新连接复用/内存不足/超过背压上限
+ * @details 供工作线程之外的后台线程（如入库线程）在任务结束后回复：
+ *          校验代数与入队在同一把锁内完成，不会发给复用该fd的新连接
+ */
+int conn_queue_frame_to(int fd, ConnHandle handle, const char *body, uint32_t len)
+{
+    Connection *conn = conn_get(fd);
+    if (!conn)
+    {
+        return -1;
+    }
+
+    OutFrame *frame = malloc(sizeof(OutFrame) + 4 + len);
+    if (!frame)
+    {
+        write_log(LOG_LEVEL_ERROR, "内存不足，无法发送响应");
+        return -1;
+    }
+    uint32_t net_len = htonl(len);
+    memcpy(frame->data, &net_len, 4);
+    memcpy(frame->data + 4, body, len);
+    frame->len = 4 + len;
+    frame->sent = 0;
+    frame->next = NULL;
+
+    pthread_mutex_lock(&conn->lock);
+    if (!conn->in_use || (handle && conn->generation != CONN_HANDLE_GEN(handle)))
+    {
+        pthread_mutex_unlock(&conn->lock);
+        free(frame);
+        return -1;
+    }
+    if (conn->out_bytes + frame->len > OUT_QUEUE_MAX)
+    {
+        // 客户端长期不读：不再无限堆积，关闭读写让事件循环走正常断开流程
+        pthread_mutex_unlock(&conn->lock);
+        free(frame);
+        write_log(LOG_LEVEL_WARN, "客户端 %d 待发送响应超过 %d 字节，断开连接", fd, OUT_QUEUE_MAX);
+        shutdown(fd, SHUT_RDWR);
+        return -1;
+    }
+    if (conn->out_tail)
+        conn->out_tail->next = frame;
+    else
+        conn->out_head = frame;
+    conn->out_tail = frame;
+    conn->out_bytes += frame->len;
+    // 只有当前任务所属的那个连接（代数相同）才留到任务结束合并发送，fd被新连接复用时立即发送
+    int batched = batch_conn == make_handle(fd, conn->generation);
+    pthread_mutex_unlock(&conn->lock);
+
+    if (!batched)
+    {
+        conn_flush(fd);
+    }
+    return 0;
+}
+
+/**
+ * @brief 工作线程开始处理某连接的任务：之后发给该连接的响应先排队
+ * @param handle 任务所属连接的句柄
+ * @return 无返回值
+ */
+void conn_batch_begin(ConnHandle handle)
+{
+    batch_conn = handle;
+}
+
+/**
+ * @brief 任务处理结束：把本任务排队的响应一次性合并发送
+ * @param 无参数
+ * @return 无返回值
+ */
+void conn_batch_end()
+{
+    ConnHandle handle = batch_conn;
+    batch_conn = 0;
+    Connection *conn = handle ? conn_lookup(handle) : NULL;
+    if (!conn)
+    {
+        return;
+    }
+
+    // 任务期间连接已关闭、fd被新连接复用时句柄失效，不替新连接发送
+    int fd = CONN_HANDLE_FD(handle);
+    pthread_mutex_lock(&conn->lock);
+    if (conn->in_use && conn->generation == CONN_HANDLE_GEN(handle))
+    {
+        conn_flush_locked(fd, conn);
+    }
+    pthread_mutex_unlock(&conn->lock);
+}
@@ -0,0 +1,132 @@
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include "cloud_disk.h"
+
+/**
+ * @brief 从句柄中取出fd
+ */
+#define CONN_HANDLE_FD(handle) ((int)((handle) & 0xffffffffu))
+
+/**
+ * @brief 从句柄中取出代数
+ */
+#define CONN_HANDLE_GEN(handle) ((uint32_t)((handle) >> 32))
+
+/**
+ * @brief 登记新连接（fd所在块不存在时按需分配），代数+1并清空旧状态
+ * @param fd 客户端文件描述符
+ * @param addr 客户端地址信息
+ * @param epfd 所属reactor的epoll实例（io_uring后端传-1）
+ * @param handle 输出：新连接的句柄（可为NULL）
+ * @return 连接对象，NULL=fd超出上限或内存不足
+ */
+Connection *conn_open(int fd, struct sockaddr_in addr, int epfd, ConnHandle *handle);
+
+/**
+ * @brief 按fd取连接对象（业务函数在已校验的任务内使用）
+ * @param fd 客户端文件描述符
+ * @return 连接对象，NULL=fd未登记
+ */
+Connection *conn_get(int fd);
+
+/**
+ * @brief 按句柄取连接对象，校验代数（fd已关闭或已被新连接复用时返回NULL）
+ * @param handle 连接句柄
+ * @return 连接对象，NULL=句柄已失效
+ */
+Connection *conn_lookup(ConnHandle handle);
+
+/**
+ * @brief 获取fd上当前连接的句柄
+ * @param fd 客户端文件描述符
+ * @return 连接句柄，0=fd未登记
+ */
+ConnHandle conn_handle(int fd);
+
+/**
+ * @brief 关闭连接：释放路径和缓冲区、代数+1使旧句柄失效，最后关闭socket
+ * @param fd 客户端文件描述符
+ * @return 无返回值
+ */
+void conn_close(int fd);
+
+/**
+ * @brief 把连接登记为某用户的在线会话（同一用户可有多个会话；连接已绑定其他用户时先解绑）
+ * @param fd 客户端文件描述符
+ * @param username 用户名
+ * @return 无返回值（内存不足时只绑定用户名，该会话收不到推送）
+ */
+void conn_bind_user(int fd, const char *username);
+
+/**
+ * @brief 把连接从其用户的在线会话中移除并清空绑定的用户名（未登录的连接直接返回）
+ * @param fd 客户端文件描述符
+ * @return 无返回值（用户最后一个会话移除时释放该用户的索引项）
+ */
+void conn_unbind_user(int fd);
+
+/**
+ * @brief 向某用户所有在线会话各加入一帧消息（自动加4字节长度前缀）
+ * @param username 目标用户名
+ * @param body 帧内容（JSON文本）
+ * @param len 帧内容长度
+ * @return 成功入队的会话数，0=用户不在线
+ * @details 持分片锁逐个入队：会话在连接关闭前先从索引移除，索引中的fd一定属于仍在线的连接
+ */
+int conn_send_to_user(const char *username, const char *body, uint32_t len);
+
+/**
+ * @brief 保存上传/下载文件路径（按实际长度分配，替换旧路径）
+ * @param dst 连接中的路径字段（如&conn->up.filepath）
+ * @param path 完整路径
+ * @return 0=成功，-1=内存不足
+ */
+int conn_set_path(char **dst, const char *path);
+
+/**
+ * @brief 把一帧响应（自动加4字节长度前缀）加入连接的发送队列
+ * @param fd 客户端文件描述符
+ * @param body 帧内容（JSON文本）
+ * @param len 帧内容长度
+ * @return 0=已入队，-1=连接不存在/内存不足/超过背压上限
+ * @details 发给当前任务所属连接的帧等任务结束（conn_batch_end）时合并发送；
+ *          发给其他连接的帧（如分享通知）立即发送
+ */
+int conn_queue_frame(int fd, const char *body, uint32_t len);
+
+/**
+ * @brief 把一帧响应加入指定连接的发送队列（句柄失效则丢弃）
+ * @param fd 客户端文件描述符
+ * @param handle 目标连接的句柄（0=fd上当前的连接）
+ * @param body 帧内容（JSON文本）
+ * @param len 帧内容长度
+ * @return 0=已入队，-1=连接已关闭/fd已被新连接复用/内存不足/超过背压上限
+ * @details 供工作线程之外的后台线程（如入库线程）在任务结束后回复：
+ *          校验代数与入队在同一把锁内完成，不会发给复用该fd的新连接
+ */
+int conn_queue_frame_to(int fd, ConnHandle handle, const char *body, uint32_t len);
+
+/**
+ * @brief 发送连接响应队列中的帧，并按剩余情况开关EPOLLOUT
+ * @param fd 客户端文件描述符
+ * @return 0=队列已发空，1=仍有剩余（已关注EPOLLOUT，可写时继续），-1=连接出错
+ * @details 下载文件已打开（数据流进行中）时只保留队列不发送
+ */
+int conn_flush(int fd);
+
+/**
+ * @brief 工作线程开始处理某连接的任务：之后发给该连接的响应先排队
+ * @param handle 任务所属连接的句柄
+ * @return 无返回值
+ */
+void conn_batch_begin(ConnHandle handle);
+
+/**
+ * @brief 任务处理结束：把本任务排队的响应一次性合并发送
+ * @param 无参数
+ * @return 无返回值
+ */
+void conn_batch_end();
+
+#endif // CONN_TABLE_H
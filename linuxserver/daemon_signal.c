@@ -1,5 +1,7 @@
 #include "daemon_signal.h"
 
+#include <sys/eventfd.h>
+
 /**
  * @brief 将进程转为守护进程（脱离终端、后台运行）
  * @param log_file 日志文件路径（守护进程的输出重定向）
@@ -58,6 +60,8 @@ void daemonize(const char *log_file)
  * @brief 信号处理函数（捕获SIGINT、SIGTERM、SIGPIPE）
  * @param signo 捕获到的信号编号
  * @return 无返回值
+ * @details 终止信号只在主线程上处理（其他线程都屏蔽了），这里只置退出标志并唤醒事件循环；
+ *          停止线程、写完操作日志等清理由main在事件循环返回后按顺序完成
  */
 void signal_handler(int signo)
 {
@@ -66,39 +70,18 @@ void signal_handler(int signo)
     // 处理Ctrl+C（SIGINT）和kill命令（SIGTERM）：优雅退出
     case SIGINT:
     case SIGTERM:
-        write_log(LOG_LEVEL_INFO, "收到终止信号，正在优雅退出...");
+    {
+        int saved_errno = errno;
         server_running = 0; // 设置服务器退出标志
-
-        // 唤醒所有等待的线程（避免线程阻塞在sem_wait）
-        for (int i = 0; i < THREAD_POOL_SIZE; i++)
-        {
-            sem_post(&thread_pool.semaphore);
-        }
-
-        // 关闭文件描述符
-        if (epfd != -1)
-            close(epfd);
-        if (server_fd != -1)
-            close(server_fd);
-
-        // 关闭MySQL连接
-        mysql_close(&mysql);
-
-        // 等待所有线程退出
-        for (int i = 0; i < THREAD_POOL_SIZE; i++)
+        // 唤醒阻塞在epoll_wait/io_uring上的事件循环（只用异步信号安全的write）
+        uint64_t one = 1;
+        if (shutdown_fd >= 0 && write(shutdown_fd, &one, sizeof(one)) == -1)
         {
-            pthread_join(thread_pool.threads[i], NULL);
+            // eventfd计数已满也能唤醒，忽略
         }
-
-        // 销毁锁和信号量
-        pthread_mutex_destroy(&thread_pool.mutex);
-        sem_destroy(&thread_pool.semaphore);
-
-        // 记录退出日志，关闭syslog
-        write_log(LOG_LEVEL_INFO, "服务器已成功关闭");
-        closelog();
-        exit(EXIT_SUCCESS);
+        errno = saved_errno;
         break;
+    }
 
     // 处理SIGPIPE（客户端断开连接后继续写数据）
     case SIGPIPE:
@@ -109,4 +92,56 @@ void signal_handler(int signo)
     default:
         break;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief 安装信号处理并在调用线程屏蔽终止信号（须在创建任何线程之前由主线程调用）
+ * @param 无参数
+ * @return 0=成功，-1=失败
+ * @details 之后创建的线程继承屏蔽字，终止信号不会落到持有锁的工作线程或操作日志线程上；
+ *          主线程创建完所有线程后调用signal_unblock_shutdown，只在主线程上接收终止信号
+ */
+int signal_init()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0)
+    {
+        return -1;
+    }
+
+    shutdown_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (shutdown_fd == -1)
+    {
+        return -1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    if (sigaction(SIGINT, &sa, NULL) == -1 ||
+        sigaction(SIGTERM, &sa, NULL) == -1 ||
+        sigaction(SIGPIPE, &sa, NULL) == -1)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 主线程解除终止信号屏蔽（所有线程创建完成后、进入事件循环前调用；屏蔽期间到达的信号此时递送）
+ * @param 无参数
+ * @return 无返回值
+ */
+void signal_unblock_shutdown()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+}
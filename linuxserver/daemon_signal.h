@@ -14,7 +14,25 @@ void daemonize(const char *log_file);
  * @brief 信号处理函数（捕获SIGINT、SIGTERM、SIGPIPE）
  * @param signo 捕获到的信号编号
  * @return 无返回值
+ * @details 终止信号只在主线程上处理（其他线程都屏蔽了），这里只置退出标志并唤醒事件循环；
+ *          停止线程、写完操作日志等清理由main在事件循环返回后按顺序完成
  */
 void signal_handler(int signo);
 
+/**
+ * @brief 安装信号处理并在调用线程屏蔽终止信号（须在创建任何线程之前由主线程调用）
+ * @param 无参数
+ * @return 0=成功，-1=失败
+ * @details 之后创建的线程继承屏蔽字，终止信号不会落到持有锁的工作线程或操作日志线程上；
+ *          主线程创建完所有线程后调用signal_unblock_shutdown，只在主线程上接收终止信号
+ */
+int signal_init();
+
+/**
+ * @brief 主线程解除终止信号屏蔽（所有线程创建完成后、进入事件循环前调用；屏蔽期间到达的信号此时递送）
+ * @param 无参数
+ * @return 无返回值
+ */
+void signal_unblock_shutdown();
+
 #endif // DAEMON_SIGNAL_H
\ No newline at end of file
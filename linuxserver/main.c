@@ -3,228 +3,201 @@
 
 // ========================== 全局变量定义 ==========================
 int server_running = 1;                              // 服务器运行状态标志（1=运行，0=退出）
-int server_fd = -1;                                  // 服务器监听socket文件描述符
-int epfd = -1;                                       // epoll实例文件描述符
-UserCache user_cache[MAX_USERS];                     // 用户信息缓存数组
-int user_cache_count = 0;                            // 缓存的用户数量
+int shutdown_fd = -1;                                // 退出通知eventfd（终止信号处理函数写入，唤醒各事件循环）
+ServerConfig server_config = {1, 1, 1, IO_BACKEND_EPOLL, OPLOG_FLUSH_MS_DEFAULT, META_BACKEND_MYSQL, NULL, NULL}; // 服务器启动配置（默认守护进程、单reactor、splice上传、epoll后端、异步操作日志、MySQL元数据、随机令牌密钥）
+Reactor reactors[MAX_REACTORS];                      // reactor数组
+int reactor_count = 0;                               // 实际启动的reactor数量
+UserCache user_cache;                                // 用户信息缓存
 char server_ip[INET_ADDRSTRLEN] = "192.168.112.10";  // 服务器IP地址
-ClientUploadInfo client_up_info[MAX_EVENTS] = {0};   // 客户端上传信息数组（按fd索引）
-ClientDownloadInfo client_dl_info[MAX_EVENTS] = {0}; // 客户端下载信息数组（按fd索引）
-char client_username[MAX_EVENTS][50] = {0};          // 客户端fd->用户名映射（登录后绑定）
-struct sockaddr_in client_addrs[MAX_EVENTS];         // 客户端fd->IP地址映射
 ThreadPool thread_pool;                              // 线程池实例
 
 /**
- * @brief 主函数：服务器入口（初始化、epoll事件循环）
+ * @brief 解析命令行参数到server_config
  * @param argc 命令行参数个数
- * @param argv 命令行参数数组（-f 表示前台运行，默认后台守护进程）
- * @return 0=正常退出，1=异常退出
+ * @param argv 命令行参数数组
+ * @return 无返回值（参数非法时打印用法并退出）
  */
-int main(int argc, char *argv[])
+static void parse_options(int argc, char *argv[])
 {
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = signal_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-
-    if (sigaction(SIGINT, &sa, NULL) == -1 ||
-        sigaction(SIGTERM, &sa, NULL) == -1 ||
-        sigaction(SIGPIPE, &sa, NULL) == -1)
-    {
-        perror("设置信号处理失败");
-        exit(EXIT_FAILURE);
-    }
-
-    int daemon_mode = 1;
-    for (int i = 0; i < argc; i++)
+    int opt;
+    while ((opt = getopt(argc, argv, "fr:cuL:S:K:")) != -1)
     {
-        if (strcmp(argv[i], "-f") == 0)
+        switch (opt)
         {
-            daemon_mode = 0;
+        case 'f': // 前台运行
+            server_config.daemon_mode = 0;
             break;
+        case 'r': // reactor线程数（0=按CPU核数）
+            server_config.reactor_count = atoi(optarg);
+            break;
+        case 'c': // 上传改用recv+write拷贝模式
+            server_config.upload_splice = 0;
+            break;
+        case 'u': // 使用io_uring后端
+            server_config.io_backend = IO_BACKEND_URING;
+            break;
+        case 'L': // 操作日志刷盘间隔（0=同步写入）
+            server_config.log_flush_ms = atoi(optarg);
+            break;
+        case 'S': // 元数据改存内嵌SQLite数据库文件
+            server_config.meta_backend = META_BACKEND_SQLITE;
+            server_config.meta_path = optarg;
+            break;
+        case 'K': // 会话令牌签名密钥文件（重启后已签发的令牌仍有效）
+            server_config.token_key_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "用法: %s [-f] [-r reactor数(0=CPU核数)] [-c 上传使用拷贝模式] [-u 使用io_uring后端] [-L 操作日志刷盘间隔ms(0=同步)] [-S SQLite数据库文件(替代MySQL)] [-K 会话令牌密钥文件]\n", argv[0]);
+            exit(EXIT_FAILURE);
         }
     }
-    if (daemon_mode)
+
+    if (server_config.reactor_count <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        server_config.reactor_count = cpus > 0 ? (int)cpus : 1;
+    }
+    if (server_config.reactor_count > MAX_REACTORS)
     {
-        daemonize(SERVER_ROOT "/server.log");
+        server_config.reactor_count = MAX_REACTORS;
+    }
+    if (server_config.log_flush_ms < 0)
+    {
+        server_config.log_flush_ms = 0;
     }
+}
 
-    // 初始化服务器核心模块
-    init_server();      // 初始化服务器根目录
-    init_mysql();       // 初始化MySQL连接
-    thread_pool_init(); // 初始化线程池
+/**
+ * @brief 把进程可打开的文件数软上限提到硬上限（连接表最多管理MAX_CONNECTIONS个fd）
+ * @param 无参数
+ * @return 无返回值
+ */
+static void raise_fd_limit()
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+        return;
+
+    rlim_t want = rl.rlim_max;
+    if (want == RLIM_INFINITY || want > MAX_CONNECTIONS)
+        want = MAX_CONNECTIONS;
+    if (rl.rlim_cur < want)
+    {
+        rl.rlim_cur = want;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+        {
+            write_log(LOG_LEVEL_WARN, "提高文件描述符上限失败: %s", strerror(errno));
+        }
+    }
+}
 
-    // 创建服务器监听socket（TCP）
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd == -1)
+/**
+ * @brief 主函数：服务器入口（初始化、启动reactor事件循环）
+ * @param argc 命令行参数个数
+ * @param argv 命令行参数数组（-f 前台运行，-r N 启动N个reactor）
+ * @return 0=正常退出，1=异常退出
+ */
+int main(int argc, char *argv[])
+{
+    // 先屏蔽终止信号再创建线程：只有主线程解除屏蔽，信号处理函数不会打断持有锁的线程
+    if (signal_init() == -1)
     {
-        perror("socket失败");
-        write_log(LOG_LEVEL_ERROR, "socket创建失败: %s", strerror(errno));
+        perror("设置信号处理失败");
         exit(EXIT_FAILURE);
     }
 
-    // 设置socket选项：允许端口复用（避免重启时端口占用）
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-    // 设置socket为非阻塞模式（配合epoll边缘触发）
-    int flags = fcntl(server_fd, F_GETFL, 0);
-    fcntl(server_fd, F_SETFL, flags | O_NONBLOCK);
+    parse_options(argc, argv);
+    if (server_config.daemon_mode)
+    {
+        daemonize(SERVER_ROOT "/server.log");
+    }
 
-    // 绑定IP和端口
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = inet_addr(server_ip);
-    addr.sin_port = htons(PORT);
-    if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    // 初始化服务器核心模块
+    raise_fd_limit();     // 提高fd上限（支持大量空闲长连接）
+    init_server();        // 初始化服务器根目录
+    user_cache_init();    // 初始化用户缓存
+    if (cas_init() == -1) // 初始化块存储（由清单重建块引用计数）
     {
-        perror("bind失败");
-        write_log(LOG_LEVEL_ERROR, "bind失败: %s", strerror(errno));
-        close(server_fd);
         exit(EXIT_FAILURE);
     }
-
-    // 开始监听（backlog=12，最大等待连接数）
-    if (listen(server_fd, 12) == -1)
+    if (upload_journal_init() == -1) // 初始化断点续传（回收过期的未完成上传）
     {
-        perror("listen失败");
-        write_log(LOG_LEVEL_ERROR, "listen失败: %s", strerror(errno));
-        close(server_fd);
         exit(EXIT_FAILURE);
     }
-    printf("服务器启动，监听 %s:%d...\n", server_ip, PORT);
-    write_log(LOG_LEVEL_INFO, "服务器启动，监听 %s:%d", server_ip, PORT);
-
-    // 创建epoll实例（用于IO多路复用）
-    epfd = epoll_create1(0);
-    if (epfd == -1)
+    if (session_token_init() == -1) // 初始化会话令牌签名密钥
     {
-        perror("epoll_create失败");
-        write_log(LOG_LEVEL_ERROR, "epoll_create失败: %s", strerror(errno));
-        close(server_fd);
         exit(EXIT_FAILURE);
     }
+    meta_store_init();    // 初始化元数据存储（默认MySQL连接池，-S 使用内嵌SQLite）
+    oplog_writer_start(); // 启动操作日志批量写线程（-L 0 时不启动，同步写入）
+    cas_ingest_start();   // 启动后台入库线程（上传收齐后的切块、哈希不占用工作线程）
+    thread_pool_init();   // 初始化线程池
 
-    // 将监听socket添加到epoll（边缘触发+读事件）
-    struct epoll_event ev, events[MAX_EVENTS];
-    ev.events = EPOLLIN | EPOLLET;
-    ev.data.fd = server_fd;
-    if (epoll_ctl(epfd, EPOLL_CTL_ADD, server_fd, &ev) == -1)
+    // io_uring后端：主线程运行完成事件循环；不可用（未编译或内核不支持）时回退epoll
+    if (server_config.io_backend == IO_BACKEND_URING && uring_backend_run() == -1)
     {
-        perror("epoll_ctl失败");
-        write_log(LOG_LEVEL_ERROR, "epoll_ctl失败: %s", strerror(errno));
-        close(epfd);
-        close(server_fd);
-        exit(EXIT_FAILURE);
+        printf("io_uring后端不可用，回退到epoll\n");
+        write_log(LOG_LEVEL_WARN, "io_uring后端不可用，回退到epoll");
+        server_config.io_backend = IO_BACKEND_EPOLL;
     }
 
-    // epoll事件循环（服务器核心逻辑）
-    while (server_running)
+    if (server_config.io_backend == IO_BACKEND_EPOLL)
     {
-        // 等待epoll事件（阻塞，直到有事件发生）
-        int nfds = epoll_wait(epfd, events, MAX_EVENTS, -1);
-        if (nfds == -1)
+        // 创建reactor：每个reactor拥有独立的监听socket和epoll实例
+        int reuse_port = server_config.reactor_count > 1;
+        for (int i = 0; i < server_config.reactor_count; i++)
         {
-            // 忽略中断错误（信号导致的暂时返回）
-            if (errno == EINTR)
-                continue;
-            perror("epoll_wait失败");
-            write_log(LOG_LEVEL_ERROR, "epoll_wait失败: %s", strerror(errno));
-            break;
+            if (reactor_init(&reactors[i], i, reuse_port) == -1)
+            {
+                reactor_close_all();
+                exit(EXIT_FAILURE);
+            }
+            reactor_count++;
         }
+        printf("服务器启动，监听 %s:%d（%d个reactor）...\n", server_ip, PORT, reactor_count);
+        write_log(LOG_LEVEL_INFO, "服务器启动，监听 %s:%d（%d个reactor）", server_ip, PORT, reactor_count);
 
-        // 遍历处理所有发生的事件
-        for (int i = 0; i < nfds; i++)
+        // 1号及以后的reactor各自运行在独立线程，0号reactor运行在主线程
+        for (int i = 1; i < reactor_count; i++)
         {
-            int fd = events[i].data.fd;
-            struct sockaddr_in client_addr;
-            socklen_t client_len = sizeof(client_addr);
-
-            // 事件1：监听socket有新连接
-            if (fd == server_fd)
-            {
-                // 循环接受所有新连接（边缘触发需一次性处理完）
-                while (1)
-                {
-                    int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
-                    if (client_fd == -1)
-                    {
-                        // 没有更多连接（非阻塞accept的正常返回）
-                        if (errno == EAGAIN || errno == EWOULDBLOCK)
-                            break;
-                        perror("accept失败");
-                        write_log(LOG_LEVEL_ERROR, "accept失败: %s", strerror(errno));
-                        break;
-                    }
-
-                    // 设置客户端socket为非阻塞模式
-                    flags = fcntl(client_fd, F_GETFL, 0);
-                    fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
-
-                    // 记录客户端地址信息
-                    client_addrs[client_fd] = client_addr;
-                    printf("新客户端连接：fd=%d, IP=%s\n", client_fd, inet_ntoa(client_addr.sin_addr));
-                    write_log(LOG_LEVEL_INFO, "新客户端连接：fd=%d, IP=%s", client_fd, inet_ntoa(client_addr.sin_addr));
-
-                    // 将客户端socket添加到epoll（边缘触发+读事件）
-                    ev.events = EPOLLIN | EPOLLET;
-                    ev.data.fd = client_fd;
-                    if (epoll_ctl(epfd, EPOLL_CTL_ADD, client_fd, &ev) == -1)
-                    {
-                        perror("epoll_ctl添加客户端失败");
-                        write_log(LOG_LEVEL_ERROR, "epoll_ctl添加客户端 %d 失败: %s", client_fd, strerror(errno));
-                        close(client_fd);
-                    }
-                }
-            }
-            // 事件2：客户端socket有上传数据（处于上传中状态）
-            else if (client_up_info[fd].state == UP_STATE_RECEIVING)
+            if (pthread_create(&reactors[i].thread, NULL, reactor_loop, &reactors[i]) != 0)
             {
-                // 添加上传任务到线程池
-                Task task;
-                task.client_fd = fd;
-                task.type = TASK_UPLOAD_DATA;
-                task.client_addr = client_addrs[fd];
-                thread_pool_add_task(task);
-            }
-            // 下载推模式：EPOLLOUT事件且处于发送中
-            else if ((events[i].events & EPOLLOUT) && client_dl_info[fd].state == DL_STATE_SENDING)
-            {
-                Task task;
-                task.client_fd = fd;
-                task.type = TASK_DOWNLOAD_DATA;
-                task.client_addr = client_addrs[fd];
-                thread_pool_add_task(task);
-            }
-            // 其他普通消息
-            else if (events[i].events & EPOLLIN)
-            {
-                Task task;
-                task.client_fd = fd;
-                task.type = TASK_CLIENT_MESSAGE;
-                task.client_addr = client_addrs[fd];
-                thread_pool_add_task(task);
+                perror("reactor线程创建失败");
+                write_log(LOG_LEVEL_ERROR, "reactor %d 线程创建失败", i);
+                reactor_close_all();
+                exit(EXIT_FAILURE);
             }
         }
+        signal_unblock_shutdown(); // 所有线程都已创建（继承了屏蔽字），终止信号只递送给主线程
+        reactor_loop(&reactors[0]);
     }
 
-    // 服务器退出前清理资源
-    close(epfd);
-    close(server_fd);
-    mysql_close(&mysql);
-
-    // 等待所有线程退出
-    for (int i = 0; i < THREAD_POOL_SIZE; i++)
+    // 服务器退出前清理资源（终止信号处理函数只置标志，清理都在这里完成）
+    write_log(LOG_LEVEL_INFO, "事件循环已结束，正在优雅退出...");
+    server_running = 0;
+    // 0号reactor可能因出错而非信号退出：写退出通知唤醒其他reactor，等它们不再派发任务后再销毁线程池
+    uint64_t one = 1;
+    if (write(shutdown_fd, &one, sizeof(one)) == -1)
     {
-        pthread_join(thread_pool.threads[i], NULL);
+        write_log(LOG_LEVEL_WARN, "写入退出通知失败: %s", strerror(errno));
     }
-
-    // 销毁线程池同步资源
-    pthread_mutex_destroy(&thread_pool.mutex);
-    sem_destroy(&thread_pool.semaphore);
+    for (int i = 1; i < reactor_count; i++)
+    {
+        pthread_join(reactors[i].thread, NULL);
+    }
+    reactor_close_all();
+
+    // 等待所有线程退出并销毁线程池同步资源
+    thread_pool_destroy();
+    // 不再有新的上传提交：写完等待入库的上传（回复和操作日志都在入库线程上完成）
+    cas_ingest_stop();
+    user_cache_log_stats();
+    cas_log_stats();
+    // 工作线程都已退出：写完剩余的操作日志，再关闭元数据存储
+    oplog_writer_stop();
+    meta_store_destroy();
 
     write_log(LOG_LEVEL_INFO, "服务器已退出");
     closelog();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,254 @@
+#include "meta_store.h"
+
+// 当前使用的元数据存储后端（定义，声明在cloud_disk.h；启动时由meta_store_init选定）
+const MetaStore *meta_store = &mysql_meta_store;
+
+/**
+ * @brief 按启动配置选择元数据存储后端并初始化（-S 选择内嵌SQLite，默认MySQL）
+ * @param 无参数
+ * @return 无返回值（后端初始化失败时直接退出程序）
+ */
+void meta_store_init()
+{
+    meta_store = server_config.meta_backend == META_BACKEND_SQLITE ? &sqlite_meta_store : &mysql_meta_store;
+    meta_store->init();
+    write_log(LOG_LEVEL_INFO, "元数据存储后端: %s", meta_store->name);
+}
+
+/**
+ * @brief 关闭元数据存储
+ * @param 无参数
+ * @return 无返回值（调用前需已停止线程池和操作日志写线程）
+ */
+void meta_store_destroy()
+{
+    meta_store->destroy();
+}
+
+// ========================== 操作日志批量写线程 ==========================
+/**
+ * @brief 环形队列槽位（seq为序号：等于入队位置表示空闲，等于位置+1表示已写入）
+ */
+typedef struct
+{
+    unsigned long long seq; // 槽位序号
+    OpLogRecord rec;        // 操作记录
+} OpLogSlot;
+
+static OpLogSlot oplog_ring[OPLOG_RING_SIZE];
+static unsigned long long oplog_head = 0; // 下一个入队位置（多个工作线程CAS竞争）
+static unsigned long long oplog_tail = 0; // 下一个出队位置（只有写线程访问）
+static sem_t oplog_sem;                   // 唤醒写线程（攒够一批或退出时投递）
+static pthread_t oplog_thread;
+static int oplog_running = 0;             // 写线程是否在运行（0=同步写入）
+static int oplog_stopping = 0;            // 1=写线程写完剩余记录后退出
+
+/**
+ * @brief 把一条记录放入环形队列（无锁，多生产者）
+ * @param rec 操作记录
+ * @return 0=成功，-1=队列已满
+ */
+static int oplog_push(const OpLogRecord *rec)
+{
+    unsigned long long pos = __atomic_load_n(&oplog_head, __ATOMIC_RELAXED);
+    OpLogSlot *slot;
+    while (1)
+    {
+        slot = &oplog_ring[pos & (OPLOG_RING_SIZE - 1)];
+        unsigned long long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        long long diff = (long long)seq - (long long)pos;
+        if (diff == 0)
+        {
+            // 槽位空闲：抢占这个入队位置（失败时pos被更新为最新值）
+            if (__atomic_compare_exchange_n(&oplog_head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return -1; // 写线程还没取走一圈前的记录：队列已满
+        }
+        else
+        {
+            pos = __atomic_load_n(&oplog_head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->rec = *rec;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    // 每攒够一批唤醒写线程，不必等到刷盘间隔
+    if ((pos + 1) % OPLOG_BATCH_MAX == 0)
+    {
+        sem_post(&oplog_sem);
+    }
+    return 0;
+}
+
+/**
+ * @brief 从环形队列取出一条记录（只由写线程调用）
+ * @param rec 输出：操作记录
+ * @return 1=取到，0=队列为空
+ */
+static int oplog_pop(OpLogRecord *rec)
+{
+    OpLogSlot *slot = &oplog_ring[oplog_tail & (OPLOG_RING_SIZE - 1)];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != oplog_tail + 1)
+    {
+        return 0;
+    }
+    *rec = slot->rec;
+    // 槽位序号推进一圈，留给下一轮的生产者
+    __atomic_store_n(&slot->seq, oplog_tail + OPLOG_RING_SIZE, __ATOMIC_RELEASE);
+    oplog_tail++;
+    return 1;
+}
+
+/**
+ * @brief 把一批记录交给元数据存储写入，写完释放记录中的文件名
+ * @param batch 记录数组
+ * @param count 记录数
+ * @return 无返回值
+ */
+static void oplog_write_batch(OpLogRecord *batch, int count)
+{
+    if (meta_store->insert_logs(batch, count) != 0)
+    {
+        write_log(LOG_LEVEL_ERROR, "批量写入 %d 条操作记录失败", count);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        free(batch[i].filename);
+    }
+}
+
+/**
+ * @brief 操作日志写线程：每log_flush_ms毫秒或攒够OPLOG_BATCH_MAX条时，把队列中的记录批量写入
+ * @param arg 无实际意义（满足pthread_create要求）
+ * @return 无返回值（返回NULL）
+ */
+static void *oplog_writer_thread(void *arg)
+{
+    (void)arg;
+
+    static OpLogRecord batch[OPLOG_BATCH_MAX];
+    while (1)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)server_config.log_flush_ms * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        sem_timedwait(&oplog_sem, &deadline);
+
+        int stopping = __atomic_load_n(&oplog_stopping, __ATOMIC_ACQUIRE);
+        // 取空队列：每OPLOG_BATCH_MAX条写一批
+        int count;
+        do
+        {
+            count = 0;
+            while (count < OPLOG_BATCH_MAX && oplog_pop(&batch[count]))
+                count++;
+            if (count > 0)
+                oplog_write_batch(batch, count);
+        } while (count == OPLOG_BATCH_MAX);
+        // 一轮写完归还连接，不在休眠期间占用
+        meta_store->release();
+
+        if (stopping)
+            break;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 启动操作日志批量写线程（log_flush_ms为0或启动失败时保持同步写入）
+ * @param 无参数
+ * @return 无返回值（需在meta_store_init之后调用）
+ */
+void oplog_writer_start()
+{
+    if (server_config.log_flush_ms <= 0)
+    {
+        write_log(LOG_LEVEL_INFO, "操作日志同步写入");
+        return;
+    }
+
+    for (unsigned long long i = 0; i < OPLOG_RING_SIZE; i++)
+    {
+        oplog_ring[i].seq = i;
+    }
+    sem_init(&oplog_sem, 0, 0);
+
+    if (pthread_create(&oplog_thread, NULL, oplog_writer_thread, NULL) != 0)
+    {
+        write_log(LOG_LEVEL_WARN, "操作日志写线程创建失败，改为同步写入");
+        sem_destroy(&oplog_sem);
+        return;
+    }
+    oplog_running = 1;
+    write_log(LOG_LEVEL_INFO, "操作日志批量写入（每 %d ms 或 %d 条刷盘一次）",
+              server_config.log_flush_ms, OPLOG_BATCH_MAX);
+}
+
+/**
+ * @brief 停止操作日志批量写线程（写完队列中剩余的记录后退出）
+ * @param 无参数
+ * @return 无返回值（调用前需已停止线程池，不再有新记录入队）
+ */
+void oplog_writer_stop()
+{
+    if (!oplog_running)
+    {
+        return;
+    }
+    __atomic_store_n(&oplog_stopping, 1, __ATOMIC_RELEASE);
+    sem_post(&oplog_sem);
+    pthread_join(oplog_thread, NULL);
+    oplog_running = 0;
+
+    sem_destroy(&oplog_sem);
+}
+
+/**
+ * @brief 插入用户操作记录（登录、上传、下载等）
+ * @param client_fd 客户端文件描述符
+ * @param username 操作用户名
+ * @param ip 客户端IP地址
+ * @param operation 操作类型（如"login"、"upload"）
+ * @param filename 操作的文件名（无则传NULL）
+ * @param status 操作状态（如"成功"、"失败"）
+ * @return 无返回值
+ * @details 批量写线程运行时只把记录放入无锁环形队列就返回；队列满或同步模式（-L 0）时直接写入
+ */
+void insert_operation_log(int client_fd, const char *username, const char *ip,
+                          const char *operation, const char *filename, const char *status)
+{
+    OpLogRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    strncpy(rec.username, username, sizeof(rec.username) - 1);
+    rec.client_fd = client_fd;
+    strncpy(rec.ip, ip, sizeof(rec.ip) - 1);
+    strncpy(rec.operation, operation, sizeof(rec.operation) - 1);
+    strncpy(rec.status, status, sizeof(rec.status) - 1);
+    rec.time = time(NULL);
+
+    if (oplog_running)
+    {
+        rec.filename = (filename && filename[0]) ? strdup(filename) : NULL;
+        if (oplog_push(&rec) == 0)
+        {
+            return;
+        }
+        // 队列已满：退回同步写入，记录不丢失
+        free(rec.filename);
+    }
+
+    // 同步写入：文件名直接引用调用方的字符串
+    rec.filename = (filename && filename[0]) ? (char *)filename : NULL;
+    if (meta_store->insert_logs(&rec, 1) != 0)
+    {
+        write_log(LOG_LEVEL_ERROR, "写入操作记录失败: %s %s", username, operation);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef META_STORE_H
+#define META_STORE_H
+
+#include "cloud_disk.h"
+
+/**
+ * @brief 按启动配置选择元数据存储后端并初始化（-S 选择内嵌SQLite，默认MySQL）
+ * @param 无参数
+ * @return 无返回值（后端初始化失败时直接退出程序）
+ */
+void meta_store_init();
+
+/**
+ * @brief 关闭元数据存储
+ * @param 无参数
+ * @return 无返回值（调用前需已停止线程池和操作日志写线程）
+ */
+void meta_store_destroy();
+
+/**
+ * @brief 启动操作日志批量写线程（log_flush_ms为0或启动失败时保持同步写入）
+ * @param 无参数
+ * @return 无返回值（需在meta_store_init之后调用）
+ */
+void oplog_writer_start();
+
+/**
+ * @brief 停止操作日志批量写线程（写完队列中剩余的记录后退出）
+ * @param 无参数
+ * @return 无返回值（调用前需已停止线程池，不再有新记录入队）
+ */
+void oplog_writer_stop();
+
+/**
+ * @brief 插入用户操作记录（登录、上传、下载等）
+ * @param client_fd 客户端文件描述符
+ * @param username 操作用户名
+ * @param ip 客户端IP地址
+ * @param operation 操作类型（如"login"、"upload"）
+ * @param filename 操作的文件名（无则传NULL）
+ * @param status 操作状态（如"成功"、"失败"）
+ * @return 无返回值
+ * @details 批量写线程运行时只把记录放入无锁环形队列就返回；队列满或同步模式（-L 0）时直接写入
+ */
+void insert_operation_log(int client_fd, const char *username, const char *ip,
+                          const char *operation, const char *filename, const char *status);
+
+#endif // META_STORE_H
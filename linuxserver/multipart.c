@@ -0,0 +1,263 @@
+#include "multipart.h"
+
+#include <openssl/rand.h>
+
+// 进行中的分段上传，由一把锁保护；只在发起、开始/结束一段、完成时加锁，接收段数据时不碰
+static MultipartUpload *multipart_list = NULL;
+static pthread_mutex_t multipart_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief 在分段上传链表中查找（调用方须持有multipart_mutex）
+ * @param id 上传ID
+ * @param username 用户名（只能找到该用户发起的上传）
+ * @return 指向该项的链表指针（便于摘除），NULL=不存在
+ */
+static MultipartUpload **multipart_find(const char *id, const char *username)
+{
+    for (MultipartUpload **pp = &multipart_list; *pp; pp = &(*pp)->next)
+    {
+        if (strcmp((*pp)->id, id) == 0 && strcmp((*pp)->username, username) == 0)
+            return pp;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 回收超过MULTIPART_TTL没有新的段的分段上传（调用方须持有multipart_mutex，正在接收段的跳过）
+ * @param now 当前时间
+ * @return 回收的分段上传数
+ */
+static int multipart_collect(time_t now)
+{
+    int removed = 0;
+    MultipartUpload **pp = &multipart_list;
+    while (*pp)
+    {
+        MultipartUpload *mp = *pp;
+        if (mp->receiving == 0 && now - mp->last_active > MULTIPART_TTL)
+        {
+            *pp = mp->next;
+            write_log(LOG_LEVEL_INFO, "回收过期的分段上传 %s：%s", mp->id, mp->filepath);
+            multipart_free(mp);
+            removed++;
+            continue;
+        }
+        pp = &mp->next;
+    }
+    return removed;
+}
+
+/**
+ * @brief 发起分段上传：创建按文件大小预分配的暂存文件，分配随机上传ID
+ * @param username 发起上传的用户
+ * @param filepath 上传目标的完整路径
+ * @param size 文件大小（大于0）
+ * @param file_hash 客户端声明的整文件SHA-256（入库时校验，各段拼接是否正确以此为准）
+ * @return 分段上传（已加入链表，mp->id发给客户端），NULL=失败
+ *         （errno=EBUSY表示该用户进行中的分段上传已达上限，ENOSPC表示空间不足）
+ */
+MultipartUpload *multipart_create(const char *username, const char *filepath, long long size,
+                                  const unsigned char *file_hash)
+{
+    long long count = (size + MULTIPART_PART_SIZE - 1) / MULTIPART_PART_SIZE;
+    if (size <= 0 || count > INT_MAX)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    MultipartUpload *mp = calloc(1, sizeof(MultipartUpload));
+    if (!mp || !(mp->filepath = strdup(filepath)) || !(mp->parts = calloc(count, 1)))
+    {
+        if (mp)
+            free(mp->filepath);
+        free(mp);
+        errno = ENOMEM;
+        return NULL;
+    }
+    mp->fd = -1;
+    snprintf(mp->username, sizeof(mp->username), "%s", username);
+    mp->size = size;
+    mp->part_count = (int)count;
+    memcpy(mp->file_hash, file_hash, CAS_HASH_LEN);
+
+    unsigned char raw[MULTIPART_ID_LEN];
+    if (RAND_bytes(raw, sizeof(raw)) != 1)
+    {
+        write_log(LOG_LEVEL_ERROR, "生成分段上传ID失败");
+        multipart_free(mp);
+        errno = EIO;
+        return NULL;
+    }
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < MULTIPART_ID_LEN; i++)
+    {
+        mp->id[i * 2] = digits[raw[i] >> 4];
+        mp->id[i * 2 + 1] = digits[raw[i] & 0x0f];
+    }
+    mp->id[MULTIPART_ID_LEN * 2] = '\0';
+
+    // 先占满整个文件的空间：各段并发写入不同偏移时不会交错扩展文件，空间不足在开始时就发现
+    mp->fd = cas_stage_open();
+    if (mp->fd == -1)
+    {
+        int err = errno;
+        multipart_free(mp);
+        errno = err;
+        return NULL;
+    }
+    if (fallocate(mp->fd, 0, 0, size) == -1)
+    {
+        // 文件系统不支持预分配时只设置文件长度
+        if ((errno != EOPNOTSUPP && errno != ENOSYS) || ftruncate(mp->fd, size) == -1)
+        {
+            int err = errno;
+            write_log(LOG_LEVEL_ERROR, "分段上传预分配 %lld 字节失败: %s", size, strerror(err));
+            multipart_free(mp);
+            errno = err;
+            return NULL;
+        }
+    }
+
+    time_t now = time(NULL);
+    mp->last_active = now;
+    pthread_mutex_lock(&multipart_mutex);
+    multipart_collect(now);
+    int active = 0;
+    for (MultipartUpload *p = multipart_list; p; p = p->next)
+    {
+        if (strcmp(p->username, username) == 0)
+            active++;
+    }
+    if (active >= MULTIPART_MAX_PER_USER)
+    {
+        pthread_mutex_unlock(&multipart_mutex);
+        multipart_free(mp);
+        errno = EBUSY;
+        return NULL;
+    }
+    mp->next = multipart_list;
+    multipart_list = mp;
+    pthread_mutex_unlock(&multipart_mutex);
+
+    write_log(LOG_LEVEL_INFO, "发起分段上传 %s：%s（%lld 字节，%d 段）", mp->id, filepath, size, mp->part_count);
+    return mp;
+}
+
+/**
+ * @brief 开始接收一段：标记为接收中，给出段的位置和暂存文件
+ * @param id 上传ID
+ * @param username 当前连接的用户（只能上传自己发起的分段上传）
+ * @param part 段号（从0起）
+ * @param mp 输出参数：分段上传（该段结束前不会被释放）
+ * @param offset 输出参数：段在文件中的偏移
+ * @param len 输出参数：段长度
+ * @param fd 输出参数：暂存文件的文件描述符（dup得到，调用方关闭）
+ * @return 0=成功，-1=失败（errno=ENOENT上传不存在或已过期，EINVAL段号无效，EBUSY该段正在其他连接上传）
+ * @details 已完成的段可以重新上传（客户端没收到结果时重发），以最后一次为准
+ */
+int multipart_part_begin(const char *id, const char *username, int part,
+                         MultipartUpload **mp, long long *offset, long long *len, int *fd)
+{
+    pthread_mutex_lock(&multipart_mutex);
+    MultipartUpload **pp = multipart_find(id, username);
+    if (!pp)
+    {
+        pthread_mutex_unlock(&multipart_mutex);
+        errno = ENOENT;
+        return -1;
+    }
+    MultipartUpload *m = *pp;
+    if (part < 0 || part >= m->part_count)
+    {
+        pthread_mutex_unlock(&multipart_mutex);
+        errno = EINVAL;
+        return -1;
+    }
+    if (m->parts[part] == MULTIPART_PART_RECEIVING)
+    {
+        pthread_mutex_unlock(&multipart_mutex);
+        errno = EBUSY;
+        return -1;
+    }
+    // 每个连接持有自己的描述符，按偏移pwrite，互不影响
+    *fd = fcntl(m->fd, F_DUPFD_CLOEXEC, 0);
+    if (*fd == -1)
+    {
+        pthread_mutex_unlock(&multipart_mutex);
+        return -1;
+    }
+    m->parts[part] = MULTIPART_PART_RECEIVING;
+    m->receiving++;
+    m->last_active = time(NULL);
+    pthread_mutex_unlock(&multipart_mutex);
+
+    *mp = m;
+    *offset = (long long)part * MULTIPART_PART_SIZE;
+    *len = m->size - *offset < MULTIPART_PART_SIZE ? m->size - *offset : MULTIPART_PART_SIZE;
+    return 0;
+}
+
+/**
+ * @brief 一段接收结束
+ * @param mp 分段上传
+ * @param part 段号
+ * @param done 1=该段已完整写入，0=接收中断（该段需要重新上传）
+ * @return 无返回值
+ */
+void multipart_part_end(MultipartUpload *mp, int part, int done)
+{
+    pthread_mutex_lock(&multipart_mutex);
+    mp->parts[part] = done ? MULTIPART_PART_DONE : MULTIPART_PART_MISSING;
+    mp->receiving--;
+    mp->last_active = time(NULL);
+    pthread_mutex_unlock(&multipart_mutex);
+}
+
+/**
+ * @brief 完成分段上传：所有段都已收到时把它移出链表交给调用方入库
+ * @param id 上传ID
+ * @param username 当前连接的用户
+ * @param missing 输出参数：还没有收到的段数（含正在接收的段）
+ * @return 分段上传（调用方入库后用multipart_free释放），NULL=不能完成（errno=ENOENT上传不存在，EAGAIN还有段没收到）
+ */
+MultipartUpload *multipart_take(const char *id, const char *username, int *missing)
+{
+    *missing = 0;
+    pthread_mutex_lock(&multipart_mutex);
+    MultipartUpload **pp = multipart_find(id, username);
+    if (!pp)
+    {
+        pthread_mutex_unlock(&multipart_mutex);
+        errno = ENOENT;
+        return NULL;
+    }
+    MultipartUpload *mp = *pp;
+    for (int i = 0; i < mp->part_count; i++)
+    {
+        if (mp->parts[i] != MULTIPART_PART_DONE)
+            (*missing)++;
+    }
+    if (*missing > 0)
+    {
+        pthread_mutex_unlock(&multipart_mutex);
+        errno = EAGAIN;
+        return NULL;
+    }
+    *pp = mp->next;
+    pthread_mutex_unlock(&multipart_mutex);
+    return mp;
+}
+
+/**
+ * @brief 释放分段上传（关闭暂存文件，暂存数据随之释放）
+ * @param mp 分段上传（已移出链表）
+ * @return 无返回值
+ */
+void multipart_free(MultipartUpload *mp)
+{
+    if (mp->fd >= 0)
+        close(mp->fd);
+    free(mp->parts);
+    free(mp->filepath);
+    free(mp);
+}
@@ -0,0 +1,58 @@
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+#include "cloud_disk.h"
+
+/**
+ * @brief 发起分段上传：创建按文件大小预分配的暂存文件，分配随机上传ID
+ * @param username 发起上传的用户
+ * @param filepath 上传目标的完整路径
+ * @param size 文件大小（大于0）
+ * @param file_hash 客户端声明的整文件SHA-256（入库时校验，各段拼接是否正确以此为准）
+ * @return 分段上传（已加入链表，mp->id发给客户端），NULL=失败
+ *         （errno=EBUSY表示该用户进行中的分段上传已达上限，ENOSPC表示空间不足）
+ */
+MultipartUpload *multipart_create(const char *username, const char *filepath, long long size,
+                                  const unsigned char *file_hash);
+
+/**
+ * @brief 开始接收一段：标记为接收中，给出段的位置和暂存文件
+ * @param id 上传ID
+ * @param username 当前连接的用户（只能上传自己发起的分段上传）
+ * @param part 段号（从0起）
+ * @param mp 输出参数：分段上传（该段结束前不会被释放）
+ * @param offset 输出参数：段在文件中的偏移
+ * @param len 输出参数：段长度
+ * @param fd 输出参数：暂存文件的文件描述符（dup得到，调用方关闭）
+ * @return 0=成功，-1=失败（errno=ENOENT上传不存在或已过期，EINVAL段号无效，EBUSY该段正在其他连接上传）
+ * @details 已完成的段可以重新上传（客户端没收到结果时重发），以最后一次为准
+ */
+int multipart_part_begin(const char *id, const char *username, int part,
+                         MultipartUpload **mp, long long *offset, long long *len, int *fd);
+
+/**
+ * @brief 一段接收结束
+ * @param mp 分段上传
+ * @param part 段号
+ * @param done 1=该段已完整写入，0=接收中断（该段需要重新上传）
+ * @return 无返回值
+ */
+void multipart_part_end(MultipartUpload *mp, int part, int done);
+
+/**
+ * @brief 完成分段上传：所有段都已收到时把它移出链表交给调用方入库
+ * @param id 上传ID
+ * @param username 当前连接的用户
+ * @param missing 输出参数：还没有收到的段数（含正在接收的段）
+ * @return 分段上传（调用方入库后用multipart_free释放），NULL=不能完成（errno=ENOENT上传不存在，EAGAIN还有段没收到）
+ */
+MultipartUpload *multipart_take(const char *id, const char *username, int *missing);
+
+/**
+ * @brief 释放分段上传（关闭暂存文件，暂存数据随之释放）
+ * @param mp 分段上传（已移出链表）
+ * @return 无返回值
+ */
+void multipart_free(MultipartUpload *mp);
+
+#endif // MULTIPART_H
@@ -1,155 +1,884 @@
 #include "mysql_utils.h"
+#include <mysql/errmsg.h>
 
-// 全局MySQL连接句柄（定义，声明在cloud_disk.h）
-MYSQL mysql;
+// 全局MySQL连接池（定义，声明在cloud_disk.h）
+DbPool db_pool;
+
+// 各预编译语句的SQL（下标与DbStmtId对应）
+static const char *db_stmt_sql[DB_STMT_COUNT] = {
+    "SELECT password FROM user WHERE username=?",
+    "SELECT id FROM user WHERE username=?",
+    "SELECT root_dir FROM user WHERE username=?",
+    "SELECT id, filename, operation, time, status FROM operation_log "
+    "WHERE username=? AND (time < ? OR (time = ? AND id < ?)) "
+    "AND (? = '' OR operation = ?) AND (? = '' OR filename LIKE ?) "
+    "ORDER BY time DESC, id DESC LIMIT ?",
+    "INSERT INTO operation_log (username, client_fd, ip, operation, filename, time, status) "
+    "VALUES (?, ?, ?, ?, ?, FROM_UNIXTIME(?), ?)",
+    "INSERT INTO user (username, password, root_dir) VALUES (?, ?, '')",
+    "UPDATE user SET root_dir=? WHERE username=?",
+    "INSERT INTO file_share (owner, recipient, filepath, filename, share_time, status) "
+    "VALUES (?, ?, ?, ?, NOW(), 'pending')",
+    "SELECT owner, filepath, filename FROM file_share "
+    "WHERE id=? AND recipient=? AND status='pending'",
+    "UPDATE file_share SET status=?, accept_time=NOW() WHERE id=?",
+    "SELECT owner FROM file WHERE filepath=?",
+};
+
+// 当前线程借出的连接在池中的下标（-1=未借出；任务结束时由线程池归还）
+static __thread int db_slot = -1;
 
 /**
- * @brief 初始化MySQL连接，包含重试机制
+ * @brief 获取当前单调时钟时间（微秒）
  * @param 无参数
- * @return 无返回值（连接失败时直接退出程序）
- * @details 最多重试3次，每次间隔2秒，确保数据库连接稳定性
+ * @return 微秒时间戳
  */
-void init_mysql()
+static long long db_now_us()
 {
-    mysql_init(&mysql);
-    mysql_set_character_set(&mysql, "utf8");
-    int retry_count = 3;    // 最多重试3次
-    int retry_interval = 2; // 重试间隔2秒
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 初始化并连接单个MySQL句柄
+ * @param conn MySQL句柄
+ * @return 1=连接成功，0=连接失败（句柄已初始化，可读取mysql_error）
+ */
+static int db_connect(MYSQL *conn)
+{
+    mysql_init(conn);
+    mysql_set_character_set(conn, "utf8");
+    // 主机：localhost，用户：root，密码：123，数据库：linuxpro，端口：3306
+    return mysql_real_connect(conn, "localhost", "root", "123", "linuxpro", 3306, NULL, 0) != NULL;
+}
 
-    while (retry_count-- > 0)
+/**
+ * @brief 关闭一个连接上缓存的所有预编译语句（连接重建或关闭前调用）
+ * @param slot 连接在池中的下标
+ * @return 无返回值
+ */
+static void db_close_stmts(int slot)
+{
+    for (int i = 0; i < DB_STMT_COUNT; i++)
     {
-        // 尝试连接MySQL（主机：localhost，用户：root，密码：123，数据库：linuxpro，端口：3306）
-        if (mysql_real_connect(&mysql, "localhost", "root", "123", "linuxpro", 3306, NULL, 0))
+        if (db_pool.stmts[slot][i])
         {
-            printf("MySQL初始化成功\n");
-            write_log(LOG_LEVEL_INFO, "MySQL初始化成功");
-            return;
+            mysql_stmt_close(db_pool.stmts[slot][i]);
+            db_pool.stmts[slot][i] = NULL;
         }
+    }
+}
 
-        // 连接失败，输出错误并准备重试
-        fprintf(stderr, "MySQL连接失败（剩余重试次数：%d）: %s\n", retry_count, mysql_error(&mysql));
-        write_log(LOG_LEVEL_ERROR, "MySQL连接失败（剩余重试次数：%d）: %s", retry_count, mysql_error(&mysql));
+/**
+ * @brief 重建一个已断开的连接
+ * @param slot 连接在池中的下标（调用方已把它从空闲列表取出）
+ * @return 1=重连成功，0=重连失败
+ */
+static int db_reconnect(int slot)
+{
+    MYSQL *conn = &db_pool.conns[slot];
+    db_close_stmts(slot); // 预编译语句属于旧连接，重连后在首次使用时重新prepare
+    mysql_close(conn);
+    if (db_connect(conn))
+    {
+        db_pool.broken[slot] = 0;
+        write_log(LOG_LEVEL_INFO, "MySQL连接 %d 重连成功", slot);
+        return 1;
+    }
+    db_pool.broken[slot] = 1;
+    write_log(LOG_LEVEL_ERROR, "MySQL连接 %d 重连失败: %s", slot, mysql_error(conn));
+    return 0;
+}
+
+/**
+ * @brief 后台健康检查线程：定期ping空闲连接，断开的连接在这里重连，业务请求不再逐次ping
+ * @param arg 无实际意义（满足pthread_create要求）
+ * @return 无返回值（返回NULL）
+ */
+static void *db_health_thread(void *arg)
+{
+    (void)arg;
+    mysql_thread_init();
 
-        if (retry_count > 0)
+    pthread_mutex_lock(&db_pool.mutex);
+    while (server_running)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += DB_HEALTH_INTERVAL;
+        pthread_cond_timedwait(&db_pool.health_cond, &db_pool.mutex, &deadline);
+        if (!server_running)
+            break;
+
+        // 逐个检查当前空闲的连接：取出后在锁外ping，不阻塞其他线程借还连接
+        int count = db_pool.free_count;
+        for (int i = 0; i < count && db_pool.free_count > 0; i++)
         {
-            sleep(retry_interval); // 重试前等待
+            int slot = db_pool.free_list[--db_pool.free_count];
+            pthread_mutex_unlock(&db_pool.mutex);
+
+            if (db_pool.broken[slot] || mysql_ping(&db_pool.conns[slot]) != 0)
+            {
+                write_log(LOG_LEVEL_WARN, "MySQL连接 %d 已断开，尝试重连...", slot);
+                db_reconnect(slot);
+            }
+
+            pthread_mutex_lock(&db_pool.mutex);
+            // 放回空闲列表底部，下一轮先检查其他连接
+            memmove(db_pool.free_list + 1, db_pool.free_list, db_pool.free_count * sizeof(int));
+            db_pool.free_list[0] = slot;
+            db_pool.free_count++;
+            pthread_cond_signal(&db_pool.cond);
         }
     }
+    pthread_mutex_unlock(&db_pool.mutex);
 
-    // 多次重试失败后退出程序
-    fprintf(stderr, "MySQL连接失败，程序无法继续运行\n");
-    write_log(LOG_LEVEL_ERROR, "MySQL连接失败，程序无法继续运行");
-    exit(1);
+    mysql_thread_end();
+    return NULL;
 }
 
 /**
- * @brief 检查MySQL连接状态，断开时自动重连
- * @param 无参数
- * @return 1=连接正常/重连成功，0=重连失败
+ * @brief 数据库结构迁移：为operation_log补建(username, time, id)索引（已存在则跳过）
+ * @param conn 已连接的MySQL句柄
+ * @return 无返回值（失败只记录日志，历史查询仍可用，只是需要排序）
+ * @details 历史分页按 username 等值 + (time, id) 倒序范围扫描，有此索引时每页只读取limit行
  */
-int check_mysql_connection()
+static void db_migrate(MYSQL *conn)
 {
-    // 发送ping包检查连接
-    if (mysql_ping(&mysql) != 0)
+    const char *check_sql =
+        "SELECT 1 FROM information_schema.statistics "
+        "WHERE table_schema = DATABASE() AND table_name = 'operation_log' "
+        "AND index_name = 'idx_oplog_user_time_id' LIMIT 1";
+    if (mysql_query(conn, check_sql) != 0)
+    {
+        write_log(LOG_LEVEL_WARN, "检查operation_log索引失败: %s", mysql_error(conn));
+        return;
+    }
+    MYSQL_RES *res = mysql_store_result(conn);
+    int exists = res && mysql_num_rows(res) > 0;
+    mysql_free_result(res);
+    if (exists)
     {
-        write_log(LOG_LEVEL_WARN, "MySQL连接已断开，尝试重连...");
+        return;
+    }
+
+    write_log(LOG_LEVEL_INFO, "为operation_log创建索引 idx_oplog_user_time_id(username, time, id)...");
+    if (mysql_query(conn, "ALTER TABLE operation_log ADD INDEX idx_oplog_user_time_id (username, time, id)") != 0)
+    {
+        write_log(LOG_LEVEL_WARN, "创建operation_log索引失败: %s", mysql_error(conn));
+        return;
+    }
+    write_log(LOG_LEVEL_INFO, "operation_log索引创建完成");
+}
+
+/**
+ * @brief 初始化MySQL连接池（建立DB_POOL_SIZE个连接并启动后台健康检查线程），包含重试机制
+ * @param 无参数
+ * @return 无返回值（连接失败时直接退出程序）
+ * @details 每个连接最多重试3次，每次间隔2秒，确保数据库连接稳定性
+ */
+void db_pool_init()
+{
+    memset(&db_pool, 0, sizeof(db_pool));
+    mysql_library_init(0, NULL, NULL); // 多线程使用前必须先初始化客户端库
+    pthread_mutex_init(&db_pool.mutex, NULL);
+    pthread_cond_init(&db_pool.cond, NULL);
+    pthread_cond_init(&db_pool.health_cond, NULL);
 
-        // 关闭旧连接
-        mysql_close(&mysql);
-        mysql_init(&mysql);
+    for (int i = 0; i < DB_POOL_SIZE; i++)
+    {
+        int retry_count = 3;    // 最多重试3次
+        int retry_interval = 2; // 重试间隔2秒
+        int connected = 0;
 
-        // 尝试重连
-        if (mysql_real_connect(&mysql, "localhost", "root", "123", "linuxpro", 3306, NULL, 0))
+        while (retry_count-- > 0)
         {
-            write_log(LOG_LEVEL_INFO, "MySQL重连成功");
-            return 1;
+            if (db_connect(&db_pool.conns[i]))
+            {
+                connected = 1;
+                break;
+            }
+
+            // 连接失败，输出错误并准备重试
+            fprintf(stderr, "MySQL连接失败（剩余重试次数：%d）: %s\n", retry_count, mysql_error(&db_pool.conns[i]));
+            write_log(LOG_LEVEL_ERROR, "MySQL连接失败（剩余重试次数：%d）: %s", retry_count, mysql_error(&db_pool.conns[i]));
+            mysql_close(&db_pool.conns[i]);
+
+            if (retry_count > 0)
+            {
+                sleep(retry_interval); // 重试前等待
+            }
         }
-        else
+
+        if (!connected)
         {
-            write_log(LOG_LEVEL_ERROR, "MySQL重连失败: %s", mysql_error(&mysql));
-            return 0;
+            // 多次重试失败后退出程序
+            fprintf(stderr, "MySQL连接失败，程序无法继续运行\n");
+            write_log(LOG_LEVEL_ERROR, "MySQL连接失败，程序无法继续运行");
+            exit(1);
         }
+        db_pool.free_list[db_pool.free_count++] = i;
+    }
+
+    db_migrate(&db_pool.conns[0]);
+
+    if (pthread_create(&db_pool.health_thread, NULL, db_health_thread, NULL) != 0)
+    {
+        write_log(LOG_LEVEL_WARN, "MySQL健康检查线程创建失败，断开的连接将在借出时重连");
+    }
+    else
+    {
+        db_pool.health_started = 1;
     }
-    return 1;
+
+    printf("MySQL连接池初始化成功（%d个连接）\n", DB_POOL_SIZE);
+    write_log(LOG_LEVEL_INFO, "MySQL连接池初始化成功（%d个连接）", DB_POOL_SIZE);
 }
 
 /**
- * @brief 查询数据库中是否存在指定用户
- * @param username 要查询的用户名
- * @return 1=用户存在，-1=用户不存在/查询失败
+ * @brief 获取当前线程借出的MySQL连接（首次调用时从连接池借出，池空则等待）
+ * @param 无参数
+ * @return MySQL连接句柄（同一任务内多次调用返回同一连接）
  */
-int mysql_find_user(const char *username)
+MYSQL *db_conn()
 {
-    char sql[256];
-    // 构建查询SQL（查询用户ID，存在则返回非空）
-    snprintf(sql, sizeof(sql), "SELECT id FROM user WHERE username='%s'", username);
-    if (mysql_query(&mysql, sql) != 0)
+    if (db_slot >= 0)
     {
-        fprintf(stderr, "查询用户失败: %s\n", mysql_error(&mysql));
-        write_log(LOG_LEVEL_ERROR, "查询用户失败: %s", mysql_error(&mysql));
-        return -1;
+        return &db_pool.conns[db_slot];
+    }
+
+    long long start = db_now_us();
+    int waited = 0;
+
+    pthread_mutex_lock(&db_pool.mutex);
+    while (db_pool.free_count == 0)
+    {
+        waited = 1;
+        pthread_cond_wait(&db_pool.cond, &db_pool.mutex);
+    }
+    db_slot = db_pool.free_list[--db_pool.free_count];
+
+    unsigned long long wait_us = waited ? (unsigned long long)(db_now_us() - start) : 0;
+    db_pool.acquires++;
+    if (waited)
+    {
+        db_pool.waits++;
+        db_pool.wait_sum_us += wait_us;
+        if (wait_us > db_pool.wait_max_us)
+            db_pool.wait_max_us = wait_us;
     }
+    pthread_mutex_unlock(&db_pool.mutex);
 
-    // 获取查询结果
-    MYSQL_RES *res = mysql_store_result(&mysql);
-    // 判定用户是否存在（行数>0表示存在）
-    int id = (mysql_num_rows(res) > 0) ? 1 : -1;
-    mysql_free_result(res); // 释放结果集内存
-    return id;
+    // 上次使用时发现已断开且健康检查还没来得及重连：借出前先重连
+    if (db_pool.broken[db_slot])
+    {
+        db_reconnect(db_slot);
+    }
+    return &db_pool.conns[db_slot];
 }
 
 /**
- * @brief 插入用户操作记录到数据库（登录、上传、下载等）
- * @param client_fd 客户端文件描述符
- * @param username 操作用户名
- * @param ip 客户端IP地址
- * @param operation 操作类型（如"login"、"upload"）
- * @param filename 操作的文件名（无则传NULL）
- * @param status 操作状态（如"成功"、"失败"）
+ * @brief 归还当前线程借出的MySQL连接（工作线程每个任务结束后调用，未借出则什么也不做）
+ * @param 无参数
  * @return 无返回值
  */
-// 插入操作记录的函数
-void insert_operation_log(int client_fd, const char *username, const char *ip,
-                          const char *operation, const char *filename, const char *status)
+void db_release()
 {
+    if (db_slot < 0)
+    {
+        return;
+    }
 
-    char sql[1024];
-    // 处理filename：非空则用单引号包裹（字符串），为空则用NULL（无需引号）
-    const char *filename_sql;
-    if (filename && strlen(filename) > 0)
+    // 本次使用中出现连接级错误：标记断开，由健康检查线程或下次借出时重连
+    unsigned int err = mysql_errno(&db_pool.conns[db_slot]);
+    if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
     {
-        // 为避免SQL注入和语法错误，简单处理单引号（基础防护）
-        static char quoted_filename[256 * 2 + 2]; // 预留足够空间
-        snprintf(quoted_filename, sizeof(quoted_filename), "'%s'", filename);
-        filename_sql = quoted_filename;
+        db_pool.broken[db_slot] = 1;
     }
-    else
+
+    pthread_mutex_lock(&db_pool.mutex);
+    db_pool.free_list[db_pool.free_count++] = db_slot;
+    pthread_cond_signal(&db_pool.cond);
+    pthread_mutex_unlock(&db_pool.mutex);
+    db_slot = -1;
+}
+
+/**
+ * @brief 获取当前线程借出连接上的预编译语句（首次使用时prepare并缓存到该连接）
+ * @param id 预编译语句编号
+ * @return 语句句柄，NULL=prepare失败
+ */
+MYSQL_STMT *db_stmt(DbStmtId id)
+{
+    MYSQL *conn = db_conn();
+    MYSQL_STMT **cached = &db_pool.stmts[db_slot][id];
+    if (*cached)
     {
-        filename_sql = "NULL"; // 为空时直接用NULL（不带引号）
+        return *cached;
     }
 
-    // 拼接SQL：插入操作记录（7个字段，与值对应）
-    snprintf(sql, sizeof(sql),
-             "INSERT INTO operation_log ("
-             "username, client_fd, ip, operation, filename, time, status"
-             ") VALUES ('%s', %d, '%s', '%s', %s, NOW(), '%s');",
-             username,
-             client_fd,
-             ip,
-             operation,
-             filename_sql, // 直接使用处理后的filename（带引号或NULL）
-             status);
+    MYSQL_STMT *stmt = mysql_stmt_init(conn);
+    if (!stmt)
+    {
+        write_log(LOG_LEVEL_ERROR, "预编译语句 %d 初始化失败: %s", id, mysql_error(conn));
+        return NULL;
+    }
+    if (mysql_stmt_prepare(stmt, db_stmt_sql[id], strlen(db_stmt_sql[id])) != 0)
+    {
+        db_stmt_failed(stmt, id);
+        mysql_stmt_close(stmt);
+        return NULL;
+    }
+    *cached = stmt;
+    return stmt;
+}
 
-    // 检查连接状态，失败则返回
-    if (!check_mysql_connection())
+/**
+ * @brief 把字符串绑定为语句的输入参数
+ * @param bind 要填写的参数绑定（调用方已清零）
+ * @param str 参数值（NULL表示SQL NULL）
+ * @param length 输出：参数长度的存放处（须在执行语句前保持有效）
+ * @return 无返回值
+ */
+void db_bind_string(MYSQL_BIND *bind, const char *str, unsigned long *length)
+{
+    static bool null_flag = 1;
+    bind->buffer_type = MYSQL_TYPE_STRING;
+    if (!str)
     {
+        bind->is_null = &null_flag;
         return;
     }
+    *length = strlen(str);
+    bind->buffer = (void *)str;
+    bind->buffer_length = *length;
+    bind->length = length;
+}
+
+/**
+ * @brief 记录预编译语句执行失败；连接已断开时标记该连接，归还后由健康检查重连
+ * @param stmt 失败的语句
+ * @param id 预编译语句编号
+ * @return 固定返回-1（便于调用方直接return）
+ */
+int db_stmt_failed(MYSQL_STMT *stmt, DbStmtId id)
+{
+    unsigned int err = mysql_stmt_errno(stmt);
+    write_log(LOG_LEVEL_ERROR, "预编译语句 %d 执行失败: %s", id, mysql_stmt_error(stmt));
+    if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+    {
+        db_pool.broken[db_slot] = 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief 执行“一个字符串参数、返回一行一列”的预编译查询
+ * @param id 预编译语句编号
+ * @param param 查询参数
+ * @param out 输出：第一行第一列的值（以'\0'结尾，超长截断，NULL值输出空串）
+ * @param out_size out缓冲区大小
+ * @return 1=查到，0=无结果，-1=查询失败
+ */
+int db_query_string(DbStmtId id, const char *param, char *out, size_t out_size)
+{
+    MYSQL_STMT *stmt = db_stmt(id);
+    if (!stmt)
+    {
+        return -1;
+    }
+
+    MYSQL_BIND in;
+    unsigned long in_len = 0;
+    memset(&in, 0, sizeof(in));
+    db_bind_string(&in, param, &in_len);
+    if (mysql_stmt_bind_param(stmt, &in) || mysql_stmt_execute(stmt))
+    {
+        return db_stmt_failed(stmt, id);
+    }
+
+    MYSQL_BIND result;
+    unsigned long out_len = 0;
+    bool is_null = 0;
+    memset(&result, 0, sizeof(result));
+    result.buffer_type = MYSQL_TYPE_STRING;
+    result.buffer = out;
+    result.buffer_length = out_size;
+    result.length = &out_len;
+    result.is_null = &is_null;
+    if (mysql_stmt_bind_result(stmt, &result) || mysql_stmt_store_result(stmt))
+    {
+        return db_stmt_failed(stmt, id);
+    }
+
+    int found = 0;
+    int rc = mysql_stmt_fetch(stmt);
+    if (rc == 0 || rc == MYSQL_DATA_TRUNCATED)
+    {
+        size_t len = is_null ? 0 : (out_len < out_size ? out_len : out_size - 1);
+        out[len] = '\0';
+        found = 1;
+    }
+    else if (rc != MYSQL_NO_DATA)
+    {
+        found = db_stmt_failed(stmt, id);
+    }
+    mysql_stmt_free_result(stmt);
+    return found;
+}
+
+/**
+ * @brief 把连接池的借出次数、等待次数和等待时长（平均/最大）写入日志
+ * @param 无参数
+ * @return 无返回值
+ */
+void db_pool_log_stats()
+{
+    pthread_mutex_lock(&db_pool.mutex);
+    unsigned long long acquires = db_pool.acquires;
+    unsigned long long waits = db_pool.waits;
+    unsigned long long sum_us = db_pool.wait_sum_us;
+    unsigned long long max_us = db_pool.wait_max_us;
+    pthread_mutex_unlock(&db_pool.mutex);
+
+    write_log(LOG_LEVEL_INFO, "MySQL连接池统计：借出 %llu 次，等待 %llu 次，等待时长 平均 %llu us / 最大 %llu us",
+              acquires, waits, waits ? sum_us / waits : 0, max_us);
+}
+
+/**
+ * @brief 关闭MySQL连接池（停止健康检查线程、记录统计、关闭所有连接）
+ * @param 无参数
+ * @return 无返回值（调用前需已停止线程池，确保没有连接被借出）
+ */
+void db_pool_destroy()
+{
+    if (db_pool.health_started)
+    {
+        pthread_mutex_lock(&db_pool.mutex);
+        pthread_cond_signal(&db_pool.health_cond);
+        pthread_mutex_unlock(&db_pool.mutex);
+        pthread_join(db_pool.health_thread, NULL);
+        db_pool.health_started = 0;
+    }
+
+    db_pool_log_stats();
+
+    for (int i = 0; i < DB_POOL_SIZE; i++)
+    {
+        db_close_stmts(i);
+        mysql_close(&db_pool.conns[i]);
+    }
+    pthread_cond_destroy(&db_pool.health_cond);
+    pthread_cond_destroy(&db_pool.cond);
+    pthread_mutex_destroy(&db_pool.mutex);
+    mysql_library_end();
+}
+
+
+// ========================== MySQL元数据存储 ==========================
+/**
+ * @brief 绑定参数并执行一条不返回结果集的预编译语句
+ * @param id 预编译语句编号
+ * @param params 参数绑定数组
+ * @return 0=成功，-1=失败
+ */
+static int db_exec(DbStmtId id, MYSQL_BIND *params)
+{
+    MYSQL_STMT *stmt = db_stmt(id);
+    if (!stmt)
+    {
+        return -1;
+    }
+    if (mysql_stmt_bind_param(stmt, params) || mysql_stmt_execute(stmt))
+    {
+        return db_stmt_failed(stmt, id);
+    }
+    return 0;
+}
+
+/**
+ * @brief 查询用户密码
+ * @param username 用户名
+ * @param out 输出：密码
+ * @param out_size out缓冲区大小
+ * @return 1=查到，0=用户不存在，-1=查询失败
+ */
+static int db_user_password(const char *username, char *out, size_t out_size)
+{
+    return db_query_string(STMT_USER_PASSWORD, username, out, out_size);
+}
+
+/**
+ * @brief 查询用户是否存在
+ * @param username 用户名
+ * @return 1=存在，0=不存在，-1=查询失败
+ */
+static int db_user_exists(const char *username)
+{
+    char id[32];
+    return db_query_string(STMT_USER_ID, username, id, sizeof(id));
+}
+
+/**
+ * @brief 注册新用户（根目录留空，首次登录时创建）
+ * @param username 用户名
+ * @param password 密码
+ * @return 0=成功，-1=失败
+ */
+static int db_user_insert(const char *username, const char *password)
+{
+    MYSQL_BIND params[2];
+    unsigned long lengths[2] = {0};
+    memset(params, 0, sizeof(params));
+    db_bind_string(&params[0], username, &lengths[0]);
+    db_bind_string(&params[1], password, &lengths[1]);
+    return db_exec(STMT_INSERT_USER, params);
+}
+
+/**
+ * @brief 查询用户根目录
+ * @param username 用户名
+ * @param out 输出：根目录路径
+ * @param out_size out缓冲区大小
+ * @return 1=查到，0=用户不存在，-1=查询失败
+ */
+static int db_user_root_dir(const char *username, char *out, size_t out_size)
+{
+    return db_query_string(STMT_USER_ROOT_DIR, username, out, out_size);
+}
+
+/**
+ * @brief 更新用户根目录
+ * @param username 用户名
+ * @param root_dir 根目录路径
+ * @return 0=成功，-1=失败
+ */
+static int db_user_set_root_dir(const char *username, const char *root_dir)
+{
+    MYSQL_BIND params[2];
+    unsigned long lengths[2] = {0};
+    memset(params, 0, sizeof(params));
+    db_bind_string(&params[0], root_dir, &lengths[0]);
+    db_bind_string(&params[1], username, &lengths[1]);
+    return db_exec(STMT_SET_ROOT_DIR, params);
+}
+
+/**
+ * @brief 发起文件分享（状态为pending）
+ * @param owner 分享者
+ * @param recipient 接收者
+ * @param filepath 文件所在路径
+ * @param filename 文件名
+ * @return 分享id，-1=失败
+ */
+static int db_share_insert(const char *owner, const char *recipient,
+                           const char *filepath, const char *filename)
+{
+    MYSQL_BIND params[4];
+    unsigned long lengths[4] = {0};
+    memset(params, 0, sizeof(params));
+    db_bind_string(&params[0], owner, &lengths[0]);
+    db_bind_string(&params[1], recipient, &lengths[1]);
+    db_bind_string(&params[2], filepath, &lengths[2]);
+    db_bind_string(&params[3], filename, &lengths[3]);
+    if (db_exec(STMT_SHARE_INSERT, params) != 0)
+    {
+        return -1;
+    }
+    return (int)mysql_stmt_insert_id(db_stmt(STMT_SHARE_INSERT));
+}
+
+/**
+ * @brief 查询发给指定接收者、尚未处理的分享
+ * @param share_id 分享id
+ * @param recipient 接收者
+ * @param info 输出：分享者、文件路径和文件名
+ * @return 1=查到，0=不存在或已处理，-1=查询失败
+ */
+static int db_share_get_pending(int share_id, const char *recipient, ShareInfo *info)
+{
+    MYSQL_STMT *stmt = db_stmt(STMT_SHARE_PENDING);
+    if (!stmt)
+    {
+        return -1;
+    }
+
+    MYSQL_BIND params[2];
+    unsigned long param_len = 0;
+    memset(params, 0, sizeof(params));
+    params[0].buffer_type = MYSQL_TYPE_LONG;
+    params[0].buffer = &share_id;
+    db_bind_string(&params[1], recipient, &param_len);
+
+    char *columns[3] = {info->owner, info->filepath, info->filename};
+    size_t sizes[3] = {sizeof(info->owner), sizeof(info->filepath), sizeof(info->filename)};
+    unsigned long lengths[3] = {0};
+    bool is_null[3] = {0};
+    MYSQL_BIND result[3];
+    memset(result, 0, sizeof(result));
+    for (int i = 0; i < 3; i++)
+    {
+        result[i].buffer_type = MYSQL_TYPE_STRING;
+        result[i].buffer = columns[i];
+        result[i].buffer_length = sizes[i];
+        result[i].length = &lengths[i];
+        result[i].is_null = &is_null[i];
+    }
+
+    if (mysql_stmt_bind_param(stmt, params) || mysql_stmt_execute(stmt) ||
+        mysql_stmt_bind_result(stmt, result) || mysql_stmt_store_result(stmt))
+    {
+        return db_stmt_failed(stmt, STMT_SHARE_PENDING);
+    }
+
+    int found = 0;
+    int rc = mysql_stmt_fetch(stmt);
+    if (rc == 0 || rc == MYSQL_DATA_TRUNCATED)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            size_t len = is_null[i] ? 0 : (lengths[i] < sizes[i] ? lengths[i] : sizes[i] - 1);
+            columns[i][len] = '\0';
+        }
+        found = 1;
+    }
+    else if (rc != MYSQL_NO_DATA)
+    {
+        found = db_stmt_failed(stmt, STMT_SHARE_PENDING);
+    }
+    mysql_stmt_free_result(stmt);
+    return found;
+}
+
+/**
+ * @brief 更新分享状态
+ * @param share_id 分享id
+ * @param status 新状态（accepted/rejected）
+ * @return 0=成功，-1=失败
+ */
+static int db_share_set_status(int share_id, const char *status)
+{
+    MYSQL_BIND params[2];
+    unsigned long status_len = 0;
+    memset(params, 0, sizeof(params));
+    db_bind_string(&params[0], status, &status_len);
+    params[1].buffer_type = MYSQL_TYPE_LONG;
+    params[1].buffer = &share_id;
+    return db_exec(STMT_SHARE_STATUS, params);
+}
+
+/**
+ * @brief 按文件路径查询所有者
+ * @param filepath 文件路径
+ * @param owner 输出：所有者用户名
+ * @param owner_size owner缓冲区大小
+ * @return 1=查到，0=无记录，-1=查询失败
+ */
+static int db_file_owner(const char *filepath, char *owner, size_t owner_size)
+{
+    return db_query_string(STMT_FILE_OWNER, filepath, owner, owner_size);
+}
 
-    // 执行SQL，失败则打印错误
-    if (mysql_query(&mysql, sql) != 0)
+/**
+ * @brief 按游标查询一页操作历史，按(time, id)倒序追加到records
+ * @param username 用户名
+ * @param query 分页游标、条数和过滤条件
+ * @param records 输出：JSON数组（每条含id、filename、operation、time、status）
+ * @return 本页行数，-1=查询失败
+ * @details 走(username, time, id)索引倒序范围扫描，每页只读取limit行
+ */
+static int db_history_page(const char *username, const HistoryQuery *query, cJSON *records)
+{
+    MYSQL_STMT *stmt = db_stmt(STMT_HISTORY);
+    if (!stmt)
+    {
+        return -1;
+    }
+
+    long long before_id = query->before_id;
+    int limit = query->limit;
+    MYSQL_BIND params[9];
+    unsigned long param_lens[9] = {0};
+    memset(params, 0, sizeof(params));
+    db_bind_string(&params[0], username, &param_lens[0]);
+    db_bind_string(&params[1], query->before_time, &param_lens[1]);
+    db_bind_string(&params[2], query->before_time, &param_lens[2]);
+    params[3].buffer_type = MYSQL_TYPE_LONGLONG;
+    params[3].buffer = &before_id;
+    db_bind_string(&params[4], query->operation, &param_lens[4]);
+    db_bind_string(&params[5], query->operation, &param_lens[5]);
+    db_bind_string(&params[6], query->filename_pattern, &param_lens[6]);
+    db_bind_string(&params[7], query->filename_pattern, &param_lens[7]);
+    params[8].buffer_type = MYSQL_TYPE_LONG;
+    params[8].buffer = &limit;
+
+    // 结果列：id按整数接收，其余4列以字符串接收（time由客户端库转成"YYYY-MM-DD HH:MM:SS"）
+    long long row_id = 0;
+    char columns[4][MAX_PATH_LEN];
+    unsigned long lengths[4];
+    bool is_null[4];
+    MYSQL_BIND result[5];
+    memset(result, 0, sizeof(result));
+    result[0].buffer_type = MYSQL_TYPE_LONGLONG;
+    result[0].buffer = &row_id;
+    for (int i = 0; i < 4; i++)
     {
-        fprintf(stderr, "插入操作记录失败: %s（SQL: %s）\n", mysql_error(&mysql), sql); // 打印完整SQL方便调试
-        write_log(LOG_LEVEL_ERROR, "插入操作记录失败: %s", mysql_error(&mysql));
+        result[i + 1].buffer_type = MYSQL_TYPE_STRING;
+        result[i + 1].buffer = columns[i];
+        result[i + 1].buffer_length = sizeof(columns[i]);
+        result[i + 1].length = &lengths[i];
+        result[i + 1].is_null = &is_null[i];
+    }
+
+    if (mysql_stmt_bind_param(stmt, params) || mysql_stmt_execute(stmt) ||
+        mysql_stmt_bind_result(stmt, result) || mysql_stmt_store_result(stmt))
+    {
+        return db_stmt_failed(stmt, STMT_HISTORY);
+    }
+
+    int rc;
+    int count = 0;
+    while ((rc = mysql_stmt_fetch(stmt)) == 0 || rc == MYSQL_DATA_TRUNCATED)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            size_t len = lengths[i] < sizeof(columns[i]) ? lengths[i] : sizeof(columns[i]) - 1;
+            columns[i][len] = '\0';
+        }
+        cJSON *record = cJSON_CreateObject();
+        cJSON_AddNumberToObject(record, "id", (double)row_id);
+        cJSON_AddStringToObject(record, "filename", is_null[0] ? "" : columns[0]);   // 文件名（空则填空字符串）
+        cJSON_AddStringToObject(record, "operation", is_null[1] ? "" : columns[1]);  // 操作类型
+        cJSON_AddStringToObject(record, "time", is_null[2] ? "" : columns[2]);       // 操作时间
+        cJSON_AddStringToObject(record, "status", is_null[3] ? "未知" : columns[3]); // 操作状态（默认“未知”）
+        cJSON_AddItemToArray(records, record);
+        count++;
     }
-}
\ No newline at end of file
+    mysql_stmt_free_result(stmt); // 释放结果集
+    return count;
+}
+
+/**
+ * @brief 向SQL缓冲区追加一个转义后带单引号的字符串（NULL追加SQL NULL）
+ * @param conn 用于转义的连接（转义结果与连接字符集相关）
+ * @param p 写入位置
+ * @param str 字符串
+ * @return 写入后的新位置
+ */
+static char *db_append_quoted(MYSQL *conn, char *p, const char *str)
+{
+    if (!str)
+    {
+        memcpy(p, "NULL", 4);
+        return p + 4;
+    }
+    *p++ = '\'';
+    p += mysql_real_escape_string(conn, p, str, strlen(str));
+    *p++ = '\'';
+    return p;
+}
+
+/**
+ * @brief 写入一批操作记录（单条走预编译语句，多条拼成一条多行INSERT；连接断开时重连重试一次）
+ * @param records 记录数组
+ * @param count 记录数
+ * @return 0=成功，-1=失败
+ */
+static int db_insert_logs(OpLogRecord *records, int count)
+{
+    if (count == 1)
+    {
+        // 绑定7个参数（time按记录发生时间写入）；filename为空时绑定SQL NULL
+        OpLogRecord *rec = &records[0];
+        long long when = (long long)rec->time;
+        MYSQL_BIND params[7];
+        unsigned long lengths[7] = {0};
+        memset(params, 0, sizeof(params));
+        db_bind_string(&params[0], rec->username, &lengths[0]);
+        params[1].buffer_type = MYSQL_TYPE_LONG;
+        params[1].buffer = &rec->client_fd;
+        db_bind_string(&params[2], rec->ip, &lengths[2]);
+        db_bind_string(&params[3], rec->operation, &lengths[3]);
+        db_bind_string(&params[4], rec->filename, &lengths[4]);
+        params[5].buffer_type = MYSQL_TYPE_LONGLONG;
+        params[5].buffer = &when;
+        db_bind_string(&params[6], rec->status, &lengths[6]);
+        return db_exec(STMT_INSERT_LOG, params);
+    }
+
+    // 每行固定部分 + 各字符串转义后最多2倍长度
+    size_t cap = 256;
+    for (int i = 0; i < count; i++)
+    {
+        cap += 128 + 2 * (strlen(records[i].username) + strlen(records[i].ip) +
+                          strlen(records[i].operation) + strlen(records[i].status) +
+                          (records[i].filename ? strlen(records[i].filename) : 0));
+    }
+    char *sql = malloc(cap);
+    if (!sql)
+    {
+        write_log(LOG_LEVEL_ERROR, "操作日志批量写入分配内存失败，丢弃 %d 条记录", count);
+        return -1;
+    }
+
+    MYSQL *conn = db_conn();
+    char *p = sql;
+    p += sprintf(p, "INSERT INTO operation_log "
+                    "(username, client_fd, ip, operation, filename, time, status) VALUES ");
+    for (int i = 0; i < count; i++)
+    {
+        if (i > 0)
+            *p++ = ',';
+        *p++ = '(';
+        p = db_append_quoted(conn, p, records[i].username);
+        p += sprintf(p, ", %d, ", records[i].client_fd);
+        p = db_append_quoted(conn, p, records[i].ip);
+        *p++ = ',';
+        p = db_append_quoted(conn, p, records[i].operation);
+        *p++ = ',';
+        p = db_append_quoted(conn, p, records[i].filename);
+        p += sprintf(p, ", FROM_UNIXTIME(%lld), ", (long long)records[i].time);
+        p = db_append_quoted(conn, p, records[i].status);
+        *p++ = ')';
+    }
+
+    int ret = mysql_real_query(conn, sql, p - sql);
+    if (ret != 0)
+    {
+        unsigned int err = mysql_errno(conn);
+        if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+        {
+            // 连接断开：归还（标记断开）后重新借出即重连，再重试一次
+            write_log(LOG_LEVEL_WARN, "写操作日志时MySQL连接已断开，重连后重试...");
+            db_release();
+            conn = db_conn();
+            ret = mysql_real_query(conn, sql, p - sql);
+        }
+    }
+    if (ret != 0)
+    {
+        write_log(LOG_LEVEL_ERROR, "批量插入 %d 条操作记录失败: %s", count, mysql_error(conn));
+    }
+    free(sql);
+    return ret == 0 ? 0 : -1;
+}
+
+// MySQL元数据存储（定义，声明在cloud_disk.h）
+const MetaStore mysql_meta_store = {
+    "mysql",
+    db_pool_init,
+    db_pool_destroy,
+    db_release,
+    db_user_password,
+    db_user_exists,
+    db_user_insert,
+    db_user_root_dir,
+    db_user_set_root_dir,
+    db_share_insert,
+    db_share_get_pending,
+    db_share_set_status,
+    db_file_owner,
+    db_history_page,
+    db_insert_logs,
+};
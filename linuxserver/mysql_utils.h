@@ -4,38 +4,73 @@
 #include "cloud_disk.h"
 
 /**
- * @brief 初始化MySQL连接，包含重试机制
+ * @brief 初始化MySQL连接池（建立DB_POOL_SIZE个连接并启动后台健康检查线程），包含重试机制
  * @param 无参数
  * @return 无返回值（连接失败时直接退出程序）
- * @details 最多重试3次，每次间隔2秒，确保数据库连接稳定性
+ * @details 每个连接最多重试3次，每次间隔2秒，确保数据库连接稳定性
  */
-void init_mysql();
+void db_pool_init();
 
 /**
- * @brief 检查MySQL连接状态，断开时自动重连
+ * @brief 获取当前线程借出的MySQL连接（首次调用时从连接池借出，池空则等待）
  * @param 无参数
- * @return 1=连接正常/重连成功，0=重连失败
+ * @return MySQL连接句柄（同一任务内多次调用返回同一连接）
  */
-int check_mysql_connection();
+MYSQL *db_conn();
 
 /**
- * @brief 查询数据库中是否存在指定用户
- * @param username 要查询的用户名
- * @return 1=用户存在，-1=用户不存在/查询失败
+ * @brief 归还当前线程借出的MySQL连接（工作线程每个任务结束后调用，未借出则什么也不做）
+ * @param 无参数
+ * @return 无返回值
+ */
+void db_release();
+
+/**
+ * @brief 获取当前线程借出连接上的预编译语句（首次使用时prepare并缓存到该连接）
+ * @param id 预编译语句编号
+ * @return 语句句柄，NULL=prepare失败
+ */
+MYSQL_STMT *db_stmt(DbStmtId id);
+
+/**
+ * @brief 把字符串绑定为语句的输入参数
+ * @param bind 要填写的参数绑定（调用方已清零）
+ * @param str 参数值（NULL表示SQL NULL）
+ * @param length 输出：参数长度的存放处（须在执行语句前保持有效）
+ * @return 无返回值
+ */
+void db_bind_string(MYSQL_BIND *bind, const char *str, unsigned long *length);
+
+/**
+ * @brief 记录预编译语句执行失败；连接已断开时标记该连接，归还后由健康检查重连
+ * @param stmt 失败的语句
+ * @param id 预编译语句编号
+ * @return 固定返回-1（便于调用方直接return）
+ */
+int db_stmt_failed(MYSQL_STMT *stmt, DbStmtId id);
+
+/**
+ * @brief 执行“一个字符串参数、返回一行一列”的预编译查询
+ * @param id 预编译语句编号
+ * @param param 查询参数
+ * @param out 输出：第一行第一列的值（以'\0'结尾，超长截断，NULL值输出空串）
+ * @param out_size out缓冲区大小
+ * @return 1=查到，0=无结果，-1=查询失败
  */
-int mysql_find_user(const char *username);
+int db_query_string(DbStmtId id, const char *param, char *out, size_t out_size);
 
 /**
- * @brief 插入用户操作记录到数据库（登录、上传、下载等）
- * @param client_fd 客户端文件描述符
- * @param username 操作用户名
- * @param ip 客户端IP地址
- * @param operation 操作类型（如"login"、"upload"）
- * @param filename 操作的文件名（无则传NULL）
- * @param status 操作状态（如"成功"、"失败"）
+ * @brief 把连接池的借出次数、等待次数和等待时长（平均/最大）写入日志
+ * @param 无参数
  * @return 无返回值
  */
-void insert_operation_log(int client_fd, const char *username, const char *ip,
-                          const char *operation, const char *filename, const char *status);
+void db_pool_log_stats();
+
+/**
+ * @brief 关闭MySQL连接池（停止健康检查线程、记录统计、关闭所有连接）
+ * @param 无参数
+ * @return 无返回值（调用前需已停止线程池，确保没有连接被借出）
+ */
+void db_pool_destroy();
 
-#endif // MYSQL_UTILS_H
\ No newline at end of file
+#endif // MYSQL_UTILS_H
@@ -0,0 +1,442 @@
+#include "reactor.h"
+#include "conn_table.h"
+
+/**
+ * @brief 创建并绑定服务器监听socket
+ * @param reuse_port 1=开启SO_REUSEPORT（多个监听socket共享端口），0=不开启
+ * @param nonblock 1=设置为非阻塞（epoll后端），0=保持阻塞（io_uring后端由内核异步等待）
+ * @return 监听socket文件描述符，-1=创建失败
+ */
+int create_listen_socket(int reuse_port, int nonblock)
+{
+    // 创建监听socket（TCP）
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd == -1)
+    {
+        perror("socket失败");
+        write_log(LOG_LEVEL_ERROR, "socket创建失败: %s", strerror(errno));
+        return -1;
+    }
+
+    // 设置socket选项：允许端口复用（避免重启时端口占用）
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // 多reactor模式：每个reactor绑定同一端口，由内核按连接哈希分配到各监听socket
+    if (reuse_port && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+    {
+        perror("SO_REUSEPORT设置失败");
+        write_log(LOG_LEVEL_ERROR, "SO_REUSEPORT设置失败: %s", strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+
+    // 设置socket为非阻塞模式（配合epoll边缘触发）
+    if (nonblock)
+    {
+        int flags = fcntl(listen_fd, F_GETFL, 0);
+        fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    // 绑定IP和端口
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(server_ip);
+    addr.sin_port = htons(PORT);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        perror("bind失败");
+        write_log(LOG_LEVEL_ERROR, "bind失败: %s", strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+
+    if (listen(listen_fd, LISTEN_BACKLOG) == -1)
+    {
+        perror("listen失败");
+        write_log(LOG_LEVEL_ERROR, "listen失败: %s", strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+
+    return listen_fd;
+}
+
+/**
+ * @brief 初始化单个reactor（创建监听socket、epoll实例，并注册监听socket）
+ * @param reactor 要初始化的reactor
+ * @param id reactor编号
+ * @param reuse_port 1=开启SO_REUSEPORT（多reactor模式），0=不开启
+ * @return 0=初始化成功，-1=初始化失败
+ */
+int reactor_init(Reactor *reactor, int id, int reuse_port)
+{
+    reactor->id = id;
+    reactor->listen_fd = -1;
+    reactor->epfd = -1;
+    reactor->deferred = NULL;
+    reactor->deferred_head = 0;
+    reactor->deferred_count = 0;
+    reactor->deferred_cap = 0;
+
+    int listen_fd = create_listen_socket(reuse_port, 1);
+    if (listen_fd == -1)
+    {
+        return -1;
+    }
+
+    // 创建本reactor独立的epoll实例
+    int epfd = epoll_create1(0);
+    if (epfd == -1)
+    {
+        perror("epoll_create失败");
+        write_log(LOG_LEVEL_ERROR, "reactor %d epoll_create失败: %s", id, strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+
+    // 将监听socket添加到epoll（边缘触发+读事件）
+    struct epoll_event ev;
+    // 监听socket的data.u64直接存fd（代数为0），客户端连接的句柄代数从1开始，二者不会混淆
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = (uint64_t)listen_fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev) == -1)
+    {
+        perror("epoll_ctl失败");
+        write_log(LOG_LEVEL_ERROR, "reactor %d epoll_ctl失败: %s", id, strerror(errno));
+        close(epfd);
+        close(listen_fd);
+        return -1;
+    }
+
+    // 退出通知：水平触发且从不读取，终止信号写入后每个reactor的epoll_wait都会返回
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint64_t)shutdown_fd;
+    if (shutdown_fd >= 0 && epoll_ctl(epfd, EPOLL_CTL_ADD, shutdown_fd, &ev) == -1)
+    {
+        write_log(LOG_LEVEL_ERROR, "reactor %d 注册退出通知失败: %s", id, strerror(errno));
+        close(epfd);
+        close(listen_fd);
+        return -1;
+    }
+
+    reactor->listen_fd = listen_fd;
+    reactor->epfd = epfd;
+    return 0;
+}
+
+/**
+ * @brief 接受监听socket上的所有新连接，并注册到本reactor的epoll
+ * @param reactor 当前reactor
+ * @return 无返回值
+ */
+static void reactor_accept(Reactor *reactor)
+{
+    // 循环接受所有新连接（边缘触发需一次性处理完）
+    while (1)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept(reactor->listen_fd, (struct sockaddr *)&client_addr, &client_len);
+        if (client_fd == -1)
+        {
+            // 没有更多连接（非阻塞accept的正常返回）
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            perror("accept失败");
+            write_log(LOG_LEVEL_ERROR, "reactor %d accept失败: %s", reactor->id, strerror(errno));
+            break;
+        }
+
+        // 设置客户端socket为非阻塞模式
+        int flags = fcntl(client_fd, F_GETFL, 0);
+        fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
+
+        // 在连接表登记客户端地址信息和所属reactor
+        ConnHandle handle;
+        if (!conn_open(client_fd, client_addr, reactor->epfd, &handle))
+        {
+            write_log(LOG_LEVEL_WARN, "连接表已满，拒绝fd=%d", client_fd);
+            close(client_fd);
+            continue;
+        }
+        printf("新客户端连接：fd=%d, IP=%s, reactor=%d\n", client_fd, inet_ntoa(client_addr.sin_addr), reactor->id);
+        write_log(LOG_LEVEL_INFO, "新客户端连接：fd=%d, IP=%s, reactor=%d", client_fd, inet_ntoa(client_addr.sin_addr), reactor->id);
+
+        // 将客户端socket添加到本reactor的epoll（边缘触发+读事件+单次触发），事件数据存连接句柄
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+        ev.data.u64 = handle;
+        if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, client_fd, &ev) == -1)
+        {
+            perror("epoll_ctl添加客户端失败");
+            write_log(LOG_LEVEL_ERROR, "epoll_ctl添加客户端 %d 失败: %s", client_fd, strerror(errno));
+            conn_close(client_fd);
+        }
+    }
+}
+
+/**
+ * @brief 标记连接已派发给工作线程（同一连接同一时刻只允许一个工作线程处理）
+ * @param conn 连接对象
+ * @return 1=标记成功，0=已在处理中
+ */
+static int reactor_claim_client(Connection *conn)
+{
+    pthread_mutex_lock(&conn->lock);
+    int claimed = !conn->busy;
+    conn->busy = 1;
+    pthread_mutex_unlock(&conn->lock);
+    return claimed;
+}
+
+/**
+ * @brief 把任务放入本reactor的延后队列（线程池满时调用，连接保持处理中状态，不再读取其数据）
+ * @param reactor 当前reactor
+ * @param task 任务
+ * @return 0=已延后，-1=内存不足
+ */
+static int reactor_defer(Reactor *reactor, Task *task)
+{
+    if (reactor->deferred_count == reactor->deferred_cap)
+    {
+        if (reactor->deferred_head > 0)
+        {
+            // 前面已派发的位置腾出来复用
+            reactor->deferred_count -= reactor->deferred_head;
+            memmove(reactor->deferred, reactor->deferred + reactor->deferred_head,
+                    reactor->deferred_count * sizeof(Task));
+            reactor->deferred_head = 0;
+        }
+        else
+        {
+            int new_cap = reactor->deferred_cap ? reactor->deferred_cap * 2 : MAX_EVENTS;
+            Task *grown = realloc(reactor->deferred, new_cap * sizeof(Task));
+            if (!grown)
+            {
+                return -1;
+            }
+            reactor->deferred = grown;
+            reactor->deferred_cap = new_cap;
+        }
+    }
+    reactor->deferred[reactor->deferred_count++] = *task;
+    return 0;
+}
+
+/**
+ * @brief 把任务派发到线程池；线程池满或已有延后任务时排到延后队列尾（保持先到先派发）
+ * @param reactor 当前reactor
+ * @param task 任务
+ * @return 无返回值
+ */
+static void reactor_submit(Reactor *reactor, Task *task)
+{
+    int waiting = reactor->deferred_count - reactor->deferred_head;
+    if (waiting == 0 && thread_pool_add_task(*task) == 0)
+    {
+        return;
+    }
+
+    if (waiting == 0)
+    {
+        write_log(LOG_LEVEL_WARN, "reactor %d：任务队列已满，暂停读取新请求", reactor->id);
+    }
+    if (reactor_defer(reactor, task) == -1)
+    {
+        // 延后队列也放不下：只能释放连接，等内核下次上报
+        write_log(LOG_LEVEL_ERROR, "reactor %d：延后队列分配失败，放弃客户端 %d 的本次事件",
+                  reactor->id, task->client_fd);
+        reactor_release_client(task->conn);
+    }
+}
+
+/**
+ * @brief 按先后顺序把延后的任务重新派发到线程池，遇到线程池仍满即停止
+ * @param reactor 当前reactor
+ * @return 无返回值
+ */
+static void reactor_retry_deferred(Reactor *reactor)
+{
+    while (reactor->deferred_head < reactor->deferred_count)
+    {
+        if (thread_pool_add_task(reactor->deferred[reactor->deferred_head]) == -1)
+        {
+            return;
+        }
+        reactor->deferred_head++;
+    }
+
+    reactor->deferred_head = 0;
+    reactor->deferred_count = 0;
+    write_log(LOG_LEVEL_INFO, "reactor %d：延后任务已全部派发，恢复读取", reactor->id);
+}
+
+/**
+ * @brief reactor事件循环（接受新连接、把客户端事件分发到线程池）
+ * @param arg 指向本reactor的Reactor指针
+ * @return 无返回值（返回NULL）
+ */
+void *reactor_loop(void *arg)
+{
+    Reactor *reactor = (Reactor *)arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (server_running)
+    {
+        // 有延后任务时先尝试派发，派发不完则定时醒来重试
+        int timeout = -1;
+        if (reactor->deferred_count > reactor->deferred_head)
+        {
+            reactor_retry_deferred(reactor);
+            if (reactor->deferred_count > reactor->deferred_head)
+                timeout = DEFER_RETRY_MS;
+        }
+
+        // 等待epoll事件（阻塞，直到有事件发生或延后任务需要重试）
+        int nfds = epoll_wait(reactor->epfd, events, MAX_EVENTS, timeout);
+        if (nfds == -1)
+        {
+            // 忽略中断错误（信号导致的暂时返回）
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait失败");
+            write_log(LOG_LEVEL_ERROR, "reactor %d epoll_wait失败: %s", reactor->id, strerror(errno));
+            break;
+        }
+
+        // 遍历处理所有发生的事件
+        for (int i = 0; i < nfds; i++)
+        {
+            ConnHandle handle = events[i].data.u64;
+
+            // 事件1：监听socket有新连接
+            if (handle == (uint64_t)reactor->listen_fd)
+            {
+                reactor_accept(reactor);
+                continue;
+            }
+            // 退出通知：server_running已置0，处理完本批事件后退出循环
+            if (handle == (uint64_t)shutdown_fd)
+            {
+                continue;
+            }
+
+            // 连接已关闭（同一批事件里前面的任务已经关掉了它）或正在被工作线程处理则忽略；
+            // EPOLLONESHOT保证事件触发后不再重复上报，直到工作线程处理完重新挂载
+            Connection *conn = conn_lookup(handle);
+            if (!conn || !reactor_claim_client(conn))
+                continue;
+
+            Task task;
+            task.client_fd = CONN_HANDLE_FD(handle);
+            task.conn = handle;
+            task.client_addr = conn->addr;
+            task.payload = NULL;
+            task.enqueue_us = 0;
+
+            // 事件2：客户端socket有上传数据（处于上传中状态）
+            if (conn->up.state == UP_STATE_RECEIVING)
+                task.type = TASK_UPLOAD_DATA;
+            // 下载推模式：EPOLLOUT事件且处于发送中
+            else if ((events[i].events & EPOLLOUT) && conn->dl.state == DL_STATE_SENDING)
+                task.type = TASK_DOWNLOAD_DATA;
+            // 其他普通消息（出错/挂断也由recv读出，走正常断开流程）
+            else if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                task.type = TASK_CLIENT_MESSAGE;
+            // 响应队列之前没发完，发送缓冲区现在可写
+            else
+                task.type = TASK_FLUSH_OUTPUT;
+
+            // 任务队列已满时延后派发：连接保持处理中，不重新挂载也不再读取，
+            // 数据留在内核接收缓冲区，由TCP流控把压力传回客户端
+            reactor_submit(reactor, &task);
+        }
+    }
+
+    free(reactor->deferred);
+    reactor->deferred = NULL;
+    return NULL;
+}
+
+/**
+ * @brief 按连接当前状态重新挂载EPOLLONESHOT事件（调用方须持有conn->lock）
+ * @param client_fd 客户端文件描述符
+ * @param conn 连接对象
+ * @return 0=挂载成功，-1=挂载失败
+ * @details 上传接收中只关注读，下载发送中只关注写，其余关注读并在响应队列未发完时加关注写；
+ *          挂载时内核会重新检查就绪状态，处理期间错过的事件不会丢失
+ */
+int reactor_arm_client_locked(int client_fd, Connection *conn)
+{
+    // io_uring后端由完成事件驱动连接状态机，没有epoll注册可改
+    if (server_config.io_backend == IO_BACKEND_URING)
+    {
+        return 0;
+    }
+
+    uint32_t events;
+    if (conn->up.state == UP_STATE_RECEIVING)
+        events = EPOLLIN;
+    else if (conn->dl.state == DL_STATE_SENDING)
+        events = EPOLLOUT;
+    else
+        events = EPOLLIN | (conn->out_head ? EPOLLOUT : 0);
+    conn->out_armed = (events & EPOLLOUT) != 0;
+
+    struct epoll_event ev;
+    ev.events = events | EPOLLET | EPOLLONESHOT;
+    ev.data.u64 = conn_handle(client_fd);
+    if (epoll_ctl(conn->epfd, EPOLL_CTL_MOD, client_fd, &ev) == -1)
+    {
+        write_log(LOG_LEVEL_ERROR, "epoll_ctl修改客户端 %d 事件失败: %s", client_fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 工作线程处理完连接的任务后释放连接，并按最新状态重新挂载事件
+ * @param handle 任务所属连接的句柄
+ * @return 无返回值（连接已在处理中关闭、fd已被新连接复用则什么也不做）
+ * @details 按句柄而不是fd释放：任务期间连接关闭后fd可能已被新连接复用，
+ *          不能清掉新连接的处理中标记（否则同一连接会被两个工作线程同时处理）
+ */
+void reactor_release_client(ConnHandle handle)
+{
+    Connection *conn = conn_lookup(handle);
+    if (!conn)
+    {
+        return;
+    }
+
+    // 加锁后再校验一次：查找与加锁之间连接可能被关闭并重新登记
+    pthread_mutex_lock(&conn->lock);
+    if (conn->in_use && conn->generation == CONN_HANDLE_GEN(handle))
+    {
+        conn->busy = 0;
+        reactor_arm_client_locked(CONN_HANDLE_FD(handle), conn);
+    }
+    pthread_mutex_unlock(&conn->lock);
+}
+
+/**
+ * @brief 关闭所有reactor的监听socket和epoll实例（退出时调用）
+ * @param 无参数
+ * @return 无返回值
+ */
+void reactor_close_all()
+{
+    for (int i = 0; i < reactor_count; i++)
+    {
+        if (reactors[i].epfd != -1)
+            close(reactors[i].epfd);
+        if (reactors[i].listen_fd != -1)
+            close(reactors[i].listen_fd);
+        reactors[i].epfd = -1;
+        reactors[i].listen_fd = -1;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "cloud_disk.h"
+
+/**
+ * @brief 创建并绑定服务器监听socket
+ * @param reuse_port 1=开启SO_REUSEPORT（多个监听socket共享端口），0=不开启
+ * @param nonblock 1=设置为非阻塞（epoll后端），0=保持阻塞（io_uring后端由内核异步等待）
+ * @return 监听socket文件描述符，-1=创建失败
+ */
+int create_listen_socket(int reuse_port, int nonblock);
+
+/**
+ * @brief 初始化单个reactor（创建监听socket、epoll实例，并注册监听socket）
+ * @param reactor 要初始化的reactor
+ * @param id reactor编号
+ * @param reuse_port 1=开启SO_REUSEPORT（多reactor模式），0=不开启
+ * @return 0=初始化成功，-1=初始化失败
+ */
+int reactor_init(Reactor *reactor, int id, int reuse_port);
+
+/**
+ * @brief reactor事件循环（接受新连接、把客户端事件分发到线程池）
+ * @param arg 指向本reactor的Reactor指针
+ * @return 无返回值（返回NULL）
+ */
+void *reactor_loop(void *arg);
+
+/**
+ * @brief 按连接当前状态重新挂载EPOLLONESHOT事件（调用方须持有conn->lock）
+ * @param client_fd 客户端文件描述符
+ * @param conn 连接对象
+ * @return 0=挂载成功，-1=挂载失败
+ * @details 上传接收中只关注读，下载发送中只关注写，其余关注读并在响应队列未发完时加关注写
+ */
+int reactor_arm_client_locked(int client_fd, Connection *conn);
+
+/**
+ * @brief 工作线程处理完连接的任务后释放连接，并按最新状态重新挂载事件
+ * @param handle 任务所属连接的句柄
+ * @return 无返回值（连接已在处理中关闭、fd已被新连接复用则什么也不做）
+ */
+void reactor_release_client(ConnHandle handle);
+
+/**
+ * @brief 关闭所有reactor的监听socket和epoll实例（退出时调用）
+ * @param 无参数
+ * @return 无返回值
+ */
+void reactor_close_all();
+
+#endif // REACTOR_H
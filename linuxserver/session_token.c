@@ -0,0 +1,176 @@
+#include "session_token.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+// 令牌签名密钥（启动时初始化，之后只读，多线程无需加锁）
+static unsigned char token_key[SESSION_TOKEN_KEY_LEN];
+
+/**
+ * @brief 从密钥文件读取签名密钥，文件不存在时生成新密钥并保存（权限0600）
+ * @param path 密钥文件路径
+ * @return 0=成功，-1=失败
+ */
+static int session_token_load_key(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        ssize_t n = read(fd, token_key, sizeof(token_key));
+        close(fd);
+        if (n != (ssize_t)sizeof(token_key))
+        {
+            write_log(LOG_LEVEL_ERROR, "会话令牌密钥文件长度不足 %d 字节: %s", SESSION_TOKEN_KEY_LEN, path);
+            return -1;
+        }
+        return 0;
+    }
+    if (errno != ENOENT)
+    {
+        write_log(LOG_LEVEL_ERROR, "打开会话令牌密钥文件失败: %s, %s", path, strerror(errno));
+        return -1;
+    }
+
+    // 首次启动：生成密钥并保存，之后重启沿用，已签发的令牌不失效
+    if (RAND_bytes(token_key, sizeof(token_key)) != 1)
+    {
+        write_log(LOG_LEVEL_ERROR, "生成会话令牌密钥失败");
+        return -1;
+    }
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || write(fd, token_key, sizeof(token_key)) != (ssize_t)sizeof(token_key))
+    {
+        write_log(LOG_LEVEL_ERROR, "保存会话令牌密钥失败: %s, %s", path, strerror(errno));
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(path);
+        }
+        return -1;
+    }
+    close(fd);
+    write_log(LOG_LEVEL_INFO, "已生成会话令牌密钥: %s", path);
+    return 0;
+}
+
+/**
+ * @brief 初始化会话令牌签名密钥（-K 指定密钥文件时读取，文件不存在则生成并保存；未指定时随机生成）
+ * @param 无参数
+ * @return 0=成功，-1=失败
+ * @details 未指定密钥文件时服务器重启后旧令牌全部失效，客户端退回密码登录
+ */
+int session_token_init()
+{
+    if (server_config.token_key_path)
+    {
+        return session_token_load_key(server_config.token_key_path);
+    }
+    if (RAND_bytes(token_key, sizeof(token_key)) != 1)
+    {
+        write_log(LOG_LEVEL_ERROR, "生成会话令牌密钥失败");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 计算令牌正文（用户名.过期时间戳）的签名，输出十六进制字符串
+ * @param payload 令牌正文
+ * @param len 正文长度
+ * @param hex 输出参数：签名十六进制串（SESSION_TOKEN_MAC_HEX_LEN + 1字节）
+ * @return 0=成功，-1=失败
+ */
+static int session_token_sign(const char *payload, size_t len, char *hex)
+{
+    static const char digits[] = "0123456789abcdef";
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    unsigned int mac_len = 0;
+
+    if (!HMAC(EVP_sha256(), token_key, sizeof(token_key),
+              (const unsigned char *)payload, len, mac, &mac_len))
+    {
+        return -1;
+    }
+    for (unsigned int i = 0; i < mac_len; i++)
+    {
+        hex[i * 2] = digits[mac[i] >> 4];
+        hex[i * 2 + 1] = digits[mac[i] & 0x0f];
+    }
+    hex[mac_len * 2] = '\0';
+    return 0;
+}
+
+/**
+ * @brief 为用户签发会话令牌（格式：用户名.过期时间戳.HMAC-SHA256十六进制）
+ * @param username 用户名
+ * @param token 输出参数：令牌字符串（SESSION_TOKEN_MAX_LEN）
+ * @param expires 输出参数：过期时间戳（可为NULL）
+ * @return 0=成功，-1=失败
+ */
+int session_token_issue(const char *username, char *token, time_t *expires)
+{
+    time_t exp = time(NULL) + SESSION_TOKEN_TTL;
+    int len = snprintf(token, SESSION_TOKEN_MAX_LEN, "%s.%lld", username, (long long)exp);
+    if (len < 0 || len + 1 + SESSION_TOKEN_MAC_HEX_LEN >= SESSION_TOKEN_MAX_LEN)
+    {
+        return -1;
+    }
+
+    token[len] = '.';
+    if (session_token_sign(token, len, token + len + 1) != 0)
+    {
+        write_log(LOG_LEVEL_ERROR, "会话令牌签名失败: %s", username);
+        return -1;
+    }
+    if (expires)
+    {
+        *expires = exp;
+    }
+    return 0;
+}
+
+/**
+ * @brief 校验会话令牌（只做内存中的签名和过期检查，不访问数据库）
+ * @param token 令牌字符串
+ * @param username 输出参数：令牌所属用户名（50字节）
+ * @return 1=有效，0=格式错误/签名不符/已过期
+ */
+int session_token_verify(const char *token, char *username)
+{
+    // 用户名可能含'.'，从右往左拆出签名和过期时间
+    const char *mac_dot = strrchr(token, '.');
+    if (!mac_dot || strlen(mac_dot + 1) != SESSION_TOKEN_MAC_HEX_LEN)
+    {
+        return 0;
+    }
+    const char *exp_dot = mac_dot - 1;
+    while (exp_dot >= token && *exp_dot != '.')
+    {
+        exp_dot--;
+    }
+    size_t name_len = exp_dot - token;
+    if (exp_dot < token || name_len == 0 || name_len >= 50 || exp_dot + 1 == mac_dot)
+    {
+        return 0;
+    }
+
+    // 先验签名（常数时间比较），再看过期时间
+    char expected[SESSION_TOKEN_MAC_HEX_LEN + 1];
+    if (session_token_sign(token, mac_dot - token, expected) != 0 ||
+        CRYPTO_memcmp(expected, mac_dot + 1, SESSION_TOKEN_MAC_HEX_LEN) != 0)
+    {
+        return 0;
+    }
+    char *end;
+    long long exp = strtoll(exp_dot + 1, &end, 10);
+    if (end != mac_dot || exp < (long long)time(NULL))
+    {
+        return 0;
+    }
+
+    memcpy(username, token, name_len);
+    username[name_len] = '\0';
+    return 1;
+}
@@ -0,0 +1,31 @@
+#ifndef SESSION_TOKEN_H
+#define SESSION_TOKEN_H
+
+#include "cloud_disk.h"
+
+/**
+ * @brief 初始化会话令牌签名密钥（-K 指定密钥文件时读取，文件不存在则生成并保存；未指定时随机生成）
+ * @param 无参数
+ * @return 0=成功，-1=失败
+ * @details 未指定密钥文件时服务器重启后旧令牌全部失效，客户端退回密码登录
+ */
+int session_token_init();
+
+/**
+ * @brief 为用户签发会话令牌（格式：用户名.过期时间戳.HMAC-SHA256十六进制）
+ * @param username 用户名
+ * @param token 输出参数：令牌字符串（SESSION_TOKEN_MAX_LEN）
+ * @param expires 输出参数：过期时间戳（可为NULL）
+ * @return 0=成功，-1=失败
+ */
+int session_token_issue(const char *username, char *token, time_t *expires);
+
+/**
+ * @brief 校验会话令牌（只做内存中的签名和过期检查，不访问数据库）
+ * @param token 令牌字符串
+ * @param username 输出参数：令牌所属用户名（50字节）
+ * @return 1=有效，0=格式错误/签名不符/已过期
+ */
+int session_token_verify(const char *token, char *username);
+
+#endif // SESSION_TOKEN_H
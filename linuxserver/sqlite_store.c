@@ -0,0 +1,563 @@
+#include "sqlite_store.h"
+
+#ifdef USE_SQLITE
+
+#include <sqlite3.h>
+
+#define SQ_MAX_CONNS (THREAD_POOL_SIZE + 4) // 最多连接数（工作线程、操作日志写线程、主线程各一个）
+#define SQ_BUSY_TIMEOUT_MS 5000             // 写锁被占用时的最长等待（毫秒）
+
+// 建表语句（首次启动时创建数据库文件和全部表、索引）
+static const char *sq_schema_sql =
+    "CREATE TABLE IF NOT EXISTS user ("
+    " id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    " username TEXT NOT NULL UNIQUE,"
+    " password TEXT NOT NULL,"
+    " root_dir TEXT NOT NULL DEFAULT '');"
+    "CREATE TABLE IF NOT EXISTS operation_log ("
+    " id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    " username TEXT NOT NULL,"
+    " client_fd INTEGER,"
+    " ip TEXT,"
+    " operation TEXT NOT NULL,"
+    " filename TEXT,"
+    " time TEXT NOT NULL,"
+    " status TEXT);"
+    "CREATE INDEX IF NOT EXISTS idx_oplog_user_time_id ON operation_log (username, time, id);"
+    "CREATE TABLE IF NOT EXISTS file_share ("
+    " id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    " owner TEXT NOT NULL,"
+    " recipient TEXT NOT NULL,"
+    " filepath TEXT NOT NULL,"
+    " filename TEXT NOT NULL,"
+    " share_time TEXT,"
+    " accept_time TEXT,"
+    " status TEXT NOT NULL DEFAULT 'pending');"
+    "CREATE INDEX IF NOT EXISTS idx_share_recipient ON file_share (recipient, status);"
+    "CREATE TABLE IF NOT EXISTS file ("
+    " filepath TEXT PRIMARY KEY,"
+    " owner TEXT NOT NULL);";
+
+// 各预编译语句的SQL（下标与DbStmtId对应；时间统一存为本地时间"YYYY-MM-DD HH:MM:SS"，与MySQL一致）
+static const char *sq_stmt_sql[DB_STMT_COUNT] = {
+    "SELECT password FROM user WHERE username=?1",
+    "SELECT id FROM user WHERE username=?1",
+    "SELECT root_dir FROM user WHERE username=?1",
+    "SELECT id, filename, operation, time, status FROM operation_log "
+    "WHERE username=?1 AND (time, id) < (?2, ?3) "
+    "AND (?4 = '' OR operation = ?4) AND (?5 = '' OR filename LIKE ?5 ESCAPE '\\') "
+    "ORDER BY time DESC, id DESC LIMIT ?6",
+    "INSERT INTO operation_log (username, client_fd, ip, operation, filename, time, status) "
+    "VALUES (?1, ?2, ?3, ?4, ?5, datetime(?6, 'unixepoch', 'localtime'), ?7)",
+    "INSERT INTO user (username, password, root_dir) VALUES (?1, ?2, '')",
+    "UPDATE user SET root_dir=?1 WHERE username=?2",
+    "INSERT INTO file_share (owner, recipient, filepath, filename, share_time, status) "
+    "VALUES (?1, ?2, ?3, ?4, datetime('now', 'localtime'), 'pending')",
+    "SELECT owner, filepath, filename FROM file_share "
+    "WHERE id=?1 AND recipient=?2 AND status='pending'",
+    "UPDATE file_share SET status=?1, accept_time=datetime('now', 'localtime') WHERE id=?2",
+    "SELECT owner FROM file WHERE filepath=?1",
+};
+
+/**
+ * @brief 一个线程专用的SQLite连接及其预编译语句缓存
+ */
+typedef struct
+{
+    sqlite3 *db;                         // 连接句柄
+    sqlite3_stmt *stmts[DB_STMT_COUNT];  // 预编译语句缓存（NULL=尚未prepare）
+} SqConn;
+
+static SqConn sq_conns[SQ_MAX_CONNS];                        // 所有线程的连接（关闭时统一释放）
+static int sq_conn_count = 0;                                // 已打开的连接数
+static pthread_mutex_t sq_mutex = PTHREAD_MUTEX_INITIALIZER; // 保护连接登记
+static __thread SqConn *sq_local = NULL;                     // 当前线程的连接（首次使用时打开）
+
+/**
+ * @brief 打开一个SQLite连接（WAL模式：读不阻塞写，写事务只在提交时刷盘）
+ * @param db 输出：连接句柄
+ * @return 1=成功，0=失败
+ */
+static int sq_open(sqlite3 **db)
+{
+    int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX;
+    if (sqlite3_open_v2(server_config.meta_path, db, flags, NULL) != SQLITE_OK)
+    {
+        write_log(LOG_LEVEL_ERROR, "打开SQLite数据库 %s 失败: %s",
+                  server_config.meta_path, *db ? sqlite3_errmsg(*db) : "内存不足");
+        sqlite3_close(*db);
+        *db = NULL;
+        return 0;
+    }
+    sqlite3_busy_timeout(*db, SQ_BUSY_TIMEOUT_MS);
+    sqlite3_exec(*db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
+    return 1;
+}
+
+/**
+ * @brief 获取当前线程的SQLite连接（每个线程一个连接，语句缓存不跨线程共享）
+ * @param 无参数
+ * @return 连接，NULL=打开失败或连接数已满
+ */
+static SqConn *sq_conn()
+{
+    if (sq_local)
+    {
+        return sq_local;
+    }
+
+    pthread_mutex_lock(&sq_mutex);
+    if (sq_conn_count < SQ_MAX_CONNS && sq_open(&sq_conns[sq_conn_count].db))
+    {
+        sq_local = &sq_conns[sq_conn_count++];
+    }
+    else if (sq_conn_count >= SQ_MAX_CONNS)
+    {
+        write_log(LOG_LEVEL_ERROR, "SQLite连接数已达上限 %d", SQ_MAX_CONNS);
+    }
+    pthread_mutex_unlock(&sq_mutex);
+    return sq_local;
+}
+
+/**
+ * @brief 获取当前线程连接上的预编译语句（首次使用时prepare并缓存），并清空上次的绑定
+ * @param id 预编译语句编号
+ * @return 语句句柄，NULL=失败
+ */
+static sqlite3_stmt *sq_stmt(DbStmtId id)
+{
+    SqConn *conn = sq_conn();
+    if (!conn)
+    {
+        return NULL;
+    }
+    sqlite3_stmt **cached = &conn->stmts[id];
+    if (!*cached && sqlite3_prepare_v2(conn->db, sq_stmt_sql[id], -1, cached, NULL) != SQLITE_OK)
+    {
+        write_log(LOG_LEVEL_ERROR, "SQLite预编译语句 %d 准备失败: %s", id, sqlite3_errmsg(conn->db));
+        *cached = NULL;
+        return NULL;
+    }
+    sqlite3_clear_bindings(*cached);
+    return *cached;
+}
+
+/**
+ * @brief 结束一次语句执行（重置以便复用，释放读快照）
+ * @param stmt 语句
+ * @param id 预编译语句编号
+ * @param rc 最后一次sqlite3_step的返回值
+ * @return 0=执行成功，-1=失败（已记录日志）
+ */
+static int sq_done(sqlite3_stmt *stmt, DbStmtId id, int rc)
+{
+    if (rc != SQLITE_DONE && rc != SQLITE_ROW)
+    {
+        write_log(LOG_LEVEL_ERROR, "SQLite预编译语句 %d 执行失败: %s", id,
+                  sqlite3_errmsg(sqlite3_db_handle(stmt)));
+        sqlite3_reset(stmt);
+        return -1;
+    }
+    sqlite3_reset(stmt);
+    return 0;
+}
+
+/**
+ * @brief 把字符串绑定为语句参数（NULL绑定为SQL NULL）
+ * @param stmt 语句
+ * @param index 参数编号（从1开始）
+ * @param str 参数值（须在语句执行完之前保持有效）
+ * @return 无返回值
+ */
+static void sq_bind_text(sqlite3_stmt *stmt, int index, const char *str)
+{
+    if (str)
+        sqlite3_bind_text(stmt, index, str, -1, SQLITE_STATIC);
+    else
+        sqlite3_bind_null(stmt, index);
+}
+
+/**
+ * @brief 把一列文本复制到缓冲区（NULL输出空串，超长截断）
+ * @param stmt 当前行所在的语句
+ * @param col 列号（从0开始）
+ * @param out 输出缓冲区
+ * @param out_size 缓冲区大小
+ * @return 无返回值
+ */
+static void sq_column_text(sqlite3_stmt *stmt, int col, char *out, size_t out_size)
+{
+    const unsigned char *text = sqlite3_column_text(stmt, col);
+    snprintf(out, out_size, "%s", text ? (const char *)text : "");
+}
+
+/**
+ * @brief 执行“一个字符串参数、返回一行一列”的查询
+ * @param id 预编译语句编号
+ * @param param 查询参数
+ * @param out 输出：第一行第一列的值（NULL值输出空串）
+ * @param out_size out缓冲区大小
+ * @return 1=查到，0=无结果，-1=查询失败
+ */
+static int sq_query_string(DbStmtId id, const char *param, char *out, size_t out_size)
+{
+    sqlite3_stmt *stmt = sq_stmt(id);
+    if (!stmt)
+    {
+        return -1;
+    }
+    sq_bind_text(stmt, 1, param);
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW)
+    {
+        sq_column_text(stmt, 0, out, out_size);
+    }
+    if (sq_done(stmt, id, rc) != 0)
+    {
+        return -1;
+    }
+    return rc == SQLITE_ROW ? 1 : 0;
+}
+
+/**
+ * @brief 打开数据库文件并建表（首次启动时创建），失败时退出程序
+ * @param 无参数
+ * @return 无返回值
+ */
+static void sq_init()
+{
+    if (sqlite3_threadsafe() == 0)
+    {
+        fprintf(stderr, "SQLite库未开启线程安全，无法使用\n");
+        write_log(LOG_LEVEL_ERROR, "SQLite库未开启线程安全，无法使用");
+        exit(1);
+    }
+
+    // 主线程的连接负责建表，之后留给主线程使用
+    SqConn *conn = sq_conn();
+    char *err = NULL;
+    if (!conn || sqlite3_exec(conn->db, sq_schema_sql, NULL, NULL, &err) != SQLITE_OK)
+    {
+        fprintf(stderr, "SQLite数据库初始化失败: %s\n", err ? err : server_config.meta_path);
+        write_log(LOG_LEVEL_ERROR, "SQLite数据库初始化失败: %s", err ? err : server_config.meta_path);
+        sqlite3_free(err);
+        exit(1);
+    }
+
+    printf("SQLite元数据存储初始化成功: %s\n", server_config.meta_path);
+    write_log(LOG_LEVEL_INFO, "SQLite元数据存储初始化成功: %s", server_config.meta_path);
+}
+
+/**
+ * @brief 关闭所有线程的连接（释放语句缓存，WAL在最后一个连接关闭时合并回主库）
+ * @param 无参数
+ * @return 无返回值（调用前需已停止线程池和操作日志写线程）
+ */
+static void sq_destroy()
+{
+    pthread_mutex_lock(&sq_mutex);
+    for (int i = 0; i < sq_conn_count; i++)
+    {
+        for (int j = 0; j < DB_STMT_COUNT; j++)
+        {
+            sqlite3_finalize(sq_conns[i].stmts[j]);
+            sq_conns[i].stmts[j] = NULL;
+        }
+        sqlite3_close(sq_conns[i].db);
+        sq_conns[i].db = NULL;
+    }
+    sq_conn_count = 0;
+    pthread_mutex_unlock(&sq_mutex);
+    sq_local = NULL;
+}
+
+/**
+ * @brief 任务结束：SQLite连接归线程所有，语句在每次执行后已重置，无需归还
+ * @param 无参数
+ * @return 无返回值
+ */
+static void sq_release()
+{
+}
+
+/**
+ * @brief 查询用户密码
+ * @param username 用户名
+ * @param out 输出：密码
+ * @param out_size out缓冲区大小
+ * @return 1=查到，0=用户不存在，-1=查询失败
+ */
+static int sq_user_password(const char *username, char *out, size_t out_size)
+{
+    return sq_query_string(STMT_USER_PASSWORD, username, out, out_size);
+}
+
+/**
+ * @brief 查询用户是否存在
+ * @param username 用户名
+ * @return 1=存在，0=不存在，-1=查询失败
+ */
+static int sq_user_exists(const char *username)
+{
+    char id[32];
+    return sq_query_string(STMT_USER_ID, username, id, sizeof(id));
+}
+
+/**
+ * @brief 查询用户根目录
+ * @param username 用户名
+ * @param out 输出：根目录路径
+ * @param out_size out缓冲区大小
+ * @return 1=查到，0=用户不存在，-1=查询失败
+ */
+static int sq_user_root_dir(const char *username, char *out, size_t out_size)
+{
+    return sq_query_string(STMT_USER_ROOT_DIR, username, out, out_size);
+}
+
+/**
+ * @brief 按文件路径查询所有者
+ * @param filepath 文件路径
+ * @param owner 输出：所有者用户名
+ * @param owner_size owner缓冲区大小
+ * @return 1=查到，0=无记录，-1=查询失败
+ */
+static int sq_file_owner(const char *filepath, char *owner, size_t owner_size)
+{
+    return sq_query_string(STMT_FILE_OWNER, filepath, owner, owner_size);
+}
+
+/**
+ * @brief 注册新用户（根目录留空，首次登录时创建）
+ * @param username 用户名
+ * @param password 密码
+ * @return 0=成功，-1=失败（含用户名重复）
+ */
+static int sq_user_insert(const char *username, const char *password)
+{
+    sqlite3_stmt *stmt = sq_stmt(STMT_INSERT_USER);
+    if (!stmt)
+    {
+        return -1;
+    }
+    sq_bind_text(stmt, 1, username);
+    sq_bind_text(stmt, 2, password);
+    return sq_done(stmt, STMT_INSERT_USER, sqlite3_step(stmt));
+}
+
+/**
+ * @brief 更新用户根目录
+ * @param username 用户名
+ * @param root_dir 根目录路径
+ * @return 0=成功，-1=失败
+ */
+static int sq_user_set_root_dir(const char *username, const char *root_dir)
+{
+    sqlite3_stmt *stmt = sq_stmt(STMT_SET_ROOT_DIR);
+    if (!stmt)
+    {
+        return -1;
+    }
+    sq_bind_text(stmt, 1, root_dir);
+    sq_bind_text(stmt, 2, username);
+    return sq_done(stmt, STMT_SET_ROOT_DIR, sqlite3_step(stmt));
+}
+
+/**
+ * @brief 发起文件分享（状态为pending）
+ * @param owner 分享者
+ * @param recipient 接收者
+ * @param filepath 文件所在路径
+ * @param filename 文件名
+ * @return 分享id，-1=失败
+ */
+static int sq_share_insert(const char *owner, const char *recipient,
+                           const char *filepath, const char *filename)
+{
+    sqlite3_stmt *stmt = sq_stmt(STMT_SHARE_INSERT);
+    if (!stmt)
+    {
+        return -1;
+    }
+    sq_bind_text(stmt, 1, owner);
+    sq_bind_text(stmt, 2, recipient);
+    sq_bind_text(stmt, 3, filepath);
+    sq_bind_text(stmt, 4, filename);
+    if (sq_done(stmt, STMT_SHARE_INSERT, sqlite3_step(stmt)) != 0)
+    {
+        return -1;
+    }
+    return (int)sqlite3_last_insert_rowid(sq_local->db);
+}
+
+/**
+ * @brief 查询发给指定接收者、尚未处理的分享
+ * @param share_id 分享id
+ * @param recipient 接收者
+ * @param info 输出：分享者、文件路径和文件名
+ * @return 1=查到，0=不存在或已处理，-1=查询失败
+ */
+static int sq_share_get_pending(int share_id, const char *recipient, ShareInfo *info)
+{
+    sqlite3_stmt *stmt = sq_stmt(STMT_SHARE_PENDING);
+    if (!stmt)
+    {
+        return -1;
+    }
+    sqlite3_bind_int(stmt, 1, share_id);
+    sq_bind_text(stmt, 2, recipient);
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW)
+    {
+        sq_column_text(stmt, 0, info->owner, sizeof(info->owner));
+        sq_column_text(stmt, 1, info->filepath, sizeof(info->filepath));
+        sq_column_text(stmt, 2, info->filename, sizeof(info->filename));
+    }
+    if (sq_done(stmt, STMT_SHARE_PENDING, rc) != 0)
+    {
+        return -1;
+    }
+    return rc == SQLITE_ROW ? 1 : 0;
+}
+
+/**
+ * @brief 更新分享状态
+ * @param share_id 分享id
+ * @param status 新状态（accepted/rejected）
+ * @return 0=成功，-1=失败
+ */
+static int sq_share_set_status(int share_id, const char *status)
+{
+    sqlite3_stmt *stmt = sq_stmt(STMT_SHARE_STATUS);
+    if (!stmt)
+    {
+        return -1;
+    }
+    sq_bind_text(stmt, 1, status);
+    sqlite3_bind_int(stmt, 2, share_id);
+    return sq_done(stmt, STMT_SHARE_STATUS, sqlite3_step(stmt));
+}
+
+/**
+ * @brief 按游标查询一页操作历史，按(time, id)倒序追加到records
+ * @param username 用户名
+ * @param query 分页游标、条数和过滤条件
+ * @param records 输出：JSON数组（每条含id、filename、operation、time、status）
+ * @return 本页行数，-1=查询失败
+ */
+static int sq_history_page(const char *username, const HistoryQuery *query, cJSON *records)
+{
+    sqlite3_stmt *stmt = sq_stmt(STMT_HISTORY);
+    if (!stmt)
+    {
+        return -1;
+    }
+    sq_bind_text(stmt, 1, username);
+    sq_bind_text(stmt, 2, query->before_time);
+    sqlite3_bind_int64(stmt, 3, query->before_id);
+    sq_bind_text(stmt, 4, query->operation);
+    sq_bind_text(stmt, 5, query->filename_pattern);
+    sqlite3_bind_int(stmt, 6, query->limit);
+
+    int rc;
+    int count = 0;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        const char *columns[4];
+        for (int i = 0; i < 4; i++)
+        {
+            columns[i] = (const char *)sqlite3_column_text(stmt, i + 1);
+        }
+        cJSON *record = cJSON_CreateObject();
+        cJSON_AddNumberToObject(record, "id", (double)sqlite3_column_int64(stmt, 0));
+        cJSON_AddStringToObject(record, "filename", columns[0] ? columns[0] : "");   // 文件名（空则填空字符串）
+        cJSON_AddStringToObject(record, "operation", columns[1] ? columns[1] : "");  // 操作类型
+        cJSON_AddStringToObject(record, "time", columns[2] ? columns[2] : "");       // 操作时间
+        cJSON_AddStringToObject(record, "status", columns[3] ? columns[3] : "未知"); // 操作状态（默认“未知”）
+        cJSON_AddItemToArray(records, record);
+        count++;
+    }
+    return sq_done(stmt, STMT_HISTORY, rc) == 0 ? count : -1;
+}
+
+/**
+ * @brief 写入一批操作记录（一个写事务内逐条插入，只在提交时刷一次盘）
+ * @param records 记录数组
+ * @param count 记录数
+ * @return 0=成功，-1=失败（整批回滚）
+ */
+static int sq_insert_logs(OpLogRecord *records, int count)
+{
+    sqlite3_stmt *stmt = sq_stmt(STMT_INSERT_LOG);
+    if (!stmt)
+    {
+        return -1;
+    }
+    sqlite3 *db = sq_local->db;
+    if (count > 1 && sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK)
+    {
+        write_log(LOG_LEVEL_ERROR, "SQLite开始写事务失败: %s", sqlite3_errmsg(db));
+        return -1;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < count && ret == 0; i++)
+    {
+        sqlite3_clear_bindings(stmt);
+        sq_bind_text(stmt, 1, records[i].username);
+        sqlite3_bind_int(stmt, 2, records[i].client_fd);
+        sq_bind_text(stmt, 3, records[i].ip);
+        sq_bind_text(stmt, 4, records[i].operation);
+        sq_bind_text(stmt, 5, records[i].filename);
+        sqlite3_bind_int64(stmt, 6, (sqlite3_int64)records[i].time);
+        sq_bind_text(stmt, 7, records[i].status);
+        ret = sq_done(stmt, STMT_INSERT_LOG, sqlite3_step(stmt));
+    }
+
+    if (count > 1)
+    {
+        sqlite3_exec(db, ret == 0 ? "COMMIT" : "ROLLBACK", NULL, NULL, NULL);
+    }
+    return ret;
+}
+
+// 内嵌SQLite元数据存储（定义，声明在cloud_disk.h）
+const MetaStore sqlite_meta_store = {
+    "sqlite",
+    sq_init,
+    sq_destroy,
+    sq_release,
+    sq_user_password,
+    sq_user_exists,
+    sq_user_insert,
+    sq_user_root_dir,
+    sq_user_set_root_dir,
+    sq_share_insert,
+    sq_share_get_pending,
+    sq_share_set_status,
+    sq_file_owner,
+    sq_history_page,
+    sq_insert_logs,
+};
+
+#else // !USE_SQLITE
+
+/**
+ * @brief 未编译SQLite支持：选择-S时直接退出（元数据不能静默改存到另一个后端）
+ * @param 无参数
+ * @return 无返回值
+ */
+static void sq_unavailable()
+{
+    fprintf(stderr, "未以USE_SQLITE=1编译，SQLite元数据存储不可用\n");
+    write_log(LOG_LEVEL_ERROR, "未以USE_SQLITE=1编译，SQLite元数据存储不可用");
+    exit(1);
+}
+
+// 未编译SQLite支持时只有init可用（初始化即退出，其余接口不会被调用）
+const MetaStore sqlite_meta_store = {
+    .name = "sqlite",
+    .init = sq_unavailable,
+};
+
+#endif // USE_SQLITE
@@ -0,0 +1,14 @@
+#ifndef SQLITE_STORE_H
+#define SQLITE_STORE_H
+
+#include "cloud_disk.h"
+
+/**
+ * @brief 内嵌SQLite元数据存储（-S 数据库文件，需USE_SQLITE=1编译）
+ * @details 单机部署或离线压测时替代MySQL：每次元数据操作都在进程内完成，没有网络往返；
+ *          每个线程一个连接（WAL模式，读写互不阻塞），首次启动自动建表；
+ *          未编译SQLite支持时选择该后端会直接退出
+ */
+extern const MetaStore sqlite_meta_store;
+
+#endif // SQLITE_STORE_H
@@ -1,82 +1,244 @@
 #include "thread_pool.h"
 
+// 当前工作线程正在执行的任务在队列中等待的时长（微秒，供业务层做过载判断）
+static __thread long long task_wait_us = 0;
+
 /**
- * @brief 初始化线程池（创建线程、初始化锁和信号量）
+ * @brief 获取当前单调时钟时间（微秒）
+ * @param 无参数
+ * @return 微秒时间戳
+ */
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 任务类型所属的调度通道
+ * @param type 任务类型
+ * @return LANE_BULK=上传/下载数据传输，LANE_INTERACTIVE=其余任务
+ */
+static TaskLane task_lane(TaskType type)
+{
+    if (type == TASK_UPLOAD_DATA || type == TASK_DOWNLOAD_DATA)
+        return LANE_BULK;
+    return LANE_INTERACTIVE;
+}
+
+/**
+ * @brief 初始化线程池（创建线程、初始化各线程队列的锁和唤醒信号量）
  * @param 无参数
  * @return 无返回值
  */
 void thread_pool_init()
 {
-    // 初始化互斥锁（保护任务队列）
-    pthread_mutex_init(&thread_pool.mutex, NULL);
+    memset(thread_pool.workers, 0, sizeof(thread_pool.workers));
+    thread_pool.idle_reserved = 0;
+    thread_pool.idle_general = 0;
     // 初始化信号量（控制线程唤醒，初始值0表示无任务）
-    sem_init(&thread_pool.semaphore, 0, 0);
-    // 初始化任务队列（空队列）
-    thread_pool.front = 0;
-    thread_pool.rear = 0;
-    thread_pool.count = 0;
+    sem_init(&thread_pool.sem_reserved, 0, 0);
+    sem_init(&thread_pool.sem_general, 0, 0);
+    // 初始化每个工作线程的任务队列（空队列）
+    for (int i = 0; i < THREAD_POOL_SIZE; i++)
+    {
+        pthread_mutex_init(&thread_pool.workers[i].mutex, NULL);
+    }
 
-    // 创建线程池中的工作线程
+    // 创建线程池中的工作线程（参数为线程编号，对应自己的任务队列）
     for (int i = 0; i < THREAD_POOL_SIZE; i++)
     {
-        pthread_create(&thread_pool.threads[i], NULL, thread_function, NULL);
+        pthread_create(&thread_pool.threads[i], NULL, thread_function, (void *)(intptr_t)i);
+    }
+}
+
+/**
+ * @brief 把任务放入指定工作线程某个通道的队列尾
+ * @param worker 目标工作线程
+ * @param lane 任务通道
+ * @param task 任务
+ * @return 0=成功，-1=该队列已满
+ */
+static int worker_push(Worker *worker, TaskLane lane, Task *task)
+{
+    TaskQueue *q = &worker->lanes[lane];
+    int ret = -1;
+    pthread_mutex_lock(&worker->mutex);
+    if (q->count < MAX_QUEUE_SIZE)
+    {
+        q->queue[q->rear] = *task;
+        q->rear = (q->rear + 1) % MAX_QUEUE_SIZE; // 循环队列
+        __atomic_store_n(&q->count, q->count + 1, __ATOMIC_SEQ_CST);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&worker->mutex);
+    return ret;
+}
+
+/**
+ * @brief 从指定工作线程某个通道的队列头取出一个任务（主人取和偷取都从队列头，保证先到先处理）
+ * @param worker 目标工作线程
+ * @param lane 任务通道
+ * @param task 输出：取出的任务
+ * @return 1=取到任务，0=队列为空
+ */
+static int worker_pop(Worker *worker, TaskLane lane, Task *task)
+{
+    TaskQueue *q = &worker->lanes[lane];
+    // 先无锁看一眼，空队列不加锁（偷任务时大多数队列是空的）
+    if (__atomic_load_n(&q->count, __ATOMIC_SEQ_CST) == 0)
+        return 0;
+
+    int ret = 0;
+    pthread_mutex_lock(&worker->mutex);
+    if (q->count > 0)
+    {
+        *task = q->queue[q->front];
+        q->front = (q->front + 1) % MAX_QUEUE_SIZE;
+        __atomic_store_n(&q->count, q->count - 1, __ATOMIC_RELAXED);
+        ret = 1;
     }
+    pthread_mutex_unlock(&worker->mutex);
+    return ret;
 }
 
 /**
- * @brief 向线程池任务队列添加任务
+ * @brief 向线程池添加任务（按连接fd投递到固定的工作线程队列，满了再依次尝试其他队列）
  * @param task 要添加的任务（包含客户端fd、任务类型、客户端地址）
- * @return 无返回值
+ * @return 0=添加成功，-1=所有队列都已满（任务未入队，由调用方延后重试）
+ * @details 交互任务可投递到任意线程，优先唤醒预留线程；批量任务只投递到通用线程，
+ *          不会占用预留线程，登录、列表等请求在传输繁忙时仍有线程可用
  */
-void thread_pool_add_task(Task task)
+int thread_pool_add_task(Task task)
 {
-    pthread_mutex_lock(&thread_pool.mutex); // 加锁保护队列
+    TaskLane lane = task_lane(task.type);
+    // 批量任务只在通用线程（编号INTERACTIVE_WORKERS起）之间分配
+    int first = lane == LANE_BULK ? INTERACTIVE_WORKERS : 0;
+    int span = THREAD_POOL_SIZE - first;
+
+    // 首次入队时记录时刻；延后重试的任务保留原时刻，排队延迟包含在reactor中等待的时间
+    if (task.enqueue_us == 0)
+        task.enqueue_us = now_us();
 
-    // 任务队列未满，添加任务
-    if (thread_pool.count < MAX_QUEUE_SIZE)
+    int home = (task.client_fd & 0x7fffffff) % span;
+    for (int i = 0; i < span; i++)
     {
-        thread_pool.queue[thread_pool.rear] = task;
-        thread_pool.rear = (thread_pool.rear + 1) % MAX_QUEUE_SIZE; // 循环队列
-        thread_pool.count++;
-        sem_post(&thread_pool.semaphore); // 信号量+1，唤醒一个等待的线程
+        if (worker_push(&thread_pool.workers[first + (home + i) % span], lane, &task) == 0)
+        {
+            // 有线程在休眠才投递信号量，繁忙时入队不涉及任何共享的唤醒状态
+            if (lane == LANE_INTERACTIVE &&
+                __atomic_load_n(&thread_pool.idle_reserved, __ATOMIC_SEQ_CST) > 0)
+            {
+                sem_post(&thread_pool.sem_reserved);
+            }
+            else if (__atomic_load_n(&thread_pool.idle_general, __ATOMIC_SEQ_CST) > 0)
+            {
+                sem_post(&thread_pool.sem_general);
+            }
+            return 0;
+        }
     }
-    else
+
+    return -1;
+}
+
+/**
+ * @brief 取下一个任务：交互通道优先，每个通道先取自己的队列，为空则从其他线程的队列偷一个
+ * @param id 当前工作线程编号
+ * @param task 输出：取出的任务
+ * @param lane 输出：任务所在通道
+ * @return 0=没有任务，1=来自自己的队列，2=偷来的
+ * @details 预留线程（编号小于INTERACTIVE_WORKERS）只取交互通道
+ */
+static int thread_pool_next_task(int id, Task *task, TaskLane *lane)
+{
+    int lanes = id < INTERACTIVE_WORKERS ? 1 : TASK_LANES;
+    for (int l = 0; l < lanes; l++)
     {
-        // 队列已满，打印警告日志
-        write_log(LOG_LEVEL_WARN, "任务队列已满，无法添加新任务");
+        *lane = (TaskLane)l;
+        if (worker_pop(&thread_pool.workers[id], *lane, task))
+            return 1;
+        for (int i = 1; i < THREAD_POOL_SIZE; i++)
+        {
+            if (worker_pop(&thread_pool.workers[(id + i) % THREAD_POOL_SIZE], *lane, task))
+                return 2;
+        }
     }
+    return 0;
+}
+
+/**
+ * @brief 记录一次任务的排队延迟
+ * @param stats 任务所在通道的延迟统计
+ * @param latency_us 排队延迟（微秒）
+ * @return 无返回值
+ */
+static void record_latency(LatencyStats *stats, long long latency_us)
+{
+    if (latency_us < 0)
+        latency_us = 0;
+    unsigned long long us = (unsigned long long)latency_us;
+
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && (1ULL << bucket) <= us)
+        bucket++;
 
-    pthread_mutex_unlock(&thread_pool.mutex); // 解锁
+    stats->hist[bucket]++;
+    stats->count++;
+    stats->sum_us += us;
+    if (us > stats->max_us)
+        stats->max_us = us;
 }
 
 /**
- * @brief 线程池工作线程函数（循环获取任务并执行）
- * @param arg 线程参数（无实际意义，仅满足pthread_create要求）
+ * @brief 线程池工作线程函数（交互通道优先，先取自己队列的任务，为空时从其他线程偷取）
+ * @param arg 线程编号（强转为指针传入）
  * @return 无返回值（返回NULL）
  */
 void *thread_function(void *arg)
 {
-    while (server_running)
-    {                                     // 服务器运行时循环
-        sem_wait(&thread_pool.semaphore); // 等待任务（信号量-1，无任务则阻塞）
+    int id = (int)(intptr_t)arg;
+    Worker *self = &thread_pool.workers[id];
+    int reserved = id < INTERACTIVE_WORKERS;
+    int *idle = reserved ? &thread_pool.idle_reserved : &thread_pool.idle_general;
+    sem_t *sem = reserved ? &thread_pool.sem_reserved : &thread_pool.sem_general;
 
-        if (!server_running)
-            break; // 服务器退出，终止线程
-
-        pthread_mutex_lock(&thread_pool.mutex); // 加锁获取任务
+    while (server_running)
+    { // 服务器运行时循环
+        Task task;
+        TaskLane lane;
+        int source = thread_pool_next_task(id, &task, &lane);
+        if (source == 0)
+        {
+            // 可取的队列都空：先登记为空闲再复查一次，避免与投递者错过唤醒
+            __atomic_add_fetch(idle, 1, __ATOMIC_SEQ_CST);
+            source = thread_pool_next_task(id, &task, &lane);
+            if (source == 0)
+            {
+                sem_wait(sem); // 等待任务（无任务则阻塞）
+            }
+            __atomic_sub_fetch(idle, 1, __ATOMIC_SEQ_CST);
 
-        // 从队列头取出任务（循环队列）
-        Task task = thread_pool.queue[thread_pool.front];
-        thread_pool.front = (thread_pool.front + 1) % MAX_QUEUE_SIZE;
-        thread_pool.count--;
+            if (!server_running)
+                break; // 服务器退出，终止线程
+            if (source == 0)
+                continue; // 被唤醒后重新取任务
+        }
 
-        pthread_mutex_unlock(&thread_pool.mutex); // 解锁
+        // 任务排队期间连接已关闭（fd可能已被新连接复用），丢弃
+        if (!conn_lookup(task.conn))
+            continue;
 
-        // 记录任务开始时间（统计耗时）
-        struct timeval start, end;
-        gettimeofday(&start, NULL);
+        // 记录排队延迟
+        task_wait_us = now_us() - task.enqueue_us;
+        record_latency(&self->latency[lane], task_wait_us);
+        self->executed++;
+        if (source == 2)
+            self->stolen++;
 
-        // 根据任务类型执行对应处理
+        // 根据任务类型执行对应处理（期间发给该连接的响应先排队，结束后合并发送）
+        conn_batch_begin(task.conn);
         switch (task.type)
         {
         case TASK_CLIENT_MESSAGE:
@@ -88,15 +250,116 @@ void *thread_function(void *arg)
         case TASK_DOWNLOAD_DATA:
             handle_download(task.client_fd);
             break;
+        case TASK_FLUSH_OUTPUT:
+            break; // 由下面的conn_batch_end发送
+        case TASK_URING_MESSAGE:
+        case TASK_URING_FINISH:
+        case TASK_URING_CLOSE:
+            uring_backend_run_task(&task);
+            break;
         }
-
-        // 记录任务结束时间，计算耗时（毫秒）
-        gettimeofday(&end, NULL);
-        long sec_diff = end.tv_sec - start.tv_sec;
-        long usec_diff = end.tv_usec - start.tv_usec;
-        // 处理跨秒的微秒差（避免负数）
-        long elapsed_ms = sec_diff * 1000 + (usec_diff >= 0 ? usec_diff / 1000 : (usec_diff + 1000000) / 1000);
+        conn_batch_end();
+        // 归还本任务借出的数据库连接（未使用数据库则什么也不做）
+        meta_store->release();
+        // 该连接的任务处理完毕，按最新状态重新挂载EPOLLONESHOT（连接已关闭则跳过）
+        reactor_release_client(task.conn);
     }
 
     return NULL;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief 获取当前工作线程正在执行的任务的排队时长
+ * @param 无参数
+ * @return 排队时长（微秒，非工作线程调用返回0）
+ */
+long long thread_pool_task_wait_us()
+{
+    return task_wait_us;
+}
+
+/**
+ * @brief 把各工作线程的执行数、偷取数，以及各通道排队延迟（平均/p99/最大）写入日志
+ * @param 无参数
+ * @return 无返回值
+ */
+void thread_pool_log_stats()
+{
+    static const char *lane_names[TASK_LANES] = {"交互", "批量"};
+    LatencyStats total[TASK_LANES];
+    unsigned long long stolen = 0;
+    memset(total, 0, sizeof(total));
+
+    for (int i = 0; i < THREAD_POOL_SIZE; i++)
+    {
+        Worker *worker = &thread_pool.workers[i];
+        write_log(LOG_LEVEL_INFO, "工作线程 %d%s：执行任务 %llu 个（偷取 %llu 个）",
+                  i, i < INTERACTIVE_WORKERS ? "（预留）" : "", worker->executed, worker->stolen);
+        stolen += worker->stolen;
+        for (int l = 0; l < TASK_LANES; l++)
+        {
+            LatencyStats *src = &worker->latency[l];
+            total[l].count += src->count;
+            total[l].sum_us += src->sum_us;
+            if (src->max_us > total[l].max_us)
+                total[l].max_us = src->max_us;
+            for (int b = 0; b < LATENCY_BUCKETS; b++)
+                total[l].hist[b] += src->hist[b];
+        }
+    }
+    write_log(LOG_LEVEL_INFO, "线程池统计：偷取任务 %llu 个", stolen);
+
+    for (int l = 0; l < TASK_LANES; l++)
+    {
+        LatencyStats *st = &total[l];
+        if (st->count == 0)
+            continue;
+
+        // p99取累计计数首次达到99%的桶的上界（2^b微秒）
+        unsigned long long target = st->count - st->count / 100;
+        unsigned long long seen = 0;
+        unsigned long long p99_us = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++)
+        {
+            seen += st->hist[b];
+            if (seen >= target)
+            {
+                p99_us = 1ULL << b;
+                break;
+            }
+        }
+
+        write_log(LOG_LEVEL_INFO, "%s通道：任务 %llu 个，排队延迟 平均 %llu us / p99 <= %llu us / 最大 %llu us",
+                  lane_names[l], st->count, st->sum_us / st->count, p99_us, st->max_us);
+    }
+}
+
+/**
+ * @brief 停止线程池（唤醒并等待所有工作线程退出，记录统计，销毁锁和信号量）
+ * @param 无参数
+ * @return 无返回值（调用前需已把server_running置0）
+ */
+void thread_pool_destroy()
+{
+    // 唤醒所有等待的线程（避免线程阻塞在sem_wait）
+    for (int i = 0; i < THREAD_POOL_SIZE; i++)
+    {
+        sem_post(&thread_pool.sem_reserved);
+        sem_post(&thread_pool.sem_general);
+    }
+    // 等待所有线程退出
+    for (int i = 0; i < THREAD_POOL_SIZE; i++)
+    {
+        pthread_join(thread_pool.threads[i], NULL);
+    }
+
+    thread_pool_log_stats();
+
+    // 销毁线程池同步资源
+    for (int i = 0; i < THREAD_POOL_SIZE; i++)
+    {
+        pthread_mutex_destroy(&thread_pool.workers[i].mutex);
+    }
+    sem_destroy(&thread_pool.sem_reserved);
+    sem_destroy(&thread_pool.sem_general);
+}
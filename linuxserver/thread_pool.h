@@ -4,24 +4,46 @@
 #include "cloud_disk.h"
 
 /**
- * @brief 初始化线程池（创建线程、初始化锁和信号量）
+ * @brief 初始化线程池（创建线程、初始化各线程队列的锁和唤醒信号量）
  * @param 无参数
  * @return 无返回值
  */
 void thread_pool_init();
 
 /**
- * @brief 向线程池任务队列添加任务
+ * @brief 向线程池添加任务（按连接fd投递到固定的工作线程队列，满了再依次尝试其他队列）
  * @param task 要添加的任务（包含客户端fd、任务类型、客户端地址）
- * @return 无返回值
+ * @return 0=添加成功，-1=所有队列都已满（任务未入队，由调用方延后重试）
+ * @details 上传/下载数据任务进批量通道且只投递到通用线程，其余任务进交互通道
  */
-void thread_pool_add_task(Task task);
+int thread_pool_add_task(Task task);
 
 /**
- * @brief 线程池工作线程函数（循环获取任务并执行）
- * @param arg 线程参数（无实际意义，仅满足pthread_create要求）
+ * @brief 线程池工作线程函数（交互通道优先，先取自己队列的任务，为空时从其他线程偷取）
+ * @param arg 线程编号（强转为指针传入）
  * @return 无返回值（返回NULL）
  */
 void *thread_function(void *arg);
 
+/**
+ * @brief 获取当前工作线程正在执行的任务的排队时长
+ * @param 无参数
+ * @return 排队时长（微秒，非工作线程调用返回0）
+ */
+long long thread_pool_task_wait_us();
+
+/**
+ * @brief 把各工作线程的执行数、偷取数，以及各通道排队延迟（平均/p99/最大）写入日志
+ * @param 无参数
+ * @return 无返回值
+ */
+void thread_pool_log_stats();
+
+/**
+ * @brief 停止线程池（唤醒并等待所有工作线程退出，记录统计，销毁锁和信号量）
+ * @param 无参数
+ * @return 无返回值（调用前需已把server_running置0）
+ */
+void thread_pool_destroy();
+
 #endif // THREAD_POOL_H
\ No newline at end of file
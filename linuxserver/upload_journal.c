@@ -0,0 +1,408 @@
+#include "upload_journal.h"
+
+#include <openssl/evp.h>
+
+#define UPLOAD_JOURNAL_MAGIC "UPJ1 " // 续传日志首行：UPJ1 暂存数据长度 已接收字节数 块数
+
+// 正在接收的上传（同一续传键同时只允许一个连接写入）和上次回收的时间，由一把锁保护；
+// 只在开始/结束上传时加锁，接收数据时不碰
+static UploadJournal *journal_active = NULL;
+static time_t journal_last_gc = 0;
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief 拼出续传键对应的文件路径
+ * @param key 续传键
+ * @param suffix 文件后缀（.data暂存数据，.journal续传日志）
+ * @param path 输出参数：文件路径（MAX_PATH_LEN）
+ * @return 无返回值
+ */
+static void journal_path(const char *key, const char *suffix, char *path)
+{
+    snprintf(path, MAX_PATH_LEN, "%s/%s%s", UPLOAD_PARTIAL_DIR, key, suffix);
+}
+
+/**
+ * @brief 在活动上传链表中查找续传键（调用方须持有journal_mutex）
+ * @param key 续传键
+ * @return 活动的续传日志，NULL=没有连接在上传
+ */
+static UploadJournal *journal_find_active(const char *key)
+{
+    for (UploadJournal *j = journal_active; j; j = j->next)
+    {
+        if (strcmp(j->key, key) == 0)
+            return j;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 释放续传日志结构体
+ * @param j 续传日志
+ * @return 无返回值
+ */
+static void journal_free(UploadJournal *j)
+{
+    free(j->have);
+    free(j->filepath);
+    free(j);
+}
+
+/**
+ * @brief 从活动上传链表中移除并释放
+ * @param j 续传日志
+ * @return 无返回值
+ */
+static void journal_deactivate(UploadJournal *j)
+{
+    pthread_mutex_lock(&journal_mutex);
+    for (UploadJournal **pp = &journal_active; *pp; pp = &(*pp)->next)
+    {
+        if (*pp == j)
+        {
+            *pp = j->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&journal_mutex);
+    journal_free(j);
+}
+
+/**
+ * @brief 写入续传日志（先写临时文件再rename，原子替换）
+ * @param j 续传日志
+ * @param committed 已接收的字节数
+ * @return 0=成功，-1=写入失败
+ * @details 不做fsync：掉电后日志记录的进度可能超前于落盘的数据，
+ *          入库时的哈希校验会发现内容不符并丢弃这次上传，不会写入错误的文件
+ */
+static int journal_save(const UploadJournal *j, long long committed)
+{
+    char tmp[MAX_PATH_LEN];
+    char path[MAX_PATH_LEN];
+    journal_path(j->key, ".journal.tmp", tmp);
+    journal_path(j->key, ".journal", path);
+
+    FILE *fp = fopen(tmp, "we");
+    if (!fp)
+    {
+        write_log(LOG_LEVEL_ERROR, "写入续传日志失败: %s, %s", tmp, strerror(errno));
+        return -1;
+    }
+    fprintf(fp, "%s%lld %lld %d\n", UPLOAD_JOURNAL_MAGIC, j->size, committed, j->count);
+    for (int i = 0; i < j->count; i++)
+    {
+        fputc(j->have[i] ? '1' : '0', fp);
+    }
+    if (j->count > 0)
+        fputc('\n', fp);
+    fputs(j->filepath, fp); // 目标路径只供排查，读取时不解析
+    int failed = ferror(fp);
+    if (fclose(fp) != 0)
+        failed = 1;
+    if (failed || rename(tmp, path) == -1)
+    {
+        write_log(LOG_LEVEL_ERROR, "写入续传日志失败: %s, %s", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 读取续传日志
+ * @param key 续传键
+ * @param j 输出参数：填入size、committed、count和have（have由调用方free；失败时为NULL）
+ * @return 0=成功，-1=不存在或格式错误
+ */
+static int journal_load(const char *key, UploadJournal *j)
+{
+    j->have = NULL;
+    char path[MAX_PATH_LEN];
+    journal_path(key, ".journal", path);
+    FILE *fp = fopen(path, "re");
+    if (!fp)
+    {
+        return -1;
+    }
+
+    int ok = fscanf(fp, UPLOAD_JOURNAL_MAGIC "%lld %lld %d", &j->size, &j->committed, &j->count) == 3 &&
+             j->size >= 0 && j->committed >= 0 && j->committed <= j->size && j->count >= 0 &&
+             fgetc(fp) == '\n';
+    if (ok && j->count > 0)
+    {
+        j->have = malloc(j->count);
+        ok = j->have != NULL;
+        for (int i = 0; ok && i < j->count; i++)
+        {
+            int c = fgetc(fp);
+            ok = c == '0' || c == '1';
+            if (ok)
+                j->have[i] = c == '1';
+        }
+        ok = ok && fgetc(fp) == '\n';
+    }
+    fclose(fp);
+    if (!ok)
+    {
+        free(j->have);
+        j->have = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 回收未完成上传：日志超过UPLOAD_PARTIAL_TTL未更新的、没有日志的暂存数据、写了一半的日志临时文件
+ *        （调用方须持有journal_mutex，正在上传的跳过）
+ * @param now 当前时间
+ * @return 回收的未完成上传数
+ */
+static int journal_collect(time_t now)
+{
+    journal_last_gc = now;
+    DIR *dir = opendir(UPLOAD_PARTIAL_DIR);
+    if (!dir)
+    {
+        return 0;
+    }
+
+    int removed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.' || strlen(entry->d_name) <= CAS_HASH_LEN * 2)
+            continue;
+        char key[CAS_HASH_LEN * 2 + 1];
+        memcpy(key, entry->d_name, CAS_HASH_LEN * 2);
+        key[CAS_HASH_LEN * 2] = '\0';
+        if (journal_find_active(key))
+            continue;
+
+        const char *suffix = entry->d_name + CAS_HASH_LEN * 2;
+        char path[MAX_PATH_LEN];
+        snprintf(path, MAX_PATH_LEN, "%s/%s", UPLOAD_PARTIAL_DIR, entry->d_name);
+        struct stat st;
+        if (strcmp(suffix, ".journal") == 0)
+        {
+            if (stat(path, &st) == 0 && now - st.st_mtime > UPLOAD_PARTIAL_TTL)
+            {
+                char data_path[MAX_PATH_LEN];
+                journal_path(key, ".data", data_path);
+                unlink(data_path);
+                unlink(path);
+                removed++;
+            }
+        }
+        else if (strcmp(suffix, ".data") == 0)
+        {
+            // 日志已回收或创建日志前退出：暂存数据无法续传
+            char journal[MAX_PATH_LEN];
+            journal_path(key, ".journal", journal);
+            if (access(journal, F_OK) == -1 && unlink(path) == 0)
+                removed++;
+        }
+        else if (strcmp(suffix, ".journal.tmp") == 0)
+        {
+            unlink(path);
+        }
+    }
+    closedir(dir);
+    return removed;
+}
+
+/**
+ * @brief 初始化断点续传：创建暂存目录，回收过期和残缺的未完成上传
+ * @param 无参数
+ * @return 0=成功，-1=失败（目录无法创建）
+ * @details 未完成上传的暂存数据和续传日志都在磁盘上，服务器重启后仍可续传
+ */
+int upload_journal_init()
+{
+    if (mkdir_recursive(UPLOAD_PARTIAL_DIR, 0700) == -1)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&journal_mutex);
+    int removed = journal_collect(time(NULL));
+    pthread_mutex_unlock(&journal_mutex);
+    write_log(LOG_LEVEL_INFO, "断点续传初始化完成：回收未完成上传 %d 个", removed);
+    return 0;
+}
+
+/**
+ * @brief 计算续传键：同一用户路径、同一大小、同一内容的上传得到同一个键
+ * @param filepath 上传目标的完整路径
+ * @param size 文件大小
+ * @param kind 上传方式（'F'=普通上传，'D'=增量上传），两种方式的暂存数据排列不同，互不续传
+ * @param content_id 内容标识（普通上传为整文件哈希，增量上传为块清单的哈希）
+ * @param key 输出参数：续传键（CAS_HASH_LEN * 2 + 1字节的十六进制串）
+ * @return 无返回值
+ */
+void upload_journal_key(const char *filepath, long long size, char kind,
+                        const unsigned char *content_id, char *key)
+{
+    // 键由服务器端的完整路径算出，不同用户的上传不会互相续传
+    char buf[MAX_PATH_LEN + 64 + CAS_HASH_LEN];
+    int len = snprintf(buf, MAX_PATH_LEN + 64, "%c %lld %s\n", kind, size, filepath);
+    if (len > MAX_PATH_LEN + 63)
+        len = MAX_PATH_LEN + 63;
+    memcpy(buf + len, content_id, CAS_HASH_LEN);
+
+    unsigned char digest[CAS_HASH_LEN];
+    EVP_Digest(buf, len + CAS_HASH_LEN, digest, NULL, EVP_sha256(), NULL);
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < CAS_HASH_LEN; i++)
+    {
+        key[i * 2] = digits[digest[i] >> 4];
+        key[i * 2 + 1] = digits[digest[i] & 0x0f];
+    }
+    key[CAS_HASH_LEN * 2] = '\0';
+}
+
+/**
+ * @brief 开始或继续一个可续传的上传：有续传日志时沿用其中的进度，否则新建日志
+ * @param key 续传键
+ * @param filepath 上传目标的完整路径（记入日志）
+ * @param size 暂存数据总长度（增量上传为缺少的块的总长度）
+ * @param count 增量上传的块数（普通上传为0）
+ * @param have 增量上传计划（count字节）；续传时改写为上次的计划（暂存数据按上次的计划排列）
+ * @param fd 输出参数：暂存文件的文件描述符（调用方关闭）
+ * @return 续传日志（j->committed为续传起点，j->size为暂存数据总长度），NULL=失败（errno=EBUSY表示该上传正在其他连接上进行）
+ */
+UploadJournal *upload_journal_open(const char *key, const char *filepath, long long size,
+                                   int count, unsigned char *have, int *fd)
+{
+    UploadJournal *j = calloc(1, sizeof(UploadJournal));
+    if (!j || !(j->filepath = strdup(filepath)))
+    {
+        free(j);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memcpy(j->key, key, sizeof(j->key));
+    j->count = count;
+    *fd = -1;
+
+    time_t now = time(NULL);
+    pthread_mutex_lock(&journal_mutex);
+    if (now - journal_last_gc >= UPLOAD_PARTIAL_GC_INTERVAL)
+    {
+        int removed = journal_collect(now);
+        if (removed > 0)
+            write_log(LOG_LEVEL_INFO, "回收过期的未完成上传 %d 个", removed);
+    }
+    if (journal_find_active(key))
+    {
+        pthread_mutex_unlock(&journal_mutex);
+        journal_free(j);
+        errno = EBUSY;
+        return NULL;
+    }
+
+    // 有日志且块数一致（键相同即内容相同）：沿用上次的进度和计划
+    UploadJournal saved;
+    int resumed = journal_load(key, &saved) == 0 && saved.count == count && (count > 0 || saved.size == size);
+    if (resumed)
+    {
+        j->size = saved.size;
+        j->committed = saved.committed;
+        j->have = saved.have;
+        if (count > 0)
+            memcpy(have, saved.have, count);
+    }
+    else
+    {
+        free(saved.have);
+        j->size = size;
+        j->committed = 0;
+        if (count > 0 && (j->have = malloc(count)) != NULL)
+            memcpy(j->have, have, count);
+    }
+
+    char data_path[MAX_PATH_LEN];
+    journal_path(key, ".data", data_path);
+    struct stat st;
+    int ok = (count == 0 || j->have) &&
+             (*fd = open(data_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) != -1 &&
+             fstat(*fd, &st) == 0;
+    if (ok)
+    {
+        // 暂存数据比日志记录的短（掉电时未落盘），从实际长度续传；日志之后写入的数据没有记录，截掉重收
+        if (j->committed > st.st_size)
+            j->committed = st.st_size;
+        ok = ftruncate(*fd, j->committed) == 0 && (resumed || journal_save(j, 0) == 0);
+    }
+    if (!ok)
+    {
+        pthread_mutex_unlock(&journal_mutex);
+        write_log(LOG_LEVEL_ERROR, "创建上传暂存文件失败: %s, %s", data_path, strerror(errno));
+        if (*fd != -1)
+            close(*fd);
+        *fd = -1;
+        journal_free(j);
+        return NULL;
+    }
+    j->next = journal_active;
+    journal_active = j;
+    pthread_mutex_unlock(&journal_mutex);
+
+    if (j->committed > 0)
+        write_log(LOG_LEVEL_INFO, "续传上传 %s：从 %lld/%lld 字节继续", filepath, j->committed, j->size);
+    return j;
+}
+
+/**
+ * @brief 接收过程中按UPLOAD_JOURNAL_STEP间隔把已接收的字节数记入续传日志
+ * @param j 续传日志（NULL=不可续传的上传，不做任何事）
+ * @param received 已写入暂存文件的字节数
+ * @return 无返回值
+ */
+void upload_journal_checkpoint(UploadJournal *j, long long received)
+{
+    if (j && received - j->committed >= UPLOAD_JOURNAL_STEP && journal_save(j, received) == 0)
+    {
+        j->committed = received;
+    }
+}
+
+/**
+ * @brief 上传中断：记下已接收的字节数，保留暂存数据等待续传
+ * @param j 续传日志（调用后释放；NULL时不做任何事）
+ * @param received 已写入暂存文件的字节数
+ * @return 无返回值
+ */
+void upload_journal_close(UploadJournal *j, long long received)
+{
+    if (!j)
+    {
+        return;
+    }
+    if (received != j->committed && journal_save(j, received) == 0)
+    {
+        j->committed = received;
+    }
+    write_log(LOG_LEVEL_INFO, "上传中断，已保存进度：%s（%lld/%lld 字节）", j->filepath, j->committed, j->size);
+    journal_deactivate(j);
+}
+
+/**
+ * @brief 上传结束（已入库或数据无效）：删除暂存数据和续传日志
+ * @param j 续传日志（调用后释放；NULL时不做任何事）
+ * @return 无返回值
+ */
+void upload_journal_discard(UploadJournal *j)
+{
+    if (!j)
+    {
+        return;
+    }
+    // 先删文件再移出活动链表：之后同一个键的新上传从头开始
+    char path[MAX_PATH_LEN];
+    journal_path(j->key, ".data", path);
+    unlink(path);
+    journal_path(j->key, ".journal", path);
+    unlink(path);
+    journal_deactivate(j);
+}
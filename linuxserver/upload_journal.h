@@ -0,0 +1,62 @@
+#ifndef UPLOAD_JOURNAL_H
+#define UPLOAD_JOURNAL_H
+
+#include "cloud_disk.h"
+
+/**
+ * @brief 初始化断点续传：创建暂存目录，回收过期和残缺的未完成上传
+ * @param 无参数
+ * @return 0=成功，-1=失败（目录无法创建）
+ * @details 未完成上传的暂存数据和续传日志都在磁盘上，服务器重启后仍可续传
+ */
+int upload_journal_init();
+
+/**
+ * @brief 计算续传键：同一用户路径、同一大小、同一内容的上传得到同一个键
+ * @param filepath 上传目标的完整路径
+ * @param size 文件大小
+ * @param kind 上传方式（'F'=普通上传，'D'=增量上传），两种方式的暂存数据排列不同，互不续传
+ * @param content_id 内容标识（普通上传为整文件哈希，增量上传为块清单的哈希）
+ * @param key 输出参数：续传键（CAS_HASH_LEN * 2 + 1字节的十六进制串）
+ * @return 无返回值
+ */
+void upload_journal_key(const char *filepath, long long size, char kind,
+                        const unsigned char *content_id, char *key);
+
+/**
+ * @brief 开始或继续一个可续传的上传：有续传日志时沿用其中的进度，否则新建日志
+ * @param key 续传键
+ * @param filepath 上传目标的完整路径（记入日志）
+ * @param size 暂存数据总长度（增量上传为缺少的块的总长度）
+ * @param count 增量上传的块数（普通上传为0）
+ * @param have 增量上传计划（count字节）；续传时改写为上次的计划（暂存数据按上次的计划排列）
+ * @param fd 输出参数：暂存文件的文件描述符（调用方关闭）
+ * @return 续传日志（j->committed为续传起点，j->size为暂存数据总长度），NULL=失败（errno=EBUSY表示该上传正在其他连接上进行）
+ */
+UploadJournal *upload_journal_open(const char *key, const char *filepath, long long size,
+                                   int count, unsigned char *have, int *fd);
+
+/**
+ * @brief 接收过程中按UPLOAD_JOURNAL_STEP间隔把已接收的字节数记入续传日志
+ * @param j 续传日志（NULL=不可续传的上传，不做任何事）
+ * @param received 已写入暂存文件的字节数
+ * @return 无返回值
+ */
+void upload_journal_checkpoint(UploadJournal *j, long long received);
+
+/**
+ * @brief 上传中断：记下已接收的字节数，保留暂存数据等待续传
+ * @param j 续传日志（调用后释放；NULL时不做任何事）
+ * @param received 已写入暂存文件的字节数
+ * @return 无返回值
+ */
+void upload_journal_close(UploadJournal *j, long long received);
+
+/**
+ * @brief 上传结束（已入库或数据无效）：删除暂存数据和续传日志
+ * @param j 续传日志（调用后释放；NULL时不做任何事）
+ * @return 无返回值
+ */
+void upload_journal_discard(UploadJournal *j);
+
+#endif // UPLOAD_JOURNAL_H
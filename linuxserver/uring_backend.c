@@ -0,0 +1,838 @@
+#include "uring_backend.h"
+#include "conn_table.h"
+
+#ifdef USE_IO_URING
+
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+
+#define URING_ENTRIES 1024             // 提交队列深度
+#define URING_IO_BUF_SIZE (256 * 1024) // 传输中连接的数据缓冲区大小（空闲连接不分配）
+#define URING_CTL_BUF_INIT 4096        // 控制帧缓冲区初始容量（按需翻倍，上限MAX_FRAME_SIZE+4）
+#define URING_PROGRESS_STEP (4 << 20)  // 上传进度上报间隔（字节）
+
+/**
+ * @brief SQE操作类型（user_data = fd << 8 | 操作类型）
+ */
+typedef enum
+{
+    OP_ACCEPT = 1, // 接受新连接
+    OP_NOTIFY,     // 读取工作线程的完成通知（eventfd）
+    OP_SHUTDOWN,   // 等待退出通知（shutdown_fd可读，只为唤醒事件循环）
+    OP_RECV_CTL,   // 接收JSON控制帧
+    OP_RECV_UP,    // 接收上传数据
+    OP_WRITE_UP,   // 把上传数据写入文件
+    OP_READ_DL,    // 读取下载文件（与OP_SEND_DL链接）
+    OP_SEND_DL     // 发送下载数据
+} UringOp;
+
+/**
+ * @brief io_uring连接状态机
+ */
+typedef enum
+{
+    UC_RECV_CTL, // 等待/接收控制帧
+    UC_WORKER,   // 请求已交给线程池，等待处理完成
+    UC_UPLOAD,   // 上传数据接收中（recv → write 交替）
+    UC_DOWNLOAD, // 下载数据发送中（read ⇢ send 链接提交）
+    UC_CLOSING   // 已断开，等待线程池清理会话后关闭fd
+} UringConnState;
+
+/**
+ * @brief io_uring后端的单个连接（同一时刻最多一条在途SQE链）
+ */
+typedef struct UringConn
+{
+    int fd;                  // 客户端文件描述符
+    Connection *entry;       // 连接表中的连接对象（上传/下载状态、用户名等）
+    ConnHandle handle;       // 连接句柄（随任务投递给线程池）
+    UringConnState state;    // 连接状态
+    char *ctl_buf;           // 控制帧累积缓冲区
+    size_t ctl_cap;          // 控制帧缓冲区容量
+    size_t ctl_len;          // 控制帧缓冲区已有字节数
+    char *io_buf;            // 上传/下载数据缓冲区（传输开始时分配，结束后释放）
+    size_t io_req;           // 本轮请求读取的字节数
+    size_t io_len;           // 本轮实际读到/收到的字节数
+    size_t io_done;          // 本轮已写入/已发送的字节数
+    int read_failed;         // 本轮下载读文件是否失败
+    long long next_progress; // 下一次上报上传进度的阈值
+    int want_close;          // 工作线程处理结果：1=请求非法，需要断开连接
+    struct UringConn *next_done; // 完成通知链表指针
+    Task deferred_task;          // 线程池满时暂存的待派发任务
+    struct UringConn *next_deferred; // 延后派发链表指针
+} UringConn;
+
+static struct io_uring ring;
+static int listen_fd = -1;
+static int notify_fd = -1;
+static uint64_t notify_val;
+static struct sockaddr_in accept_addr;
+static socklen_t accept_addrlen;
+
+// 工作线程 → 事件循环 的完成通知链表（连接交给线程池期间不会有第二条通知，直接用连接自身做链表节点）
+static pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
+static UringConn *done_head = NULL;
+
+// 线程池满时延后派发的连接（FIFO，只由事件循环线程访问；连接在派发前不提交任何SQE，不再读取数据）
+static UringConn *deferred_head = NULL;
+static UringConn *deferred_tail = NULL;
+
+static void uring_process_ctl(UringConn *conn);
+static void uring_download_failed(UringConn *conn, const char *message);
+
+/**
+ * @brief 获取一个空闲SQE（提交队列满时先提交已有SQE腾出空间）
+ * @param 无参数
+ * @return SQE指针
+ */
+static struct io_uring_sqe *uring_get_sqe()
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+    while (!sqe)
+    {
+        io_uring_submit(&ring);
+        sqe = io_uring_get_sqe(&ring);
+    }
+    return sqe;
+}
+
+/**
+ * @brief 组装SQE的user_data
+ * @param fd 客户端文件描述符
+ * @param op 操作类型
+ * @return user_data
+ */
+static uint64_t make_user_data(int fd, UringOp op)
+{
+    return ((uint64_t)fd << 8) | op;
+}
+
+static void uring_submit_accept()
+{
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    accept_addrlen = sizeof(accept_addr);
+    io_uring_prep_accept(sqe, listen_fd, (struct sockaddr *)&accept_addr, &accept_addrlen, 0);
+    sqe->user_data = make_user_data(listen_fd, OP_ACCEPT);
+}
+
+static void uring_submit_notify_read()
+{
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    io_uring_prep_read(sqe, notify_fd, &notify_val, sizeof(notify_val), 0);
+    sqe->user_data = make_user_data(notify_fd, OP_NOTIFY);
+}
+
+static void uring_submit_shutdown_poll()
+{
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    io_uring_prep_poll_add(sqe, shutdown_fd, POLLIN);
+    sqe->user_data = make_user_data(shutdown_fd, OP_SHUTDOWN);
+}
+
+static void uring_submit_recv_upload(UringConn *conn)
+{
+    ClientUploadInfo *up = &conn->entry->up;
+    long long left = up->filesize - up->received;
+    size_t want = left > URING_IO_BUF_SIZE ? URING_IO_BUF_SIZE : (size_t)left;
+
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    io_uring_prep_recv(sqe, conn->fd, conn->io_buf, want, 0);
+    sqe->user_data = make_user_data(conn->fd, OP_RECV_UP);
+}
+
+static void uring_submit_write_upload(UringConn *conn)
+{
+    ClientUploadInfo *up = &conn->entry->up;
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    io_uring_prep_write(sqe, up->fd, conn->io_buf + conn->io_done,
+                        conn->io_len - conn->io_done, up->base + up->received + conn->io_done);
+    sqe->user_data = make_user_data(conn->fd, OP_WRITE_UP);
+}
+
+/**
+ * @brief 提交下一段下载：读文件与发送socket以IOSQE_IO_LINK链接，一次提交、两次完成
+ * @param conn 连接
+ * @return 无返回值
+ * @details 读到的字节数少于请求数时内核会断开链接，后面的send以-ECANCELED完成，
+ *          由完成处理按实际读到的长度重新发送
+ */
+static void uring_submit_download(UringConn *conn)
+{
+    ClientDownloadInfo *dl = &conn->entry->dl;
+    // 定位当前偏移所在的数据块（跨块时切换dl->fd），单次读取不越过块边界
+    off_t chunk_off;
+    size_t chunk_left;
+    if (cas_download_seek(dl, &chunk_off, &chunk_left) == -1)
+    {
+        uring_download_failed(conn, "文件打开失败");
+        return;
+    }
+    long long left = dl->end - dl->offset;
+    size_t want = left > URING_IO_BUF_SIZE ? URING_IO_BUF_SIZE : (size_t)left;
+    if (want > chunk_left)
+        want = chunk_left;
+    conn->io_req = want;
+    conn->io_len = want;
+    conn->io_done = 0;
+    conn->read_failed = 0;
+
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    io_uring_prep_read(sqe, dl->fd, conn->io_buf, want, chunk_off);
+    sqe->user_data = make_user_data(conn->fd, OP_READ_DL);
+    sqe->flags |= IOSQE_IO_LINK;
+
+    sqe = uring_get_sqe();
+    io_uring_prep_send(sqe, conn->fd, conn->io_buf, want, MSG_NOSIGNAL);
+    sqe->user_data = make_user_data(conn->fd, OP_SEND_DL);
+}
+
+static void uring_submit_send_rest(UringConn *conn)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    io_uring_prep_send(sqe, conn->fd, conn->io_buf + conn->io_done,
+                       conn->io_len - conn->io_done, MSG_NOSIGNAL);
+    sqe->user_data = make_user_data(conn->fd, OP_SEND_DL);
+}
+
+/**
+ * @brief 把连接交给线程池处理（处理期间不再为该连接提交任何SQE）
+ * @param conn 连接
+ * @param type 任务类型
+ * @param payload TASK_URING_MESSAGE的JSON文本（其他类型传NULL）
+ * @return 无返回值
+ */
+static void uring_dispatch(UringConn *conn, TaskType type, char *payload)
+{
+    conn->state = (type == TASK_URING_CLOSE) ? UC_CLOSING : UC_WORKER;
+
+    Task task;
+    task.client_fd = conn->fd;
+    task.conn = conn->handle;
+    task.type = type;
+    task.client_addr = conn->entry->addr;
+    task.payload = payload;
+    task.enqueue_us = 0;
+
+    // 已有连接在等待或线程池已满：排到延后链表尾，由事件循环定时重试
+    if (!deferred_head && thread_pool_add_task(task) == 0)
+        return;
+    if (!deferred_head)
+        write_log(LOG_LEVEL_WARN, "io_uring：任务队列已满，暂停读取新请求");
+
+    conn->deferred_task = task;
+    conn->next_deferred = NULL;
+    if (deferred_tail)
+        deferred_tail->next_deferred = conn;
+    else
+        deferred_head = conn;
+    deferred_tail = conn;
+}
+
+/**
+ * @brief 按先后顺序重新派发延后的任务，遇到线程池仍满即停止
+ * @param 无参数
+ * @return 无返回值
+ */
+static void uring_retry_deferred()
+{
+    while (deferred_head)
+    {
+        if (thread_pool_add_task(deferred_head->deferred_task) == -1)
+            return;
+        deferred_head = deferred_head->next_deferred;
+    }
+    deferred_tail = NULL;
+    write_log(LOG_LEVEL_INFO, "io_uring：延后任务已全部派发，恢复读取");
+}
+
+/**
+ * @brief 断开连接：先交给线程池清理会话（记录退出日志等），清理完成后再关闭fd
+ * @param conn 连接
+ * @return 无返回值
+ */
+static void uring_close(UringConn *conn)
+{
+    uring_dispatch(conn, TASK_URING_CLOSE, NULL);
+}
+
+static void uring_release_io_buf(UringConn *conn)
+{
+    free(conn->io_buf);
+    conn->io_buf = NULL;
+}
+
+static int uring_ensure_io_buf(UringConn *conn)
+{
+    if (!conn->io_buf)
+    {
+        conn->io_buf = malloc(URING_IO_BUF_SIZE);
+    }
+    return conn->io_buf ? 0 : -1;
+}
+
+static void uring_free_conn(UringConn *conn)
+{
+    conn_close(conn->fd);
+    free(conn->ctl_buf);
+    free(conn->io_buf);
+    free(conn);
+}
+
+/**
+ * @brief 提交控制帧接收（缓冲区满时按需扩容）
+ * @param conn 连接
+ * @return 无返回值
+ */
+static void uring_submit_recv_ctl(UringConn *conn)
+{
+    if (conn->ctl_len == conn->ctl_cap)
+    {
+        size_t new_cap = conn->ctl_cap * 2;
+        if (new_cap > MAX_FRAME_SIZE + 4)
+            new_cap = MAX_FRAME_SIZE + 4;
+        char *new_buf = new_cap > conn->ctl_cap ? realloc(conn->ctl_buf, new_cap) : NULL;
+        if (!new_buf)
+        {
+            write_log(LOG_LEVEL_ERROR, "客户端 %d 控制帧缓冲区扩容失败", conn->fd);
+            uring_close(conn);
+            return;
+        }
+        conn->ctl_buf = new_buf;
+        conn->ctl_cap = new_cap;
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    io_uring_prep_recv(sqe, conn->fd, conn->ctl_buf + conn->ctl_len, conn->ctl_cap - conn->ctl_len, 0);
+    sqe->user_data = make_user_data(conn->fd, OP_RECV_CTL);
+}
+
+/**
+ * @brief 从控制帧缓冲区取出一帧完整请求交给线程池；不足一帧则继续接收
+ * @param conn 连接
+ * @return 无返回值
+ */
+static void uring_process_ctl(UringConn *conn)
+{
+    if (conn->ctl_len >= 4)
+    {
+        uint32_t net_len;
+        memcpy(&net_len, conn->ctl_buf, 4);
+        uint32_t data_len = ntohl(net_len);
+        if (data_len > MAX_FRAME_SIZE)
+        {
+            write_log(LOG_LEVEL_WARN, "客户端 %d 控制帧过大（%u字节），断开连接", conn->fd, data_len);
+            uring_close(conn);
+            return;
+        }
+        if (conn->ctl_len >= 4 + (size_t)data_len)
+        {
+            char *payload = malloc(data_len + 1);
+            if (!payload)
+            {
+                write_log(LOG_LEVEL_ERROR, "内存不足，无法分配JSON缓冲区");
+                uring_close(conn);
+                return;
+            }
+            memcpy(payload, conn->ctl_buf + 4, data_len);
+            payload[data_len] = '\0';
+            conn->ctl_len -= 4 + data_len;
+            memmove(conn->ctl_buf, conn->ctl_buf + 4 + data_len, conn->ctl_len);
+            uring_dispatch(conn, TASK_URING_MESSAGE, payload);
+            return;
+        }
+    }
+
+    conn->state = UC_RECV_CTL;
+    uring_submit_recv_ctl(conn);
+}
+
+/**
+ * @brief 下载失败时通知客户端并回到控制帧接收
+ * @param conn 连接
+ * @param message 失败原因
+ * @return 无返回值
+ */
+static void uring_download_failed(UringConn *conn, const char *message)
+{
+    ClientDownloadInfo *dl = &conn->entry->dl;
+    write_log(LOG_LEVEL_ERROR, "客户端 %d 下载失败（%s）: %s", conn->fd, message, dl->filepath);
+    if (dl->fd >= 0)
+    {
+        close(dl->fd);
+        dl->fd = -1;
+    }
+    // 下载已放弃：释放清单，之后的ready_to_receive不会重新开始发送
+    free(dl->manifest);
+    dl->manifest = NULL;
+    dl->state = DL_STATE_IDLE;
+
+    cJSON *res = cJSON_CreateObject();
+    cJSON_AddStringToObject(res, "type", "download_result");
+    cJSON_AddBoolToObject(res, "success", 0);
+    cJSON_AddStringToObject(res, "message", message);
+    send_json_response(conn->fd, res);
+    cJSON_Delete(res);
+
+    uring_release_io_buf(conn);
+    uring_process_ctl(conn);
+}
+
+/**
+ * @brief 线程池处理完成后推进连接状态机（根据业务层设置的上传/下载状态选择下一步）
+ * @param conn 连接
+ * @param want_close 1=请求非法需要断开
+ * @return 无返回值
+ */
+static void uring_advance(UringConn *conn, int want_close)
+{
+    if (conn->state == UC_CLOSING)
+    {
+        uring_free_conn(conn);
+        return;
+    }
+    if (want_close)
+    {
+        uring_close(conn);
+        return;
+    }
+
+    ClientUploadInfo *up = &conn->entry->up;
+    ClientDownloadInfo *dl = &conn->entry->dl;
+
+    // 上传：交替提交recv和write（write带文件偏移，不依赖文件位置）
+    if (up->state == UP_STATE_RECEIVING)
+    {
+        if (up->received >= up->filesize)
+        {
+            uring_dispatch(conn, TASK_URING_FINISH, NULL);
+            return;
+        }
+        if (uring_ensure_io_buf(conn) == -1)
+        {
+            uring_close(conn);
+            return;
+        }
+        conn->state = UC_UPLOAD;
+        conn->next_progress = up->received + URING_PROGRESS_STEP;
+
+        // 请求帧之后已经收进控制缓冲区的字节属于文件数据，先写入文件
+        if (conn->ctl_len > 0)
+        {
+            long long left = up->filesize - up->received;
+            size_t n = conn->ctl_len;
+            if ((long long)n > left)
+                n = (size_t)left;
+            if (n > URING_IO_BUF_SIZE)
+                n = URING_IO_BUF_SIZE;
+            memcpy(conn->io_buf, conn->ctl_buf, n);
+            conn->ctl_len -= n;
+            memmove(conn->ctl_buf, conn->ctl_buf + n, conn->ctl_len);
+            conn->io_len = n;
+            conn->io_done = 0;
+            uring_submit_write_upload(conn);
+            return;
+        }
+        uring_submit_recv_upload(conn);
+        return;
+    }
+
+    // 下载：客户端已确认ready_to_receive，开始read ⇢ send链
+    if (dl->state == DL_STATE_SENDING)
+    {
+        if (dl->offset >= dl->end)
+        {
+            uring_dispatch(conn, TASK_URING_FINISH, NULL);
+            return;
+        }
+        if (uring_ensure_io_buf(conn) == -1)
+        {
+            uring_close(conn);
+            return;
+        }
+        conn->state = UC_DOWNLOAD;
+        uring_submit_download(conn);
+        return;
+    }
+
+    // 普通请求处理完毕：释放传输缓冲区，继续处理下一帧
+    uring_release_io_buf(conn);
+    uring_process_ctl(conn);
+}
+
+/**
+ * @brief 处理新连接的accept完成事件
+ * @param res accept结果（新连接fd或-errno）
+ * @return 无返回值
+ */
+static void uring_on_accept(int res)
+{
+    if (res < 0)
+    {
+        if (res != -EINTR && res != -EAGAIN)
+        {
+            write_log(LOG_LEVEL_ERROR, "io_uring accept失败: %s", strerror(-res));
+        }
+        return;
+    }
+
+    int client_fd = res;
+    ConnHandle handle;
+    Connection *entry = conn_open(client_fd, accept_addr, -1, &handle);
+    if (!entry)
+    {
+        write_log(LOG_LEVEL_WARN, "连接表已满，拒绝fd=%d", client_fd);
+        close(client_fd);
+        return;
+    }
+
+    UringConn *conn = calloc(1, sizeof(UringConn));
+    char *ctl_buf = malloc(URING_CTL_BUF_INIT);
+    if (!conn || !ctl_buf)
+    {
+        write_log(LOG_LEVEL_ERROR, "内存不足，无法为客户端 %d 分配连接", client_fd);
+        free(conn);
+        free(ctl_buf);
+        conn_close(client_fd);
+        return;
+    }
+    conn->fd = client_fd;
+    conn->entry = entry;
+    conn->handle = handle;
+    conn->ctl_buf = ctl_buf;
+    conn->ctl_cap = URING_CTL_BUF_INIT;
+    entry->backend_ctx = conn;
+
+    printf("新客户端连接：fd=%d, IP=%s（io_uring）\n", client_fd, inet_ntoa(accept_addr.sin_addr));
+    write_log(LOG_LEVEL_INFO, "新客户端连接：fd=%d, IP=%s（io_uring）", client_fd, inet_ntoa(accept_addr.sin_addr));
+
+    uring_process_ctl(conn);
+}
+
+/**
+ * @brief 取出所有工作线程完成通知并推进对应连接
+ * @param 无参数
+ * @return 无返回值
+ */
+static void uring_on_notify()
+{
+    pthread_mutex_lock(&done_mutex);
+    UringConn *list = done_head;
+    done_head = NULL;
+    pthread_mutex_unlock(&done_mutex);
+
+    while (list)
+    {
+        UringConn *conn = list;
+        list = conn->next_done;
+        uring_advance(conn, conn->want_close);
+    }
+}
+
+/**
+ * @brief 处理单个连接的数据收发完成事件
+ * @param conn 连接
+ * @param op 操作类型
+ * @param res 操作结果（字节数或-errno）
+ * @return 无返回值
+ */
+static void uring_on_conn_cqe(UringConn *conn, UringOp op, int res)
+{
+    int fd = conn->fd;
+    ClientUploadInfo *up = &conn->entry->up;
+    ClientDownloadInfo *dl = &conn->entry->dl;
+
+    switch (op)
+    {
+    case OP_RECV_CTL:
+        if (res <= 0)
+        {
+            if (res == 0)
+                write_log(LOG_LEVEL_INFO, "客户端 %d 正常断开", fd);
+            else
+                write_log(LOG_LEVEL_WARN, "客户端 %d 异常掉线: %s", fd, strerror(-res));
+            uring_close(conn);
+            return;
+        }
+        conn->ctl_len += res;
+        uring_process_ctl(conn);
+        break;
+
+    case OP_RECV_UP:
+        if (res <= 0)
+        {
+            write_log(LOG_LEVEL_WARN, "客户端 %d 上传时断开连接", fd);
+            uring_close(conn);
+            return;
+        }
+        conn->io_len = res;
+        conn->io_done = 0;
+        uring_submit_write_upload(conn);
+        break;
+
+    case OP_WRITE_UP:
+        if (res <= 0)
+        {
+            write_log(LOG_LEVEL_ERROR, "客户端 %d 写入文件失败: %s", fd, res < 0 ? strerror(-res) : "写入0字节");
+            upload_abort(up);
+            cJSON *progress_res = cJSON_CreateObject();
+            cJSON_AddStringToObject(progress_res, "type", "upload_progress");
+            cJSON_AddBoolToObject(progress_res, "success", 0);
+            send_json_response(fd, progress_res);
+            cJSON_Delete(progress_res);
+            uring_release_io_buf(conn);
+            uring_process_ctl(conn);
+            return;
+        }
+        conn->io_done += res;
+        if (conn->io_done < conn->io_len)
+        {
+            uring_submit_write_upload(conn); // 短写：继续写剩余部分
+            return;
+        }
+        up->received += conn->io_len;
+        upload_journal_checkpoint(up->journal, up->received);
+        if (up->received >= up->filesize)
+        {
+            uring_dispatch(conn, TASK_URING_FINISH, NULL);
+            return;
+        }
+        if (up->received >= conn->next_progress)
+        {
+            upload_report_progress(fd);
+            conn->next_progress = up->received + URING_PROGRESS_STEP;
+        }
+        uring_submit_recv_upload(conn);
+        break;
+
+    case OP_READ_DL:
+        // 只记录结果，下一步在链上send的完成事件里统一决定
+        if (res <= 0)
+            conn->read_failed = 1;
+        else if ((size_t)res < conn->io_len)
+            conn->io_len = res;
+        break;
+
+    case OP_SEND_DL:
+        if (res == -ECANCELED)
+        {
+            // 读文件失败或读短了，链上的send被内核取消
+            if (conn->read_failed)
+            {
+                uring_download_failed(conn, "文件读取失败");
+                return;
+            }
+            conn->io_done = 0;
+            uring_submit_send_rest(conn);
+            return;
+        }
+        if (res < 0)
+        {
+            write_log(LOG_LEVEL_ERROR, "客户端 %d 文件发送失败: %s", fd, strerror(-res));
+            uring_close(conn);
+            return;
+        }
+        if (conn->io_len < conn->io_req && conn->io_done == 0 && (size_t)res == conn->io_req)
+        {
+            // 读短了但send没被取消（内核不支持短读断链），已发出的数据不可信
+            write_log(LOG_LEVEL_ERROR, "客户端 %d 下载数据不一致，断开连接", fd);
+            uring_close(conn);
+            return;
+        }
+        conn->io_done += res;
+        if (conn->io_done < conn->io_len)
+        {
+            uring_submit_send_rest(conn); // 短发：继续发剩余部分
+            return;
+        }
+        dl->offset += conn->io_len;
+        if (dl->offset >= dl->end)
+        {
+            uring_dispatch(conn, TASK_URING_FINISH, NULL);
+            return;
+        }
+        uring_submit_download(conn);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief 运行io_uring后端（在调用线程上运行完成事件循环，直到服务器退出）
+ * @param 无参数
+ * @return 0=事件循环正常结束，-1=后端不可用（调用方应回退epoll）
+ */
+int uring_backend_run()
+{
+    int ret = io_uring_queue_init(URING_ENTRIES, &ring, 0);
+    if (ret < 0)
+    {
+        write_log(LOG_LEVEL_ERROR, "io_uring初始化失败: %s", strerror(-ret));
+        return -1;
+    }
+
+    notify_fd = eventfd(0, EFD_CLOEXEC);
+    if (notify_fd == -1)
+    {
+        write_log(LOG_LEVEL_ERROR, "eventfd创建失败: %s", strerror(errno));
+        io_uring_queue_exit(&ring);
+        return -1;
+    }
+
+    // 监听socket保持阻塞：accept由内核异步等待，不需要EAGAIN重试
+    listen_fd = create_listen_socket(0, 0);
+    if (listen_fd == -1)
+    {
+        close(notify_fd);
+        io_uring_queue_exit(&ring);
+        return -1;
+    }
+    printf("服务器启动，监听 %s:%d（io_uring后端）...\n", server_ip, PORT);
+    write_log(LOG_LEVEL_INFO, "服务器启动，监听 %s:%d（io_uring后端）", server_ip, PORT);
+
+    uring_submit_accept();
+    uring_submit_notify_read();
+    uring_submit_shutdown_poll();
+    signal_unblock_shutdown(); // 终止信号只递送给运行事件循环的主线程
+
+    while (server_running)
+    {
+        if (deferred_head)
+            uring_retry_deferred();
+
+        if (deferred_head)
+        {
+            // 仍有任务未派发：提交后最多等待DEFER_RETRY_MS再重试
+            struct __kernel_timespec ts = {0, DEFER_RETRY_MS * 1000000LL};
+            struct io_uring_cqe *first;
+            io_uring_submit(&ring);
+            ret = io_uring_wait_cqe_timeout(&ring, &first, &ts);
+            if (ret < 0 && ret != -EINTR && ret != -ETIME)
+            {
+                write_log(LOG_LEVEL_ERROR, "io_uring_wait_cqe_timeout失败: %s", strerror(-ret));
+                break;
+            }
+        }
+        else
+        {
+            ret = io_uring_submit_and_wait(&ring, 1);
+            if (ret < 0 && ret != -EINTR)
+            {
+                write_log(LOG_LEVEL_ERROR, "io_uring_submit_and_wait失败: %s", strerror(-ret));
+                break;
+            }
+        }
+
+        struct io_uring_cqe *cqe;
+        unsigned head;
+        unsigned count = 0;
+        io_uring_for_each_cqe(&ring, head, cqe)
+        {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            int fd = (int)(data >> 8);
+            UringOp op = (UringOp)(data & 0xff);
+            count++;
+
+            if (op == OP_ACCEPT)
+            {
+                uring_on_accept(res);
+                uring_submit_accept();
+            }
+            else if (op == OP_NOTIFY)
+            {
+                uring_on_notify();
+                uring_submit_notify_read();
+            }
+            else if (op == OP_SHUTDOWN)
+            {
+                // 终止信号已置退出标志，本轮处理完后退出循环
+            }
+            else
+            {
+                Connection *entry = conn_get(fd);
+                if (entry && entry->backend_ctx)
+                    uring_on_conn_cqe(entry->backend_ctx, op, res);
+            }
+        }
+        io_uring_cq_advance(&ring, count);
+    }
+
+    close(listen_fd);
+    close(notify_fd);
+    io_uring_queue_exit(&ring);
+    return 0;
+}
+
+/**
+ * @brief 工作线程执行io_uring后端投递的任务（请求处理、传输收尾、断开清理），完成后通知事件循环
+ * @param task 线程池任务（类型为TASK_URING_MESSAGE/TASK_URING_FINISH/TASK_URING_CLOSE）
+ * @return 无返回值
+ */
+void uring_backend_run_task(Task *task)
+{
+    int fd = task->client_fd;
+    Connection *entry = conn_get(fd);
+    UringConn *conn = entry->backend_ctx;
+    int want_close = 0;
+
+    switch (task->type)
+    {
+    case TASK_URING_MESSAGE:
+        want_close = dispatch_request(fd, task->payload, task->client_addr) == -1;
+        free(task->payload);
+        break;
+    case TASK_URING_FINISH:
+        if (entry->up.state == UP_STATE_RECEIVING)
+            upload_finish(fd);
+        else if (entry->dl.state == DL_STATE_SENDING)
+            download_finish(fd);
+        break;
+    case TASK_URING_CLOSE:
+        cleanup_client_session(fd, task->client_addr);
+        break;
+    default:
+        return;
+    }
+
+    // 先发出本任务的响应，再通知事件循环：该连接可以继续推进（之后才会提交文件数据的send）
+    conn_batch_end();
+    conn->want_close = want_close;
+    pthread_mutex_lock(&done_mutex);
+    conn->next_done = done_head;
+    done_head = conn;
+    pthread_mutex_unlock(&done_mutex);
+
+    uint64_t one = 1;
+    if (write(notify_fd, &one, sizeof(one)) == -1)
+    {
+        write_log(LOG_LEVEL_ERROR, "io_uring完成通知写入失败: %s", strerror(errno));
+    }
+}
+
+#else // !USE_IO_URING
+
+/**
+ * @brief 未编译io_uring支持：直接返回不可用，由调用方回退epoll
+ * @param 无参数
+ * @return -1
+ */
+int uring_backend_run()
+{
+    write_log(LOG_LEVEL_WARN, "未以USE_IO_URING=1编译，io_uring后端不可用");
+    return -1;
+}
+
+/**
+ * @brief 未编译io_uring支持：不会收到io_uring任务
+ * @param task 线程池任务
+ * @return 无返回值
+ */
+void uring_backend_run_task(Task *task)
+{
+    (void)task;
+}
+
+#endif // USE_IO_URING
@@ -0,0 +1,22 @@
+#ifndef URING_BACKEND_H
+#define URING_BACKEND_H
+
+#include "cloud_disk.h"
+
+/**
+ * @brief 运行io_uring后端（在调用线程上运行完成事件循环，直到服务器退出）
+ * @param 无参数
+ * @return 0=事件循环正常结束，-1=后端不可用（未以USE_IO_URING=1编译或初始化失败，调用方应回退epoll）
+ * @details 连接的收发与上传/下载的文件读写全部以SQE提交，下载的read+send以IOSQE_IO_LINK链接；
+ *          每个连接同一时刻只有一条在途链，JSON请求收齐后交给线程池处理，处理完再由完成事件推进状态机
+ */
+int uring_backend_run();
+
+/**
+ * @brief 工作线程执行io_uring后端投递的任务（请求处理、传输收尾、断开清理），完成后通知事件循环
+ * @param task 线程池任务（类型为TASK_URING_MESSAGE/TASK_URING_FINISH/TASK_URING_CLOSE）
+ * @return 无返回值
+ */
+void uring_backend_run_task(Task *task);
+
+#endif // URING_BACKEND_H
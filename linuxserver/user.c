@@ -1,5 +1,234 @@
 #include "user.h"
 
+// ========================== 用户缓存 ==========================
+// 用户名哈希（str_hash）：低位选分片，高位选哈希桶
+/**
+ * @brief 根据哈希值定位分片
+ * @param hash 用户名哈希
+ * @return 分片指针
+ */
+static UserCacheShard *user_cache_shard(uint32_t hash)
+{
+    return &user_cache.shards[hash & (USER_CACHE_SHARDS - 1)];
+}
+
+/**
+ * @brief 根据哈希值定位分片内的哈希桶
+ * @param shard 分片
+ * @param hash 用户名哈希
+ * @return 哈希桶头指针的地址
+ */
+static UserCacheEntry **user_cache_bucket(UserCacheShard *shard, uint32_t hash)
+{
+    return &shard->buckets[(hash / USER_CACHE_SHARDS) & (USER_CACHE_BUCKETS - 1)];
+}
+
+/**
+ * @brief 在分片内查找缓存项（调用方持有分片的读锁或写锁）
+ * @param shard 分片
+ * @param hash 用户名哈希
+ * @param username 用户名
+ * @return 缓存项，NULL=未缓存
+ */
+static UserCacheEntry *user_cache_find(UserCacheShard *shard, uint32_t hash, const char *username)
+{
+    for (UserCacheEntry *e = *user_cache_bucket(shard, hash); e; e = e->hash_next)
+    {
+        if (e->hash == hash && strcmp(e->username, username) == 0)
+        {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 把缓存项从分片的哈希桶和淘汰链表中摘除并释放（调用方持有写锁）
+ * @param shard 分片
+ * @param e 缓存项
+ * @return 无返回值
+ */
+static void user_cache_remove(UserCacheShard *shard, UserCacheEntry *e)
+{
+    UserCacheEntry **pp = user_cache_bucket(shard, e->hash);
+    while (*pp != e)
+    {
+        pp = &(*pp)->hash_next;
+    }
+    *pp = e->hash_next;
+
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        shard->lru_head = e->lru_next;
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        shard->lru_tail = e->lru_prev;
+
+    shard->count--;
+    free(e->root_dir);
+    free(e);
+}
+
+/**
+ * @brief 把缓存项挂到淘汰链表头部（调用方持有写锁，缓存项当前不在链表中）
+ * @param shard 分片
+ * @param e 缓存项
+ * @return 无返回值
+ */
+static void user_cache_push_front(UserCacheShard *shard, UserCacheEntry *e)
+{
+    e->lru_prev = NULL;
+    e->lru_next = shard->lru_head;
+    if (shard->lru_head)
+        shard->lru_head->lru_prev = e;
+    shard->lru_head = e;
+    if (!shard->lru_tail)
+        shard->lru_tail = e;
+}
+
+/**
+ * @brief 淘汰分片中一项（CLOCK近似LRU：从最旧的一端扫描，最近命中过的放回头部再给一次机会）
+ * @param shard 分片（调用方持有写锁，分片非空）
+ * @return 无返回值
+ */
+static void user_cache_evict(UserCacheShard *shard)
+{
+    UserCacheEntry *e = shard->lru_tail;
+    while (e->lru_prev && __atomic_exchange_n(&e->referenced, 0, __ATOMIC_RELAXED))
+    {
+        // 最近命中过：清掉标记后移到头部
+        shard->lru_tail = e->lru_prev;
+        shard->lru_tail->lru_next = NULL;
+        user_cache_push_front(shard, e);
+        e = shard->lru_tail;
+    }
+    user_cache_remove(shard, e);
+    shard->evictions++;
+}
+
+/**
+ * @brief 初始化用户缓存（分配各分片的哈希桶，初始化读写锁）
+ * @param 无参数
+ * @return 无返回值（内存不足时直接退出程序）
+ */
+void user_cache_init()
+{
+    memset(&user_cache, 0, sizeof(user_cache));
+    for (int i = 0; i < USER_CACHE_SHARDS; i++)
+    {
+        UserCacheShard *shard = &user_cache.shards[i];
+        pthread_rwlock_init(&shard->lock, NULL);
+        shard->buckets = calloc(USER_CACHE_BUCKETS, sizeof(UserCacheEntry *));
+        if (!shard->buckets)
+        {
+            write_log(LOG_LEVEL_ERROR, "用户缓存分配失败");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * @brief 从缓存获取用户根目录（只加分片读锁，命中的项打上最近使用标记）
+ * @param username 用户名
+ * @param root_dir 输出参数：用户根目录路径（MAX_PATH_LEN）
+ * @return 1=命中，0=未缓存
+ */
+int user_cache_get(const char *username, char *root_dir)
+{
+    uint32_t hash = str_hash(username);
+    UserCacheShard *shard = user_cache_shard(hash);
+
+    pthread_rwlock_rdlock(&shard->lock);
+    UserCacheEntry *e = user_cache_find(shard, hash, username);
+    if (e)
+    {
+        snprintf(root_dir, MAX_PATH_LEN, "%s", e->root_dir);
+        if (!__atomic_load_n(&e->referenced, __ATOMIC_RELAXED))
+            __atomic_store_n(&e->referenced, 1, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    __atomic_fetch_add(e ? &shard->hits : &shard->misses, 1, __ATOMIC_RELAXED);
+    return e != NULL;
+}
+
+/**
+ * @brief 写入或覆盖用户根目录缓存（分片满时先淘汰一项）
+ * @param username 用户名
+ * @param root_dir 用户根目录路径
+ * @return 无返回值（内存不足时不缓存）
+ */
+void user_cache_put(const char *username, const char *root_dir)
+{
+    uint32_t hash = str_hash(username);
+    UserCacheShard *shard = user_cache_shard(hash);
+    char *dir = strdup(root_dir);
+    if (!dir)
+    {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&shard->lock);
+    UserCacheEntry *e = user_cache_find(shard, hash, username);
+    if (e)
+    {
+        // 已缓存：覆盖路径
+        free(e->root_dir);
+        e->root_dir = dir;
+        pthread_rwlock_unlock(&shard->lock);
+        return;
+    }
+
+    e = calloc(1, sizeof(UserCacheEntry));
+    if (!e)
+    {
+        pthread_rwlock_unlock(&shard->lock);
+        free(dir);
+        return;
+    }
+    if (shard->count >= USER_CACHE_BUCKETS)
+    {
+        user_cache_evict(shard);
+    }
+    e->hash = hash;
+    strncpy(e->username, username, sizeof(e->username) - 1);
+    e->root_dir = dir;
+    UserCacheEntry **bucket = user_cache_bucket(shard, hash);
+    e->hash_next = *bucket;
+    *bucket = e;
+    user_cache_push_front(shard, e);
+    shard->count++;
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+/**
+ * @brief 把用户缓存的项数、命中次数、命中率和淘汰次数写入日志
+ * @param 无参数
+ * @return 无返回值
+ */
+void user_cache_log_stats()
+{
+    unsigned long long hits = 0, misses = 0, evictions = 0;
+    long long count = 0;
+    for (int i = 0; i < USER_CACHE_SHARDS; i++)
+    {
+        UserCacheShard *shard = &user_cache.shards[i];
+        hits += __atomic_load_n(&shard->hits, __ATOMIC_RELAXED);
+        misses += __atomic_load_n(&shard->misses, __ATOMIC_RELAXED);
+        pthread_rwlock_rdlock(&shard->lock);
+        evictions += shard->evictions;
+        count += shard->count;
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    unsigned long long total = hits + misses;
+    write_log(LOG_LEVEL_INFO, "用户缓存统计：%lld 项，命中 %llu 次，未命中 %llu 次，命中率 %.1f%%，淘汰 %llu 次",
+              count, hits, misses, total ? hits * 100.0 / total : 0.0, evictions);
+}
+
+// ========================== 用户根目录 ==========================
 /**
  * @brief 获取用户根目录（优先从缓存获取，缓存未命中则查数据库）
  * @param username 用户名
@@ -8,42 +237,25 @@
  */
 int get_user_root_dir(const char *username, char *root_dir)
 {
-    // 1. 先查内存缓存
-    for (int i = 0; i < user_cache_count; i++)
+    // 1. 先查内存缓存（缓存中的路径已规范为以/结尾）
+    if (user_cache_get(username, root_dir))
     {
-        if (strcmp(user_cache[i].username, username) == 0)
-        {
-            strcpy(root_dir, user_cache[i].root_dir);
-            size_t len = strlen(root_dir);
-            // 仅在结尾没有/时才添加，且确保有空间
-            if (len > 0 && len + 1 < MAX_PATH_LEN && root_dir[len - 1] != '/')
-            {
-                root_dir[len] = '/';
-                root_dir[len + 1] = '\0'; // 正确设置终止符
-            }
-            return 1;
-        }
+        return 1;
     }
 
-    // 2. 缓存未命中，查询数据库
-    char sql[256];
-    snprintf(sql, sizeof(sql), "SELECT root_dir FROM user WHERE username='%s'", username);
-    if (mysql_query(&mysql, sql) != 0)
+    // 2. 缓存未命中，查询数据库（预编译查询，用户名按参数绑定）
+    int found = meta_store->user_root_dir(username, root_dir, MAX_PATH_LEN);
+    if (found == -1)
     {
-        write_log(LOG_LEVEL_ERROR, "查询用户根目录失败: %s", mysql_error(&mysql));
+        write_log(LOG_LEVEL_ERROR, "查询用户根目录失败: %s", username);
         return 0;
     }
-
-    MYSQL_RES *res = mysql_store_result(&mysql);
-    if (mysql_num_rows(res) == 0)
+    if (found == 0)
     {
-        mysql_free_result(res);
         return 0;
     }
 
     // 提取用户根目录（修复核心）
-    MYSQL_ROW row = mysql_fetch_row(res);
-    strcpy(root_dir, row[0]);
     size_t len = strlen(root_dir);
     // 仅在结尾没有/时才添加，且确保有空间
     if (len > 0 && len + 1 < MAX_PATH_LEN && root_dir[len - 1] != '/')
@@ -51,15 +263,9 @@ int get_user_root_dir(const char *username, char *root_dir)
         root_dir[len] = '/';
         root_dir[len + 1] = '\0'; // 正确设置终止符
     }
-    mysql_free_result(res);
 
     // 3. 更新内存缓存
-    if (user_cache_count < MAX_USERS)
-    {
-        strcpy(user_cache[user_cache_count].username, username);
-        strcpy(user_cache[user_cache_count].root_dir, root_dir);
-        user_cache_count++;
-    }
+    user_cache_put(username, root_dir);
 
     return 1;
 }
@@ -83,33 +289,14 @@ int create_user_root_dir(const char *username)
     }
 
     // 更新数据库中的用户根目录字段
-    char sql[1024];
-    snprintf(sql, sizeof(sql),
-             "UPDATE user SET root_dir='%s' WHERE username='%s'",
-             root_dir, username);
-    if (mysql_query(&mysql, sql) != 0)
+    if (meta_store->user_set_root_dir(username, root_dir) != 0)
     {
-        write_log(LOG_LEVEL_ERROR, "更新用户根目录失败: %s", mysql_error(&mysql));
+        write_log(LOG_LEVEL_ERROR, "更新用户根目录失败: %s", username);
         return 0;
     }
 
     // 更新内存缓存（已存在则覆盖，不存在则添加）
-    for (int i = 0; i < user_cache_count; i++)
-    {
-        if (strcmp(user_cache[i].username, username) == 0)
-        {
-            strcpy(user_cache[i].root_dir, root_dir);
-            return 1;
-        }
-    }
-
-    // 缓存未满，添加新用户缓存
-    if (user_cache_count < MAX_USERS)
-    {
-        strcpy(user_cache[user_cache_count].username, username);
-        strcpy(user_cache[user_cache_count].root_dir, root_dir);
-        user_cache_count++;
-    }
+    user_cache_put(username, root_dir);
 
     return 1;
-}
\ No newline at end of file
+}
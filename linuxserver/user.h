@@ -18,4 +18,34 @@ int get_user_root_dir(const char *username, char *root_dir);
  */
 int create_user_root_dir(const char *username);
 
+/**
+ * @brief 初始化用户缓存（分配各分片的哈希桶，初始化读写锁）
+ * @param 无参数
+ * @return 无返回值（内存不足时直接退出程序）
+ */
+void user_cache_init();
+
+/**
+ * @brief 从缓存获取用户根目录（只加分片读锁，命中的项打上最近使用标记）
+ * @param username 用户名
+ * @param root_dir 输出参数：用户根目录路径（MAX_PATH_LEN）
+ * @return 1=命中，0=未缓存
+ */
+int user_cache_get(const char *username, char *root_dir);
+
+/**
+ * @brief 写入或覆盖用户根目录缓存（分片满时先淘汰一项）
+ * @param username 用户名
+ * @param root_dir 用户根目录路径
+ * @return 无返回值（内存不足时不缓存）
+ */
+void user_cache_put(const char *username, const char *root_dir);
+
+/**
+ * @brief 把用户缓存的项数、命中次数、命中率和淘汰次数写入日志
+ * @param 无参数
+ * @return 无返回值
+ */
+void user_cache_log_stats();
+
 #endif // USER_H
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "conn_table.h"
 
 /**
  * @brief 写入日志到服务器日志文件
@@ -74,6 +75,35 @@ int is_safe_path(const char *base_dir, const char *user_path)
     return strstr(real_user, real_base) == real_user;
 }
 
+/**
+ * @brief 检查上传目标是否在用户目录内（目标文件可以还不存在）
+ * @param base_dir 基准安全目录（用户根目录）
+ * @param user_path 用户传入的目标目录
+ * @param filename 用户传入的文件名
+ * @return 1=目标安全，0=不安全（文件名含/、为.或..，或目标目录不存在、不在基准目录内）
+ * @details 只解析已存在的目标目录，所以新建文件也能通过；文件名单独检查，不能借此跳出目录
+ */
+int is_safe_target(const char *base_dir, const char *user_path, const char *filename)
+{
+    if (!filename || filename[0] == '\0' || strchr(filename, '/') ||
+        strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0)
+    {
+        return 0;
+    }
+
+    char dir_path[MAX_PATH_LEN];
+    build_full_path(dir_path, base_dir, user_path, "");
+    char real_base[MAX_PATH_LEN], real_dir[MAX_PATH_LEN];
+    if (!realpath(base_dir, real_base) || !realpath(dir_path, real_dir))
+    {
+        return 0;
+    }
+
+    // 按路径分量比较前缀（/root/alice2不算在/root/alice之内）
+    size_t len = strlen(real_base);
+    return strncmp(real_dir, real_base, len) == 0 && (real_dir[len] == '\0' || real_dir[len] == '/');
+}
+
 /**
  * @brief 递归创建目录（模拟mkdir -p命令）
  * @param path 要创建的目录路径（支持多级目录）
@@ -177,6 +207,7 @@ void build_full_path(char *full_path, const char *root_dir, const char *user_pat
  * @param client_fd 客户端文件描述符
  * @param root cJSON对象（存储响应数据）
  * @return 无返回值
+ * @details 响应进入连接的发送队列，当前任务结束时与其他响应合并为一次sendmsg发出
  */
 void send_json_response(int client_fd, cJSON *root)
 {
@@ -185,17 +216,66 @@ void send_json_response(int client_fd, cJSON *root)
     if (!json_str)
         return;
 
-    // 计算JSON字符串长度，转换为网络字节序（大端）
-    uint32_t data_len = strlen(json_str);
-    uint32_t net_len = htonl(data_len);
-
-    // 先发送长度前缀，再发送JSON数据
-    send(client_fd, &net_len, 4, 0);
-    send(client_fd, json_str, data_len, 0);
+    // 加长度前缀后放入连接的发送队列（由队列负责短写、EAGAIN和合并发送）
+    conn_queue_frame(client_fd, json_str, strlen(json_str));
 
     free(json_str); // 释放JSON字符串内存
 }
 
+/**
+ * @brief 向某用户所有在线会话推送JSON消息（含长度前缀）
+ * @param username 目标用户名
+ * @param root cJSON对象（存储消息数据）
+ * @return 成功入队的会话数，0=用户不在线
+ * @details 只序列化一次，按在线会话索引逐个入队，不扫描连接表
+ */
+int send_json_to_user(const char *username, cJSON *root)
+{
+    char *json_str = cJSON_PrintUnformatted(root);
+    if (!json_str)
+        return 0;
+
+    int sent = conn_send_to_user(username, json_str, strlen(json_str));
+
+    free(json_str);
+    return sent;
+}
+
+/**
+ * @brief 向指定连接发送JSON消息（含长度前缀），连接已断开或fd已被新连接复用则丢弃
+ * @param handle 目标连接的句柄
+ * @param root cJSON对象（存储消息数据）
+ * @return 0=已入队，-1=连接已失效或入队失败
+ * @details 供后台线程在异步处理结束后回复发起请求的连接
+ */
+int send_json_to_conn(ConnHandle handle, cJSON *root)
+{
+    char *json_str = cJSON_PrintUnformatted(root);
+    if (!json_str)
+        return -1;
+
+    int ret = conn_queue_frame_to(CONN_HANDLE_FD(handle), handle, json_str, strlen(json_str));
+
+    free(json_str);
+    return ret;
+}
+
+/**
+ * @brief 计算字符串哈希（FNV-1a，用于用户名等短字符串的哈希表）
+ * @param str 字符串
+ * @return 32位哈希值
+ */
+uint32_t str_hash(const char *str)
+{
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++)
+    {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
 /**
  * @brief 将目录打包为tar文件（使用系统tar命令）
  * @param dir_path 要打包的目录路径
@@ -20,6 +20,16 @@ void write_log(LogLevel level, const char *format, ...);
  */
 int is_safe_path(const char *base_dir, const char *user_path);
 
+/**
+ * @brief 检查上传目标是否在用户目录内（目标文件可以还不存在）
+ * @param base_dir 基准安全目录（用户根目录）
+ * @param user_path 用户传入的目标目录
+ * @param filename 用户传入的文件名
+ * @return 1=目标安全，0=不安全（文件名含/、为.或..，或目标目录不存在、不在基准目录内）
+ * @details 只解析已存在的目标目录，所以新建文件也能通过；文件名单独检查，不能借此跳出目录
+ */
+int is_safe_target(const char *base_dir, const char *user_path, const char *filename);
+
 /**
  * @brief 递归创建目录（模拟mkdir -p命令）
  * @param path 要创建的目录路径（支持多级目录）
@@ -43,9 +53,35 @@ void build_full_path(char *full_path, const char *base_dir, const char *user_pat
  * @param client_fd 客户端文件描述符
  * @param root cJSON对象（存储响应数据）
  * @return 无返回值
+ * @details 响应进入连接的发送队列，当前任务结束时与其他响应合并为一次sendmsg发出
  */
 void send_json_response(int client_fd, cJSON *root);
 
+/**
+ * @brief 向某用户所有在线会话推送JSON消息（含长度前缀）
+ * @param username 目标用户名
+ * @param root cJSON对象（存储消息数据）
+ * @return 成功入队的会话数，0=用户不在线
+ * @details 只序列化一次，按在线会话索引逐个入队，不扫描连接表
+ */
+int send_json_to_user(const char *username, cJSON *root);
+
+/**
+ * @brief 向指定连接发送JSON消息（含长度前缀），连接已断开或fd已被新连接复用则丢弃
+ * @param handle 目标连接的句柄
+ * @param root cJSON对象（存储消息数据）
+ * @return 0=已入队，-1=连接已失效或入队失败
+ * @details 供后台线程在异步处理结束后回复发起请求的连接
+ */
+int send_json_to_conn(ConnHandle handle, cJSON *root);
+
+/**
+ * @brief 计算字符串哈希（FNV-1a，用于用户名等短字符串的哈希表）
+ * @param str 字符串
+ * @return 32位哈希值
+ */
+uint32_t str_hash(const char *str);
+
 /**
  * @brief 将目录打包为tar文件（使用系统tar命令）
  * @param dir_path 要打包的目录路径
@@ -8,11 +8,13 @@ TEMPLATE = app
 SOURCES += \
     historydialog.cpp \
     main.cpp \
+    multipartuploader.cpp \
     widget.cpp \
     loginwidget.cpp \
 
 HEADERS += \
     historydialog.h \
+    multipartuploader.h \
     widget.h \
     loginwidget.h \
 
@@ -94,6 +94,12 @@ void HistoryDialog::showStatus(const QString& msg)
 }
 
 
+void HistoryDialog::setHasMore(bool hasMore)
+{
+    if (m_isDeleted) return;
+    ui->loadMoreButton->setEnabled(hasMore);
+}
+
 void HistoryDialog::on_refreshButton_clicked()
 {
     if (m_isDeleted) return;  // 增加删除检查
@@ -104,6 +110,17 @@ void HistoryDialog::on_refreshButton_clicked()
     emit refreshHistoryRequested();
 }
 
+void HistoryDialog::onLoadMoreButtonClicked()
+{
+    if (m_isDeleted) return;
+
+    ui->loadMoreButton->setEnabled(false);  // 等响应回来再按has_more恢复，防止重复请求同一页
+    if (ui->statusBar) {
+        ui->statusBar->showMessage("正在加载更早的记录...");
+    }
+    emit loadMoreRequested();
+}
+
 void HistoryDialog::on_closeButton_clicked()
 {
     close();
@@ -29,16 +29,22 @@ public:
     void setHistoryRecords(const QList<HistoryRecord>& records);
     // 显示状态信息
     void showStatus(const QString& msg);
+    // 设置是否还有更早的记录（控制“加载更多”按钮）
+    void setHasMore(bool hasMore);
 
 signals:
     // 刷新历史记录请求
     void refreshHistoryRequested();
+    // 加载下一页（更早的）历史记录请求
+    void loadMoreRequested();
 
 private slots:
     // 刷新按钮点击事件
     void on_refreshButton_clicked();
     // 关闭按钮点击事件
     void on_closeButton_clicked();
+    // 加载更多按钮点击事件（不用on_前缀，避免与ui中的连接重复触发）
+    void onLoadMoreButtonClicked();
     // 取消所有未处理事件
     void cancelPendingEvents();
 
@@ -3,6 +3,9 @@
 #include "widget.h"
 #include <QMessageBox>
 #include <QJsonDocument>
+#include <QTimer>
+#include <QSettings>
+#include <QDateTime>
 
 
 //初始化界面
@@ -47,13 +50,55 @@ void LoginWidget::showStatus(const QString &msg)
     ui->statusLabel->setText(msg);
 }
 
-//登录按钮被按下，发送登录请求
+//会话令牌：登录/恢复成功时保存，下次连接同一服务器时优先凭令牌恢复，不再走密码验证
+void LoginWidget::saveSessionToken(const QString &username, const QString &host, quint16 port,
+                                   const QString &token, qint64 expires)
+{
+    QSettings settings("CloudClient", "CloudClient");
+    settings.setValue("session/username", username);
+    settings.setValue("session/host", host);
+    settings.setValue("session/port", port);
+    settings.setValue("session/token", token);
+    settings.setValue("session/expires", expires);
+}
+
+void LoginWidget::clearSessionToken()
+{
+    QSettings settings("CloudClient", "CloudClient");
+    settings.remove("session");
+}
+
+QString LoginWidget::storedSessionToken() const
+{
+    QSettings settings("CloudClient", "CloudClient");
+    if (settings.value("session/username").toString() != ui->usernameEdit->text().trimmed() ||
+            settings.value("session/host").toString() != ui->ipEdit->text().trimmed() ||
+            settings.value("session/port").toUInt() != ui->portEdit->text().toUInt() ||
+            settings.value("session/expires").toLongLong() <= QDateTime::currentSecsSinceEpoch()) {
+        return QString();
+    }
+    return settings.value("session/token").toString();
+}
+
+//发送密码登录请求
+void LoginWidget::sendLoginRequest()
+{
+    QJsonObject json;
+    json["type"] = "login";  // 明确指定类型为登录
+    json["username"] = ui->usernameEdit->text().trimmed();
+    json["password"] = ui->passwordEdit->text().trimmed();
+    sendJsonMessage(json);
+    showStatus("发送登录请求...");  // 修正提示文本
+}
+
+//登录按钮被按下：有该用户的未过期令牌时发送会话恢复请求，否则发送登录请求
 void LoginWidget::on_loginButton_clicked()
 {
     QString username = ui->usernameEdit->text().trimmed();
     QString password = ui->passwordEdit->text().trimmed();
+    QString token = storedSessionToken();
 
-    if (username.isEmpty() || password.isEmpty()) {
+    if (username.isEmpty() || (password.isEmpty() && token.isEmpty())) {
         QMessageBox::warning(this, "输入错误", "用户名和密码不能为空");
         return;
     }
@@ -65,17 +110,51 @@ void LoginWidget::on_loginButton_clicked()
         showStatus("正在连接服务器...");
         // 记录当前操作类型（登录），用于连接成功后发送请求
         currentOperation = "login";
-    } else {
-        // 直接发送登录请求
+    } else if (!token.isEmpty()) {
+        // 凭令牌恢复会话（服务器只校验令牌，不查数据库）
         QJsonObject json;
-        json["type"] = "login";  // 明确指定类型为登录
-        json["username"] = username;
-        json["password"] = password;
+        json["type"] = "resume_session";
+        json["token"] = token;
         sendJsonMessage(json);
-        showStatus("发送登录请求...");  // 修正提示文本
+        showStatus("正在恢复会话...");
+    } else {
+        sendLoginRequest();
     }
 }
 
+//登录或会话恢复成功：保存新令牌，把socket交给主界面
+void LoginWidget::enterClientWidget(const QJsonObject &json)
+{
+    QString username = ui->usernameEdit->text().trimmed();
+    QString token = json["token"].toString();
+    if (!token.isEmpty()) {
+        saveSessionToken(username, ui->ipEdit->text().trimmed(), ui->portEdit->text().toUInt(),
+                         token, static_cast<qint64>(json["token_expires"].toDouble()));
+    }
+
+    showStatus("登录成功，进入云盘...");
+    Widget *clientWidget = new Widget(socket, username);
+    clientWidget->setSessionToken(token);
+    clientWidget->show();
+
+
+    socket->setParent(clientWidget);
+    // 精准断开 LoginWidget 自己的槽函数，保留 socket 的信号能力
+    // 1. 断开 LoginWidget 的 readyRead 槽
+    disconnect(socket, &QTcpSocket::readyRead, this, &LoginWidget::on_readyRead);
+    // 2. 断开 LoginWidget 的 error 槽（解决弹窗两次的问题）
+    disconnect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
+               this, SLOT(on_errorOccurred(QAbstractSocket::SocketError)));
+    // 3. 断开 LoginWidget 的 connected 槽（主界面断线重连时不再触发登录）
+    disconnect(socket, &QTcpSocket::connected, this, &LoginWidget::on_connected);
+    clientWidget->setRecvBuffer(this->recvBuffer);
+    this->recvBuffer.clear();
+
+    QMetaObject::invokeMethod(clientWidget,"on_readyRead",Qt::QueuedConnection);
+
+    this->close();
+}
+
 
 // 注册按钮点击事件（直接发送注册请求）
 void LoginWidget::on_registerButton_clicked()
@@ -170,33 +249,26 @@ void LoginWidget::on_readyRead()
             bool success = json["success"].toBool();
             if (success) {
                 qDebug() << "客户端确认登录成功，准备跳转界面";
-                showStatus("登录成功，进入云盘...");
-                Widget *clientWidget = new Widget(socket, ui->usernameEdit->text().trimmed());
-                clientWidget->show();
-
-
-                socket->setParent(clientWidget);
-                // 精准断开 LoginWidget 自己的槽函数，保留 socket 的信号能力
-                // 1. 断开 LoginWidget 的 readyRead 槽
-                disconnect(socket, &QTcpSocket::readyRead, this, &LoginWidget::on_readyRead);
-                // 2. 断开 LoginWidget 的 error 槽（解决弹窗两次的问题）
-                disconnect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
-                           this, SLOT(on_errorOccurred(QAbstractSocket::SocketError)));
-                clientWidget->setRecvBuffer(this->recvBuffer);
-                this->recvBuffer.clear();
-
-                clientWidget->show();
-
-
-
-
-                QMetaObject::invokeMethod(clientWidget,"on_readyRead",Qt::QueuedConnection);
-
-                this->close();
+                enterClientWidget(json);
+                return;
             } else {
                 qDebug() << "登录失败，原因：" << json["message"].toString();
                 QMessageBox::warning(this, "登录失败", json["message"].toString());
             }
+        } else if (type == "resume_result") {
+            if (json["success"].toBool()) {
+                qDebug() << "会话恢复成功，准备跳转界面";
+                enterClientWidget(json);
+                return;
+            }
+            // 令牌失效：清除保存的令牌，有密码时改走密码登录
+            clearSessionToken();
+            if (!ui->passwordEdit->text().trimmed().isEmpty()) {
+                sendLoginRequest();
+            } else {
+                showStatus(json["message"].toString());
+                QMessageBox::warning(this, "登录失败", "会话已失效，请输入密码登录");
+            }
         }else if (type == "register_result") {
             bool success = json["success"].toBool();
             QString msg = json["message"].toString();
@@ -205,6 +277,18 @@ void LoginWidget::on_readyRead()
             } else {
                 QMessageBox::warning(this, "注册失败", msg);
             }
+        }else if (type == "busy") {
+            // 服务器繁忙：按建议时间后重新发送登录/注册请求（密码不随busy回传，从输入框重新读取）
+            QString requestType = json["request_type"].toString();
+            int retryAfter = json["retry_after"].toInt();
+            showStatus(QString("服务器繁忙，%1 毫秒后重试...").arg(retryAfter));
+            QTimer::singleShot(retryAfter, this, [this, requestType]() {
+                if (requestType == "login") {
+                    on_loginButton_clicked();
+                } else if (requestType == "register") {
+                    on_registerButton_clicked();
+                }
+            });
         }else {
             // 只忽略非登录/注册响应，不打印"未知类型"（避免干扰）
             qDebug() << "LoginWidget忽略非登录响应：" << type;
@@ -20,6 +20,11 @@ public:
     explicit LoginWidget(QWidget *parent = nullptr);
     ~LoginWidget();
 
+    // 会话令牌持久化（登录/恢复成功时保存，登出或令牌失效时清除）
+    static void saveSessionToken(const QString &username, const QString &host, quint16 port,
+                                 const QString &token, qint64 expires);
+    static void clearSessionToken();
+
 signals:
     void loginSuccess(QTcpSocket *socket, const QString &username);
 
@@ -37,6 +42,9 @@ private:
     QByteArray recvBuffer;  // 缓存接收的数据
     void sendJsonMessage(const QJsonObject &json);
     void showStatus(const QString &msg);
+    QString storedSessionToken() const;   // 当前用户名和服务器对应的未过期令牌（没有则为空）
+    void sendLoginRequest();
+    void enterClientWidget(const QJsonObject &json);
 };
 
 #endif // LOGINWIDGET_H
@@ -0,0 +1,262 @@
+#include "multipartuploader.h"
+#include <QJsonDocument>
+#include <QtEndian>
+#include <QDebug>
+
+// 每个连接写入socket但尚未发出的数据上限（超过后等bytesWritten再读文件，内存占用与文件大小无关）
+static const qint64 LANE_WRITE_WINDOW = 1024 * 1024;
+// 每次从文件读取的字节数
+static const qint64 LANE_READ_SIZE = 256 * 1024;
+// 同一段最多失败的次数（超过即放弃整个上传）
+static const int MAX_PART_RETRIES = 3;
+
+MultipartUploader::MultipartUploader(const QString &host, quint16 port, const QString &token,
+                                     const QString &filePath, const QString &uploadId,
+                                     qint64 fileSize, qint64 partSize, int partCount,
+                                     int connections, QObject *parent) :
+    QObject(parent),
+    m_host(host),
+    m_port(port),
+    m_token(token),
+    m_filePath(filePath),
+    m_uploadId(uploadId),
+    m_fileSize(fileSize),
+    m_partSize(partSize),
+    m_partCount(partCount),
+    m_connections(qBound(1, connections, partCount)),
+    m_retries(partCount, 0)
+{
+    for (int i = 0; i < partCount; ++i) {
+        m_pending.append(i);
+    }
+}
+
+MultipartUploader::~MultipartUploader()
+{
+    m_stopped = true;
+    for (Lane *lane : m_lanes) {
+        lane->socket->disconnect(this);
+        lane->socket->abort();
+        delete lane->socket;
+        delete lane->file;
+        delete lane;
+    }
+}
+
+void MultipartUploader::start()
+{
+    for (int i = 0; i < m_connections; ++i) {
+        Lane *lane = new Lane;
+        lane->socket = new QTcpSocket;
+        lane->file = new QFile(m_filePath);
+        m_lanes.append(lane);
+        if (!lane->file->open(QIODevice::ReadOnly)) {
+            fail("无法打开文件：" + lane->file->errorString());
+            return;
+        }
+
+        // 连接建立后先凭令牌恢复会话，服务器确认后再领取段
+        connect(lane->socket, &QTcpSocket::connected, this, [this, lane]() {
+            QJsonObject json;
+            json["type"] = "resume_session";
+            json["token"] = m_token;
+            sendJson(lane, json);
+        });
+        connect(lane->socket, &QTcpSocket::readyRead, this, [this, lane]() { onReadyRead(lane); });
+        connect(lane->socket, &QTcpSocket::bytesWritten, this, [this, lane]() { pumpPart(lane); });
+        // 连接失败和中途断开都会回到UnconnectedState
+        connect(lane->socket, &QAbstractSocket::stateChanged, this,
+                [this, lane](QAbstractSocket::SocketState state) {
+            if (state == QAbstractSocket::UnconnectedState) {
+                laneLost(lane, lane->socket->errorString());
+            }
+        });
+        lane->socket->connectToHost(m_host, m_port);
+    }
+}
+
+void MultipartUploader::sendJson(Lane *lane, const QJsonObject &json)
+{
+    QByteArray jsonData = QJsonDocument(json).toJson(QJsonDocument::Compact);
+    quint32 netLen = qToBigEndian(static_cast<quint32>(jsonData.size()));
+    QByteArray sendData;
+    sendData.append(reinterpret_cast<const char *>(&netLen), 4);
+    sendData.append(jsonData);
+    lane->socket->write(sendData);
+}
+
+// 解析服务器发来的控制消息（4字节长度前缀 + JSON），上传连接上不会收到文件数据
+void MultipartUploader::onReadyRead(Lane *lane)
+{
+    lane->recvBuffer.append(lane->socket->readAll());
+    while (!m_stopped && lane->recvBuffer.size() >= 4) {
+        quint32 netLen;
+        memcpy(&netLen, lane->recvBuffer.constData(), 4);
+        quint32 dataLen = qFromBigEndian(netLen);
+        if (static_cast<quint32>(lane->recvBuffer.size()) < 4 + dataLen) {
+            break;
+        }
+        QJsonDocument doc = QJsonDocument::fromJson(lane->recvBuffer.mid(4, dataLen));
+        lane->recvBuffer.remove(0, 4 + dataLen);
+        if (doc.isObject()) {
+            handleMessage(lane, doc.object());
+        }
+    }
+}
+
+void MultipartUploader::handleMessage(Lane *lane, const QJsonObject &json)
+{
+    QString type = json["type"].toString();
+    if (type == "resume_result") {
+        if (!json["success"].toBool()) {
+            fail("上传连接恢复会话失败：" + json["message"].toString());
+            return;
+        }
+        startNextPart(lane);
+    } else if (type == "ready_to_receive" && lane->part == json["part"].toInt(-1)) {
+        lane->partOffset = json["offset"].toVariant().toLongLong();
+        lane->partLength = json["length"].toVariant().toLongLong();
+        if (lane->partOffset != lane->part * m_partSize || lane->partLength <= 0 ||
+                lane->partOffset + lane->partLength > m_fileSize) {
+            fail("服务器返回的分段位置与本地文件不符");
+            return;
+        }
+        lane->partSent = 0;
+        lane->streaming = true;
+        pumpPart(lane);
+    } else if (type == "upload_part_result" && lane->part == json["part"].toInt(-1)) {
+        if (json["success"].toBool()) {
+            ++m_doneCount;
+            m_doneBytes += lane->partLength;
+            lane->part = -1;
+            lane->streaming = false;
+            reportProgress();
+            if (m_doneCount == m_partCount) {
+                m_stopped = true;
+                emit finished();
+                return;
+            }
+        } else {
+            qDebug() << "[分段上传] 第" << lane->part << "段失败：" << json["message"].toString();
+            int part = lane->part;
+            releasePart(lane);
+            if (++m_retries[part] > MAX_PART_RETRIES) {
+                fail(QString("第 %1 段多次上传失败：%2").arg(part).arg(json["message"].toString()));
+                return;
+            }
+        }
+        startNextPart(lane);
+    } else if (type == "upload_progress" && json.contains("success") && !json["success"].toBool() &&
+               lane->streaming) {
+        // 服务器写入该段失败并已放弃接收，后续发出的数据会被当作控制消息：断开该连接，段交给其他连接
+        qDebug() << "[分段上传] 服务器接收第" << lane->part << "段失败";
+        if (++m_retries[lane->part] > MAX_PART_RETRIES) {
+            fail(QString("第 %1 段多次上传失败").arg(lane->part));
+            return;
+        }
+        lane->socket->abort();
+    }
+    // 其他消息（上传进度、推送的分享请求等）在上传连接上忽略
+}
+
+// 领取下一段：没有待上传的段时该连接空闲，等其他连接上传完
+void MultipartUploader::startNextPart(Lane *lane)
+{
+    if (m_stopped || m_pending.isEmpty()) {
+        return;
+    }
+    lane->part = m_pending.takeFirst();
+    lane->streaming = false;
+    QJsonObject json;
+    json["type"] = "upload_part";
+    json["upload_id"] = m_uploadId;
+    json["part"] = lane->part;
+    sendJson(lane, json);
+}
+
+// 发送当前段的数据：socket待发数据低于窗口时从文件读取下一块（由bytesWritten驱动）
+void MultipartUploader::pumpPart(Lane *lane)
+{
+    if (m_stopped || !lane->streaming) {
+        return;
+    }
+    while (lane->partSent < lane->partLength && lane->socket->bytesToWrite() < LANE_WRITE_WINDOW) {
+        qint64 pos = lane->partOffset + lane->partSent;
+        if (lane->file->pos() != pos && !lane->file->seek(pos)) {
+            fail("读取文件失败：" + lane->file->errorString());
+            return;
+        }
+        QByteArray data = lane->file->read(qMin(LANE_READ_SIZE, lane->partLength - lane->partSent));
+        if (data.isEmpty()) {
+            fail("读取文件失败（文件可能已被修改）");
+            return;
+        }
+        if (lane->socket->write(data) != data.size()) {
+            lane->socket->abort();  // 按连接断开处理，该段由其他连接重传
+            return;
+        }
+        lane->partSent += data.size();
+    }
+    reportProgress();
+}
+
+void MultipartUploader::releasePart(Lane *lane)
+{
+    if (lane->part >= 0) {
+        m_pending.prepend(lane->part);
+    }
+    lane->part = -1;
+    lane->partSent = 0;
+    lane->streaming = false;
+}
+
+// 连接断开：正在上传的段交给其他连接，所有连接都断开时整个上传失败
+void MultipartUploader::laneLost(Lane *lane, const QString &reason)
+{
+    if (m_stopped || !lane->alive) {
+        return;
+    }
+    lane->alive = false;
+    releasePart(lane);
+    qDebug() << "[分段上传] 上传连接断开：" << reason;
+
+    Lane *idle = nullptr;
+    bool anyAlive = false;
+    for (Lane *other : m_lanes) {
+        if (other->alive) {
+            anyAlive = true;
+            if (other->part < 0 && other->socket->state() == QAbstractSocket::ConnectedState && !idle) {
+                idle = other;
+            }
+        }
+    }
+    if (!anyAlive) {
+        fail("所有上传连接都已断开：" + reason);
+        return;
+    }
+    // 其他连接已无段可领、处于空闲时，由它接手放回的段
+    if (idle) {
+        startNextPart(idle);
+    }
+    reportProgress();
+}
+
+void MultipartUploader::fail(const QString &message)
+{
+    if (m_stopped) {
+        return;
+    }
+    m_stopped = true;
+    emit failed(message);
+}
+
+void MultipartUploader::reportProgress()
+{
+    qint64 sent = m_doneBytes;
+    for (Lane *lane : m_lanes) {
+        if (lane->streaming) {
+            sent += lane->partSent;
+        }
+    }
+    emit progress(sent, m_fileSize);
+}
@@ -0,0 +1,75 @@
+#ifndef MULTIPARTUPLOADER_H
+#define MULTIPARTUPLOADER_H
+
+#include <QObject>
+#include <QTcpSocket>
+#include <QFile>
+#include <QByteArray>
+#include <QJsonObject>
+#include <QList>
+#include <QVector>
+
+// 分段上传：另开若干个连接（凭会话令牌恢复会话），各连接轮流领取一段，并发上传同一个文件的不同段
+// 主连接负责发起（upload_multipart_init）和完成（upload_multipart_complete），本类只负责上传各段
+class MultipartUploader : public QObject
+{
+    Q_OBJECT
+
+public:
+    MultipartUploader(const QString &host, quint16 port, const QString &token,
+                      const QString &filePath, const QString &uploadId,
+                      qint64 fileSize, qint64 partSize, int partCount,
+                      int connections, QObject *parent = nullptr);
+    ~MultipartUploader();
+
+    void start();
+    QString uploadId() const { return m_uploadId; }
+
+signals:
+    void progress(qint64 sent, qint64 total);  // 已发出的字节数（含正在上传的段已发出的部分）
+    void finished();                           // 所有段都已被服务器确认
+    void failed(const QString &message);       // 无法继续（所有连接都已断开、某段多次失败等）
+
+private:
+    // 一个上传连接
+    struct Lane {
+        QTcpSocket *socket = nullptr;
+        QFile *file = nullptr;        // 每个连接独立打开本地文件，各自定位读取
+        QByteArray recvBuffer;        // 未解析完的控制消息
+        int part = -1;                // 正在上传的段（-1=空闲）
+        qint64 partOffset = 0;        // 段在文件中的偏移
+        qint64 partLength = 0;        // 段长度
+        qint64 partSent = 0;          // 段已写入socket的字节数
+        bool streaming = false;       // 已收到ready_to_receive，正在发送段数据
+        bool alive = true;            // 连接未断开
+    };
+
+    void sendJson(Lane *lane, const QJsonObject &json);
+    void onReadyRead(Lane *lane);
+    void handleMessage(Lane *lane, const QJsonObject &json);
+    void startNextPart(Lane *lane);
+    void pumpPart(Lane *lane);
+    void releasePart(Lane *lane);     // 正在上传的段放回待上传队列
+    void laneLost(Lane *lane, const QString &reason);
+    void fail(const QString &message);
+    void reportProgress();
+
+    QString m_host;
+    quint16 m_port;
+    QString m_token;
+    QString m_filePath;
+    QString m_uploadId;
+    qint64 m_fileSize;
+    qint64 m_partSize;
+    int m_partCount;
+    int m_connections;
+
+    QVector<Lane *> m_lanes;
+    QList<int> m_pending;       // 待上传的段号
+    QVector<int> m_retries;     // 每段失败的次数
+    int m_doneCount = 0;        // 已确认的段数
+    qint64 m_doneBytes = 0;     // 已确认的段的总字节数
+    bool m_stopped = false;     // 已结束（完成或失败），不再处理连接事件
+};
+
+#endif // MULTIPARTUPLOADER_H
@@ -10,10 +10,69 @@
 #include <QDir>
 #include <QMetaObject>
 #include <QtEndian>
+#include <QTimer>
+#include <QRandomGenerator>
+#include <QCryptographicHash>
+#include <QCoreApplication>
+#include <QSettings>
+#include <QFileInfo>
 
 // 常量定义（建议放在头文件，此处临时定义确保编译）
 const int Widget::BUFFER_SIZE = 4096;  // 4KB 缓冲区，可根据需求调整
 
+// 内容定义切块参数（与服务器cas_store.c一致：切点相同，服务器才能认出未修改的块）
+static const int CDC_MIN_SIZE = 256 * 1024;
+static const int CDC_AVG_SIZE = 1024 * 1024;
+static const int CDC_MAX_SIZE = 4 * 1024 * 1024;
+static const quint64 CDC_MASK_S = ((1ULL << 22) - 1) << 42;
+static const quint64 CDC_MASK_L = ((1ULL << 18) - 1) << 46;
+// 块清单超过此长度时（约1.2万块）退回普通上传，服务器单个控制帧上限为1MB
+static const int MAX_DELTA_REQUEST_BYTES = 1000 * 1000;
+// 不小于此大小、且当前目录没有同名文件（增量上传无从去重）的文件分段并发上传
+static const qint64 MULTIPART_THRESHOLD = 256LL * 1024 * 1024;
+// 分段上传使用的连接数（不超过段数）
+static const int MULTIPART_CONNECTIONS = 4;
+
+// Gear表：splitmix64固定序列（种子0），与服务器一致
+static const quint64 *cdcGearTable()
+{
+    static quint64 table[256];
+    static bool initialized = false;
+    if (!initialized) {
+        quint64 x = 0;
+        for (int i = 0; i < 256; ++i) {
+            x += 0x9E3779B97F4A7C15ULL;
+            quint64 z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            table[i] = z ^ (z >> 31);
+        }
+        initialized = true;
+    }
+    return table;
+}
+
+// 在数据开头找下一个切点（FastCDC），返回块长度；文件剩余部分足够时data应至少有CDC_MAX_SIZE字节
+static int cdcCut(const uchar *data, int len)
+{
+    if (len <= CDC_MIN_SIZE) return len;
+    const quint64 *gear = cdcGearTable();
+    int limit = qMin(len, CDC_MAX_SIZE);
+    int normal = qMin(limit, CDC_AVG_SIZE);
+
+    quint64 h = 0;
+    int i = CDC_MIN_SIZE;
+    for (; i < normal; ++i) {
+        h = (h << 1) + gear[data[i]];
+        if (!(h & CDC_MASK_S)) return i + 1;
+    }
+    for (; i < limit; ++i) {
+        h = (h << 1) + gear[data[i]];
+        if (!(h & CDC_MASK_L)) return i + 1;
+    }
+    return limit;
+}
+
 // ========================== 构造/析构函数 ==========================
 Widget::Widget(QTcpSocket *socket, const QString &username, QWidget *parent) :
     QWidget(parent),
@@ -39,6 +98,14 @@ Widget::Widget(QTcpSocket *socket, const QString &username, QWidget *parent) :
             this, SLOT(on_errorOccurred(QAbstractSocket::SocketError)));
     // 新增：监听数据实际发送（驱动异步上传）
     connect(socket, &QTcpSocket::bytesWritten, this, &Widget::onBytesWritten, Qt::UniqueConnection);
+    connect(socket, &QTcpSocket::connected, this, &Widget::on_connected);
+
+    // 断线重连：记下服务器地址，定时器到期后重新连接
+    m_serverHost = socket->peerName().isEmpty() ? socket->peerAddress().toString() : socket->peerName();
+    m_serverPort = socket->peerPort();
+    m_reconnectTimer = new QTimer(this);
+    m_reconnectTimer->setSingleShot(true);
+    connect(m_reconnectTimer, &QTimer::timeout, this, &Widget::tryReconnect);
 
     // 界面交互信号
     connect(ui->fileListWidget, &QListWidget::itemDoubleClicked,
@@ -108,6 +175,10 @@ void Widget::on_uploadButton_clicked()
     // 选择上传文件
     QString filePath = QFileDialog::getOpenFileName(this, "选择上传文件", QDir::homePath());
     if (filePath.isEmpty()) return;
+    if (uploadFile || m_uploadInterrupted) {
+        cleanupUpload();  // 放弃之前中断且未能续传的上传（服务器保留的部分数据过期后回收）
+    }
+    m_uploadFilePath = filePath;
 
     QFileInfo fileInfo(filePath);
     uploadFile = new QFile(filePath, this);
@@ -119,21 +190,235 @@ void Widget::on_uploadButton_clicked()
     }
 
     // 记录文件总大小（用于后续校验）
-    totalUploadSize = fileInfo.size();
+    m_uploadFileSize = fileInfo.size();
+    totalUploadSize = m_uploadFileSize;
     qDebug() << "[上传] 文件总大小：" << totalUploadSize << "字节";
+    transferState = TransferState::Uploading;
+
+    // 默认整个文件都要发送；增量上传时收到upload_plan后改为只发服务器缺少的块
+    m_uploadRanges = {qMakePair(qint64(0), m_uploadFileSize)};
+    m_uploadRangeIdx = 0;
+    m_uploadRangeDone = 0;
 
-    // 发送上传请求（告知服务器文件名、大小、路径）
+    // 先切块算哈希：服务器已有相同文件时秒传，否则只要求发送同名文件当前版本中没有的块
     QJsonObject json;
-    json["type"] = "upload";
     json["filename"] = fileInfo.fileName();
-    json["size"] = totalUploadSize;
+    json["size"] = m_uploadFileSize;
     json["path"] = currentPath;
+    bool chunked = computeUploadChunks();
+    if (transferState != TransferState::Uploading) {
+        cleanupUpload();  // 切块期间连接断开，放弃本次上传
+        return;
+    }
+    if (!chunked) {
+        QMessageBox::warning(this, "错误", "读取文件失败：" + uploadFile->errorString());
+        cleanupUpload();
+        transferState = TransferState::Idle;
+        return;
+    }
+    json["file_hash"] = QString::fromLatin1(m_uploadFileHash);
+    json["instant_proof"] = true;  // 其他用户有相同文件时，先应答持有证明挑战再秒传
+
+    // 大文件且服务器没有同名文件：分段经多个连接并发上传（服务器已有相同内容时仍会秒传）
+    bool exists = false;
+    for (const auto &info : fileList) {
+        if (!info.isDirectory && info.name == fileInfo.fileName()) {
+            exists = true;
+            break;
+        }
+    }
+    if (m_uploadFileSize >= MULTIPART_THRESHOLD && !exists) {
+        json["type"] = "upload_multipart_init";
+        m_uploadChunks.clear();
+        m_uploadRequest = json;
+        sendJsonMessage(json);
+        showStatus("等待服务器准备分段上传...");
+        return;
+    }
+
+    QJsonArray chunks;
+    for (const UploadChunk &chunk : m_uploadChunks) {
+        chunks.append(QJsonArray{QString::fromLatin1(chunk.hash), chunk.len});
+    }
+    json["type"] = "upload_delta";
+    json["chunks"] = chunks;
+    if (QJsonDocument(json).toJson(QJsonDocument::Compact).size() > MAX_DELTA_REQUEST_BYTES) {
+        // 块太多，清单放不进一个控制帧：整文件上传（服务器仍会按块去重存储）
+        json.remove("chunks");
+        json["type"] = "upload";
+        m_uploadChunks.clear();
+    }
+    m_uploadRequest = json;
     sendJsonMessage(json);
 
-    transferState = TransferState::Uploading;
     showStatus("等待服务器准备接收...");
 }
 
+// 对上传文件做内容定义切块，逐块计算SHA-256，同时计算整个文件的SHA-256（按块顺序读一遍文件）
+bool Widget::computeUploadChunks()
+{
+    m_uploadChunks.clear();
+    m_uploadFileHash.clear();
+    if (!uploadFile->seek(0)) return false;
+    QCryptographicHash fileHash(QCryptographicHash::Sha256);
+
+    QByteArray window;  // 始终从当前块起点开始，切块前补满CDC_MAX_SIZE字节（文件末尾除外）
+    qint64 offset = 0;
+    while (offset < m_uploadFileSize) {
+        qint64 want = qMin<qint64>(CDC_MAX_SIZE - window.size(), m_uploadFileSize - offset - window.size());
+        if (want > 0) {
+            QByteArray data = uploadFile->read(want);
+            if (data.size() != want) return false;
+            window.append(data);
+        }
+
+        int len = cdcCut(reinterpret_cast<const uchar *>(window.constData()), window.size());
+        UploadChunk chunk;
+        chunk.hash = QCryptographicHash::hash(QByteArray::fromRawData(window.constData(), len),
+                                              QCryptographicHash::Sha256).toHex();
+        chunk.offset = offset;
+        chunk.len = len;
+        m_uploadChunks.append(chunk);
+        fileHash.addData(window.constData(), len);
+        window.remove(0, len);
+        offset += len;
+
+        int percent = m_uploadFileSize > 0 ? static_cast<int>(offset * 100.0 / m_uploadFileSize) : 100;
+        ui->progressBar->setValue(percent);
+        showStatus(QString("计算文件分块：%1%").arg(percent));
+        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);  // 大文件切块时界面不卡死
+    }
+    ui->progressBar->setValue(0);
+    m_uploadFileHash = fileHash.result().toHex();
+    return uploadFile->seek(0);
+}
+
+// 【辅助】应答跨用户秒传的持有证明挑战：对nonce和服务器指定的字节范围计算SHA-256
+void Widget::handleUploadChallengeMsg(const QJsonObject &json)
+{
+    QCryptographicHash proof(QCryptographicHash::Sha256);
+    proof.addData(QByteArray::fromHex(json["nonce"].toString().toLatin1()));
+    bool ok = uploadFile && uploadFile->isOpen();
+    for (const QJsonValue &value : json["ranges"].toArray()) {
+        QJsonArray range = value.toArray();
+        qint64 offset = static_cast<qint64>(range.at(0).toDouble());
+        qint64 len = static_cast<qint64>(range.at(1).toDouble());
+        if (!ok || !uploadFile->seek(offset)) {
+            ok = false;
+            break;
+        }
+        QByteArray data = uploadFile->read(len);
+        if (data.size() != len) {
+            ok = false;
+            break;
+        }
+        proof.addData(data);
+    }
+    if (ok) ok = uploadFile->seek(0);
+
+    // 读取失败时应答空证明，服务器按正常上传继续
+    QJsonObject res;
+    res["type"] = "upload_proof";
+    res["proof"] = ok ? QString::fromLatin1(proof.result().toHex()) : QString();
+    sendJsonMessage(res);
+    showStatus("正在验证文件内容...");
+}
+
+// 【辅助】处理服务器的增量上传计划：只发送服务器缺少的块（相邻的块合并为一个区间）
+void Widget::handleUploadPlanMsg(const QJsonObject &json)
+{
+    m_uploadRanges.clear();
+    qint64 bytes = 0;
+    QJsonArray missing = json["missing"].toArray();
+    for (const QJsonValue &val : missing) {
+        int idx = val.toInt(-1);
+        if (idx < 0 || idx >= m_uploadChunks.size()) continue;
+        const UploadChunk &chunk = m_uploadChunks[idx];
+        if (!m_uploadRanges.isEmpty() &&
+                m_uploadRanges.last().first + m_uploadRanges.last().second == chunk.offset) {
+            m_uploadRanges.last().second += chunk.len;
+        } else {
+            m_uploadRanges.append(qMakePair(chunk.offset, chunk.len));
+        }
+        bytes += chunk.len;
+    }
+    m_uploadRangeIdx = 0;
+    m_uploadRangeDone = 0;
+    uploadBuffer.clear();
+    totalUploadSize = bytes;
+
+    // 续传：服务器已收到缺少的块中前offset字节，从其后继续发送
+    qint64 offset = qBound<qint64>(0, json["offset"].toVariant().toLongLong(), bytes);
+    uploadedSize = offset;
+    while (offset > 0 && m_uploadRangeIdx < m_uploadRanges.size()) {
+        qint64 skip = qMin(offset, m_uploadRanges[m_uploadRangeIdx].second);
+        m_uploadRangeDone = skip;
+        offset -= skip;
+        if (m_uploadRangeDone == m_uploadRanges[m_uploadRangeIdx].second && offset > 0) {
+            ++m_uploadRangeIdx;
+            m_uploadRangeDone = 0;
+        }
+    }
+
+    showStatus(QString("服务器已有 %1/%2 块，需上传 %3/%4 字节%5")
+               .arg(m_uploadChunks.size() - missing.size()).arg(m_uploadChunks.size())
+               .arg(bytes).arg(m_uploadFileSize)
+               .arg(uploadedSize > 0 ? QString("，从 %1 字节处续传").arg(uploadedSize) : QString()));
+}
+
+// 【辅助】服务器已创建分段上传：另开连接并发上传各段，主连接只等待最终结果
+void Widget::handleUploadMultipartReadyMsg(const QJsonObject &json)
+{
+    QString uploadId = json["upload_id"].toString();
+    qint64 partSize = json["part_size"].toVariant().toLongLong();
+    int partCount = json["part_count"].toInt();
+    if (uploadId.isEmpty() || partSize <= 0 || partCount <= 0) {
+        QMessageBox::warning(this, "上传失败", "服务器返回的分段信息无效");
+        cleanupUpload();
+        transferState = TransferState::Idle;
+        return;
+    }
+    // 各段由上传连接各自读取，主连接不再读文件
+    if (uploadFile) {
+        uploadFile->close();
+        delete uploadFile;
+        uploadFile = nullptr;
+    }
+
+    m_multipart = new MultipartUploader(m_serverHost, m_serverPort, m_sessionToken, m_uploadFilePath,
+                                        uploadId, m_uploadFileSize, partSize, partCount,
+                                        MULTIPART_CONNECTIONS, this);
+    connect(m_multipart, &MultipartUploader::progress, this, [this](qint64 sent, qint64 total) {
+        int percent = total > 0 ? static_cast<int>(sent * 100.0 / total) : 0;
+        ui->progressBar->setValue(percent);
+        showStatus(QString("分段上传中：%1/%2 字节（%3%）").arg(sent).arg(total).arg(percent));
+    });
+    connect(m_multipart, &MultipartUploader::finished, this, [this]() {
+        m_multipartUploaded = true;
+        sendMultipartComplete();
+    });
+    connect(m_multipart, &MultipartUploader::failed, this, [this](const QString &message) {
+        QMessageBox::warning(this, "上传失败", message);
+        cleanupUpload();
+        transferState = TransferState::Idle;
+    });
+    showStatus(QString("分段上传：%1 段，%2 个连接").arg(partCount).arg(qMin(MULTIPART_CONNECTIONS, partCount)));
+    m_multipart->start();
+}
+
+void Widget::sendMultipartComplete()
+{
+    // 主连接断线时等会话恢复后再发（handleResumeResultMsg）
+    if (!m_multipart || !m_multipartUploaded || socket->state() != QAbstractSocket::ConnectedState || m_reconnecting) {
+        return;
+    }
+    QJsonObject json;
+    json["type"] = "upload_multipart_complete";
+    json["upload_id"] = m_multipart->uploadId();
+    sendJsonMessage(json);
+    showStatus("各段已上传，等待服务器校验...");
+}
+
 void Widget::cleanupUpload()
 {
     // 释放上传文件资源
@@ -145,6 +430,22 @@ void Widget::cleanupUpload()
     // 重置上传状态（仅在收到服务器确认后调用，避免异步发送冲突）
     uploadedSize = 0;
     totalUploadSize = 0;
+    m_uploadFileSize = 0;
+    m_uploadChunks.clear();
+    m_uploadFileHash.clear();
+    m_uploadFilePath.clear();
+    m_uploadRequest = QJsonObject();
+    m_uploadInterrupted = false;
+    m_uploadRanges.clear();
+    m_uploadRangeIdx = 0;
+    m_uploadRangeDone = 0;
+    if (m_multipart) {
+        // 可能正处于它发出的信号中，延后释放（释放时断开各上传连接，服务器上未完成的分段上传过期后回收）
+        m_multipart->disconnect(this);
+        m_multipart->deleteLater();
+        m_multipart = nullptr;
+    }
+    m_multipartUploaded = false;
     uploadBuffer.clear();  // 清空未发送缓存
     ui->progressBar->setValue(0);
     showStatus("上传已停止或失败");
@@ -160,9 +461,8 @@ void Widget::handleReadyToReceiveMsg()
         return;
     }
 
-    // 校验文件读取完整性（避免文件被占用导致读取不完整）
-    qint64 remainingReadSize = uploadFile->size() - uploadFile->pos();
-    if (uploadedSize + remainingReadSize < totalUploadSize) {
+    // 校验文件读取完整性（避免文件被占用导致读取不完整，或切块之后文件被修改）
+    if (uploadFile->size() != m_uploadFileSize) {
         QMessageBox::warning(this, "读取错误", "文件未完全读取（可能被其他程序占用）");
         cleanupUpload();
         transferState = TransferState::Idle;
@@ -185,9 +485,21 @@ void Widget::sendNextUploadData()
         return;
     }
 
-    // 2. 缓存为空时，从文件读取新数据（填充缓冲区）
+    // 2. 缓存为空时，从当前区间读取新数据（填充缓冲区）
     if (uploadBuffer.isEmpty() && uploadedSize < totalUploadSize) {
-        uploadBuffer = uploadFile->read(BUFFER_SIZE);
+        while (m_uploadRangeIdx < m_uploadRanges.size() &&
+               m_uploadRangeDone >= m_uploadRanges[m_uploadRangeIdx].second) {
+            ++m_uploadRangeIdx;  // 当前区间已读完，转到下一个区间
+            m_uploadRangeDone = 0;
+        }
+        if (m_uploadRangeIdx < m_uploadRanges.size()) {
+            const QPair<qint64, qint64> &range = m_uploadRanges[m_uploadRangeIdx];
+            qint64 pos = range.first + m_uploadRangeDone;
+            if (uploadFile->pos() == pos || uploadFile->seek(pos)) {
+                uploadBuffer = uploadFile->read(qMin<qint64>(BUFFER_SIZE, range.second - m_uploadRangeDone));
+                m_uploadRangeDone += uploadBuffer.size();
+            }
+        }
         qDebug() << "[上传] 从文件读取：" << uploadBuffer.size() << "字节";
 
         // 特殊情况：文件已读完，但缓存为空 → 说明所有数据已发送完成
@@ -264,7 +576,13 @@ void Widget::handleUploadResumeMsg(const QJsonObject &json)
     qint64 offset = json["offset"].toVariant().toLongLong();
     if (uploadFile && uploadFile->isOpen()) {
         if (uploadFile->seek(offset)) {
+            transferState = TransferState::Uploading;
             uploadedSize = offset;  // 从续传位置开始
+            totalUploadSize = m_uploadFileSize;
+            m_uploadRanges = {qMakePair(offset, m_uploadFileSize - offset)};
+            m_uploadRangeIdx = 0;
+            m_uploadRangeDone = 0;
+            uploadBuffer.clear();
             showStatus(QString("继续上传：从 %1 字节开始").arg(offset));
             sendNextUploadData();  // 触发续传
         } else {
@@ -273,16 +591,24 @@ void Widget::handleUploadResumeMsg(const QJsonObject &json)
             transferState = TransferState::Idle;
         }
     }
-    transferState = TransferState::Uploading;
 }
 
 // ========================== 下载相关函数 ==========================
+// 未完成下载的版本记录：按保存路径记下.part文件中数据所属的整文件哈希
+static QString partialDownloadKey(const QString &savePath)
+{
+    return QStringLiteral("partial_downloads/") + QString::fromLatin1(
+                QCryptographicHash::hash(savePath.toUtf8(), QCryptographicHash::Sha1).toHex());
+}
+
 void Widget::on_downloadButton_clicked()
 {
     if (transferState != TransferState::Idle) {
         QMessageBox::information(this, "提示", "当前有传输任务正在进行");
         return;
     }
+    // 开始新的下载：上次中断的下载不再自动续传
+    discardDownloadResume();
 
     // 检查是否选择文件
     QListWidgetItem *selectedItem = ui->fileListWidget->currentItem();
@@ -310,19 +636,30 @@ void Widget::on_downloadButton_clicked()
     json["type"] = "download";
     json["filename"] = fileName;
     json["path"] = currentPath;
+    m_downloadRequest = json;
     sendJsonMessage(json);
     transferState = TransferState::WaitingDownloadMeta;
     showStatus("发送下载请求：" + fileName);
 }
 
-void Widget::cleanupDownload()
+// 关闭.part文件并清除续传信息；已下载的部分留在.part文件中，再次保存到同一位置时从该处续传
+void Widget::discardDownloadResume()
 {
-    // 释放下载文件资源
     if (downloadFile) {
         downloadFile->close();
         delete downloadFile;
         downloadFile = nullptr;
     }
+    m_downloadSavePath.clear();
+    m_downloadRequest = QJsonObject();
+    m_downloadFileHash.clear();
+    m_downloadInterrupted = false;
+}
+
+void Widget::cleanupDownload()
+{
+    // 释放下载文件资源
+    discardDownloadResume();
     // 重置下载状态
     transferState = TransferState::Idle;
     isReadyToSendReceived = false;
@@ -368,52 +705,97 @@ void Widget::handleDownloadData()
     if (downloadedSize >= totalDownloadSize) {
         int percent = 100;
         ui->progressBar->setValue(percent);
-        QString savedFileName = downloadFile->fileName();
+        QString savedFileName = m_downloadSavePath;
         downloadFile->close();
         delete downloadFile;
         downloadFile = nullptr;
+        // 数据完整：.part文件改名为目标文件（保存对话框已确认覆盖同名文件）
+        QFile::remove(savedFileName);
+        bool renamed = QFile::rename(savedFileName + ".part", savedFileName);
+        QSettings settings("CloudClient", "CloudClient");
+        settings.remove(partialDownloadKey(savedFileName));
+        discardDownloadResume();
         transferState = TransferState::Idle;
+        if (!renamed) {
+            QMessageBox::warning(this, "下载错误", "文件已下载至：" +
+                                 QDir::toNativeSeparators(savedFileName + ".part") + "，但无法改名");
+            return;
+        }
         showStatus("文件下载完成：" + downloadFileName);
         QMessageBox::information(this, "下载成功", "文件已保存至：" + QDir::toNativeSeparators(savedFileName));
     }
     //showStatus("已进入handleDownloadData函数3");
 }
 
-// 【辅助】处理服务器下载元信息（文件名、大小）
+// 【辅助】处理服务器下载元信息（文件名、大小、本次发送的范围）
 void Widget::handleDownloadMetaMsg(const QJsonObject &json)
 {
     downloadFileName = json["filename"].toString();
-    totalDownloadSize = json["size"].toVariant().toLongLong();
-
-    // 选择保存路径
-    QString savePath = QFileDialog::getSaveFileName(
-                this, "保存文件", QDir::homePath() + "/" + downloadFileName,
-                QString("%1 文件 (*.%2);;所有文件 (*.*)").arg(downloadFileName.section('.', -1).toUpper()).arg(downloadFileName.section('.', -1))
-                );
-    if (savePath.isEmpty()) {
-        // 用户取消保存，重置状态
-        QJsonObject cancelJson;
-        cancelJson["type"] = "download_cancel";
-        sendJsonMessage(cancelJson);
-        transferState = TransferState::Idle;
-        return;
+    qint64 fileSize = json["size"].toVariant().toLongLong();
+    qint64 offset = json["offset"].toVariant().toLongLong();
+    qint64 length = json.contains("length") ? json["length"].toVariant().toLongLong() : fileSize - offset;
+    QString fileHash = json["file_hash"].toString();
+    QSettings settings("CloudClient", "CloudClient");
+
+    // 续传时已有保存路径，不再弹出对话框
+    if (m_downloadSavePath.isEmpty()) {
+        // 选择保存路径
+        QString savePath = QFileDialog::getSaveFileName(
+                    this, "保存文件", QDir::homePath() + "/" + downloadFileName,
+                    QString("%1 文件 (*.%2);;所有文件 (*.*)").arg(downloadFileName.section('.', -1).toUpper()).arg(downloadFileName.section('.', -1))
+                    );
+        if (savePath.isEmpty()) {
+            // 用户取消保存，重置状态
+            QJsonObject cancelJson;
+            cancelJson["type"] = "download_cancel";
+            sendJsonMessage(cancelJson);
+            m_downloadRequest = QJsonObject();
+            transferState = TransferState::Idle;
+            return;
+        }
+        m_downloadSavePath = savePath;
+
+        // 同一位置有这个版本的未完成下载：只请求剩余部分（服务器按if_hash确认版本，不符时从头发送）
+        qint64 partSize = QFileInfo(savePath + ".part").size();
+        if (offset == 0 && partSize > 0 && partSize < fileSize && !fileHash.isEmpty() &&
+                settings.value(partialDownloadKey(savePath)).toString() == fileHash) {
+            m_downloadRequest["offset"] = partSize;
+            m_downloadRequest["if_hash"] = fileHash;
+            m_downloadFileHash = fileHash;
+            downloadedSize = partSize;
+            sendJsonMessage(m_downloadRequest);
+            showStatus(QString("发现未完成的下载，从 %1 字节处继续...").arg(partSize));
+            return;
+        }
     }
 
-    // 创建并打开下载文件
-    downloadFile = new QFile(savePath, this);
-    if (!downloadFile->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
-        QMessageBox::warning(this, "错误", "无法创建文件：" + downloadFile->errorString());
-        delete downloadFile;
-        downloadFile = nullptr;
+    // 数据先写入.part文件：从offset处续写（offset为0时清空重写）
+    downloadFile = new QFile(m_downloadSavePath + ".part", this);
+    bool opened = offset > 0
+            ? downloadFile->open(QIODevice::ReadWrite) && downloadFile->size() >= offset &&
+              downloadFile->resize(offset) && downloadFile->seek(offset)
+            : downloadFile->open(QIODevice::WriteOnly | QIODevice::Truncate);
+    if (!opened) {
+        QMessageBox::warning(this, "错误", "无法写入文件：" + downloadFile->errorString());
+        discardDownloadResume();
         transferState = TransferState::Idle;
         return;
     }
+    // 记下.part文件中数据所属的版本，之后再保存到同一位置时可以续传
+    if (!fileHash.isEmpty()) {
+        settings.setValue(partialDownloadKey(m_downloadSavePath), fileHash);
+    } else {
+        settings.remove(partialDownloadKey(m_downloadSavePath));
+    }
+    m_downloadFileHash = fileHash;
 
-    // 初始化下载状态
-    downloadedSize = 0;
+    // 初始化下载状态（进度按整个文件计算，续传时从offset起）
+    downloadedSize = offset;
+    totalDownloadSize = offset + length;
     isReadyToSendReceived = false;
     transferState = TransferState::Downloading;
-    showStatus("等待服务器发送文件数据...");
+    showStatus(offset > 0 ? QString("从 %1 字节处续传，等待服务器发送文件数据...").arg(offset)
+                          : QString("等待服务器发送文件数据..."));
 
     // 发送"准备接收"确认
     QJsonObject ackJson;
@@ -421,6 +803,29 @@ void Widget::handleDownloadMetaMsg(const QJsonObject &json)
     sendJsonMessage(ackJson);
 }
 
+// 断线重连后续传中断的下载：请求.part文件之后的部分（文件已被覆盖时服务器从头发送）
+void Widget::requestDownloadResume()
+{
+    m_downloadInterrupted = false;
+    if (downloadFile) {
+        downloadFile->close();  // 写出缓冲的数据，收到download_meta后按offset重新打开
+        delete downloadFile;
+        downloadFile = nullptr;
+    }
+    // 没有版本哈希（旧版文件）无法确认服务器上的文件没变，只能从头下载
+    if (m_downloadFileHash.isEmpty()) {
+        m_downloadRequest.remove("offset");
+        m_downloadRequest.remove("if_hash");
+    } else {
+        m_downloadRequest["offset"] = downloadedSize;
+        m_downloadRequest["if_hash"] = m_downloadFileHash;
+    }
+    sendJsonMessage(m_downloadRequest);
+    isReadyToSendReceived = false;
+    transferState = TransferState::WaitingDownloadMeta;
+    showStatus(QString("正在续传下载：%1").arg(downloadFileName));
+}
+
 // 【辅助】处理下载控制消息（如"准备发送数据"）
 void Widget::handleDownloadControlLogic()
 {
@@ -607,12 +1012,14 @@ void Widget::on_recordButton_clicked()
     // 连接历史记录刷新信号
     connect(dialog, &HistoryDialog::refreshHistoryRequested,
             this, &Widget::onHistoryRefreshRequested, Qt::UniqueConnection);
+    connect(dialog, &HistoryDialog::loadMoreRequested,
+            this, &Widget::onHistoryLoadMoreRequested, Qt::UniqueConnection);
 
     dialog->show();
     sendHistoryRequest();  // 发送历史记录查询请求
 }
 
-void Widget::sendHistoryRequest()
+void Widget::sendHistoryRequest(bool loadMore)
 {
     if (!socket || socket->state() != QTcpSocket::ConnectedState) {
         if (m_historyDialog) m_historyDialog->showStatus("未连接到服务器");
@@ -623,6 +1030,13 @@ void Widget::sendHistoryRequest()
     QJsonObject reqObj;
     reqObj["type"] = "history_query";
     reqObj["username"] = m_username;
+    reqObj["limit"] = 100;
+    // 加载更多时带上上一页返回的游标，服务器从该条之后继续往前取
+    m_historyAppend = loadMore;
+    if (loadMore) {
+        reqObj["before_time"] = m_historyCursorTime;
+        reqObj["before_id"] = static_cast<double>(m_historyCursorId);
+    }
 
     QByteArray jsonData = QJsonDocument(reqObj).toJson(QJsonDocument::Compact);
     quint32 dataLen = static_cast<quint32>(jsonData.size());
@@ -636,7 +1050,12 @@ void Widget::sendHistoryRequest()
 
 void Widget::onHistoryRefreshRequested()
 {
-    sendHistoryRequest();  // 响应对话框的刷新请求
+    sendHistoryRequest();  // 响应对话框的刷新请求（从最新一页重新开始）
+}
+
+void Widget::onHistoryLoadMoreRequested()
+{
+    sendHistoryRequest(true);  // 按游标加载下一页
 }
 void Widget::handleHistoryResponse(const QJsonObject& json)
 {
@@ -649,7 +1068,9 @@ void Widget::handleHistoryResponse(const QJsonObject& json)
     }
 
     if (success) {
-        m_historyRecords.clear();
+        if (!m_historyAppend) {
+            m_historyRecords.clear();
+        }
         QJsonArray recordsArray = json["records"].toArray();
 
         // -------------------- 新增：定义系统根目录前缀 --------------------
@@ -673,11 +1094,21 @@ void Widget::handleHistoryResponse(const QJsonObject& json)
             m_historyRecords.append(record);
         }
 
+        // 记下续读游标，没有更早的记录时禁用“加载更多”
+        bool hasMore = json["has_more"].toBool();
+        if (hasMore) {
+            QJsonObject cursor = json["next_cursor"].toObject();
+            m_historyCursorTime = cursor["before_time"].toString();
+            m_historyCursorId = static_cast<qint64>(cursor["before_id"].toDouble());
+        }
+
         m_historyDialog->setHistoryRecords(m_historyRecords);
+        m_historyDialog->setHasMore(hasMore);
         m_historyDialog->showStatus(QString("获取成功，共 %1 条记录").arg(m_historyRecords.size()));
     } else {
         QString errMsg = json["message"].toString();
         m_historyDialog->showStatus("获取失败：" + errMsg);
+        m_historyDialog->setHasMore(m_historyAppend);  // 加载更多失败时允许重试
     }
 }
 
@@ -707,6 +1138,19 @@ void Widget::handleProgressMsg(const QJsonObject &json)
     }*/
 }
 
+// 【辅助】处理服务器繁忙消息：按服务器建议的时间后原样重发请求
+void Widget::handleBusyMsg(const QJsonObject &json)
+{
+    QJsonObject request = json["request"].toObject();
+    int retryAfter = json["retry_after"].toInt();
+    showStatus(QString("服务器繁忙，%1 毫秒后重试...").arg(retryAfter));
+    QTimer::singleShot(retryAfter, this, [this, request]() {
+        if (socket->state() == QTcpSocket::ConnectedState) {
+            sendJsonMessage(request);
+        }
+    });
+}
+
 // ========================== 核心消息接收函数（主入口） ==========================
 void Widget::on_readyRead()
 {
@@ -768,8 +1212,22 @@ void Widget::on_readyRead()
                 handleHistoryResultMsg(json);
             } else if (type == "ready_to_receive" && transferState == TransferState::Uploading) {
                 handleReadyToReceiveMsg();
+            } else if (type == "upload_multipart_ready" && transferState == TransferState::Uploading && !m_multipart) {
+                handleUploadMultipartReadyMsg(json);
+            } else if (type == "upload_challenge" && transferState == TransferState::Uploading) {
+                handleUploadChallengeMsg(json);
+            } else if (type == "upload_plan" && transferState == TransferState::Uploading) {
+                handleUploadPlanMsg(json);
             } else if (type == "upload_result") {
                 handleUploadResultMsg(json);
+            } else if (type == "download_result") {
+                // 下载失败（文件不存在、范围无效等）；成功的结果跟在文件数据之后，由下载状态处理
+                if (!json["success"].toBool()) {
+                    discardDownloadResume();
+                    transferState = TransferState::Idle;
+                    showStatus("下载失败：" + json["message"].toString());
+                    QMessageBox::warning(this, "下载失败", json["message"].toString());
+                }
             } else if (type == "download_meta") {
                 handleDownloadMetaMsg(json);
                 // 切换状态后，若需处理剩余数据：先彻底清控制消息，再处理文件数据
@@ -794,6 +1252,10 @@ void Widget::on_readyRead()
                 handleUploadResumeMsg(json);
             } else if (type == "upload_progress"/* || type == "download_progress"*/) {
                 handleProgressMsg(json);
+            } else if (type == "busy") {
+                handleBusyMsg(json);
+            } else if (type == "resume_result") {
+                handleResumeResultMsg(json);
             } else if (type == "share_request") {
                 handleShareRequest(json);
 
@@ -816,12 +1278,32 @@ void Widget::on_readyRead()
 }
 
 // ========================== 其他功能函数 ==========================
-void Widget::requestUploadResume(const QString& filepath)
+void Widget::requestUploadResume()
 {
-    QJsonObject json;
-    json["type"] = "check_upload_resume";
-    json["filepath"] = filepath;
+    m_uploadInterrupted = false;
+    if (!uploadFile) {
+        // 断线时数据可能已全部写入发送缓冲区、文件已关闭：重新打开
+        uploadFile = new QFile(m_uploadFilePath, this);
+        if (!uploadFile->open(QIODevice::ReadOnly)) {
+            delete uploadFile;
+            uploadFile = nullptr;
+        }
+    }
+    if (!uploadFile || uploadFile->size() != m_uploadFileSize) {
+        QMessageBox::warning(this, "续传失败", "本地文件已无法读取或已被修改，请重新上传");
+        cleanupUpload();
+        return;
+    }
+
+    // 重发本次上传的请求：服务器按（路径, 大小, 内容）找到未完成的上传，回复已接收的偏移
+    transferState = TransferState::Uploading;
+    uploadBuffer.clear();
+    QJsonObject json = m_uploadRequest;
+    if (json["type"].toString() == "upload") {
+        json["type"] = "check_upload_resume";  // 普通上传：回复upload_resume_info
+    }                                          // 增量上传：回复带offset的upload_plan
     sendJsonMessage(json);
+    showStatus("正在续传中断的上传...");
 }
 
 void Widget::on_shareButton_clicked()
@@ -980,6 +1462,11 @@ void Widget::on_rejectShareClicked()
 }
 void Widget::on_logoutButton_clicked()
 {
+    // 主动登出：不再断线重连，清除保存的会话令牌
+    m_loggingOut = true;
+    m_reconnectTimer->stop();
+    LoginWidget::clearSessionToken();
+
     // 发送登出请求（可选，根据服务器协议）
     QJsonObject json;
     json["type"] = "logout";
@@ -993,23 +1480,119 @@ void Widget::on_logoutButton_clicked()
     this->close();
 }
 
+void Widget::setOperationsEnabled(bool enabled)
+{
+    ui->uploadButton->setEnabled(enabled);
+    ui->downloadButton->setEnabled(enabled);
+    ui->deleteButton->setEnabled(enabled);
+    ui->refreshButton->setEnabled(enabled);
+    ui->backButton->setEnabled(enabled);
+    ui->shareButton->setEnabled(enabled);
+}
+
 void Widget::on_disconnected()
 {
     showStatus("与服务器断开连接");
     // 禁用界面操作
-    ui->uploadButton->setEnabled(false);
-    ui->downloadButton->setEnabled(false);
-    ui->deleteButton->setEnabled(false);
-    ui->refreshButton->setEnabled(false);
-    ui->backButton->setEnabled(false);
-    ui->shareButton->setEnabled(false);
-    // 重置传输状态
+    setOperationsEnabled(false);
+    // 重置传输状态（上传/下载中断时保留传输信息，会话恢复后续传）
+    // 分段上传的各段走各自的连接，不受主连接断线影响，会话恢复后只需补发完成请求
+    if (transferState == TransferState::Uploading && !m_uploadRequest.isEmpty() && !m_multipart) {
+        m_uploadInterrupted = true;
+    }
+    if ((transferState == TransferState::Downloading ||
+         transferState == TransferState::WaitingDownloadMeta) && !m_downloadSavePath.isEmpty()) {
+        m_downloadInterrupted = true;
+    }
     transferState = TransferState::Idle;
+
+    // 有会话令牌时自动重连
+    if (!m_loggingOut && !m_sessionToken.isEmpty()) {
+        m_reconnecting = true;
+        scheduleReconnect();
+    }
 }
 
 void Widget::on_errorOccurred(QAbstractSocket::SocketError error)
 {
     Q_UNUSED(error);
+    if (m_reconnecting || (!m_loggingOut && !m_sessionToken.isEmpty())) {
+        // 自动重连中：不弹窗，连接失败时按退避时间再试
+        showStatus("连接中断：" + socket->errorString() + "，正在重连...");
+        if (m_reconnecting && socket->state() != QTcpSocket::ConnectedState) {
+            scheduleReconnect();
+        }
+        return;
+    }
     QMessageBox::critical(this, "网络错误", "连接异常：" + socket->errorString());
     showStatus("错误：" + socket->errorString());
 }
+
+// 安排下一次重连：指数退避（1秒起，最长30秒）并加随机抖动，避免大量客户端同时重连
+void Widget::scheduleReconnect()
+{
+    if (m_reconnectTimer->isActive()) {
+        return;
+    }
+    m_reconnectDelayMs = m_reconnectDelayMs == 0 ? 1000 : qMin(m_reconnectDelayMs * 2, 30000);
+    int delay = m_reconnectDelayMs / 2 + QRandomGenerator::global()->bounded(m_reconnectDelayMs / 2 + 1);
+    showStatus(QString("与服务器断开连接，%1 秒后重连...").arg(delay / 1000.0, 0, 'f', 1));
+    m_reconnectTimer->start(delay);
+}
+
+void Widget::tryReconnect()
+{
+    if (m_loggingOut) {
+        return;
+    }
+    socket->abort();
+    recvBuffer.clear();
+    socket->connectToHost(m_serverHost, m_serverPort);
+}
+
+// 重连成功：凭令牌恢复会话（服务器只校验令牌，不查数据库）
+void Widget::on_connected()
+{
+    if (!m_reconnecting) {
+        return;
+    }
+    QJsonObject json;
+    json["type"] = "resume_session";
+    json["token"] = m_sessionToken;
+    sendJsonMessage(json);
+    showStatus("已重新连接，正在恢复会话...");
+}
+
+void Widget::handleResumeResultMsg(const QJsonObject &json)
+{
+    m_reconnecting = false;
+    if (!json["success"].toBool()) {
+        // 令牌失效（过期或服务器更换了密钥）：需要重新输入密码登录
+        m_sessionToken.clear();
+        LoginWidget::clearSessionToken();
+        showStatus("会话已失效，请重新登录");
+        QMessageBox::warning(this, "会话失效", "会话已失效，请登出后重新登录");
+        return;
+    }
+
+    m_reconnectDelayMs = 0;
+    QString token = json["token"].toString();
+    if (!token.isEmpty()) {
+        m_sessionToken = token;
+        LoginWidget::saveSessionToken(m_username, m_serverHost, m_serverPort, token,
+                                      static_cast<qint64>(json["token_expires"].toDouble()));
+    }
+    setOperationsEnabled(true);
+    showStatus("会话已恢复");
+    requestFileList();
+    if (m_uploadInterrupted) {
+        requestUploadResume();
+    }
+    if (m_multipart) {
+        transferState = TransferState::Uploading;
+        sendMultipartComplete();
+    }
+    if (m_downloadInterrupted) {
+        requestDownloadResume();
+    }
+}
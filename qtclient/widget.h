@@ -11,10 +11,15 @@
 #include <QLineEdit>
 #include <QComboBox>
 #include <QHBoxLayout>
+#include <QVector>
+#include <QPair>
+#include <QJsonObject>
+#include "multipartuploader.h"
 
 // 前向声明
 class QTcpSocket;
 class QListWidgetItem;
+class QTimer;
 class HistoryDialog;
 
 // 文件信息结构体
@@ -24,6 +29,12 @@ struct FileInfo {
     FileInfo(QString n, bool dir) : name(n), isDirectory(dir) {}
 };
 
+// 上传文件的内容定义切块（与服务器切块参数一致，修改文件后未变的块切点和哈希不变）
+struct UploadChunk {
+    QByteArray hash;   // SHA-256（十六进制）
+    qint64 offset;     // 块在文件中的偏移
+    qint64 len;        // 块长度
+};
 
 // 传输状态枚举
 enum class TransferState {
@@ -49,6 +60,7 @@ public:
 
     QByteArray getRecvBuffer() const { return recvBuffer; }
     void setRecvBuffer(const QByteArray &buf) { recvBuffer = buf; }
+    void setSessionToken(const QString &token) { m_sessionToken = token; }
 
 private slots:
     // 界面按钮槽函数
@@ -65,11 +77,14 @@ private slots:
     void on_readyRead();
     void on_disconnected();
     void on_errorOccurred(QAbstractSocket::SocketError error);
+    void on_connected();      // 断线重连成功，凭令牌恢复会话
+    void tryReconnect();
     void onBytesWritten(qint64 bytes);  // 新增：异步上传驱动
 
     // 界面交互槽函数
     void onFileListDoubleClicked(QListWidgetItem *item);
     void onHistoryRefreshRequested();  // 历史记录刷新请求
+    void onHistoryLoadMoreRequested(); // 历史记录加载下一页请求
 
     void on_shareDialogAccepted();
     void on_acceptShareClicked();
@@ -88,7 +103,12 @@ private:
     void sendNextUploadData();  // 新增：发送下一批上传数据
     void handleUploadResultMsg(const QJsonObject &json);
     void handleUploadResumeMsg(const QJsonObject &json);
-    void requestUploadResume(const QString& filepath);
+    void requestUploadResume();  // 断线重连后续传中断的上传（服务器从已接收的偏移继续）
+    bool computeUploadChunks();  // 增量上传：对本地文件做内容定义切块，计算每块和整个文件的哈希
+    void handleUploadPlanMsg(const QJsonObject &json);
+    void handleUploadChallengeMsg(const QJsonObject &json);  // 跨用户秒传：用本地文件应答持有证明挑战
+    void handleUploadMultipartReadyMsg(const QJsonObject &json);
+    void sendMultipartComplete();  // 各段都已上传：在主连接上请求服务器校验并入库
 
 
     // 下载相关函数
@@ -96,18 +116,26 @@ private:
     void handleDownloadData();
     void handleDownloadMetaMsg(const QJsonObject &json);
     void handleDownloadControlLogic();
+    void requestDownloadResume();  // 断线重连后续传中断的下载（请求本地文件之后的部分）
+    void discardDownloadResume();  // 关闭.part文件并清除续传信息（.part文件保留）
 
     // 文件管理相关函数
     void handleFileListMsg(const QJsonObject &json);
     void handleDeleteResultMsg(const QJsonObject &json);
 
     // 历史记录相关函数
-    void sendHistoryRequest();
+    void sendHistoryRequest(bool loadMore = false);
     Q_INVOKABLE void handleHistoryResponse(const QJsonObject& json);
     void handleHistoryResultMsg(const QJsonObject &json);
 
     // 通用控制函数
     void handleProgressMsg(const QJsonObject &json);
+    void handleBusyMsg(const QJsonObject &json);
+
+    // 断线重连相关函数
+    void scheduleReconnect();
+    void handleResumeResultMsg(const QJsonObject &json);
+    void setOperationsEnabled(bool enabled);
 
     QDialog *shareDialog;
     QLineEdit *recipientEdit;
@@ -130,14 +158,41 @@ private:
     qint64 downloadedSize;
     qint64 totalDownloadSize;
     QByteArray uploadBuffer;
+    qint64 m_uploadFileSize = 0;                  // 本地文件大小（totalUploadSize是需要发送的字节数）
+    QVector<UploadChunk> m_uploadChunks;          // 增量上传：本地文件的切块
+    QByteArray m_uploadFileHash;                  // 整个文件的SHA-256（十六进制，服务器已有相同文件时秒传）
+    QString m_uploadFilePath;                     // 本地文件路径（续传时重新打开）
+    QJsonObject m_uploadRequest;                  // 本次上传的请求（续传时重发，服务器按内容找到未完成的上传）
+    bool m_uploadInterrupted = false;             // 上传中途断线，会话恢复后续传
+    QVector<QPair<qint64, qint64>> m_uploadRanges; // 需要发送的文件区间（偏移，长度），按顺序发送
+    int m_uploadRangeIdx = 0;                     // 当前发送的区间
+    qint64 m_uploadRangeDone = 0;                 // 当前区间已读出的字节数
+    MultipartUploader *m_multipart = nullptr;     // 分段上传：多个连接并发上传各段（大文件且服务器没有同名文件时）
+    bool m_multipartUploaded = false;             // 各段都已上传，等待发送upload_multipart_complete（主连接断线时会话恢复后再发）
     QByteArray recvBuffer;
     QString downloadFileName;
+    QString m_downloadSavePath;                   // 下载保存路径（数据先写入<路径>.part，完成后改名）
+    QJsonObject m_downloadRequest;                // 本次下载的请求（续传时带上offset和if_hash重发）
+    QString m_downloadFileHash;                   // 正在下载的文件版本（服务器给出的整文件哈希）
+    bool m_downloadInterrupted = false;           // 下载中途断线，会话恢复后续传
     bool isReadyToSendReceived;
 
     // 数据存储
     QList<FileInfo> fileList;
     QList<HistoryRecord> m_historyRecords;
+    QString m_historyCursorTime;   // 下一页游标：上一页最后一条的时间
+    qint64 m_historyCursorId = 0;  // 下一页游标：上一页最后一条的id
+    bool m_historyAppend = false;  // 当前请求是否为加载更多（响应追加到已有记录后）
     QPointer<HistoryDialog> m_historyDialog;  // 历史对话框（自动管理生命周期）
+
+    // 断线重连（登录返回的会话令牌，重连后发resume_session恢复，不再走密码验证）
+    QString m_sessionToken;
+    QString m_serverHost;
+    quint16 m_serverPort = 0;
+    QTimer *m_reconnectTimer = nullptr;
+    int m_reconnectDelayMs = 0;    // 下次重连的基础延迟（指数退避）
+    bool m_reconnecting = false;   // 正在断线重连（错误不再弹窗）
+    bool m_loggingOut = false;     // 用户主动登出，不重连
 };
 
 #endif // WIDGET_H